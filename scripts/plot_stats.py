@@ -4,6 +4,7 @@ Generate time series graphs of power/bandwidth/energy...
 """
 
 import argparse
+import csv
 import json
 import os
 import sys
@@ -27,6 +28,18 @@ def extract_epoch_data(json_data, label, merge_channel=True):
                                        key=lambda t: t[0])]
 
 
+def load_epoch_csv(csv_file):
+    """
+    load the columnar epoch stats (epoch_format = csv), one row per channel
+    and epoch, into the same list of dicts as the epoch json
+    """
+    rows = []
+    with open(csv_file, 'r') as c_file:
+        for row in csv.DictReader(c_file):
+            rows.append({k: float(v) for (k, v) in row.items()})
+    return rows
+
+
 def plot_epochs(json_data, label, unit="", output=None):
     """
     plot the time series of a specified stat serie (e.g. bw, power, etc)
@@ -102,7 +115,7 @@ def plot_histogram(json_data, label, unit='', output=None):
 if __name__ == '__main__':
     parser = argparse.ArgumentParser(description='Plot time serie graphs from '
                                      'stats outputs, type -h for more options')
-    parser.add_argument('json', help='stats json file')
+    parser.add_argument('json', help='stats json file, or epoch csv file')
     parser.add_argument('-d', '--dir', help='output dir', default='.')
     parser.add_argument('-o', '--output',
                         help='output name (withouth extension name)',
@@ -112,17 +125,21 @@ if __name__ == '__main__':
                         'use the name in JSON')
     args = parser.parse_args()
 
-    with open(args.json, 'r') as j_file:
-        is_epoch = False
-        try:
-            j_data = json.load(j_file)
-        except:
-            print('cannot load file ' + args.json)
-            exit(1)
-        if isinstance(j_data, list):
-            is_epoch = True
-        else:
+    if args.json.endswith('.csv'):
+        j_data = load_epoch_csv(args.json)
+        is_epoch = True
+    else:
+        with open(args.json, 'r') as j_file:
             is_epoch = False
+            try:
+                j_data = json.load(j_file)
+            except:
+                print('cannot load file ' + args.json)
+                exit(1)
+            if isinstance(j_data, list):
+                is_epoch = True
+            else:
+                is_epoch = False
 
     prefix = os.path.join(args.dir, args.output)
     if is_epoch:
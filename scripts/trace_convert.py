@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+
+"""
+Convert DRAMsim3 text traces ("<hex addr> <op> <cycle>" per line) to the
+binary trace format read by TraceBasedCPU, or back with --decode.
+See src/binary_trace.h for the format.
+"""
+
+import argparse
+import struct
+
+MAGIC = b'DRS3BTRC'
+VERSION = 1
+HEADER = struct.Struct('<8sIIQ')
+WRITE_TYPES = {'WRITE', 'write', 'P_MEM_WR', 'BOFF'}
+MASK64 = (1 << 64) - 1
+
+
+def zigzag_encode(delta):
+    delta &= MASK64
+    sign = MASK64 if delta >> 63 else 0
+    return ((delta << 1) & MASK64) ^ sign
+
+
+def zigzag_decode(value):
+    return (value >> 1) ^ (MASK64 if value & 1 else 0)
+
+
+def put_varint(buf, value):
+    while value >= 0x80:
+        buf.append((value & 0x7f) | 0x80)
+        value >>= 7
+    buf.append(value)
+
+
+def get_varint(data, pos):
+    value, shift = 0, 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        if not byte & 0x80:
+            return value, pos
+        shift += 7
+
+
+def encode(text_file, bin_file):
+    num_records = 0
+    last_cycle, last_addr = 0, 0
+    with open(text_file, 'r') as fin, open(bin_file, 'wb') as fout:
+        fout.write(HEADER.pack(MAGIC, VERSION, 0, 0))
+        buf = bytearray()
+        for line in fin:
+            fields = line.split()
+            if len(fields) < 3:
+                continue
+            addr = int(fields[0], 16)
+            is_write = 1 if fields[1] in WRITE_TYPES else 0
+            cycle = int(fields[2])
+            put_varint(buf, (zigzag_encode(cycle - last_cycle) << 1) | is_write)
+            put_varint(buf, zigzag_encode(addr - last_addr))
+            last_cycle, last_addr = cycle, addr
+            num_records += 1
+            if len(buf) >= 1 << 20:
+                fout.write(buf)
+                buf = bytearray()
+        fout.write(buf)
+        fout.seek(0)
+        fout.write(HEADER.pack(MAGIC, VERSION, 0, num_records))
+    return num_records
+
+
+def decode(bin_file, text_file):
+    with open(bin_file, 'rb') as fin:
+        data = fin.read()
+    magic, version, flags, num_records = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION or flags != 0:
+        raise ValueError(bin_file + ' is not a supported binary trace')
+    pos = HEADER.size
+    last_cycle, last_addr = 0, 0
+    with open(text_file, 'w') as fout:
+        for _ in range(num_records):
+            cycle_word, pos = get_varint(data, pos)
+            addr_word, pos = get_varint(data, pos)
+            last_cycle = (last_cycle + zigzag_decode(cycle_word >> 1)) & MASK64
+            last_addr = (last_addr + zigzag_decode(addr_word)) & MASK64
+            op = 'WRITE' if cycle_word & 1 else 'READ'
+            fout.write('{} {} {}\n'.format(hex(last_addr), op, last_cycle))
+    return num_records
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='Convert between text and binary DRAMsim3 traces')
+    parser.add_argument('input', help='input trace file')
+    parser.add_argument('output', help='output trace file')
+    parser.add_argument('-d', '--decode', action='store_true',
+                        help='convert a binary trace back to text')
+    args = parser.parse_args()
+
+    if args.decode:
+        n = decode(args.input, args.output)
+    else:
+        n = encode(args.input, args.output)
+    print('Converted {} records to {}'.format(n, args.output))
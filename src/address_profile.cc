@@ -0,0 +1,229 @@
+#include "address_profile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+
+namespace dramsim3 {
+
+namespace {
+
+int AddressBits(const Config &config) {
+  return LogBase2(config.channels) + LogBase2(config.ranks) +
+         LogBase2(config.bankgroups) + LogBase2(config.banks_per_group) +
+         LogBase2(config.rows) + LogBase2(config.columns) -
+         LogBase2(config.BL);
+}
+
+int HighestBit(uint64_t bits) {
+  int bit = -1;
+  while (bits != 0) {
+    bits >>= 1;
+    bit++;
+  }
+  return bit;
+}
+
+}  // namespace
+
+AddressProfile::AddressProfile(const Config &config)
+    : shift_bits_(config.shift_bits),
+      num_bits_(AddressBits(config)),
+      count_(0),
+      prev_(0),
+      ones_(num_bits_, 0),
+      flips_(num_bits_, 0),
+      highest_flip_(num_bits_ + 1, 0) {}
+
+void AddressProfile::Add(uint64_t hex_addr) {
+  uint64_t addr = (hex_addr >> shift_bits_) & ((1ull << num_bits_) - 1);
+  uint64_t diff = addr ^ prev_;
+  for (int i = 0; i < num_bits_; i++) {
+    ones_[i] += (addr >> i) & 1;
+  }
+  if (count_ > 0) {
+    for (int i = 0; i < num_bits_; i++) {
+      flips_[i] += (diff >> i) & 1;
+    }
+    highest_flip_[diff == 0 ? num_bits_ : HighestBit(diff)]++;
+  }
+  prev_ = addr;
+  count_++;
+}
+
+double AddressProfile::OneRate(int bit) const {
+  return count_ == 0 ? 0.0 : static_cast<double>(ones_[bit]) / count_;
+}
+
+double AddressProfile::Entropy(int bit) const {
+  double p = OneRate(bit);
+  if (p <= 0.0 || p >= 1.0) {
+    return 0.0;
+  }
+  return -p * std::log2(p) - (1.0 - p) * std::log2(1.0 - p);
+}
+
+double AddressProfile::FlipRate(int bit) const {
+  return count_ < 2 ? 0.0 : static_cast<double>(flips_[bit]) / (count_ - 1);
+}
+
+double AddressProfile::RowLocality(int bit) const {
+  if (count_ < 2) {
+    return 0.0;
+  }
+  uint64_t same_block = highest_flip_[num_bits_];
+  for (int i = 0; i < bit; i++) {
+    same_block += highest_flip_[i];
+  }
+  return static_cast<double>(same_block) / (count_ - 1);
+}
+
+nlohmann::json AddressProfile::ToJson() const {
+  nlohmann::json j_bits;
+  for (int i = 0; i < num_bits_; i++) {
+    nlohmann::json j_bit;
+    j_bit["bit"] = shift_bits_ + i;
+    j_bit["one_rate"] = OneRate(i);
+    j_bit["entropy"] = Entropy(i);
+    j_bit["flip_rate"] = FlipRate(i);
+    j_bit["row_locality"] = RowLocality(i);
+    j_bits.push_back(j_bit);
+  }
+  return j_bits;
+}
+
+nlohmann::json MappingPrediction::ToJson() const {
+  nlohmann::json j;
+  j["address_mapping"] = address_mapping;
+  j["address_xor"] = address_xor;
+  j["row_hit_rate"] = row_hit_rate;
+  j["bank_parallelism"] = bank_parallelism;
+  j["channel_imbalance"] = channel_imbalance;
+  j["requests_per_cycle"] = requests_per_cycle;
+  return j;
+}
+
+MappingPrediction PredictMapping(const Config &config,
+                                 const std::vector<uint64_t> &addrs) {
+  int num_banks = config.channels * config.ranks * config.banks;
+  size_t window = std::max(1, config.trans_queue_size * config.channels);
+  uint64_t hit_cost = static_cast<uint64_t>(config.burst_cycle);
+  uint64_t miss_cost = hit_cost + config.tRP + config.tRCD;
+
+  std::vector<int> open_row(num_banks, -1);
+  std::vector<uint64_t> bank_busy(num_banks, 0);
+  std::vector<uint64_t> channel_reqs(config.channels, 0);
+  std::vector<int> touched;
+  uint64_t hits = 0;
+  uint64_t cycles = 0;
+  double parallelism_sum = 0.0;
+  double imbalance_sum = 0.0;
+  uint64_t num_windows = 0;
+  size_t in_window = 0;
+  for (size_t i = 0; i < addrs.size(); i++) {
+    Address addr = config.AddressMapping(addrs[i]);
+    int bank = ((addr.channel * config.ranks + addr.rank) * config.bankgroups +
+                addr.bankgroup) *
+                   config.banks_per_group +
+               addr.bank;
+    bool hit = open_row[bank] == addr.row;
+    hits += hit ? 1 : 0;
+    open_row[bank] = addr.row;
+    if (bank_busy[bank] == 0) {
+      touched.push_back(bank);
+    }
+    bank_busy[bank] += hit ? hit_cost : miss_cost;
+    channel_reqs[addr.channel]++;
+    in_window++;
+    if (in_window < window && i + 1 < addrs.size()) {
+      continue;
+    }
+    // a window is done, it takes as long as its busiest bank or bus
+    uint64_t busiest_bank = 0;
+    for (int b : touched) {
+      busiest_bank = std::max(busiest_bank, bank_busy[b]);
+      bank_busy[b] = 0;
+    }
+    uint64_t busiest_channel =
+        *std::max_element(channel_reqs.begin(), channel_reqs.end());
+    cycles += std::max(busiest_bank, busiest_channel * hit_cost);
+    parallelism_sum += static_cast<double>(touched.size()) /
+                       std::min(in_window, static_cast<size_t>(num_banks));
+    imbalance_sum += static_cast<double>(busiest_channel) * config.channels /
+                     in_window;
+    num_windows++;
+    touched.clear();
+    std::fill(channel_reqs.begin(), channel_reqs.end(), 0);
+    in_window = 0;
+  }
+
+  MappingPrediction prediction;
+  prediction.address_mapping = config.address_mapping;
+  prediction.address_xor = config.address_xor;
+  double num_addrs = static_cast<double>(addrs.size());
+  prediction.row_hit_rate = addrs.empty() ? 0.0 : hits / num_addrs;
+  prediction.bank_parallelism =
+      num_windows == 0 ? 0.0 : parallelism_sum / num_windows;
+  prediction.channel_imbalance =
+      num_windows == 0 ? 0.0 : imbalance_sum / num_windows;
+  prediction.requests_per_cycle = cycles == 0 ? 0.0 : num_addrs / cycles;
+  return prediction;
+}
+
+std::vector<std::pair<std::string, std::string>> CandidateMappings(
+    const Config &config, bool with_xor) {
+  std::map<std::string, int> widths;
+  widths["ch"] = LogBase2(config.channels);
+  widths["ra"] = LogBase2(config.ranks);
+  widths["bg"] = LogBase2(config.bankgroups);
+  widths["ba"] = LogBase2(config.banks_per_group);
+  widths["ro"] = LogBase2(config.rows);
+  widths["co"] = LogBase2(config.columns) - LogBase2(config.BL);
+
+  // the fields that can be hashed, in the order they take the row bits
+  std::vector<std::string> hashable;
+  if (with_xor) {
+    for (const char *field : {"ba", "bg", "ch"}) {
+      if (widths[field] > 0) {
+        hashable.push_back(field);
+      }
+    }
+  }
+  std::vector<std::string> xors;
+  for (int mask = 0; mask < (1 << hashable.size()); mask++) {
+    std::string xor_fields;
+    int xor_bits = 0;
+    for (size_t i = 0; i < hashable.size(); i++) {
+      if (mask & (1 << i)) {
+        xor_fields += hashable[i];
+        xor_bits += widths[hashable[i]];
+      }
+    }
+    if (xor_bits <= widths["ro"]) {
+      xors.push_back(xor_fields);
+    }
+  }
+
+  std::vector<std::pair<std::string, std::string>> candidates;
+  std::set<std::string> layouts;
+  std::vector<std::string> fields = {"ba", "bg", "ch", "co", "ra", "ro"};
+  do {
+    std::string mapping, layout;
+    for (const auto &field : fields) {
+      mapping += field;
+      if (widths[field] > 0) {
+        layout += field;
+      }
+    }
+    if (!layouts.insert(layout).second) {
+      continue;
+    }
+    for (const auto &xor_fields : xors) {
+      candidates.push_back(std::make_pair(mapping, xor_fields));
+    }
+  } while (std::next_permutation(fields.begin(), fields.end()));
+  return candidates;
+}
+
+}  // namespace dramsim3
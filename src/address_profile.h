@@ -0,0 +1,72 @@
+#ifndef __ADDRESS_PROFILE_H
+#define __ADDRESS_PROFILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "configuration.h"
+#include "json.hpp"
+
+namespace dramsim3 {
+
+/// @brief Statistics of every address bit above the request offset, gathered
+/// in one pass over a stream of addresses:
+///   one rate       how often the bit is set, and its entropy
+///   flip rate      how often it differs from the previous address
+///   row locality   how often the previous address is in the same block of
+///                  the bits below it, i.e. the rate of row hits between
+///                  consecutive requests if the bit and the ones above it
+///                  were row bits
+/// Bit i is address bit shift_bits + i, up to the bits the config decodes.
+class AddressProfile {
+public:
+  explicit AddressProfile(const Config &config);
+  void Add(uint64_t hex_addr);
+  uint64_t Count() const { return count_; }
+  double OneRate(int bit) const;
+  double Entropy(int bit) const;
+  double FlipRate(int bit) const;
+  double RowLocality(int bit) const;
+  nlohmann::json ToJson() const;
+
+private:
+  int shift_bits_;
+  int num_bits_;
+  uint64_t count_;
+  uint64_t prev_;
+  std::vector<uint64_t> ones_;
+  std::vector<uint64_t> flips_;
+  // consecutive pairs by their highest differing bit, num_bits_ if equal
+  std::vector<uint64_t> highest_flip_;
+};
+
+/// @brief What an address mapping is predicted to do with a stream of
+/// addresses, without simulating timing. The stream is cut into windows of
+/// the requests the controllers can hold. A window takes as long as its
+/// busiest channel bus or its busiest bank, whose requests each cost a burst
+/// on a row hit and a precharge and an activation as well on a miss.
+struct MappingPrediction {
+  std::string address_mapping;
+  std::string address_xor;
+  double row_hit_rate;
+  // distinct banks per window, over the most a window could use
+  double bank_parallelism;
+  // requests of the busiest channel per window, over an even share
+  double channel_imbalance;
+  double requests_per_cycle;
+  nlohmann::json ToJson() const;
+};
+
+MappingPrediction PredictMapping(const Config &config,
+                                 const std::vector<uint64_t> &addrs);
+
+/// @brief Every field order of address_mapping, the ones that only differ in
+/// where fields of no bits are left out, each with no XOR hashing and with
+/// every combination of ch, bg and ba hashing the row bits can take. Pairs
+/// of address_mapping and address_xor.
+std::vector<std::pair<std::string, std::string>> CandidateMappings(
+    const Config &config, bool with_xor);
+
+}  // namespace dramsim3
+#endif  // __ADDRESS_PROFILE_H
@@ -0,0 +1,450 @@
+#include "analytical_system.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include "json.hpp"
+
+namespace dramsim3 {
+
+namespace {
+
+// cycles over which the arrival rates are averaged
+const double kRateWindow = 1000.0;
+// utilization at which the queueing delays stop growing, the data bus limit
+// takes over beyond it
+const double kMaxUtilization = 0.95;
+
+// mean wait of an M/D/1 queue with utilization rho and service time service
+double MD1Wait(double rho, double service) {
+  rho = std::min(rho, kMaxUtilization);
+  return rho * service / (2.0 * (1.0 - rho));
+}
+
+}  // namespace
+
+AnalyticalDRAMSystem::AnalyticalDRAMSystem(
+    const Config &config, const std::string &output_dir,
+    std::function<void(uint64_t)> read_callback,
+    std::function<void(uint64_t)> write_callback)
+    : BaseDRAMSystem(config, output_dir, read_callback, write_callback),
+      banks_(config_.channels * config_.ranks * config_.banks,
+             Bank{-1, 0, 0.0, 0, 0.0}),
+      ranks_(config_.channels * config_.ranks, Rank{0.0, 0, 0.0}),
+      buses_(config_.channels * config_.sub_channels, Bus{0.0, 0, 0, 0, 0}),
+      stats_(config_.channels, ChannelStats{0, 0, 0, 0, 0, 0, 0, 0}),
+      stats_clk_(0), event_seq_(0), latency_scale_(1.0),
+      latency_offset_(0.0), detailed_(nullptr), sample_seq_(0), fit_n_(0.0),
+      fit_x_(0.0), fit_y_(0.0), fit_xx_(0.0), fit_xy_(0.0) {
+  double refresh_share = static_cast<double>(config_.tRFC) / config_.tREFI;
+  bus_service_ = config_.burst_cycle / (1.0 - refresh_share);
+  act_interval_ = std::max<double>(config_.tRRD_S, config_.tFAW / 4.0);
+  // an access lands in a refresh with that share, and waits half of it
+  refresh_delay_ = refresh_share * config_.tRFC / 2.0;
+  if (config_.analytical_calibration_cycles > 0) {
+    detailed_ =
+        new JedecDRAMSystem(config_, output_dir, read_callback, write_callback);
+    detailed_->RegisterCompletionCallback(
+        [this](const Completion &completion) { CalibrationDone(completion); });
+  }
+}
+
+AnalyticalDRAMSystem::~AnalyticalDRAMSystem() { delete detailed_; }
+
+int AnalyticalDRAMSystem::BusIndex(const Address &addr) const {
+  return addr.channel * config_.sub_channels + config_.SubChannel(addr.rank);
+}
+
+bool AnalyticalDRAMSystem::WillAcceptTransaction(uint64_t hex_addr,
+                                                 bool is_write,
+                                                 int qos_class) const {
+  if (Calibrating()) {
+    return detailed_->WillAcceptTransaction(hex_addr, is_write);
+  }
+  const Bus &bus = buses_[BusIndex(config_.AddressMapping(hex_addr))];
+  if (config_.unified_queue) {
+    return bus.pending_reads + bus.pending_writes < config_.trans_queue_size;
+  }
+  return is_write ? bus.pending_writes < config_.write_buf_size
+                  : bus.pending_reads < config_.trans_queue_size;
+}
+
+double AnalyticalDRAMSystem::Rate(double rate, uint64_t rate_clk) const {
+  return rate * std::exp(-static_cast<double>(clk_ - rate_clk) / kRateWindow);
+}
+
+uint64_t AnalyticalDRAMSystem::Access(uint64_t hex_addr, bool is_write,
+                                      double &base, double &queueing) {
+  Address addr = config_.AddressMapping(hex_addr);
+  int bank_index = (addr.channel * config_.ranks + addr.rank) * config_.banks +
+                   addr.bankgroup * config_.banks_per_group + addr.bank;
+  Bank &bank = banks_[bank_index];
+  Rank &rank = ranks_[addr.channel * config_.ranks + addr.rank];
+  Bus &bus = buses_[BusIndex(addr)];
+  ChannelStats &stats = stats_[addr.channel];
+
+  if (config_.row_buf_policy == "TIMEOUT" && bank.open_row != -1 &&
+      clk_ - bank.last_use > static_cast<uint64_t>(config_.row_buf_timeout)) {
+    bank.open_row = -1;
+  }
+  double burst = std::max(config_.burst_cycle, config_.tCCD_L);
+  double occupancy;
+  base = is_write ? config_.write_delay : config_.read_delay;
+  // the earliest the row can be opened, -1 for a row hit
+  double act_ready = -1.0;
+  if (bank.open_row == addr.row) {
+    occupancy = burst;
+    if (is_write) {
+      stats.write_row_hits++;
+    } else {
+      stats.read_row_hits++;
+    }
+  } else if (bank.open_row == -1) {
+    act_ready = static_cast<double>(clk_);
+    base += config_.tRCD;
+    occupancy = config_.tRCD + burst;
+    stats.row_empties++;
+  } else {
+    act_ready = static_cast<double>(clk_ + config_.tRP);
+    base += config_.tRP + config_.tRCD;
+    occupancy =
+        std::max<double>(config_.tRC, config_.tRP + config_.tRCD + burst);
+    stats.row_conflicts++;
+  }
+  base += refresh_delay_;
+  bank.open_row = config_.row_buf_policy == "CLOSE_PAGE" ? -1 : addr.row;
+  bank.last_use = clk_;
+
+  // both rates count this access too
+  bank.rate = Rate(bank.rate, bank.rate_clk) + 1.0 / kRateWindow;
+  bank.rate_clk = clk_;
+  bank.service = bank.service == 0.0
+                     ? occupancy
+                     : bank.service + (occupancy - bank.service) / 8.0;
+  bus.rate = Rate(bus.rate, bus.rate_clk) + 1.0 / kRateWindow;
+  bus.rate_clk = clk_;
+  queueing = MD1Wait(bank.rate * bank.service, bank.service) +
+             MD1Wait(bus.rate * bus_service_, bus_service_);
+  if (act_ready >= 0.0) {
+    rank.act_rate = Rate(rank.act_rate, rank.rate_clk) + 1.0 / kRateWindow;
+    rank.rate_clk = clk_;
+    queueing += MD1Wait(rank.act_rate * act_interval_, act_interval_);
+  }
+
+  double latency = std::max(
+      1.0, base + latency_offset_ + latency_scale_ * queueing);
+  // the ACTs and bursts are given out in order of arrival, they only hold up
+  // the transactions once more arrive than the rank or the bus can take
+  uint64_t done_clk = clk_ + static_cast<uint64_t>(latency);
+  if (act_ready >= 0.0) {
+    rank.act_clk = std::max(act_ready, rank.act_clk) + act_interval_;
+    double after_act = config_.tRCD + (is_write ? config_.write_delay
+                                                : config_.read_delay);
+    done_clk = std::max(done_clk,
+                        static_cast<uint64_t>(rank.act_clk + after_act));
+  }
+  bus.free_clk = std::max(clk_, bus.free_clk) + config_.burst_cycle;
+  done_clk = std::max(done_clk, bus.free_clk);
+  if (is_write) {
+    stats.writes++;
+  } else {
+    stats.reads++;
+  }
+  return done_clk;
+}
+
+bool AnalyticalDRAMSystem::AddTransaction(uint64_t hex_addr, bool is_write,
+                                          uint64_t tag, int source,
+                                          int qos_class) {
+  TraceTransaction(hex_addr, is_write);
+  last_req_clk_ = clk_;
+  double base, queueing;
+  if (Calibrating()) {
+    if (!detailed_->AddTransaction(hex_addr, is_write, sample_seq_)) {
+      return false;
+    }
+    Access(hex_addr, is_write, base, queueing);
+    samples_[sample_seq_++] = Sample{tag, clk_, base, queueing};
+    return true;
+  }
+
+  uint64_t done_clk = Access(hex_addr, is_write, base, queueing);
+  int bus = BusIndex(config_.AddressMapping(hex_addr));
+  // the queue entry is taken until the transaction is done waiting
+  uint64_t free_clk = std::max(
+      clk_ + 1, done_clk - static_cast<uint64_t>(base + latency_offset_));
+  if (is_write) {
+    buses_[bus].pending_writes++;
+    AddEvent(Event{clk_ + 1, 0, hex_addr, tag, bus, true, true, false});
+    AddEvent(Event{free_clk, 0, hex_addr, tag, bus, true, false, true});
+  } else {
+    buses_[bus].pending_reads++;
+    AddEvent(Event{free_clk, 0, hex_addr, tag, bus, false, false, true});
+    AddEvent(Event{done_clk, 0, hex_addr, tag, bus, false, true, false});
+    ChannelStats &stats = stats_[bus / config_.sub_channels];
+    stats.read_latency_sum += done_clk - clk_;
+    stats.read_queueing_sum += static_cast<uint64_t>(
+        std::max(0.0, done_clk - clk_ - base - latency_offset_));
+  }
+  return true;
+}
+
+void AnalyticalDRAMSystem::AddEvent(const Event &event) {
+  events_.push_back(event);
+  events_.back().seq = event_seq_++;
+  std::push_heap(events_.begin(), events_.end(), EventLater);
+}
+
+void AnalyticalDRAMSystem::DeliverEvents() {
+  while (!events_.empty() && events_.front().cycle <= clk_) {
+    std::pop_heap(events_.begin(), events_.end(), EventLater);
+    Event event = events_.back();
+    events_.pop_back();
+    if (event.frees) {
+      Bus &bus = buses_[event.bus];
+      if (event.is_write) {
+        bus.pending_writes--;
+      } else {
+        bus.pending_reads--;
+      }
+      num_slots_freed_++;
+    }
+    if (event.returns) {
+      ReturnTransaction(event.addr, event.tag, event.is_write);
+    }
+  }
+}
+
+void AnalyticalDRAMSystem::CalibrationDone(const Completion &completion) {
+  auto it = samples_.find(completion.tag);
+  const Sample &sample = it->second;
+  if (!completion.is_write) {
+    double latency = static_cast<double>(clk_ - sample.clk);
+    double y = latency - sample.base;
+    fit_n_ += 1.0;
+    fit_x_ += sample.queueing;
+    fit_y_ += y;
+    fit_xx_ += sample.queueing * sample.queueing;
+    fit_xy_ += sample.queueing * y;
+    ChannelStats &stats = stats_[config_.AddressChannel(completion.hex_addr)];
+    stats.read_latency_sum += clk_ - sample.clk;
+    stats.read_queueing_sum += static_cast<uint64_t>(std::max(0.0, y));
+  }
+  ReturnTransaction(completion.hex_addr, sample.tag, completion.is_write);
+  samples_.erase(it);
+}
+
+void AnalyticalDRAMSystem::FinishCalibration() {
+  if (fit_n_ < 2.0) {
+    std::cout << "WARNING: too few reads to calibrate the analytical model"
+              << std::endl;
+    return;
+  }
+  double mean_x = fit_x_ / fit_n_;
+  double mean_y = fit_y_ / fit_n_;
+  double var_x = fit_xx_ / fit_n_ - mean_x * mean_x;
+  double cov_xy = fit_xy_ / fit_n_ - mean_x * mean_y;
+  // without much queueing to go by the scale stays as it is
+  latency_scale_ = var_x > 1.0 ? std::max(0.0, cov_xy / var_x) : 1.0;
+  latency_offset_ = mean_y - latency_scale_ * mean_x;
+}
+
+void AnalyticalDRAMSystem::ClockTick() {
+  if (detailed_ != nullptr) {
+    uint64_t calibration_cycles =
+        static_cast<uint64_t>(config_.analytical_calibration_cycles);
+    // the detailed system finishes what it has been given before it goes
+    detailed_->ClockTick();
+    if (clk_ + 1 == calibration_cycles) {
+      FinishCalibration();
+    }
+    if (clk_ + 1 >= calibration_cycles && samples_.empty()) {
+      delete detailed_;
+      detailed_ = nullptr;
+    }
+  }
+  DeliverEvents();
+  clk_++;
+}
+
+uint64_t AnalyticalDRAMSystem::ClockTickN(uint64_t cycles) {
+  if (detailed_ != nullptr) {
+    ClockTick();
+    return 1;
+  }
+  uint64_t start_events = HostEvents();
+  uint64_t elapsed = 0;
+  while (elapsed < cycles) {
+    uint64_t next = events_.empty() ? std::numeric_limits<uint64_t>::max()
+                                    : events_.front().cycle;
+    if (next > clk_) {
+      uint64_t idle_cycles = std::min(cycles - elapsed, next - clk_);
+      clk_ += idle_cycles;
+      elapsed += idle_cycles;
+      continue;
+    }
+    ClockTick();
+    elapsed++;
+    if (HostEvents() != start_events) {
+      break;
+    }
+  }
+  return elapsed;
+}
+
+void AnalyticalDRAMSystem::PrintStats() {
+  uint64_t cycles = clk_ - stats_clk_;
+  nlohmann::json j;
+  for (size_t i = 0; i < stats_.size(); i++) {
+    const ChannelStats &stats = stats_[i];
+    nlohmann::json channel;
+    channel["channel"] = i;
+    channel["num_cycles"] = cycles;
+    channel["num_reads_done"] = stats.reads;
+    channel["num_writes_done"] = stats.writes;
+    channel["num_read_row_hits"] = stats.read_row_hits;
+    channel["num_write_row_hits"] = stats.write_row_hits;
+    channel["num_row_empties"] = stats.row_empties;
+    channel["num_row_conflicts"] = stats.row_conflicts;
+    double reads = static_cast<double>(std::max<uint64_t>(stats.reads, 1));
+    channel["average_read_latency"] = stats.read_latency_sum / reads;
+    channel["average_read_queueing"] = stats.read_queueing_sum / reads;
+    double total_time = std::max<uint64_t>(cycles, 1) * config_.tCK;
+    channel["average_bandwidth"] = (stats.reads + stats.writes) *
+                                   config_.request_size_bytes / total_time;
+    j[std::to_string(i)] = channel;
+  }
+  if (config_.output_level >= 0) {
+    std::ofstream(config_.json_stats_name) << j.dump(2) << std::endl;
+  }
+
+  nlohmann::json model;
+  model["calibration_cycles"] = config_.analytical_calibration_cycles;
+  model["calibration_reads"] = fit_n_;
+  model["latency_scale"] = latency_scale_;
+  model["latency_offset"] = latency_offset_;
+  model["bus_service_cycles"] = bus_service_;
+  model["act_interval_cycles"] = act_interval_;
+  model["refresh_delay"] = refresh_delay_;
+  std::ofstream(config_.output_prefix + "analytical.json")
+      << model.dump(2) << std::endl;
+}
+
+void AnalyticalDRAMSystem::ResetStats() {
+  std::fill(stats_.begin(), stats_.end(),
+            ChannelStats{0, 0, 0, 0, 0, 0, 0, 0});
+  stats_clk_ = clk_;
+}
+
+void AnalyticalDRAMSystem::Save(CheckpointWriter &writer) const {
+  if (detailed_ != nullptr) {
+    std::cerr << "Can't checkpoint the analytical model while it calibrates"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  BaseDRAMSystem::Save(writer);
+  for (const auto &bank : banks_) {
+    writer.Put(bank.open_row);
+    writer.Put(bank.last_use);
+    writer.Put(bank.rate);
+    writer.Put(bank.rate_clk);
+    writer.Put(bank.service);
+  }
+  for (const auto &rank : ranks_) {
+    writer.Put(rank.act_rate);
+    writer.Put(rank.rate_clk);
+    writer.Put(rank.act_clk);
+  }
+  for (const auto &bus : buses_) {
+    writer.Put(bus.rate);
+    writer.Put(bus.rate_clk);
+    writer.Put(bus.free_clk);
+    writer.Put(bus.pending_reads);
+    writer.Put(bus.pending_writes);
+  }
+  for (const auto &stats : stats_) {
+    writer.Put(stats.reads);
+    writer.Put(stats.writes);
+    writer.Put(stats.read_row_hits);
+    writer.Put(stats.write_row_hits);
+    writer.Put(stats.row_empties);
+    writer.Put(stats.row_conflicts);
+    writer.Put(stats.read_latency_sum);
+    writer.Put(stats.read_queueing_sum);
+  }
+  writer.Put(stats_clk_);
+  writer.Put(static_cast<uint64_t>(events_.size()));
+  for (const auto &event : events_) {
+    writer.Put(event.cycle);
+    writer.Put(event.seq);
+    writer.Put(event.addr);
+    writer.Put(event.tag);
+    writer.Put(event.bus);
+    writer.Put(event.is_write);
+    writer.Put(event.returns);
+    writer.Put(event.frees);
+  }
+  writer.Put(event_seq_);
+  writer.Put(latency_scale_);
+  writer.Put(latency_offset_);
+  writer.Put(fit_n_);
+}
+
+void AnalyticalDRAMSystem::Load(CheckpointReader &reader) {
+  BaseDRAMSystem::Load(reader);
+  for (auto &bank : banks_) {
+    reader.Get(bank.open_row);
+    reader.Get(bank.last_use);
+    reader.Get(bank.rate);
+    reader.Get(bank.rate_clk);
+    reader.Get(bank.service);
+  }
+  for (auto &rank : ranks_) {
+    reader.Get(rank.act_rate);
+    reader.Get(rank.rate_clk);
+    reader.Get(rank.act_clk);
+  }
+  for (auto &bus : buses_) {
+    reader.Get(bus.rate);
+    reader.Get(bus.rate_clk);
+    reader.Get(bus.free_clk);
+    reader.Get(bus.pending_reads);
+    reader.Get(bus.pending_writes);
+  }
+  for (auto &stats : stats_) {
+    reader.Get(stats.reads);
+    reader.Get(stats.writes);
+    reader.Get(stats.read_row_hits);
+    reader.Get(stats.write_row_hits);
+    reader.Get(stats.row_empties);
+    reader.Get(stats.row_conflicts);
+    reader.Get(stats.read_latency_sum);
+    reader.Get(stats.read_queueing_sum);
+  }
+  reader.Get(stats_clk_);
+  uint64_t size;
+  reader.Get(size);
+  events_.resize(size);
+  for (auto &event : events_) {
+    reader.Get(event.cycle);
+    reader.Get(event.seq);
+    reader.Get(event.addr);
+    reader.Get(event.tag);
+    reader.Get(event.bus);
+    reader.Get(event.is_write);
+    reader.Get(event.returns);
+    reader.Get(event.frees);
+  }
+  reader.Get(event_seq_);
+  reader.Get(latency_scale_);
+  reader.Get(latency_offset_);
+  reader.Get(fit_n_);
+  // a restored model is calibrated already, or never will be
+  delete detailed_;
+  detailed_ = nullptr;
+  samples_.clear();
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,149 @@
+#ifndef __ANALYTICAL_SYSTEM_H
+#define __ANALYTICAL_SYSTEM_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dram_system.h"
+
+namespace dramsim3 {
+
+/// @brief A fast statistical model of a JEDEC system (system.memory_model =
+/// ANALYTICAL). No commands are scheduled, the latency of each transaction
+/// is computed once, when it is added:
+///   - the row hit, empty or conflict latency of its bank from the timings,
+///     with the open row of every bank tracked (CLOSE_PAGE closes them after
+///     each access, TIMEOUT after row_buf_timeout idle cycles),
+///   - the M/D/1 queueing delay rho * S / (2 * (1 - rho)) of its bank, of
+///     the activations of its rank (if it opens a row) and of its data bus,
+///     with the arrival rates averaged over the last cycles and S the mean
+///     occupancy of the bank, the ACT spacing of tRRD_S and tFAW and the
+///     burst,
+///   - the expected wait for a refresh.
+/// The data bus of each channel (each sub-channel) moves at most one burst
+/// per burst_cycle cycles and each rank opens at most one row per ACT
+/// spacing, so the model never exceeds the peak bandwidth or activation
+/// rate. A transaction holds its queue entry while it waits, until it would
+/// have moved on to the command queue of its bank. Writes return right away,
+/// as they do from the write buffer of the controllers.
+///
+/// With analytical_calibration_cycles the first cycles are simulated by a
+/// detailed JedecDRAMSystem while the model predicts the same reads. The
+/// measured latencies are fitted to base + offset + scale * queueing, which
+/// the model uses from then on.
+///
+/// There are no epoch stats, the final stats of each channel go to
+/// <output_prefix>.json and the model parameters to
+/// <output_prefix>analytical.json.
+class AnalyticalDRAMSystem : public BaseDRAMSystem {
+public:
+  AnalyticalDRAMSystem(const Config &config, const std::string &output_dir,
+                       std::function<void(uint64_t)> read_callback,
+                       std::function<void(uint64_t)> write_callback);
+  ~AnalyticalDRAMSystem();
+  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                             int qos_class = 0) const override;
+  bool AddTransaction(uint64_t hex_addr, bool is_write, uint64_t tag = 0,
+                      int source = 0, int qos_class = 0) override;
+  void ClockTick() override;
+  /// @brief Jumps to the next completion, one cycle at a time while
+  /// calibrating.
+  uint64_t ClockTickN(uint64_t cycles) override;
+  void PrintStats() override;
+  void ResetStats() override;
+  /// @brief Not while calibrating, the detailed system is not saved.
+  void Save(CheckpointWriter &writer) const override;
+  void Load(CheckpointReader &reader) override;
+
+  /// @brief Whether transactions still go to the detailed system.
+  bool Calibrating() const {
+    return detailed_ != nullptr &&
+           clk_ < static_cast<uint64_t>(config_.analytical_calibration_cycles);
+  }
+  double LatencyScale() const { return latency_scale_; }
+  double LatencyOffset() const { return latency_offset_; }
+
+private:
+  struct Bank {
+    int open_row;
+    uint64_t last_use;
+    // arrivals per cycle, decayed since rate_clk
+    double rate;
+    uint64_t rate_clk;
+    // mean cycles the bank is busy per access
+    double service;
+  };
+  struct Rank {
+    double act_rate;
+    uint64_t rate_clk;
+    // cycle the activations given out so far are done
+    double act_clk;
+  };
+  // the data bus of a channel, or of a sub-channel
+  struct Bus {
+    double rate;
+    uint64_t rate_clk;
+    // cycle the bursts given out so far end
+    uint64_t free_clk;
+    int pending_reads;
+    int pending_writes;
+  };
+  struct ChannelStats {
+    uint64_t reads, writes, read_row_hits, write_row_hits;
+    uint64_t row_empties, row_conflicts;
+    uint64_t read_latency_sum, read_queueing_sum;
+  };
+  struct Event {
+    uint64_t cycle, seq, addr, tag;
+    int bus;
+    bool is_write;
+    // the host gets the completion
+    bool returns;
+    // the queue entry is freed
+    bool frees;
+  };
+  static bool EventLater(const Event &a, const Event &b) {
+    return a.cycle != b.cycle ? a.cycle > b.cycle : a.seq > b.seq;
+  }
+  // a read of the calibration run
+  struct Sample {
+    uint64_t tag, clk;
+    double base, queueing;
+  };
+
+  int BusIndex(const Address &addr) const;
+  /// @brief Latency of an access at clk_ without the calibration, split into
+  /// base and queueing, and the cycle its burst ends. Updates the state of
+  /// its bank and bus and the stats.
+  uint64_t Access(uint64_t hex_addr, bool is_write, double &base,
+                  double &queueing);
+  double Rate(double rate, uint64_t rate_clk) const;
+  void AddEvent(const Event &event);
+  void DeliverEvents();
+  void CalibrationDone(const Completion &completion);
+  void FinishCalibration();
+
+  std::vector<Bank> banks_;
+  std::vector<Rank> ranks_;
+  std::vector<Bus> buses_;
+  std::vector<ChannelStats> stats_;
+  uint64_t stats_clk_;
+  std::vector<Event> events_;
+  uint64_t event_seq_;
+  // cycles per burst, stretched by the share of time lost to refresh
+  double bus_service_;
+  // cycles between the ACTs of a rank
+  double act_interval_;
+  double refresh_delay_;
+  double latency_scale_, latency_offset_;
+
+  JedecDRAMSystem *detailed_;
+  std::unordered_map<uint64_t, Sample> samples_;
+  uint64_t sample_seq_;
+  // sums of the least squares fit of the measured latencies
+  double fit_n_, fit_x_, fit_y_, fit_xx_, fit_xy_;
+};
+
+}  // namespace dramsim3
+#endif  // __ANALYTICAL_SYSTEM_H
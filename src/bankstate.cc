@@ -3,20 +3,21 @@
 namespace dramsim3 {
 
 BankState::BankState()
-    : state_(State::CLOSED), cmd_timing_(static_cast<int>(CommandType::SIZE)),
-      open_row_(-1), row_hit_count_(0) {
-  cmd_timing_[static_cast<int>(CommandType::READ)] = 0;
-  cmd_timing_[static_cast<int>(CommandType::READ_PRECHARGE)] = 0;
-  cmd_timing_[static_cast<int>(CommandType::WRITE)] = 0;
-  cmd_timing_[static_cast<int>(CommandType::WRITE_PRECHARGE)] = 0;
-  cmd_timing_[static_cast<int>(CommandType::ACTIVATE)] = 0;
-  cmd_timing_[static_cast<int>(CommandType::PRECHARGE)] = 0;
-  cmd_timing_[static_cast<int>(CommandType::REFRESH)] = 0;
-  cmd_timing_[static_cast<int>(CommandType::SREF_ENTER)] = 0;
-  cmd_timing_[static_cast<int>(CommandType::SREF_EXIT)] = 0;
+    : state_(State::CLOSED), open_row_(-1), row_hit_count_(0) {}
+
+void BankState::Save(CheckpointWriter &writer) const {
+  writer.Put(state_);
+  writer.Put(open_row_);
+  writer.Put(row_hit_count_);
+}
+
+void BankState::Load(CheckpointReader &reader) {
+  reader.Get(state_);
+  reader.Get(open_row_);
+  reader.Get(row_hit_count_);
 }
 
-Command BankState::GetReadyCommand(const Command &cmd, uint64_t clk) const {
+CommandType BankState::GetRequiredCommand(const Command &cmd) const {
   CommandType required_type = CommandType::SIZE;
   switch (state_) {
     case State::CLOSED:
@@ -29,7 +30,8 @@ Command BankState::GetReadyCommand(const Command &cmd, uint64_t clk) const {
           break;
         case CommandType::REFRESH:
         case CommandType::REFRESH_BANK:
-        case CommandType::SREF_ENTER: required_type = cmd.cmd_type; break;
+        case CommandType::SREF_ENTER:
+        case CommandType::PD_ENTER: required_type = cmd.cmd_type; break;
         default:
           std::cerr << "Unknown type!" << std::endl;
           AbruptExit(__FILE__, __LINE__);
@@ -53,6 +55,8 @@ Command BankState::GetReadyCommand(const Command &cmd, uint64_t clk) const {
         case CommandType::SREF_ENTER:
           required_type = CommandType::PRECHARGE;
           break;
+        // active power-down, the rows stay open
+        case CommandType::PD_ENTER: required_type = cmd.cmd_type; break;
         default:
           std::cerr << "Unknown type!" << std::endl;
           AbruptExit(__FILE__, __LINE__);
@@ -67,6 +71,8 @@ Command BankState::GetReadyCommand(const Command &cmd, uint64_t clk) const {
         case CommandType::WRITE_PRECHARGE:
           required_type = CommandType::SREF_EXIT;
           break;
+        // the wake-up of a rank with requests waiting
+        case CommandType::SREF_EXIT: required_type = cmd.cmd_type; break;
         default:
           std::cerr << "Unknown type!" << std::endl;
           AbruptExit(__FILE__, __LINE__);
@@ -74,18 +80,29 @@ Command BankState::GetReadyCommand(const Command &cmd, uint64_t clk) const {
       }
       break;
     case State::PD:
+      switch (cmd.cmd_type) {
+        case CommandType::READ:
+        case CommandType::READ_PRECHARGE:
+        case CommandType::WRITE:
+        case CommandType::WRITE_PRECHARGE:
+        case CommandType::REFRESH:
+        case CommandType::REFRESH_BANK:
+        case CommandType::SREF_ENTER:
+          required_type = CommandType::PD_EXIT;
+          break;
+        default:
+          std::cerr << "Unknown type!" << std::endl;
+          AbruptExit(__FILE__, __LINE__);
+          break;
+      }
+      break;
     case State::SIZE:
       std::cerr << "In unknown state" << std::endl;
       AbruptExit(__FILE__, __LINE__);
       break;
   }
 
-  if (required_type != CommandType::SIZE) {
-    if (clk >= cmd_timing_[static_cast<int>(required_type)]) {
-      return Command(required_type, cmd.addr, cmd.hex_addr);
-    }
-  }
-  return Command();
+  return required_type;
 }
 
 void BankState::UpdateState(const Command &cmd) {
@@ -101,6 +118,7 @@ void BankState::UpdateState(const Command &cmd) {
           open_row_ = -1;
           row_hit_count_ = 0;
           break;
+        case CommandType::PD_ENTER: state_ = State::PD; break;
         case CommandType::ACTIVATE:
         case CommandType::REFRESH:
         case CommandType::REFRESH_BANK:
@@ -118,6 +136,7 @@ void BankState::UpdateState(const Command &cmd) {
           open_row_ = cmd.Row();
           break;
         case CommandType::SREF_ENTER: state_ = State::SREF; break;
+        case CommandType::PD_ENTER: state_ = State::PD; break;
         case CommandType::READ:
         case CommandType::WRITE:
         case CommandType::READ_PRECHARGE:
@@ -142,15 +161,18 @@ void BankState::UpdateState(const Command &cmd) {
         default: AbruptExit(__FILE__, __LINE__);
       }
       break;
+    case State::PD:
+      switch (cmd.cmd_type) {
+        // back to the state the bank was powered down in
+        case CommandType::PD_EXIT:
+          state_ = open_row_ >= 0 ? State::OPEN : State::CLOSED;
+          break;
+        default: AbruptExit(__FILE__, __LINE__);
+      }
+      break;
     default: AbruptExit(__FILE__, __LINE__);
   }
   return;
 }
 
-void BankState::UpdateTiming(CommandType cmd_type, uint64_t time) {
-  cmd_timing_[static_cast<int>(cmd_type)] =
-      std::max(cmd_timing_[static_cast<int>(cmd_type)], time);
-  return;
-}
-
 }  // namespace dramsim3
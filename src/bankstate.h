@@ -1,36 +1,40 @@
 #ifndef __BANKSTATE_H
 #define __BANKSTATE_H
 
+#include "checkpoint.h"
 #include "common.h"
-#include <vector>
 
 namespace dramsim3 {
 
+/// @brief The state machine of a bank. The timing constraints of all the
+/// banks of a channel are kept apart in ChannelState, as one flat table.
 class BankState {
 public:
   BankState();
 
+  /// @brief PD is power-down, a bank keeps the row it had open, if any, so
+  /// that it is back to OPEN or CLOSED on exit.
   enum class State { OPEN, CLOSED, SREF, PD, SIZE };
-  Command GetReadyCommand(const Command &cmd, uint64_t clk) const;
+
+  // The command this bank has to execute next in order to serve cmd
+  CommandType GetRequiredCommand(const Command &cmd) const;
 
   // Update the state of the bank resulting after the execution of the command
   void UpdateState(const Command &cmd);
 
-  // Update the existing timing constraints for the command
-  void UpdateTiming(const CommandType cmd_type, uint64_t time);
-
   bool IsRowOpen() const { return state_ == State::OPEN; }
   int OpenRow() const { return open_row_; }
   int RowHitCount() const { return row_hit_count_; }
 
+  // checkpointing, see MemorySystem::SaveCheckpoint
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
+
 private:
   // Current state of the Bank
   // Apriori or instantaneously transitions on a command.
   State state_;
 
-  // Earliest time when the particular Command can be executed in this bank
-  std::vector<uint64_t> cmd_timing_;
-
   // Currently open row
   int open_row_;
 
@@ -0,0 +1,217 @@
+#include "./../ext/headers/args.hxx"
+#include "cpu.h"
+#include "json.hpp"
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+using namespace dramsim3;
+
+namespace {
+
+// heap allocations of the whole process, the library included
+std::atomic<uint64_t> num_allocs(0);
+
+// a fixed set of protocols, each run with every generator
+const char *const kBenchConfigs[] = {
+    "DDR4_8Gb_x8_3200.ini", "LPDDR4_8Gb_x16_2400.ini", "GDDR6_8Gb_x16.ini",
+    "HBM2_8Gb_x128.ini",    "HMC_2GB_4Lx16.ini",
+};
+const char *const kBenchCPUs[] = {"random", "stream", "trace"};
+
+/// @brief Counts the requests the memory system returns to the CPU.
+template <class BaseCPU>
+class CountingCPU : public BaseCPU {
+public:
+  using BaseCPU::BaseCPU;
+  void ReadCallBack(uint64_t addr) override { num_returns++; }
+  void WriteCallBack(uint64_t addr) override { num_returns++; }
+  uint64_t num_returns = 0;
+};
+
+struct BenchResult {
+  double seconds;
+  uint64_t cycles;
+  uint64_t requests;
+  uint64_t allocs;
+  uint64_t peak_rss_kb;
+};
+
+// peak resident set of the process, reset before each workload where the
+// kernel allows it so that every workload gets its own peak
+void ResetPeakRSS() { std::ofstream("/proc/self/clear_refs") << "5"; }
+
+uint64_t PeakRSS() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::strtoull(line.c_str() + 6, nullptr, 10);
+    }
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<uint64_t>(usage.ru_maxrss);
+}
+
+template <class BenchCPU>
+BenchResult Run(BenchCPU *cpu, uint64_t cycles) {
+  // the construction, e.g. parsing the config, is not what is measured
+  uint64_t allocs = num_allocs.load();
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t clk = 0; clk < cycles; clk++) {
+    cpu->ClockTick();
+  }
+  auto end = std::chrono::steady_clock::now();
+  BenchResult result;
+  result.seconds = std::chrono::duration<double>(end - start).count();
+  result.cycles = cycles;
+  result.requests = cpu->num_returns;
+  result.allocs = num_allocs.load() - allocs;
+  delete cpu;
+  return result;
+}
+
+BenchResult RunWorkload(const std::string &config_file,
+                        const std::string &cpu_type,
+                        const std::string &trace_file,
+                        const std::string &output_dir, uint64_t cycles) {
+  ResetPeakRSS();
+  BenchResult result;
+  if (cpu_type == "random") {
+    result = Run(new CountingCPU<RandomCPU>(config_file, output_dir), cycles);
+  } else if (cpu_type == "stream") {
+    result = Run(new CountingCPU<StreamCPU>(config_file, output_dir), cycles);
+  } else {
+    result = Run(new CountingCPU<TraceBasedCPU>(config_file, output_dir,
+                                                  trace_file),
+                 cycles);
+  }
+  result.peak_rss_kb = PeakRSS();
+  return result;
+}
+
+}  // namespace
+
+void *operator new(size_t size) {
+  num_allocs++;
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+int main(int argc, const char **argv) {
+  args::ArgumentParser parser(
+      "Simulator throughput benchmark, runs a fixed set of workloads (random, "
+      "stream and trace CPUs on DDR4, LPDDR4, GDDR6, HBM2 and HMC configs) "
+      "and reports the host performance of each.",
+      "Example: \n"
+      "./build/dramsim3bench -c 500000 -o bench_out\n"
+      "./build/dramsim3bench --filter HBM2 --filter DDR4_8Gb_x8_3200-random");
+  args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+  args::ValueFlag<uint64_t> num_cycles_arg(
+      parser, "num_cycles", "Number of cycles to simulate per workload",
+      {'c', "cycles"}, 1000000);
+  args::ValueFlag<std::string> output_dir_arg(
+      parser, "output_dir",
+      "Output directory for the simulator stats and bench.json",
+      {'o', "output-dir"}, ".");
+  args::ValueFlag<std::string> config_dir_arg(
+      parser, "config_dir", "Directory of the config files", {"config-dir"},
+      "configs");
+  args::ValueFlag<std::string> trace_file_arg(
+      parser, "trace", "Trace file replayed by the trace workloads",
+      {'t', "trace"}, "tests/example.trace");
+  args::ValueFlag<int> repeat_arg(
+      parser, "repeat", "Runs of each workload, the fastest is reported",
+      {'r', "repeat"}, 1);
+  args::ValueFlagList<std::string> filter_arg(
+      parser, "filter",
+      "Only run the workloads whose name (config-cpu) contains this, can be "
+      "repeated",
+      {"filter"});
+
+  try {
+    parser.ParseCLI(argc, argv);
+  } catch (const args::Help &) {
+    std::cout << parser;
+    return 0;
+  } catch (const args::ParseError &e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return 1;
+  }
+
+  uint64_t cycles = args::get(num_cycles_arg);
+  std::string output_dir = args::get(output_dir_arg);
+  std::string config_dir = args::get(config_dir_arg);
+  std::string trace_file = args::get(trace_file_arg);
+  int repeat = std::max(1, args::get(repeat_arg));
+  std::vector<std::string> filters = args::get(filter_arg);
+  mkdir(output_dir.c_str(), 0755);
+
+  nlohmann::json results;
+  results["cycles"] = cycles;
+  results["repeat"] = repeat;
+  results["trace"] = trace_file;
+  std::cout << std::left << std::setw(36) << "workload" << std::right
+            << std::setw(14) << "cycles/s" << std::setw(14) << "requests/s"
+            << std::setw(12) << "allocs" << std::setw(12) << "peak KB"
+            << std::endl;
+  for (const char *config : kBenchConfigs) {
+    std::string config_file = config_dir + "/" + config;
+    std::string stem(config, std::string(config).find('.'));
+    for (const char *cpu_type : kBenchCPUs) {
+      std::string name = stem + "-" + cpu_type;
+      bool selected = filters.empty();
+      for (const auto &filter : filters) {
+        selected = selected || name.find(filter) != std::string::npos;
+      }
+      if (!selected) {
+        continue;
+      }
+      BenchResult best;
+      for (int i = 0; i < repeat; i++) {
+        BenchResult result = RunWorkload(config_file, cpu_type, trace_file,
+                                         output_dir, cycles);
+        if (i == 0 || result.seconds < best.seconds) {
+          best = result;
+        }
+      }
+      double cycles_per_sec = best.cycles / best.seconds;
+      double requests_per_sec = best.requests / best.seconds;
+      std::cout << std::left << std::setw(36) << name << std::right
+                << std::fixed << std::setprecision(0) << std::setw(14)
+                << cycles_per_sec << std::setw(14) << requests_per_sec
+                << std::setw(12) << best.allocs << std::setw(12)
+                << best.peak_rss_kb << std::endl;
+      nlohmann::json j_run;
+      j_run["name"] = name;
+      j_run["config"] = config_file;
+      j_run["cpu"] = cpu_type;
+      j_run["seconds"] = best.seconds;
+      j_run["simulated_cycles"] = best.cycles;
+      j_run["requests"] = best.requests;
+      j_run["cycles_per_sec"] = cycles_per_sec;
+      j_run["requests_per_sec"] = requests_per_sec;
+      j_run["allocations"] = best.allocs;
+      j_run["peak_rss_kb"] = best.peak_rss_kb;
+      results["runs"].push_back(j_run);
+    }
+  }
+  std::ofstream(output_dir + "/bench.json") << results.dump(2) << std::endl;
+  std::cout << "Results written to " << output_dir << "/bench.json"
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,339 @@
+#include "binary_trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace dramsim3 {
+
+namespace {
+
+// distance the kernel is asked to read ahead of the decoder
+const size_t kPrefetchWindow = 4 << 20;
+const size_t kWriteBufferSize = 1 << 16;
+
+// deltas are taken modulo 2^64, zigzag keeps small negative ones short
+uint64_t ZigZagEncode(uint64_t delta) {
+  uint64_t sign = static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63);
+  return (delta << 1) ^ sign;
+}
+
+uint64_t ZigZagDecode(uint64_t value) {
+  return (value >> 1) ^ (~(value & 1) + 1);
+}
+
+uint64_t LoadLE(const uint8_t *p, int bytes) {
+  uint64_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--) {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+void StoreLE(uint8_t *p, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    p[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+void PutVarint(std::vector<uint8_t> &buffer, uint64_t value) {
+  while (value >= 0x80) {
+    buffer.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  buffer.push_back(static_cast<uint8_t>(value));
+}
+
+bool HasMagic(const std::string &trace_file, const char *magic) {
+  std::ifstream file(trace_file, std::ifstream::binary);
+  char head[kBinaryTraceMagicSize];
+  if (!file.read(head, kBinaryTraceMagicSize)) {
+    return false;
+  }
+  return std::memcmp(head, magic, kBinaryTraceMagicSize) == 0;
+}
+
+// map a trace read-only for one front to back pass, it has at least a header
+const uint8_t *MapTrace(const std::string &trace_file, int &fd, size_t &size) {
+  fd = ::open(trace_file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Trace file " << trace_file << " does not exist"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      file_stat.st_size < kBinaryTraceHeaderSize) {
+    std::cerr << "Trace " << trace_file << " has no header" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  size = static_cast<size_t>(file_stat.st_size);
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    std::cerr << "Cannot map trace " << trace_file << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+  return static_cast<const uint8_t *>(map);
+}
+
+void UnmapTrace(const uint8_t *data, int fd, size_t size) {
+  if (data != nullptr) {
+    munmap(const_cast<uint8_t *>(data), size);
+  }
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+
+// keep the window after the one at pos in flight, returns the position at
+// which to prefetch again
+size_t PrefetchAhead(const uint8_t *data, size_t size, size_t pos) {
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t begin = (pos + kPrefetchWindow) / page_size * page_size;
+  if (begin < size) {
+    size_t len = std::min(kPrefetchWindow, size - begin);
+    madvise(const_cast<uint8_t *>(data) + begin, len, MADV_WILLNEED);
+  }
+  return pos + kPrefetchWindow;
+}
+
+}  // namespace
+
+BinaryTraceReader::BinaryTraceReader(const std::string &trace_file)
+    : fd_(-1), data_(nullptr), size_(0), pos_(kBinaryTraceHeaderSize),
+      prefetch_mark_(0), num_records_(0), records_read_(0), last_cycle_(0),
+      last_addr_(0) {
+  data_ = MapTrace(trace_file, fd_, size_);
+  if (std::memcmp(data_, kBinaryTraceMagic, kBinaryTraceMagicSize) != 0) {
+    std::cerr << trace_file << " is not a binary trace" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  uint64_t version = LoadLE(data_ + 8, 4);
+  uint64_t flags = LoadLE(data_ + 12, 4);
+  if (version != kBinaryTraceVersion || flags != 0) {
+    std::cerr << "Unsupported binary trace version " << version
+              << " flags " << flags << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  num_records_ = LoadLE(data_ + 16, 8);
+}
+
+BinaryTraceReader::~BinaryTraceReader() { UnmapTrace(data_, fd_, size_); }
+
+bool BinaryTraceReader::IsBinaryTrace(const std::string &trace_file) {
+  return HasMagic(trace_file, kBinaryTraceMagic);
+}
+
+bool BinaryTraceReader::Next(Transaction &trans) {
+  if (records_read_ == num_records_) {
+    return false;
+  }
+  if (pos_ >= prefetch_mark_) {
+    prefetch_mark_ = PrefetchAhead(data_, size_, pos_);
+  }
+  uint64_t cycle_word = ReadVarint();
+  uint64_t addr_word = ReadVarint();
+  last_cycle_ += ZigZagDecode(cycle_word >> 1);
+  last_addr_ += ZigZagDecode(addr_word);
+  trans.addr = last_addr_;
+  trans.added_cycle = last_cycle_;
+  trans.is_write = (cycle_word & 1) != 0;
+  records_read_++;
+  return true;
+}
+
+uint64_t BinaryTraceReader::ReadVarint() {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (pos_ >= size_) {
+      std::cerr << "Binary trace is truncated at record " << records_read_
+                << std::endl;
+      AbruptExit(__FILE__, __LINE__);
+    }
+    uint8_t byte = data_[pos_++];
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  std::cerr << "Bad varint in binary trace at record " << records_read_
+            << std::endl;
+  AbruptExit(__FILE__, __LINE__);
+  return 0;
+}
+
+BinaryTraceWriter::BinaryTraceWriter(const std::string &trace_file)
+    : out_(trace_file, std::ofstream::binary | std::ofstream::trunc),
+      num_records_(0), last_cycle_(0), last_addr_(0) {
+  if (out_.fail()) {
+    std::cerr << "Cannot open " << trace_file << " for writing" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  // header, the record count is patched in Close()
+  uint8_t header[kBinaryTraceHeaderSize] = {0};
+  std::memcpy(header, kBinaryTraceMagic, kBinaryTraceMagicSize);
+  StoreLE(header + 8, kBinaryTraceVersion, 4);
+  out_.write(reinterpret_cast<const char *>(header), kBinaryTraceHeaderSize);
+  buffer_.reserve(kWriteBufferSize + 32);
+}
+
+void BinaryTraceWriter::Write(uint64_t addr, bool is_write, uint64_t cycle) {
+  WriteVarint((ZigZagEncode(cycle - last_cycle_) << 1) | (is_write ? 1 : 0));
+  WriteVarint(ZigZagEncode(addr - last_addr_));
+  last_cycle_ = cycle;
+  last_addr_ = addr;
+  num_records_++;
+  if (buffer_.size() >= kWriteBufferSize) {
+    Flush();
+  }
+}
+
+void BinaryTraceWriter::Close() {
+  if (!out_.is_open()) {
+    return;
+  }
+  Flush();
+  uint8_t count[8];
+  StoreLE(count, num_records_, 8);
+  out_.seekp(16);
+  out_.write(reinterpret_cast<const char *>(count), 8);
+  out_.close();
+}
+
+void BinaryTraceWriter::WriteVarint(uint64_t value) {
+  PutVarint(buffer_, value);
+}
+
+void BinaryTraceWriter::Flush() {
+  out_.write(reinterpret_cast<const char *>(buffer_.data()), buffer_.size());
+  buffer_.clear();
+}
+
+CommandTraceWriter::CommandTraceWriter(const std::string &trace_file,
+                                       int channel)
+    : out_(trace_file, std::ofstream::binary | std::ofstream::trunc),
+      num_records_(0), last_cycle_(0) {
+  if (out_.fail()) {
+    std::cerr << "Cannot open " << trace_file << " for writing" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  // header, the record count is patched in Close()
+  uint8_t header[kBinaryTraceHeaderSize] = {0};
+  std::memcpy(header, kCommandTraceMagic, kBinaryTraceMagicSize);
+  StoreLE(header + 8, kCommandTraceVersion, 4);
+  StoreLE(header + 12, static_cast<uint64_t>(channel), 4);
+  out_.write(reinterpret_cast<const char *>(header), kBinaryTraceHeaderSize);
+  buffer_.reserve(kWriteBufferSize + 64);
+}
+
+void CommandTraceWriter::Write(uint64_t cycle, const Command &cmd) {
+  PutVarint(buffer_, cycle - last_cycle_);
+  buffer_.push_back(static_cast<uint8_t>(cmd.cmd_type));
+  const int fields[] = {cmd.Rank(), cmd.Bankgroup(), cmd.Bank(), cmd.Row(),
+                        cmd.Column()};
+  for (int field : fields) {
+    PutVarint(buffer_, ZigZagEncode(static_cast<uint64_t>(
+                           static_cast<int64_t>(field))));
+  }
+  last_cycle_ = cycle;
+  num_records_++;
+  if (buffer_.size() >= kWriteBufferSize) {
+    Flush();
+  }
+}
+
+void CommandTraceWriter::Close() {
+  if (!out_.is_open()) {
+    return;
+  }
+  Flush();
+  uint8_t count[8];
+  StoreLE(count, num_records_, 8);
+  out_.seekp(16);
+  out_.write(reinterpret_cast<const char *>(count), 8);
+  out_.close();
+}
+
+void CommandTraceWriter::Flush() {
+  out_.write(reinterpret_cast<const char *>(buffer_.data()), buffer_.size());
+  buffer_.clear();
+}
+
+CommandTraceReader::CommandTraceReader(const std::string &trace_file)
+    : fd_(-1), data_(nullptr), size_(0), pos_(kBinaryTraceHeaderSize),
+      prefetch_mark_(0), channel_(0), num_records_(0), records_read_(0),
+      last_cycle_(0) {
+  data_ = MapTrace(trace_file, fd_, size_);
+  if (std::memcmp(data_, kCommandTraceMagic, kBinaryTraceMagicSize) != 0) {
+    std::cerr << trace_file << " is not a command trace" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  uint64_t version = LoadLE(data_ + 8, 4);
+  if (version != kCommandTraceVersion) {
+    std::cerr << "Unsupported command trace version " << version << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  channel_ = static_cast<int>(LoadLE(data_ + 12, 4));
+  num_records_ = LoadLE(data_ + 16, 8);
+}
+
+CommandTraceReader::~CommandTraceReader() { UnmapTrace(data_, fd_, size_); }
+
+bool CommandTraceReader::IsCommandTrace(const std::string &trace_file) {
+  return HasMagic(trace_file, kCommandTraceMagic);
+}
+
+bool CommandTraceReader::Next(uint64_t &cycle, Command &cmd) {
+  if (records_read_ == num_records_) {
+    return false;
+  }
+  if (pos_ >= prefetch_mark_) {
+    prefetch_mark_ = PrefetchAhead(data_, size_, pos_);
+  }
+  last_cycle_ += ReadVarint();
+  if (pos_ >= size_ ||
+      data_[pos_] >= static_cast<uint8_t>(CommandType::SIZE)) {
+    std::cerr << "Bad command in command trace at record " << records_read_
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  CommandType cmd_type = static_cast<CommandType>(data_[pos_++]);
+  int fields[5];
+  for (int &field : fields) {
+    field = static_cast<int>(static_cast<int64_t>(ZigZagDecode(ReadVarint())));
+  }
+  cycle = last_cycle_;
+  cmd = Command(cmd_type,
+                Address(channel_, fields[0], fields[1], fields[2], fields[3],
+                        fields[4]),
+                -1);
+  records_read_++;
+  return true;
+}
+
+uint64_t CommandTraceReader::ReadVarint() {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (pos_ >= size_) {
+      std::cerr << "Command trace is truncated at record " << records_read_
+                << std::endl;
+      AbruptExit(__FILE__, __LINE__);
+    }
+    uint8_t byte = data_[pos_++];
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  std::cerr << "Bad varint in command trace at record " << records_read_
+            << std::endl;
+  AbruptExit(__FILE__, __LINE__);
+  return 0;
+}
+
+}  // namespace dramsim3
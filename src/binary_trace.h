@@ -0,0 +1,126 @@
+#ifndef __BINARY_TRACE_H
+#define __BINARY_TRACE_H
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+namespace dramsim3 {
+
+/// @brief Binary trace format, a compact replacement of the text trace.
+/// All integers are little endian.
+///   header: 8 byte magic "DRS3BTRC", uint32 version, uint32 flags (must be
+///           0, reserved for block compression), uint64 number of records
+///   record: varint((zigzag(cycle - last cycle) << 1) | is_write)
+///           varint(zigzag(addr - last addr))
+/// where varint is LEB128 and last cycle/addr start at 0. Use
+/// scripts/trace_convert.py to convert text traces.
+const char kBinaryTraceMagic[] = "DRS3BTRC";
+const int kBinaryTraceMagicSize = 8;
+const uint32_t kBinaryTraceVersion = 1;
+const int kBinaryTraceHeaderSize = 24;
+
+/// @brief Streams a binary trace out of a read-only memory map, advising the
+/// kernel to read the next window ahead of the decoder.
+class BinaryTraceReader {
+public:
+  explicit BinaryTraceReader(const std::string &trace_file);
+  ~BinaryTraceReader();
+  /// @brief Whether the file starts with the binary trace magic.
+  static bool IsBinaryTrace(const std::string &trace_file);
+  /// @brief Decode the next record into trans, return false at the end.
+  bool Next(Transaction &trans);
+  uint64_t NumRecords() const { return num_records_; }
+
+private:
+  uint64_t ReadVarint();
+
+  int fd_;
+  const uint8_t *data_;
+  size_t size_;
+  size_t pos_;
+  size_t prefetch_mark_;
+  uint64_t num_records_;
+  uint64_t records_read_;
+  uint64_t last_cycle_;
+  uint64_t last_addr_;
+};
+
+/// @brief Writes a binary trace, the record count in the header is filled
+/// in by Close().
+class BinaryTraceWriter {
+public:
+  explicit BinaryTraceWriter(const std::string &trace_file);
+  ~BinaryTraceWriter() { Close(); }
+  void Write(uint64_t addr, bool is_write, uint64_t cycle);
+  void Close();
+
+private:
+  void WriteVarint(uint64_t value);
+  void Flush();
+
+  std::ofstream out_;
+  std::vector<uint8_t> buffer_;
+  uint64_t num_records_;
+  uint64_t last_cycle_;
+  uint64_t last_addr_;
+};
+
+/// @brief Binary command trace, what CMD_TRACE writes as text, one file per
+/// channel. All integers are little endian.
+///   header: 8 byte magic "DRS3CTRC", uint32 version, uint32 channel,
+///           uint64 number of records
+///   record: varint(cycle - last cycle), uint8 command type, then
+///           varint(zigzag(x)) of rank, bankgroup, bank, row and column
+/// Commands are recorded in issue order, so cycles never decrease.
+const char kCommandTraceMagic[] = "DRS3CTRC";
+const uint32_t kCommandTraceVersion = 1;
+
+class CommandTraceWriter {
+public:
+  CommandTraceWriter(const std::string &trace_file, int channel);
+  ~CommandTraceWriter() { Close(); }
+  void Write(uint64_t cycle, const Command &cmd);
+  void Close();
+
+private:
+  void Flush();
+
+  std::ofstream out_;
+  std::vector<uint8_t> buffer_;
+  uint64_t num_records_;
+  uint64_t last_cycle_;
+};
+
+/// @brief Streams a command trace out of a read-only memory map like
+/// BinaryTraceReader, used by the decoder and the thermal replay.
+class CommandTraceReader {
+public:
+  explicit CommandTraceReader(const std::string &trace_file);
+  ~CommandTraceReader();
+  /// @brief Whether the file starts with the command trace magic.
+  static bool IsCommandTrace(const std::string &trace_file);
+  /// @brief Decode the next record, return false at the end.
+  bool Next(uint64_t &cycle, Command &cmd);
+  int Channel() const { return channel_; }
+  uint64_t NumRecords() const { return num_records_; }
+
+private:
+  uint64_t ReadVarint();
+
+  int fd_;
+  const uint8_t *data_;
+  size_t size_;
+  size_t pos_;
+  size_t prefetch_mark_;
+  int channel_;
+  uint64_t num_records_;
+  uint64_t records_read_;
+  uint64_t last_cycle_;
+};
+
+}  // namespace dramsim3
+#endif
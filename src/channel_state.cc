@@ -1,30 +1,33 @@
 #include "channel_state.h"
+#include <algorithm>
+#include <limits>
 
 namespace dramsim3 {
 ChannelState::ChannelState(const Config &config, const Timing &timing)
     : rank_idle_cycles(config.ranks, 0), config_(config), timing_(timing),
-      rank_is_sref_(config.ranks, false),
+      num_banks_(config.ranks * config.banks),
+      bank_states_(num_banks_, BankState()),
+      cmd_timing_(static_cast<int>(CommandType::SIZE) * num_banks_, 0),
+      rank_is_sref_(config.ranks, false), rank_is_pd_(config.ranks, false),
+      rank_pd_active_(config.ranks, false),
       four_aw_(config_.ranks, std::vector<uint64_t>()),
-      thirty_two_aw_(config_.ranks, std::vector<uint64_t>()) {
-  bank_states_.reserve(config_.ranks);
-  for (auto i = 0; i < config_.ranks; i++) {
-    auto rank_states = std::vector<std::vector<BankState>>();
-    rank_states.reserve(config_.bankgroups);
-    for (auto j = 0; j < config_.bankgroups; j++) {
-      auto bg_states =
-          std::vector<BankState>(config_.banks_per_group, BankState());
-      rank_states.push_back(bg_states);
-    }
-    bank_states_.push_back(rank_states);
+      thirty_two_aw_(config_.ranks, std::vector<uint64_t>()),
+      has_32aw_(config.IsGDDR()), profiler_(nullptr) {}
+
+Command ChannelState::BankReadyCommand(const Command &cmd, int bank_idx,
+                                       uint64_t clk) const {
+  CommandType required_type = bank_states_[bank_idx].GetRequiredCommand(cmd);
+  if (clk >= BankTiming(required_type, bank_idx)) {
+    return Command(required_type, cmd.addr, cmd.hex_addr);
   }
+  return Command();
 }
 
 bool ChannelState::IsAllBankIdleInRank(int rank) const {
-  for (int j = 0; j < config_.bankgroups; j++) {
-    for (int k = 0; k < config_.banks_per_group; k++) {
-      if (bank_states_[rank][j][k].IsRowOpen()) {
-        return false;
-      }
+  int rank_base = rank * config_.banks;
+  for (int i = rank_base; i < rank_base + config_.banks; i++) {
+    if (bank_states_[i].IsRowOpen()) {
+      return false;
     }
   }
   return true;
@@ -36,7 +39,16 @@ bool ChannelState::IsRWPendingOnRef(const Command &cmd) const {
   int bank = cmd.Bank();
   return (IsRowOpen(rank, bankgroup, bank) &&
           RowHitCount(rank, bankgroup, bank) == 0 &&
-          bank_states_[rank][bankgroup][bank].OpenRow() == cmd.Row());
+          OpenRow(rank, bankgroup, bank) == cmd.Row());
+}
+
+bool ChannelState::IsRefreshWaiting(int rank) const {
+  for (const auto &ref : refresh_q_) {
+    if (ref.Rank() == rank) {
+      return true;
+    }
+  }
+  return false;
 }
 
 void ChannelState::BankNeedRefresh(int rank, int bankgroup, int bank,
@@ -88,7 +100,7 @@ Command ChannelState::GetReadyCommand(const Command &cmd, uint64_t clk) const {
         /// We here need to choose the right command according to the current
         /// state of the bank. And if the bank state is open, and it should
         /// firstly pre-charge, so ready_cmd may be PRECHARGE command here.
-        ready_cmd = bank_states_[cmd.Rank()][j][k].GetReadyCommand(cmd, clk);
+        ready_cmd = BankReadyCommand(cmd, BankIndex(cmd.Rank(), j, k), clk);
         if (!ready_cmd.IsValid()) {  // Not ready
           continue;
         }
@@ -108,11 +120,26 @@ Command ChannelState::GetReadyCommand(const Command &cmd, uint64_t clk) const {
     } else {
       return Command();
     }
+  } else if (cmd.IsSameBankRefresh()) {
+    /// Same as above over the banks of the bank set.
+    int num_ready = 0;
+    for (auto j = 0; j < config_.bankgroups; j++) {
+      ready_cmd = BankReadyCommand(cmd, BankIndex(cmd.Rank(), j, cmd.Bank()),
+                                   clk);
+      if (!ready_cmd.IsValid()) {
+        continue;
+      }
+      if (ready_cmd.cmd_type != cmd.cmd_type) {
+        ready_cmd.addr = Address(-1, cmd.Rank(), j, cmd.Bank(), -1, -1);
+        return ready_cmd;
+      }
+      num_ready++;
+    }
+    return num_ready == config_.bankgroups ? ready_cmd : Command();
   } else {
     /// For other commands.
-    ready_cmd =
-        bank_states_[cmd.Rank()][cmd.Bankgroup()][cmd.Bank()].GetReadyCommand(
-            cmd, clk);
+    ready_cmd = BankReadyCommand(
+        cmd, BankIndex(cmd.Rank(), cmd.Bankgroup(), cmd.Bank()), clk);
     if (!ready_cmd.IsValid()) {
       return Command();
     }
@@ -126,13 +153,57 @@ Command ChannelState::GetReadyCommand(const Command &cmd, uint64_t clk) const {
   }
 }
 
-void ChannelState::UpdateState(const Command &cmd) {
-  if (cmd.IsRankCMD()) {
+uint64_t ChannelState::GetReadyCycle(const Command &cmd) const {
+  if (cmd.IsRankCMD() || cmd.IsSameBankRefresh()) {
+    /// Mirrors GetReadyCommand: a bank that still needs another command
+    /// (likely PRECHARGE) is served first, otherwise all banks must be ready.
+    uint64_t all_ready = 0;
+    uint64_t other_ready = std::numeric_limits<uint64_t>::max();
+    bool need_other = false;
     for (auto j = 0; j < config_.bankgroups; j++) {
       for (auto k = 0; k < config_.banks_per_group; k++) {
-        bank_states_[cmd.Rank()][j][k].UpdateState(cmd);
+        if (!cmd.IsRankCMD() && k != cmd.Bank()) {
+          continue;
+        }
+        int bank_idx = BankIndex(cmd.Rank(), j, k);
+        uint64_t ready = BankReadyCycle(cmd, bank_idx);
+        if (bank_states_[bank_idx].GetRequiredCommand(cmd) != cmd.cmd_type) {
+          need_other = true;
+          other_ready = std::min(other_ready, ready);
+        } else {
+          all_ready = std::max(all_ready, ready);
+        }
       }
     }
+    return need_other ? other_ready : all_ready;
+  }
+  int bank_idx = BankIndex(cmd.Rank(), cmd.Bankgroup(), cmd.Bank());
+  uint64_t ready = BankReadyCycle(cmd, bank_idx);
+  if (bank_states_[bank_idx].GetRequiredCommand(cmd) ==
+      CommandType::ACTIVATE) {
+    int rank = cmd.Rank();
+    if (four_aw_[rank].size() >= 4) {
+      ready = std::max(ready, four_aw_[rank][0]);
+    }
+    if (has_32aw_ && thirty_two_aw_[rank].size() >= 32) {
+      ready = std::max(ready, thirty_two_aw_[rank][0]);
+    }
+  }
+  return ready;
+}
+
+void ChannelState::UpdateState(const Command &cmd) {
+  if (cmd.IsRankCMD()) {
+    if (cmd.cmd_type == CommandType::PD_ENTER) {
+      rank_is_pd_[cmd.Rank()] = true;
+      rank_pd_active_[cmd.Rank()] = !IsAllBankIdleInRank(cmd.Rank());
+    } else if (cmd.cmd_type == CommandType::PD_EXIT) {
+      rank_is_pd_[cmd.Rank()] = false;
+    }
+    int rank_base = cmd.Rank() * config_.banks;
+    for (int i = rank_base; i < rank_base + config_.banks; i++) {
+      bank_states_[i].UpdateState(cmd);
+    }
     if (cmd.IsRefresh()) {
       RankNeedRefresh(cmd.Rank(), false);
     } else if (cmd.cmd_type == CommandType::SREF_ENTER) {
@@ -140,8 +211,14 @@ void ChannelState::UpdateState(const Command &cmd) {
     } else if (cmd.cmd_type == CommandType::SREF_EXIT) {
       rank_is_sref_[cmd.Rank()] = false;
     }
+  } else if (cmd.IsSameBankRefresh()) {
+    for (int j = 0; j < config_.bankgroups; j++) {
+      bank_states_[BankIndex(cmd.Rank(), j, cmd.Bank())].UpdateState(cmd);
+    }
+    BankNeedRefresh(cmd.Rank(), -1, cmd.Bank(), false);
   } else {
-    bank_states_[cmd.Rank()][cmd.Bankgroup()][cmd.Bank()].UpdateState(cmd);
+    bank_states_[BankIndex(cmd.Rank(), cmd.Bankgroup(), cmd.Bank())]
+        .UpdateState(cmd);
     if (cmd.IsRefresh()) {
       BankNeedRefresh(cmd.Rank(), cmd.Bankgroup(), cmd.Bank(), false);
     }
@@ -149,7 +226,78 @@ void ChannelState::UpdateState(const Command &cmd) {
   return;
 }
 
+void ChannelState::Save(CheckpointWriter &writer) const {
+  writer.Put(rank_idle_cycles);
+  for (const auto &bank_state : bank_states_) {
+    bank_state.Save(writer);
+  }
+  writer.Put(cmd_timing_);
+  writer.Put(rank_is_sref_);
+  writer.Put(rank_is_pd_);
+  writer.Put(rank_pd_active_);
+  writer.Put(refresh_q_);
+  writer.Put(four_aw_);
+  writer.Put(thirty_two_aw_);
+}
+
+void ChannelState::Load(CheckpointReader &reader) {
+  reader.Get(rank_idle_cycles);
+  for (auto &bank_state : bank_states_) {
+    bank_state.Load(reader);
+  }
+  reader.Get(cmd_timing_);
+  reader.Get(rank_is_sref_);
+  reader.Get(rank_is_pd_);
+  reader.Get(rank_pd_active_);
+  reader.Get(refresh_q_);
+  reader.Get(four_aw_);
+  reader.Get(thirty_two_aw_);
+}
+
+CommandType ChannelState::FunctionalAccess(const Command &cmd) {
+  const BankState &bank_state =
+      bank_states_[BankIndex(cmd.Rank(), cmd.Bankgroup(), cmd.Bank())];
+  CommandType first = bank_state.GetRequiredCommand(cmd);
+  CommandType required = first;
+  while (required != cmd.cmd_type) {
+    UpdateState(Command(required, cmd.addr, cmd.hex_addr));
+    required = bank_state.GetRequiredCommand(cmd);
+  }
+  UpdateState(cmd);
+  return first;
+}
+
+void ChannelState::FunctionalRefresh(int rank, int bankgroup, int bank) {
+  Command precharge(CommandType::PRECHARGE, Address(), -1);
+  for (int j = 0; j < config_.bankgroups; j++) {
+    for (int k = 0; k < config_.banks_per_group; k++) {
+      if ((bankgroup >= 0 && j != bankgroup) || (bank >= 0 && k != bank)) {
+        continue;
+      }
+      int i = BankIndex(rank, j, k);
+      if (bank_states_[i].IsRowOpen()) {
+        bank_states_[i].UpdateState(precharge);
+      }
+    }
+  }
+}
+
 void ChannelState::UpdateTiming(const Command &cmd, uint64_t clk) {
+  if (cmd.IsSameBankRefresh()) {
+    // only the banks of the set are busy, for tRFCb, the other banks of the
+    // rank take ACTs and refreshes tREFSBRD later
+    for (int j = 0; j < config_.bankgroups; j++) {
+      for (int k = 0; k < config_.banks_per_group; k++) {
+        int bank_idx = BankIndex(cmd.Rank(), j, k);
+        UpdateBanksTiming(
+            k == cmd.Bank()
+                ? timing_.same_rank[static_cast<int>(CommandType::REFRESH_BANK)]
+                : timing_.same_bank_refresh_other_banks,
+            bank_idx, bank_idx + 1, clk);
+      }
+    }
+    return;
+  }
   switch (cmd.cmd_type) {
     /// Update the tFAW window, and update the t32AW window for the GDDR.
     case CommandType::ACTIVATE: UpdateActivationTimes(cmd.Rank(), clk);
@@ -183,6 +331,8 @@ void ChannelState::UpdateTiming(const Command &cmd, uint64_t clk) {
     case CommandType::REFRESH:
     case CommandType::SREF_ENTER:
     case CommandType::SREF_EXIT:
+    case CommandType::PD_ENTER:
+    case CommandType::PD_EXIT:
       UpdateSameRankTiming(
           cmd.addr, timing_.same_rank[static_cast<int>(cmd.cmd_type)], clk);
       break;
@@ -191,80 +341,67 @@ void ChannelState::UpdateTiming(const Command &cmd, uint64_t clk) {
   return;
 }
 
-void ChannelState::UpdateSameBankTiming(
-    const Address &addr,
-    const std::vector<std::pair<CommandType, int>> &cmd_timing_list,
-    uint64_t clk) {
+void ChannelState::UpdateBanksTiming(const TimingList &cmd_timing_list,
+                                     int begin, int end, uint64_t clk) {
+  if (end > begin) {
+    ProfileCount(profiler_, ProfileEvent::TIMING_UPDATES,
+                 cmd_timing_list.size() * (end - begin));
+  }
   for (auto cmd_timing : cmd_timing_list) {
-    bank_states_[addr.rank][addr.bankgroup][addr.bank].UpdateTiming(
-        cmd_timing.first, clk + cmd_timing.second);
+    uint64_t *timing =
+        &cmd_timing_[static_cast<int>(cmd_timing.first) * num_banks_];
+    uint64_t time = clk + cmd_timing.second;
+    for (int i = begin; i < end; i++) {
+      timing[i] = std::max(timing[i], time);
+    }
   }
   return;
 }
 
+void ChannelState::UpdateSameBankTiming(
+    const Address &addr, const TimingList &cmd_timing_list, uint64_t clk) {
+  int bank_idx = BankIndex(addr.rank, addr.bankgroup, addr.bank);
+  UpdateBanksTiming(cmd_timing_list, bank_idx, bank_idx + 1, clk);
+  return;
+}
+
 void ChannelState::UpdateOtherBanksSameBankgroupTiming(
-    const Address &addr,
-    const std::vector<std::pair<CommandType, int>> &cmd_timing_list,
-    uint64_t clk) {
-  for (auto k = 0; k < config_.banks_per_group; k++) {
-    if (k != addr.bank) {
-      for (auto cmd_timing : cmd_timing_list) {
-        bank_states_[addr.rank][addr.bankgroup][k].UpdateTiming(
-            cmd_timing.first, clk + cmd_timing.second);
-      }
-    }
-  }
+    const Address &addr, const TimingList &cmd_timing_list, uint64_t clk) {
+  int bg_base = BankIndex(addr.rank, addr.bankgroup, 0);
+  int bank_idx = bg_base + addr.bank;
+  UpdateBanksTiming(cmd_timing_list, bg_base, bank_idx, clk);
+  UpdateBanksTiming(cmd_timing_list, bank_idx + 1,
+                    bg_base + config_.banks_per_group, clk);
   return;
 }
 
 void ChannelState::UpdateOtherBankgroupsSameRankTiming(
-    const Address &addr,
-    const std::vector<std::pair<CommandType, int>> &cmd_timing_list,
-    uint64_t clk) {
-  for (auto j = 0; j < config_.bankgroups; j++) {
-    if (j != addr.bankgroup) {
-      for (auto k = 0; k < config_.banks_per_group; k++) {
-        for (auto cmd_timing : cmd_timing_list) {
-          bank_states_[addr.rank][j][k].UpdateTiming(cmd_timing.first,
-                                                     clk + cmd_timing.second);
-        }
-      }
-    }
-  }
+    const Address &addr, const TimingList &cmd_timing_list, uint64_t clk) {
+  int rank_base = addr.rank * config_.banks;
+  int bg_base = BankIndex(addr.rank, addr.bankgroup, 0);
+  UpdateBanksTiming(cmd_timing_list, rank_base, bg_base, clk);
+  UpdateBanksTiming(cmd_timing_list, bg_base + config_.banks_per_group,
+                    rank_base + config_.banks, clk);
   return;
 }
 
 void ChannelState::UpdateOtherRanksTiming(
-    const Address &addr,
-    const std::vector<std::pair<CommandType, int>> &cmd_timing_list,
-    uint64_t clk) {
-  for (auto i = 0; i < config_.ranks; i++) {
-    if (i != addr.rank) {
-      for (auto j = 0; j < config_.bankgroups; j++) {
-        for (auto k = 0; k < config_.banks_per_group; k++) {
-          for (auto cmd_timing : cmd_timing_list) {
-            bank_states_[i][j][k].UpdateTiming(cmd_timing.first,
-                                               clk + cmd_timing.second);
-          }
-        }
-      }
-    }
-  }
+    const Address &addr, const TimingList &cmd_timing_list, uint64_t clk) {
+  // only the ranks on the data bus of the sub-channel
+  int sub_channel_banks = num_banks_ / config_.sub_channels;
+  int begin = addr.rank * config_.banks / sub_channel_banks * sub_channel_banks;
+  int rank_base = addr.rank * config_.banks;
+  UpdateBanksTiming(cmd_timing_list, begin, rank_base, clk);
+  UpdateBanksTiming(cmd_timing_list, rank_base + config_.banks,
+                    begin + sub_channel_banks, clk);
   return;
 }
 
 void ChannelState::UpdateSameRankTiming(
-    const Address &addr,
-    const std::vector<std::pair<CommandType, int>> &cmd_timing_list,
-    uint64_t clk) {
-  for (auto j = 0; j < config_.bankgroups; j++) {
-    for (auto k = 0; k < config_.banks_per_group; k++) {
-      for (auto cmd_timing : cmd_timing_list) {
-        bank_states_[addr.rank][j][k].UpdateTiming(cmd_timing.first,
-                                                   clk + cmd_timing.second);
-      }
-    }
-  }
+    const Address &addr, const TimingList &cmd_timing_list, uint64_t clk) {
+  int rank_base = addr.rank * config_.banks;
+  UpdateBanksTiming(cmd_timing_list, rank_base, rank_base + config_.banks,
+                    clk);
   return;
 }
 
@@ -276,7 +413,7 @@ void ChannelState::UpdateTimingAndStates(const Command &cmd, uint64_t clk) {
 
 bool ChannelState::ActivationWindowOk(int rank, uint64_t curr_time) const {
   bool tfaw_ok = IsFAWReady(rank, curr_time);
-  if (config_.IsGDDR()) {
+  if (has_32aw_) {
     if (!tfaw_ok)
       return false;
     else
@@ -285,12 +422,28 @@ bool ChannelState::ActivationWindowOk(int rank, uint64_t curr_time) const {
   return tfaw_ok;
 }
 
+uint64_t ChannelState::ActivationWindowDelay(const Command &cmd,
+                                             uint64_t clk) const {
+  int rank = cmd.Rank();
+  uint64_t window_ready = 0;
+  if (four_aw_[rank].size() >= 4) {
+    window_ready = four_aw_[rank][0];
+  }
+  if (has_32aw_ && thirty_two_aw_[rank].size() >= 32) {
+    window_ready = std::max(window_ready, thirty_two_aw_[rank][0]);
+  }
+  uint64_t bank_ready = BankTiming(
+      CommandType::ACTIVATE, BankIndex(rank, cmd.Bankgroup(), cmd.Bank()));
+  window_ready = std::min(window_ready, clk);
+  return window_ready > bank_ready ? window_ready - bank_ready : 0;
+}
+
 void ChannelState::UpdateActivationTimes(int rank, uint64_t curr_time) {
   if (!four_aw_[rank].empty() && curr_time >= four_aw_[rank][0]) {
     four_aw_[rank].erase(four_aw_[rank].begin());
   }
   four_aw_[rank].push_back(curr_time + config_.tFAW);
-  if (config_.IsGDDR()) {
+  if (has_32aw_) {
     if (!thirty_two_aw_[rank].empty() && curr_time >= thirty_two_aw_[rank][0]) {
       thirty_two_aw_[rank].erase(thirty_two_aw_[rank].begin());
     }
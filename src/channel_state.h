@@ -4,6 +4,7 @@
 #include "bankstate.h"
 #include "common.h"
 #include "configuration.h"
+#include "profiler.h"
 #include "timing.h"
 #include <vector>
 
@@ -13,10 +14,25 @@ class ChannelState {
 public:
   ChannelState(const Config &config, const Timing &timing);
   Command GetReadyCommand(const Command &cmd, uint64_t clk) const;
+  /// @brief Lower bound of the cycle at which GetReadyCommand may return a
+  /// valid command for cmd, assuming no other command is issued meanwhile.
+  uint64_t GetReadyCycle(const Command &cmd) const;
   void UpdateState(const Command &cmd);
+  /// @brief Functional access for sampled simulation: apply cmd (a read or
+  /// write) and the commands it requires to the bank states, ignoring timing.
+  /// Returns the first command the bank had to execute, i.e. cmd itself on a
+  /// row hit, ACTIVATE, PRECHARGE or SREF_EXIT otherwise.
+  CommandType FunctionalAccess(const Command &cmd);
+  /// @brief Functional refresh, closes the open rows of a rank, restricted to
+  /// one bankgroup and/or one bank index if they are not negative.
+  void FunctionalRefresh(int rank, int bankgroup, int bank);
   void UpdateTiming(const Command &cmd, uint64_t clk);
   void UpdateTimingAndStates(const Command &cmd, uint64_t clk);
   bool ActivationWindowOk(int rank, uint64_t curr_time) const;
+  /// @brief Cycles that the ACTIVATE cmd, issued at clk, was held back by
+  /// tFAW or t32AW after its bank was ready for it. Only valid before the
+  /// activation is applied.
+  uint64_t ActivationWindowDelay(const Command &cmd, uint64_t clk) const;
   /// @brief When an activate command is issued,
   /// Not more than 4 ACTIVATE or SINGLE BANK REFRESH commands are allowed
   /// within tFAW period.
@@ -24,23 +40,41 @@ public:
   /// window.
   void UpdateActivationTimes(int rank, uint64_t curr_time);
   bool IsRowOpen(int rank, int bankgroup, int bank) const {
-    return bank_states_[rank][bankgroup][bank].IsRowOpen();
+    return bank_states_[BankIndex(rank, bankgroup, bank)].IsRowOpen();
   }
   /// @brief Once there is a bank from this rank is in the state of ROW OPEN,
   /// this rank is not idle.
   bool IsAllBankIdleInRank(int rank) const;
   bool IsRankSelfRefreshing(int rank) const { return rank_is_sref_[rank]; }
+  /// @brief Whether the rank is in power-down, and whether it is an active
+  /// power-down, i.e. a bank had a row open when it was entered.
+  bool IsRankPoweredDown(int rank) const { return rank_is_pd_[rank]; }
+  bool IsRankActivePowerDown(int rank) const { return rank_pd_active_[rank]; }
   bool IsRefreshWaiting() const { return !refresh_q_.empty(); }
+  /// @brief Whether a refresh of the rank is waiting.
+  bool IsRefreshWaiting(int rank) const;
   bool IsRWPendingOnRef(const Command &cmd) const;
   const Command &PendingRefCommand() const { return refresh_q_.front(); }
   void BankNeedRefresh(int rank, int bankgroup, int bank, bool need);
   void RankNeedRefresh(int rank, bool need);
   int OpenRow(int rank, int bankgroup, int bank) const {
-    return bank_states_[rank][bankgroup][bank].OpenRow();
+    return bank_states_[BankIndex(rank, bankgroup, bank)].OpenRow();
   }
   int RowHitCount(int rank, int bankgroup, int bank) const {
-    return bank_states_[rank][bankgroup][bank].RowHitCount();
+    return bank_states_[BankIndex(rank, bankgroup, bank)].RowHitCount();
   };
+  /// @brief The earliest cycle a PRECHARGE may close the open row of the
+  /// bank, for the precharges the controller issues by itself.
+  uint64_t PrechargeReadyCycle(int rank, int bankgroup, int bank) const {
+    return BankTiming(CommandType::PRECHARGE,
+                      BankIndex(rank, bankgroup, bank));
+  }
+
+  void SetProfiler(Profiler *profiler) { profiler_ = profiler; }
+
+  // checkpointing, see MemorySystem::SaveCheckpoint
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
 
   /// @brief Each rank has a cycle counter for idle cycles.
   std::vector<int> rank_idle_cycles;
@@ -49,10 +83,39 @@ private:
   const Config &config_;
   const Timing &timing_;
 
+  /// @brief Banks are numbered rank by rank, bankgroup by bankgroup, so the
+  /// banks of a bankgroup, and those of a rank, are contiguous.
+  int num_banks_;
+  std::vector<BankState> bank_states_;
+  /// @brief Structure of arrays timing table, cmd_timing_[type * num_banks_ +
+  /// bank] is the earliest cycle at which a command of type can be executed
+  /// in bank. Rank and channel wide updates are plain max loops over it.
+  std::vector<uint64_t> cmd_timing_;
+
+  int BankIndex(int rank, int bankgroup, int bank) const {
+    return (rank * config_.bankgroups + bankgroup) * config_.banks_per_group +
+           bank;
+  }
+  uint64_t BankTiming(CommandType cmd_type, int bank_idx) const {
+    return cmd_timing_[static_cast<int>(cmd_type) * num_banks_ + bank_idx];
+  }
+  // Ready cycle of the command bank_idx has to execute to serve cmd
+  uint64_t BankReadyCycle(const Command &cmd, int bank_idx) const {
+    return BankTiming(bank_states_[bank_idx].GetRequiredCommand(cmd), bank_idx);
+  }
+  // The command bank_idx has to execute to serve cmd, if it can at clk
+  Command BankReadyCommand(const Command &cmd, int bank_idx,
+                           uint64_t clk) const;
+  // Apply cmd_timing_list to the banks in [begin, end)
+  void UpdateBanksTiming(const TimingList &cmd_timing_list, int begin,
+                         int end, uint64_t clk);
+
   /// @brief Each rank has a flag indicates if the rank is in the state of the
   /// refresh. Only after the self refresh command is issued, the rank will set
   /// rank_is_sref_[.] to be true, and after the self exit command is issued,
   std::vector<bool> rank_is_sref_;
+  std::vector<bool> rank_is_pd_;
+  std::vector<bool> rank_pd_active_;
   std::vector<Command> refresh_q_;
 
   /// @brief See the defination of function of IsFAWReady. It stores up to 4
@@ -65,38 +128,39 @@ private:
   /// @brief See the defination of function of IsFAWReady. Same as fout_aw_.
   std::vector<std::vector<uint64_t>> thirty_two_aw_;
 
+  /// @brief GDDR also limits activations in a rolling t32AW window, resolved
+  /// once at construction instead of on every activation.
+  bool has_32aw_;
+
+  Profiler *profiler_;
+
   bool IsFAWReady(int rank, uint64_t curr_time) const;
   bool Is32AWReady(int rank, uint64_t curr_time) const;
   // Update timing of the bank the command corresponds to
-  void UpdateSameBankTiming(
-      const Address &addr,
-      const std::vector<std::pair<CommandType, int>> &cmd_timing_list,
-      uint64_t clk);
+  void UpdateSameBankTiming(const Address &addr,
+                            const TimingList &cmd_timing_list,
+                            uint64_t clk);
 
   // Update timing of the other banks in the same bankgroup as the command
-  void UpdateOtherBanksSameBankgroupTiming(
-      const Address &addr,
-      const std::vector<std::pair<CommandType, int>> &cmd_timing_list,
-      uint64_t clk);
+  void UpdateOtherBanksSameBankgroupTiming(const Address &addr,
+                                           const TimingList &cmd_timing_list,
+                                           uint64_t clk);
 
   // Update timing of banks in the same rank but different bankgroup as the
   // command
-  void UpdateOtherBankgroupsSameRankTiming(
-      const Address &addr,
-      const std::vector<std::pair<CommandType, int>> &cmd_timing_list,
-      uint64_t clk);
+  void UpdateOtherBankgroupsSameRankTiming(const Address &addr,
+                                           const TimingList &cmd_timing_list,
+                                           uint64_t clk);
 
   // Update timing of banks in a different rank as the command
-  void UpdateOtherRanksTiming(
-      const Address &addr,
-      const std::vector<std::pair<CommandType, int>> &cmd_timing_list,
-      uint64_t clk);
+  void UpdateOtherRanksTiming(const Address &addr,
+                              const TimingList &cmd_timing_list,
+                              uint64_t clk);
 
   // Update timing of the entire rank (for rank level commands)
-  void UpdateSameRankTiming(
-      const Address &addr,
-      const std::vector<std::pair<CommandType, int>> &cmd_timing_list,
-      uint64_t clk);
+  void UpdateSameRankTiming(const Address &addr,
+                            const TimingList &cmd_timing_list,
+                            uint64_t clk);
 };
 
 }  // namespace dramsim3
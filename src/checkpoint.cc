@@ -0,0 +1,229 @@
+#include "checkpoint.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+
+namespace dramsim3 {
+
+namespace {
+
+const size_t kWriteBufferSize = 1 << 16;
+
+}  // namespace
+
+CheckpointWriter::CheckpointWriter(const std::string &file)
+    : out_(file, std::ofstream::binary | std::ofstream::trunc),
+      payload_size_(0) {
+  if (out_.fail()) {
+    std::cerr << "Cannot open checkpoint " << file << " for writing"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  // header, the payload size is patched in Close()
+  char header[kCheckpointHeaderSize] = {0};
+  std::memcpy(header, kCheckpointMagic, kCheckpointMagicSize);
+  std::memcpy(header + 8, &kCheckpointVersion, sizeof(kCheckpointVersion));
+  std::memcpy(header + 12, &kCheckpointFlags, sizeof(kCheckpointFlags));
+  out_.write(header, kCheckpointHeaderSize);
+  buffer_.reserve(kWriteBufferSize);
+}
+
+void CheckpointWriter::Close() {
+  if (!out_.is_open()) {
+    return;
+  }
+  Flush();
+  out_.seekp(16);
+  out_.write(reinterpret_cast<const char *>(&payload_size_),
+             sizeof(payload_size_));
+  out_.close();
+}
+
+void CheckpointWriter::PutBytes(const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  buffer_.insert(buffer_.end(), bytes, bytes + size);
+  payload_size_ += size;
+  if (buffer_.size() >= kWriteBufferSize) {
+    Flush();
+  }
+}
+
+void CheckpointWriter::Flush() {
+  out_.write(buffer_.data(), buffer_.size());
+  buffer_.clear();
+}
+
+void CheckpointWriter::Put(const std::string &value) {
+  Put(static_cast<uint64_t>(value.size()));
+  PutBytes(value.data(), value.size());
+}
+
+void CheckpointWriter::Put(const Address &addr) {
+  Put(addr.channel);
+  Put(addr.rank);
+  Put(addr.bankgroup);
+  Put(addr.bank);
+  Put(addr.row);
+  Put(addr.column);
+}
+
+void CheckpointWriter::Put(const Command &cmd) {
+  Put(cmd.cmd_type);
+  Put(cmd.addr);
+  Put(cmd.hex_addr);
+}
+
+void CheckpointWriter::Put(const Transaction &trans) {
+  Put(trans.addr);
+  Put(trans.id);
+  Put(trans.mapped_addr);
+  Put(trans.added_cycle);
+  Put(trans.complete_cycle);
+#ifdef LATENCY_BREAKDOWN
+  Put(trans.stage_cycle);
+  Put(trans.stage_refresh);
+#endif  // LATENCY_BREAKDOWN
+  Put(trans.source);
+  Put(trans.qos_class);
+  Put(trans.is_write);
+}
+
+void CheckpointWriter::Put(const std::vector<bool> &values) {
+  Put(static_cast<uint64_t>(values.size()));
+  for (bool value : values) {
+    Put(value);
+  }
+}
+
+CheckpointReader::CheckpointReader(const std::string &file)
+    : fd_(-1), data_(nullptr), size_(0), pos_(kCheckpointHeaderSize) {
+  fd_ = ::open(file.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    std::cerr << "Checkpoint " << file << " does not exist" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  struct stat file_stat;
+  if (fstat(fd_, &file_stat) != 0 ||
+      file_stat.st_size < kCheckpointHeaderSize) {
+    std::cerr << "Checkpoint " << file << " has no header" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  size_ = static_cast<size_t>(file_stat.st_size);
+  void *map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (map == MAP_FAILED) {
+    std::cerr << "Cannot map checkpoint " << file << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  data_ = static_cast<const uint8_t *>(map);
+  // the whole file is read front to back right away
+  madvise(map, size_, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+  uint32_t version, flags;
+  uint64_t payload_size;
+  std::memcpy(&version, data_ + 8, sizeof(version));
+  std::memcpy(&flags, data_ + 12, sizeof(flags));
+  std::memcpy(&payload_size, data_ + 16, sizeof(payload_size));
+  if (std::memcmp(data_, kCheckpointMagic, kCheckpointMagicSize) != 0 ||
+      version != kCheckpointVersion ||
+      payload_size != size_ - kCheckpointHeaderSize) {
+    std::cerr << file << " is not a complete version " << kCheckpointVersion
+              << " checkpoint" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  if (flags != kCheckpointFlags) {
+    std::cerr << file << " was written by a build with different options"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+}
+
+CheckpointReader::~CheckpointReader() {
+  if (data_ != nullptr) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+void CheckpointReader::GetBytes(void *data, size_t size) {
+  if (size > size_ - pos_) {
+    std::cerr << "Checkpoint is truncated at byte " << pos_ << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  std::memcpy(data, data_ + pos_, size);
+  pos_ += size;
+}
+
+uint64_t CheckpointReader::GetSize() {
+  uint64_t size;
+  Get(size);
+  // every element takes at least one byte, guards against corrupt counts
+  if (size > size_ - pos_) {
+    std::cerr << "Bad element count in checkpoint at byte " << pos_
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  return size;
+}
+
+void CheckpointReader::Expect(uint64_t expected, const std::string &what) {
+  uint64_t value;
+  Get(value);
+  if (value != expected) {
+    std::cerr << "Checkpoint was taken with " << what << " " << value
+              << ", this memory system has " << expected << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+}
+
+void CheckpointReader::Get(std::string &value) {
+  uint64_t size = GetSize();
+  value.assign(reinterpret_cast<const char *>(data_ + pos_), size);
+  pos_ += size;
+}
+
+void CheckpointReader::Get(Address &addr) {
+  Get(addr.channel);
+  Get(addr.rank);
+  Get(addr.bankgroup);
+  Get(addr.bank);
+  Get(addr.row);
+  Get(addr.column);
+}
+
+void CheckpointReader::Get(Command &cmd) {
+  Get(cmd.cmd_type);
+  Get(cmd.addr);
+  Get(cmd.hex_addr);
+}
+
+void CheckpointReader::Get(Transaction &trans) {
+  Get(trans.addr);
+  Get(trans.id);
+  Get(trans.mapped_addr);
+  Get(trans.added_cycle);
+  Get(trans.complete_cycle);
+#ifdef LATENCY_BREAKDOWN
+  Get(trans.stage_cycle);
+  Get(trans.stage_refresh);
+#endif  // LATENCY_BREAKDOWN
+  Get(trans.source);
+  Get(trans.qos_class);
+  Get(trans.is_write);
+}
+
+void CheckpointReader::Get(std::vector<bool> &values) {
+  uint64_t size = GetSize();
+  values.resize(size);
+  for (uint64_t i = 0; i < size; i++) {
+    bool value;
+    Get(value);
+    values[i] = value;
+  }
+}
+
+}  // namespace dramsim3
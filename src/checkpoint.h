@@ -0,0 +1,179 @@
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+
+namespace dramsim3 {
+
+/// @brief Checkpoint files are a 24 byte header followed by the state of the
+/// memory system, each part of which writes its members in a fixed order:
+///   offset 0   magic "DRS3CKPT"
+///   offset 8   uint32 version
+///   offset 12  uint32 build flags, kCheckpointFlags
+///   offset 16  uint64 payload size in bytes
+/// Scalars are stored in the native byte order and width, strings and
+/// containers as a uint64 element count followed by the elements. A checkpoint
+/// can only be restored on the same kind of host it was taken on.
+const char kCheckpointMagic[] = "DRS3CKPT";
+const int kCheckpointMagicSize = 8;
+const uint32_t kCheckpointVersion = 17;
+const int kCheckpointHeaderSize = 24;
+/// @brief Build options that change what is stored, bit 0 is set in
+/// LATENCY_BREAKDOWN builds, whose transactions carry timestamps.
+#ifdef LATENCY_BREAKDOWN
+const uint32_t kCheckpointFlags = 1;
+#else
+const uint32_t kCheckpointFlags = 0;
+#endif  // LATENCY_BREAKDOWN
+
+class CheckpointWriter {
+public:
+  explicit CheckpointWriter(const std::string &file);
+  ~CheckpointWriter() { Close(); }
+  /// @brief Flush and patch the payload size into the header.
+  void Close();
+
+  template <typename T>
+  void Put(const T &value) {
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value,
+                  "only scalars are stored as raw bytes");
+    PutBytes(&value, sizeof(T));
+  }
+  void Put(const std::string &value);
+  void Put(const Address &addr);
+  void Put(const Command &cmd);
+  void Put(const Transaction &trans);
+  void Put(const std::vector<bool> &values);
+  template <typename T>
+  void Put(const std::vector<T> &values) {
+    Put(static_cast<uint64_t>(values.size()));
+    for (const auto &value : values) {
+      Put(value);
+    }
+  }
+  template <typename K, typename V>
+  void Put(const std::pair<K, V> &value) {
+    Put(value.first);
+    Put(value.second);
+  }
+  /// @brief Unordered containers are stored in key order, so that the same
+  /// state always gives the same file.
+  template <typename K, typename V>
+  void Put(const std::unordered_map<K, V> &values) {
+    Put(std::map<K, V>(values.begin(), values.end()));
+  }
+  template <typename K, typename V>
+  void Put(const std::map<K, V> &values) {
+    Put(static_cast<uint64_t>(values.size()));
+    for (const auto &value : values) {
+      Put(value);
+    }
+  }
+  template <typename K>
+  void Put(const std::unordered_set<K> &values) {
+    std::vector<K> sorted(values.begin(), values.end());
+    std::sort(sorted.begin(), sorted.end());
+    Put(sorted);
+  }
+
+private:
+  void PutBytes(const void *data, size_t size);
+  void Flush();
+
+  std::ofstream out_;
+  std::vector<char> buffer_;
+  uint64_t payload_size_;
+};
+
+/// @brief Reads a checkpoint through a read-only memory map of the file.
+class CheckpointReader {
+public:
+  explicit CheckpointReader(const std::string &file);
+  ~CheckpointReader();
+  /// @brief Whether the whole payload has been read.
+  bool AtEnd() const { return pos_ == size_; }
+
+  template <typename T>
+  void Get(T &value) {
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value,
+                  "only scalars are stored as raw bytes");
+    GetBytes(&value, sizeof(T));
+  }
+  void Get(std::string &value);
+  void Get(Address &addr);
+  void Get(Command &cmd);
+  void Get(Transaction &trans);
+  void Get(std::vector<bool> &values);
+  /// @brief Replaces the elements, the capacity is kept as long as it is
+  /// large enough (the controller queues use it as their size limit).
+  template <typename T>
+  void Get(std::vector<T> &values) {
+    uint64_t size = GetSize();
+    values.clear();
+    for (uint64_t i = 0; i < size; i++) {
+      T value;
+      Get(value);
+      values.push_back(value);
+    }
+  }
+  template <typename K, typename V>
+  void Get(std::pair<K, V> &value) {
+    Get(value.first);
+    Get(value.second);
+  }
+  /// @brief Maps are updated in place, the stored keys are assigned and the
+  /// elements of other keys are left alone. Elements of an unordered_map do
+  /// not move, so pointers to them stay valid.
+  template <typename K, typename V>
+  void Get(std::unordered_map<K, V> &values) {
+    uint64_t size = GetSize();
+    for (uint64_t i = 0; i < size; i++) {
+      K key;
+      Get(key);
+      Get(values[key]);
+    }
+  }
+  template <typename K, typename V>
+  void Get(std::map<K, V> &values) {
+    uint64_t size = GetSize();
+    for (uint64_t i = 0; i < size; i++) {
+      K key;
+      Get(key);
+      Get(values[key]);
+    }
+  }
+  template <typename K>
+  void Get(std::unordered_set<K> &values) {
+    std::vector<K> sorted;
+    Get(sorted);
+    values.clear();
+    values.insert(sorted.begin(), sorted.end());
+  }
+  /// @brief Read a value and exit if it is not the expected one, used to
+  /// check that a checkpoint fits the memory system it is restored into.
+  void Expect(uint64_t expected, const std::string &what);
+
+private:
+  uint64_t GetSize();
+  void GetBytes(void *data, size_t size);
+
+  int fd_;
+  const uint8_t *data_;
+  size_t size_;
+  size_t pos_;
+};
+
+}  // namespace dramsim3
+#endif  // __CHECKPOINT_H
@@ -1,4 +1,6 @@
 #include "command_queue.h"
+#include <algorithm>
+#include <limits>
 
 namespace dramsim3 {
 
@@ -7,6 +9,18 @@ CommandQueue::CommandQueue(int channel_id, const Config &config,
                            SimpleStats &simple_stats)
     : rank_q_empty(config.ranks, true), config_(config),
       channel_state_(channel_state), simple_stats_(simple_stats),
+      ondemand_pres_stat_(simple_stats.Counter("num_ondemand_pres")),
+      column_batches_stat_(simple_stats.Counter("num_column_batches")),
+      profiler_(nullptr), row_hit_cap_(config.row_hit_cap),
+      read_to_write_cost_(config.RL + config.burst_cycle - config.WL +
+                          config.tRTRS),
+      write_to_read_cost_(config.write_delay + config.tWTR_S),
+      rank_switch_cost_(config.burst_cycle + config.tRTRS),
+      batch_rank_(config.sub_channels, -1),
+      batch_write_(config.sub_channels, false),
+      batch_cmds_(config.sub_channels, 0),
+      batch_held_clk_(config.sub_channels,
+                      std::numeric_limits<uint64_t>::max()),
       is_in_ref_(false),
       queue_size_(static_cast<size_t>(config_.cmd_queue_size)), queue_idx_(0),
       clk_(0) {
@@ -22,36 +36,153 @@ CommandQueue::CommandQueue(int channel_id, const Config &config,
     AbruptExit(__FILE__, __LINE__);
   }
 
+  if (config_.scheduler == "FIRST_READY") {
+    scheduler_ = SchedulerPolicy::FIRST_READY;
+  } else if (config_.scheduler == "FRFCFS") {
+    scheduler_ = SchedulerPolicy::FRFCFS;
+  } else {
+    std::cerr << "Unsupported scheduler " << config_.scheduler << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+
   queues_.reserve(num_queues_);
   for (int i = 0; i < num_queues_; i++) {
     auto cmd_queue = std::vector<Command>();
     cmd_queue.reserve(config_.cmd_queue_size);
     queues_.push_back(cmd_queue);
   }
+  ready_bound_.resize(num_queues_, std::numeric_limits<uint64_t>::max());
+  // beyond back to back column commands
+  int spacing = std::max(config_.burst_cycle, config_.tCCD_S);
+  read_to_write_cost_ = std::max(0, read_to_write_cost_ - spacing);
+  write_to_read_cost_ = std::max(0, write_to_read_cost_ - spacing);
+  rank_switch_cost_ = std::max(0, rank_switch_cost_ - spacing);
+  pending_rows_.resize(config_.ranks * config_.banks);
 }
 
-Command CommandQueue::GetCommandToIssue() {
+Command CommandQueue::GetCommandToIssue(int sub_channel) {
+  if (scheduler_ == SchedulerPolicy::FRFCFS) {
+    auto cmd = GetRowHitToIssue(sub_channel);
+    if (cmd.IsValid()) {
+      return cmd;
+    }
+  }
   /// num_queues is the number of banks within a rank if PER_BANK, and the
   /// numver of ranks if PER_RANK.
   for (int i = 0; i < num_queues_; i++) {
     auto &queue = GetNextQueue();
+    if (!IsInSubChannel(queue_idx_, sub_channel)) {
+      continue;
+    }
     // if we're refresing, skip the command queues that are involved
     if (is_in_ref_) {
       if (ref_q_indices_.find(queue_idx_) != ref_q_indices_.end()) {
         continue;
       }
     }
-    auto cmd = GetFirstReadyInQueue(queue);
+    if (ready_bound_[queue_idx_] > clk_) {
+      continue;
+    }
+    uint64_t next_ready;
+    auto cmd = GetFirstReadyInQueue(queue, next_ready);
     if (cmd.IsValid()) {
       if (cmd.IsReadWrite()) {
         EraseRWCommand(cmd);
       }
       return cmd;
     }
+    ready_bound_[queue_idx_] = next_ready;
   }
   return Command();
 }
 
+Command CommandQueue::GetRowHitToIssue(int sub_channel) {
+  for (int i = 1; i <= num_queues_; i++) {
+    int q_idx = (queue_idx_ + i) % num_queues_;
+    if (!IsInSubChannel(q_idx, sub_channel)) {
+      continue;
+    }
+    if (is_in_ref_ && ref_q_indices_.find(q_idx) != ref_q_indices_.end()) {
+      continue;
+    }
+    if (queues_[q_idx].empty() || ready_bound_[q_idx] > clk_ ||
+        !QueueHasRowHit(q_idx)) {
+      continue;
+    }
+    auto &queue = queues_[q_idx];
+    ProfileCount(profiler_, ProfileEvent::QUEUES_SCANNED);
+    for (auto cmd_it = queue.begin(); cmd_it != queue.end(); cmd_it++) {
+      ProfileCount(profiler_, ProfileEvent::COMMANDS_SCANNED);
+      if (!cmd_it->IsReadWrite() ||
+          channel_state_.OpenRow(cmd_it->Rank(), cmd_it->Bankgroup(),
+                                 cmd_it->Bank()) != cmd_it->Row() ||
+          channel_state_.RowHitCount(cmd_it->Rank(), cmd_it->Bankgroup(),
+                                     cmd_it->Bank()) >= row_hit_cap_) {
+        continue;
+      }
+      ProfileCount(profiler_, ProfileEvent::GET_READY_CALLS);
+      Command cmd = channel_state_.GetReadyCommand(*cmd_it, clk_);
+      if (cmd.cmd_type != cmd_it->cmd_type) {
+        continue;
+      }
+      if (cmd.IsWrite() && HasRWDependency(cmd_it, queue)) {
+        continue;
+      }
+      if (BatchHoldsBack(cmd)) {
+        continue;
+      }
+      // the round robin of the other commands resumes after this queue
+      queue_idx_ = q_idx;
+      EraseRWCommand(cmd);
+      return cmd;
+    }
+  }
+  return Command();
+}
+
+bool CommandQueue::HasPendingRowHit(int rank, int bankgroup, int bank) const {
+  const auto &rows =
+      pending_rows_[rank * config_.banks + bankgroup * config_.banks_per_group +
+                    bank];
+  return rows.find(channel_state_.OpenRow(rank, bankgroup, bank)) !=
+         rows.end();
+}
+
+bool CommandQueue::QueueHasRowHit(int q_idx) const {
+  if (queue_structure_ == QueueStructure::PER_BANK) {
+    int rank = q_idx / config_.banks;
+    int bankgroup = (q_idx % config_.banks) / config_.banks_per_group;
+    int bank = q_idx % config_.banks_per_group;
+    return channel_state_.RowHitCount(rank, bankgroup, bank) < row_hit_cap_ &&
+           HasPendingRowHit(rank, bankgroup, bank);
+  }
+  for (int bg = 0; bg < config_.bankgroups; bg++) {
+    for (int bank = 0; bank < config_.banks_per_group; bank++) {
+      if (channel_state_.RowHitCount(q_idx, bg, bank) < row_hit_cap_ &&
+          HasPendingRowHit(q_idx, bg, bank)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void CommandQueue::AddPendingRow(const Command &cmd) {
+  pending_rows_[cmd.Rank() * config_.banks +
+                cmd.Bankgroup() * config_.banks_per_group + cmd.Bank()]
+               [cmd.Row()]++;
+}
+
+void CommandQueue::RemovePendingRow(const Command &cmd) {
+  auto &rows = pending_rows_[cmd.Rank() * config_.banks +
+                             cmd.Bankgroup() * config_.banks_per_group +
+                             cmd.Bank()];
+  auto it = rows.find(cmd.Row());
+  if (--it->second == 0) {
+    rows.erase(it);
+  }
+}
+
 Command CommandQueue::FinishRefresh() {
   // we can do something fancy here like clearing the R/Ws
   // that already had ACT on the way but by doing that we
@@ -96,6 +227,7 @@ Command CommandQueue::FinishRefresh() {
   /// command. For example, if one of the banks is in the state of open, it
   /// should pre-charge before the refresh command, and this function will
   /// return the precharge command.
+  ProfileCount(profiler_, ProfileEvent::GET_READY_CALLS);
   auto cmd = channel_state_.GetReadyCommand(ref, clk_);
 
   /// If the refresh command is ok for all the banks (not the precharge
@@ -109,6 +241,105 @@ Command CommandQueue::FinishRefresh() {
   return cmd;
 }
 
+uint64_t CommandQueue::GetEarliestReadyCycle() const {
+  uint64_t earliest = std::numeric_limits<uint64_t>::max();
+  for (const auto &queue : queues_) {
+    for (const auto &cmd : queue) {
+      earliest = std::min(earliest, channel_state_.GetReadyCycle(cmd));
+    }
+  }
+  return earliest;
+}
+
+void CommandQueue::InvalidateReadyBounds(const Command &issued) {
+  if (issued.IsRankCMD() && queue_structure_ == QueueStructure::PER_BANK) {
+    for (int i = 0; i < config_.banks; i++) {
+      ready_bound_[issued.Rank() * config_.banks + i] = 0;
+    }
+  } else if (issued.IsSameBankRefresh()) {
+    for (int j = 0; j < config_.bankgroups; j++) {
+      ready_bound_[GetQueueIndex(issued.Rank(), j, issued.Bank())] = 0;
+    }
+  } else {
+    ready_bound_[GetQueueIndex(issued.Rank(), issued.Bankgroup(),
+                               issued.Bank())] = 0;
+  }
+  return;
+}
+
+void CommandQueue::ColumnIssued(const Command &cmd) {
+  if (config_.column_batch_length == 0) {
+    return;
+  }
+  int sub_channel = config_.SubChannel(cmd.Rank());
+  if (batch_rank_[sub_channel] == cmd.Rank() &&
+      batch_write_[sub_channel] == cmd.IsWrite() &&
+      batch_cmds_[sub_channel] < config_.column_batch_length) {
+    batch_cmds_[sub_channel]++;
+    return;
+  }
+  batch_rank_[sub_channel] = cmd.Rank();
+  batch_write_[sub_channel] = cmd.IsWrite();
+  batch_cmds_[sub_channel] = 1;
+  batch_held_clk_[sub_channel] = std::numeric_limits<uint64_t>::max();
+  simple_stats_.Increment(column_batches_stat_);
+}
+
+bool CommandQueue::BatchHoldsBack(const Command &cmd) {
+  if (config_.column_batch_length == 0) {
+    return false;
+  }
+  int sub_channel = config_.SubChannel(cmd.Rank());
+  if (batch_rank_[sub_channel] < 0 ||
+      batch_cmds_[sub_channel] >= config_.column_batch_length ||
+      (batch_rank_[sub_channel] == cmd.Rank() &&
+       batch_write_[sub_channel] == cmd.IsWrite())) {
+    return false;
+  }
+  int cost = 0;
+  if (cmd.IsWrite() != batch_write_[sub_channel]) {
+    cost = cmd.IsWrite() ? read_to_write_cost_ : write_to_read_cost_;
+  } else if (cmd.IsRead()) {
+    cost = rank_switch_cost_;
+  }
+  if (!BatchCanContinue(sub_channel, clk_ + static_cast<uint64_t>(cost))) {
+    return false;
+  }
+  uint64_t &held_clk = batch_held_clk_[sub_channel];
+  if (held_clk == std::numeric_limits<uint64_t>::max()) {
+    held_clk = clk_;
+  } else if (clk_ - held_clk >=
+             static_cast<uint64_t>(config_.column_batch_fairness_cycles)) {
+    batch_rank_[sub_channel] = -1;
+    return false;
+  }
+  return true;
+}
+
+bool CommandQueue::BatchCanContinue(int sub_channel,
+                                    uint64_t horizon) const {
+  int rank = batch_rank_[sub_channel];
+  int first = rank, last = rank + 1;
+  if (queue_structure_ == QueueStructure::PER_BANK) {
+    first = rank * config_.banks;
+    last = first + config_.banks;
+  }
+  for (int q_idx = first; q_idx < last; q_idx++) {
+    if (is_in_ref_ && ref_q_indices_.find(q_idx) != ref_q_indices_.end()) {
+      continue;
+    }
+    for (const auto &cmd : queues_[q_idx]) {
+      if (cmd.IsReadWrite() && cmd.IsWrite() == batch_write_[sub_channel] &&
+          channel_state_.OpenRow(rank, cmd.Bankgroup(), cmd.Bank()) ==
+              cmd.Row() &&
+          channel_state_.GetReadyCycle(cmd) <= horizon) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 bool CommandQueue::ArbitratePrecharge(const CMDIterator &cmd_it,
                                       const CMDQueue &queue) const {
   auto cmd = *cmd_it;
@@ -123,29 +354,21 @@ bool CommandQueue::ArbitratePrecharge(const CMDIterator &cmd_it,
     }
   }
 
-  bool pending_row_hits_exist = false;
-  int open_row =
-      channel_state_.OpenRow(cmd.Rank(), cmd.Bankgroup(), cmd.Bank());
   /// Check if there are following commands that have will access the same open
-  /// row on the same bank with the precharge command. pending_row_hits_exist
-  /// records if this open row will be used by the commands after the precharge
-  /// command in the queue.
-  for (auto pending_itr = cmd_it; pending_itr != queue.end(); pending_itr++) {
-    if (pending_itr->Row() == open_row && pending_itr->Bank() == cmd.Bank() &&
-        pending_itr->Bankgroup() == cmd.Bankgroup() &&
-        pending_itr->Rank() == cmd.Rank()) {
-      pending_row_hits_exist = true;
-      break;
-    }
-  }
+  /// row on the same bank with the precharge command. No command before it
+  /// goes to this bank, so any queued command to the open row of the bank
+  /// follows the precharge command in the queue.
+  bool pending_row_hits_exist =
+      HasPendingRowHit(cmd.Rank(), cmd.Bankgroup(), cmd.Bank());
 
   bool rowhit_limit_reached =
-      channel_state_.RowHitCount(cmd.Rank(), cmd.Bankgroup(), cmd.Bank()) >= 4;
+      channel_state_.RowHitCount(cmd.Rank(), cmd.Bankgroup(), cmd.Bank()) >=
+      row_hit_cap_;
   /// Only if there are no commands that will access the open row or the row
-  /// hit number of this row does exceed 4, will continue to execute the
+  /// hit number of this row reaches row_hit_cap, will continue to execute the
   /// precharge command.
   if (!pending_row_hits_exist || rowhit_limit_reached) {
-    simple_stats_.Increment("num_ondemand_pres");
+    simple_stats_.Increment(ondemand_pres_stat_);
     return true;
   }
   return false;
@@ -156,6 +379,28 @@ bool CommandQueue::WillAcceptCommand(int rank, int bankgroup, int bank) const {
   return queues_[q_idx].size() < queue_size_;
 }
 
+bool CommandQueue::HasPendingCommands(int rank, int bankgroup,
+                                      int bank) const {
+  if (queue_structure_ == QueueStructure::PER_BANK) {
+    for (int j = 0; j < config_.bankgroups; j++) {
+      for (int k = 0; k < config_.banks_per_group; k++) {
+        if ((bankgroup < 0 || j == bankgroup) && (bank < 0 || k == bank) &&
+            !queues_[GetQueueIndex(rank, j, k)].empty()) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+  for (const auto &cmd : queues_[rank]) {
+    if ((bankgroup < 0 || cmd.Bankgroup() == bankgroup) &&
+        (bank < 0 || cmd.Bank() == bank)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 bool CommandQueue::QueueEmpty() const {
   for (const auto q : queues_) {
     if (!q.empty()) {
@@ -169,6 +414,10 @@ bool CommandQueue::AddCommand(Command cmd) {
   auto &queue = GetQueue(cmd.Rank(), cmd.Bankgroup(), cmd.Bank());
   if (queue.size() < queue_size_) {
     queue.push_back(cmd);
+    AddPendingRow(cmd);
+    int q_idx = GetQueueIndex(cmd.Rank(), cmd.Bankgroup(), cmd.Bank());
+    ready_bound_[q_idx] =
+        std::min(ready_bound_[q_idx], channel_state_.GetReadyCycle(cmd));
     rank_q_empty[cmd.Rank()] = false;
     return true;
   } else {
@@ -176,6 +425,54 @@ bool CommandQueue::AddCommand(Command cmd) {
   }
 }
 
+void CommandQueue::Save(CheckpointWriter &writer) const {
+  writer.Put(rank_q_empty);
+  writer.Put(queues_);
+  writer.Put(ready_bound_);
+  writer.Put(ref_q_indices_);
+  writer.Put(is_in_ref_);
+  writer.Put(queue_idx_);
+  writer.Put(batch_rank_);
+  writer.Put(batch_write_);
+  writer.Put(batch_cmds_);
+  writer.Put(batch_held_clk_);
+  writer.Put(clk_);
+}
+
+void CommandQueue::Load(CheckpointReader &reader) {
+  reader.Get(rank_q_empty);
+  reader.Get(queues_);
+  reader.Get(ready_bound_);
+  reader.Get(ref_q_indices_);
+  reader.Get(is_in_ref_);
+  reader.Get(queue_idx_);
+  reader.Get(batch_rank_);
+  reader.Get(batch_write_);
+  reader.Get(batch_cmds_);
+  reader.Get(batch_held_clk_);
+  reader.Get(clk_);
+  for (auto &rows : pending_rows_) {
+    rows.clear();
+  }
+  for (const auto &queue : queues_) {
+    for (const auto &cmd : queue) {
+      AddPendingRow(cmd);
+    }
+  }
+}
+
+void CommandQueue::Drain(std::vector<Command> &cmds) {
+  for (int i = 0; i < num_queues_; i++) {
+    cmds.insert(cmds.end(), queues_[i].begin(), queues_[i].end());
+    queues_[i].clear();
+    ready_bound_[i] = std::numeric_limits<uint64_t>::max();
+  }
+  for (auto &rows : pending_rows_) {
+    rows.clear();
+  }
+  std::fill(rank_q_empty.begin(), rank_q_empty.end(), true);
+}
+
 CMDQueue &CommandQueue::GetNextQueue() {
   queue_idx_++;
   if (queue_idx_ == num_queues_) {
@@ -198,6 +495,11 @@ void CommandQueue::GetRefQIndices(const Command &ref) {
       // Just append this rank.
       ref_q_indices_.insert(ref.Rank());
     }
+  } else if (ref.IsSameBankRefresh()) {
+    /// Append the bank of every bankgroup.
+    for (int j = 0; j < config_.bankgroups; j++) {
+      ref_q_indices_.insert(GetQueueIndex(ref.Rank(), j, ref.Bank()));
+    }
   } else {  // refb
     /// Append the bank index to the ref_q_indexes_.
     int idx = GetQueueIndex(ref.Rank(), ref.Bankgroup(), ref.Bank());
@@ -206,6 +508,16 @@ void CommandQueue::GetRefQIndices(const Command &ref) {
   return;
 }
 
+bool CommandQueue::IsInSubChannel(int q_idx, int sub_channel) const {
+  if (sub_channel < 0) {
+    return true;
+  }
+  int rank = queue_structure_ == QueueStructure::PER_RANK
+                 ? q_idx
+                 : q_idx / config_.banks;
+  return config_.SubChannel(rank) == sub_channel;
+}
+
 int CommandQueue::GetQueueIndex(int rank, int bankgroup, int bank) const {
   if (queue_structure_ == QueueStructure::PER_RANK) {
     return rank;
@@ -219,10 +531,16 @@ CMDQueue &CommandQueue::GetQueue(int rank, int bankgroup, int bank) {
   return queues_[index];
 }
 
-Command CommandQueue::GetFirstReadyInQueue(CMDQueue &queue) const {
+Command CommandQueue::GetFirstReadyInQueue(CMDQueue &queue,
+                                           uint64_t &next_ready) {
+  next_ready = std::numeric_limits<uint64_t>::max();
+  ProfileCount(profiler_, ProfileEvent::QUEUES_SCANNED);
   for (auto cmd_it = queue.begin(); cmd_it != queue.end(); cmd_it++) {
+    ProfileCount(profiler_, ProfileEvent::COMMANDS_SCANNED);
+    ProfileCount(profiler_, ProfileEvent::GET_READY_CALLS);
     Command cmd = channel_state_.GetReadyCommand(*cmd_it, clk_);
     if (!cmd.IsValid()) {
+      next_ready = std::min(next_ready, channel_state_.GetReadyCycle(*cmd_it));
       continue;
     }
     if (cmd.cmd_type == CommandType::PRECHARGE) {
@@ -234,6 +552,11 @@ Command CommandQueue::GetFirstReadyInQueue(CMDQueue &queue) const {
         continue;
       }
     }
+    if (cmd.IsReadWrite() && BatchHoldsBack(cmd)) {
+      // the batch may be over by the next cycle
+      next_ready = std::min(next_ready, clk_ + 1);
+      continue;
+    }
     return cmd;
   }
   return Command();
@@ -243,7 +566,11 @@ void CommandQueue::EraseRWCommand(const Command &cmd) {
   auto &queue = GetQueue(cmd.Rank(), cmd.Bankgroup(), cmd.Bank());
   for (auto cmd_it = queue.begin(); cmd_it != queue.end(); cmd_it++) {
     if (cmd.hex_addr == cmd_it->hex_addr && cmd.cmd_type == cmd_it->cmd_type) {
+      RemovePendingRow(*cmd_it);
       queue.erase(cmd_it);
+      // the commands behind may no longer be held back
+      ready_bound_[GetQueueIndex(cmd.Rank(), cmd.Bankgroup(), cmd.Bank())] = 0;
+      rank_q_empty[cmd.Rank()] = !HasPendingCommands(cmd.Rank(), -1, -1);
       return;
     }
   }
@@ -4,7 +4,9 @@
 #include "channel_state.h"
 #include "common.h"
 #include "configuration.h"
+#include "profiler.h"
 #include "simple_stats.h"
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -13,25 +15,72 @@ namespace dramsim3 {
 using CMDIterator = std::vector<Command>::iterator;
 using CMDQueue = std::vector<Command>;
 enum class QueueStructure { PER_RANK, PER_BANK, SIZE };
+enum class SchedulerPolicy { FIRST_READY, FRFCFS, SIZE };
 
 class CommandQueue {
 public:
   CommandQueue(int channel_id, const Config &config,
                const ChannelState &channel_state, SimpleStats &simple_stats);
-  Command GetCommandToIssue();
+  /// @brief The next command to issue, only from the ranks of sub_channel if
+  /// it is not negative.
+  Command GetCommandToIssue(int sub_channel = -1);
   Command FinishRefresh();
   void ClockTick() { clk_ += 1; };
+  void FastForward(uint64_t cycles) { clk_ += cycles; }
+  /// @brief Lower bound of the cycle at which any queued command may become
+  /// ready, if nothing else is issued in between.
+  uint64_t GetEarliestReadyCycle() const;
+  /// @brief Must be called for every issued command. Bank timings only ever
+  /// move forward, so only the queues whose bank (or rank for rank commands)
+  /// changed state lose their ready bound.
+  void InvalidateReadyBounds(const Command &issued);
+  /// @brief Must be called for every issued read or write, it extends the
+  /// column batch of its sub-channel or starts a new one, see
+  /// Config::column_batch_length.
+  void ColumnIssued(const Command &cmd);
   bool WillAcceptCommand(int rank, int bankgroup, int bank) const;
   bool AddCommand(Command cmd);
+  /// @brief Move every queued command into cmds, leaving the queues empty.
+  void Drain(std::vector<Command> &cmds);
   bool QueueEmpty() const;
+  /// @brief Whether any queued command goes to the rank, restricted to one
+  /// bankgroup and/or one bank index if they are not negative.
+  bool HasPendingCommands(int rank, int bankgroup, int bank) const;
+  /// @brief Whether a queued command may hit the open row of the bank, from
+  /// the pending row index.
+  bool HasPendingRowHit(int rank, int bankgroup, int bank) const;
   int QueueUsage() const;
+  void SetProfiler(Profiler *profiler) { profiler_ = profiler; }
+  // checkpointing, see MemorySystem::SaveCheckpoint
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
+  // whether no read or write is queued for the rank, set again when the last
+  // one is issued
   std::vector<bool> rank_q_empty;
 
 private:
   bool ArbitratePrecharge(const CMDIterator &cmd_it,
                           const CMDQueue &queue) const;
   bool HasRWDependency(const CMDIterator &cmd_it, const CMDQueue &queue) const;
-  Command GetFirstReadyInQueue(CMDQueue &queue) const;
+  /// @brief FRFCFS, return the first issuable row hit, visiting the queues
+  /// round robin. Banks that reached row_hit_cap are not preferred.
+  Command GetRowHitToIssue(int sub_channel);
+  bool QueueHasRowHit(int q_idx) const;
+  void AddPendingRow(const Command &cmd);
+  void RemovePendingRow(const Command &cmd);
+  /// @brief Return the first issuable command in the queue. If there is none,
+  /// next_ready is set to the earliest cycle at which one may become ready.
+  Command GetFirstReadyInQueue(CMDQueue &queue, uint64_t &next_ready);
+  /// @brief Whether the ready read or write is held back by the column batch
+  /// of its sub-channel, i.e. a row hit of the batch is ready before the
+  /// data bus would be idle for switching to cmd. Ends the batch once it
+  /// held back a command for column_batch_fairness_cycles.
+  bool BatchHoldsBack(const Command &cmd);
+  /// @brief Whether a row hit of the batch is ready by the cycle.
+  bool BatchCanContinue(int sub_channel, uint64_t horizon) const;
+  /// @brief Whether the commands of the queue go to the sub-channel, every
+  /// queue does if sub_channel is negative.
+  bool IsInSubChannel(int q_idx, int sub_channel) const;
   /// @brief Return the index of the queue.
   int GetQueueIndex(int rank, int bankgroup, int bank) const;
   CMDQueue &GetQueue(int rank, int bankgroup, int bank);
@@ -41,14 +90,38 @@ private:
   Command PrepRefCmd(const CMDIterator &it, const Command &ref) const;
 
   QueueStructure queue_structure_;
+  SchedulerPolicy scheduler_;
   const Config &config_;
   const ChannelState &channel_state_;
   SimpleStats &simple_stats_;
+  CounterHandle ondemand_pres_stat_, column_batches_stat_;
+  Profiler *profiler_;
+  int row_hit_cap_;
+  // data bus cycles lost to switching from a read to a write, from a write
+  // to a read and between the reads of two ranks
+  int read_to_write_cost_, write_to_read_cost_, rank_switch_cost_;
 
   /// @brief The size of command queues is config_.banks * config_.ranks when
   /// the queue structure is PER_BANK, or config_.ranks when it is PER_RANK.
   /// Each item in queues_[.] is std::vector<Command>(config_.cmd_queue_size).
   std::vector<CMDQueue> queues_;
+  /// @brief Per queue lower bound of the cycle at which GetFirstReadyInQueue
+  /// may find a command, so GetCommandToIssue only visits queues that can
+  /// make progress. Commands held back by ArbitratePrecharge or
+  /// HasRWDependency stay so until their queue or bank changes, which resets
+  /// the bound.
+  std::vector<uint64_t> ready_bound_;
+  /// @brief Per bank, the number of queued commands to each row, so that
+  /// finding out whether a bank has pending row hits does not scan a queue.
+  /// Derived from queues_, rebuilt when a checkpoint is loaded.
+  std::vector<std::unordered_map<int, int>> pending_rows_;
+
+  // column batch of each sub-channel, rank -1 if there is none, and the cycle
+  // it first held back a command (max if it did not)
+  std::vector<int> batch_rank_;
+  std::vector<bool> batch_write_;
+  std::vector<int> batch_cmds_;
+  std::vector<uint64_t> batch_held_clk_;
 
   // Refresh related data structures
   std::unordered_set<int> ref_q_indices_;
@@ -18,6 +18,8 @@ std::ostream &operator<<(std::ostream &os, const Command &cmd) {
       "refresh",
       "self_refresh_enter",
       "self_refresh_exit",
+      "power_down_enter",
+      "power_down_exit",
       "WRONG"};
   os << fmt::format("{:<20} {:>3} {:>3} {:>3} {:>3} {:>#8x} {:>#8x}",
                     command_string[static_cast<int>(cmd.cmd_type)],
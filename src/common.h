@@ -1,6 +1,7 @@
 #ifndef __COMMON_H
 #define __COMMON_H
 
+#include <functional>
 #include <iostream>
 #include <stdint.h>
 #include <vector>
@@ -54,10 +55,12 @@ enum class CommandType {
   REFRESH,
   SREF_ENTER,
   SREF_EXIT,
+  PD_ENTER,
+  PD_EXIT,
   SIZE
 };
 
-/// @brief There are 10 command types.
+/// @brief There are 12 command types.
 struct Command {
   Command() : cmd_type(CommandType::SIZE), hex_addr(0) {}
   Command(CommandType cmd_type, const Address &addr, uint64_t hex_addr)
@@ -81,11 +84,18 @@ struct Command {
   bool IsRankCMD() const {
     return cmd_type == CommandType::REFRESH ||
            cmd_type == CommandType::SREF_ENTER ||
-           cmd_type == CommandType::SREF_EXIT;
+           cmd_type == CommandType::SREF_EXIT ||
+           cmd_type == CommandType::PD_ENTER ||
+           cmd_type == CommandType::PD_EXIT;
   }
-  /// @brief There are 10 command types which are read, read and precharge,
+  /// @brief DDR5 style same-bank refresh (REFsb), a REFRESH_BANK to the same
+  /// bank of every bankgroup of the rank, addressed with bankgroup -1.
+  bool IsSameBankRefresh() const {
+    return cmd_type == CommandType::REFRESH_BANK && addr.bankgroup < 0;
+  }
+  /// @brief There are 12 command types which are read, read and precharge,
   /// write, write and precharge, activate, precharge, refresh bank, refresh,
-  /// self enter, self exit.
+  /// self enter, self exit, power-down enter, power-down exit.
   CommandType cmd_type;
   Address addr;
   uint64_t hex_addr;
@@ -103,18 +113,51 @@ struct Command {
 struct Transaction {
   Transaction() {}
   Transaction(uint64_t addr, bool is_write)
-      : addr(addr), added_cycle(0), complete_cycle(0), is_write(is_write) {}
+      : addr(addr), id(0), added_cycle(0), complete_cycle(0), source(0),
+        qos_class(0), is_write(is_write) {}
   Transaction(const Transaction &tran)
-      : addr(tran.addr), added_cycle(tran.added_cycle),
-        complete_cycle(tran.complete_cycle), is_write(tran.is_write) {}
+      : addr(tran.addr), id(tran.id), mapped_addr(tran.mapped_addr),
+        added_cycle(tran.added_cycle), complete_cycle(tran.complete_cycle),
+#ifdef LATENCY_BREAKDOWN
+        stage_cycle(tran.stage_cycle), stage_refresh(tran.stage_refresh),
+#endif  // LATENCY_BREAKDOWN
+        source(tran.source), qos_class(tran.qos_class),
+        is_write(tran.is_write) {}
   uint64_t addr;
+  // tag of the front end, handed back as is with the finished transaction
+  uint64_t id;
+  // addr decoded by Config::AddressMapping, filled in once by the controller
+  Address mapped_addr;
   uint64_t added_cycle;
   uint64_t complete_cycle;
+#ifdef LATENCY_BREAKDOWN
+  // cycle the transaction entered the command queue (or the controller, until
+  // it does) and the refresh blocked cycles of its bank by then, see
+  // LatencyBreakdown
+  uint64_t stage_cycle = 0;
+  uint64_t stage_refresh = 0;
+#endif  // LATENCY_BREAKDOWN
+  // the front end that sent the transaction and its priority class, see
+  // Config::qos_classes
+  int source;
+  int qos_class;
   bool is_write;
 
   friend std::ostream &operator<<(std::ostream &os, const Transaction &trans);
   friend std::istream &operator>>(std::istream &is, Transaction &trans);
 };
 
+/// @brief A finished transaction as handed to the host, tag is the one it was
+/// added with.
+struct Completion {
+  uint64_t hex_addr;
+  uint64_t tag;
+  bool is_write;
+};
+/// @brief Host callbacks of every completion, and of all the completions of a
+/// ClockTick or ClockTickN call as one array.
+typedef std::function<void(const Completion &done)> CompletionCallback;
+typedef std::function<void(const Completion *done, size_t num)> BatchCallback;
+
 }  // namespace dramsim3
 #endif
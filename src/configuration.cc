@@ -1,5 +1,8 @@
 #include "configuration.h"
 
+#include <functional>
+#include <iterator>
+#include <mutex>
 #include <vector>
 
 #ifdef THERMAL
@@ -8,12 +11,100 @@
 
 namespace dramsim3 {
 
-Config::Config(std::string config_file, std::string out_dir)
-    : output_dir(out_dir), reader_(new INIReader(config_file)) {
-  if (reader_->ParseError() < 0) {
+namespace {
+
+// INIReader has no setter, but subclasses can reach its values
+class OverridableINIReader : public INIReader {
+public:
+  explicit OverridableINIReader(const INIReader &values) : INIReader(values) {}
+  void Set(const std::string &section, const std::string &name,
+           const std::string &value) {
+    _values[MakeKey(section, name)] = value;
+    _sections.insert(section);
+  }
+};
+
+// parses the text of a config file the way INIReader(filename) parses the file
+class TextINIReader : public INIReader {
+public:
+  explicit TextINIReader(const std::string &text) {
+    TextStream stream = {text.c_str(), text.c_str() + text.size()};
+    _error = ini_parse_stream(ReadLine, &stream, ValueHandler, this);
+  }
+
+private:
+  struct TextStream {
+    const char *pos;
+    const char *end;
+  };
+  // fgets on a TextStream
+  static char *ReadLine(char *str, int num, void *stream) {
+    TextStream *text = static_cast<TextStream *>(stream);
+    if (text->pos == text->end || num < 2) {
+      return nullptr;
+    }
+    int len = 0;
+    while (len < num - 1 && text->pos != text->end) {
+      char c = *text->pos++;
+      str[len++] = c;
+      if (c == '\n') {
+        break;
+      }
+    }
+    str[len] = '\0';
+    return str;
+  }
+};
+
+INIReader ReadConfigFile(const std::string &config_file) {
+  INIReader reader(config_file);
+  if (reader.ParseError() < 0) {
     std::cerr << "Can't load config file - " << config_file << std::endl;
     AbruptExit(__FILE__, __LINE__);
   }
+  return reader;
+}
+
+// Configs derived from different overrides or output directories are kept
+// up to this many, then the derived ones are all dropped
+const size_t kMaxCachedConfigs = 1024;
+
+struct CachedFile {
+  size_t content_hash;
+  INIReader values;
+};
+
+struct CachedConfig {
+  size_t content_hash;
+  std::shared_ptr<const Config> config;
+};
+
+std::mutex cache_mutex;
+std::map<std::string, CachedFile> cached_files;
+std::map<std::string, CachedConfig> cached_configs;
+uint64_t num_files_parsed = 0;
+uint64_t num_configs_derived = 0;
+
+}  // namespace
+
+Config::Config(std::string config_file, std::string out_dir,
+               const ConfigOverrides &overrides)
+    : Config(ReadConfigFile(config_file), out_dir, overrides) {}
+
+Config::Config(const INIReader &values, std::string out_dir,
+               const ConfigOverrides &overrides)
+    : output_dir(out_dir) {
+  OverridableINIReader reader(values);
+  for (const auto &it : overrides) {
+    size_t dot = it.first.find('.');
+    if (dot == std::string::npos || dot == 0 || dot + 1 == it.first.size()) {
+      std::cerr << "Config override " << it.first
+                << " is not in section.name form" << std::endl;
+      AbruptExit(__FILE__, __LINE__);
+    }
+    reader.Set(it.first.substr(0, dot), it.first.substr(dot + 1), it.second);
+  }
+  reader_ = &reader;
 
   // The initialization of the parameters has to be strictly in this order
   // because of internal dependencies
@@ -24,21 +115,80 @@ Config::Config(std::string config_file, std::string out_dir)
   InitTimingParams();
   InitPowerParams();
   InitOtherParams();
+  InitCacheParams();
 #ifdef THERMAL
   InitThermalParams();
 #endif  // THERMAL
-  delete (reader_);
+  reader_ = nullptr;
+}
+
+std::shared_ptr<const Config> ConfigCache::Get(
+    const std::string &config_file, const std::string &out_dir,
+    const ConfigOverrides &overrides) {
+  std::ifstream file(config_file, std::ios::binary);
+  if (!file) {
+    std::cerr << "Can't load config file - " << config_file << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  std::string text((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  size_t content_hash = std::hash<std::string>()(text);
+
+  // the output directory is resolved when the config is derived
+  std::string key = config_file + '\0' + out_dir + '\0' +
+                    (DirExist(out_dir) ? '1' : '0');
+  for (const auto &it : overrides) {
+    key += '\0' + it.first + '=' + it.second;
+  }
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto derived = cached_configs.find(key);
+  if (derived != cached_configs.end() &&
+      derived->second.content_hash == content_hash) {
+    return derived->second.config;
+  }
+  auto parsed = cached_files.find(config_file);
+  if (parsed == cached_files.end() ||
+      parsed->second.content_hash != content_hash) {
+    TextINIReader values(text);
+    if (values.ParseError() < 0) {
+      std::cerr << "Can't load config file - " << config_file << std::endl;
+      AbruptExit(__FILE__, __LINE__);
+    }
+    CachedFile &cached = cached_files[config_file];
+    cached.content_hash = content_hash;
+    cached.values = values;
+    parsed = cached_files.find(config_file);
+    num_files_parsed++;
+  }
+  if (cached_configs.size() >= kMaxCachedConfigs) {
+    cached_configs.clear();
+  }
+  std::shared_ptr<const Config> config(
+      new Config(parsed->second.values, out_dir, overrides));
+  CachedConfig &cached = cached_configs[key];
+  cached.content_hash = content_hash;
+  cached.config = config;
+  num_configs_derived++;
+  return config;
+}
+
+void ConfigCache::Clear() {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  cached_files.clear();
+  cached_configs.clear();
+  num_files_parsed = 0;
+  num_configs_derived = 0;
+}
+
+uint64_t ConfigCache::NumFilesParsed() {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  return num_files_parsed;
 }
 
-Address Config::AddressMapping(uint64_t hex_addr) const {
-  hex_addr >>= shift_bits;
-  int channel = (hex_addr >> ch_pos) & ch_mask;
-  int rank = (hex_addr >> ra_pos) & ra_mask;
-  int bg = (hex_addr >> bg_pos) & bg_mask;
-  int ba = (hex_addr >> ba_pos) & ba_mask;
-  int ro = (hex_addr >> ro_pos) & ro_mask;
-  int co = (hex_addr >> co_pos) & co_mask;
-  return Address(channel, rank, bg, ba, ro, co);
+uint64_t ConfigCache::NumConfigsDerived() {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  return num_configs_derived;
 }
 
 void Config::CalculateSize() {
@@ -59,6 +209,11 @@ void Config::CalculateSize() {
     ranks = channel_size / megs_per_rank;
     channel_size = ranks * megs_per_rank;
   }
+  if (sub_channels <= 0 || ranks % sub_channels != 0) {
+    std::cerr << "The " << ranks << " ranks of a channel can not be split into "
+              << sub_channels << " sub-channels" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
   return;
 }
 
@@ -94,6 +249,16 @@ int Config::GetInteger(const std::string &sec, const std::string &opt,
 void Config::InitDRAMParams() {
   const auto &reader = *reader_;
   protocol = GetDRAMProtocol(reader.Get("dram_structure", "protocol", "DDR3"));
+  // the system params are read before the protocol is known
+  if (memory_model != "JEDEC" && IsHMC()) {
+    std::cerr << "memory_model " << memory_model
+              << " does not work with HMC" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  if ((qos_classes > 1 || !qos_source_caps.empty()) && IsHMC()) {
+    std::cerr << "QoS does not work with HMC" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
   bankgroups = GetInteger("dram_structure", "bankgroups", 2);
   banks_per_group = GetInteger("dram_structure", "banks_per_group", 2);
   bool bankgroup_enable =
@@ -119,6 +284,28 @@ void Config::InitDRAMParams() {
   link_speed = GetInteger("hmc", "link_speed", 15000);  // MHz
   block_size = GetInteger("hmc", "block_size", 64);
   xbar_queue_depth = GetInteger("hmc", "xbar_queue_depth", 16);
+  xbar_bandwidth = GetInteger("hmc", "xbar_bandwidth", 2);
+  num_quads = GetInteger("hmc", "num_quads", 4);
+  xbar_arbitration = reader.Get("hmc", "xbar_arbitration", "AGE");
+  if (xbar_bandwidth < 1 || num_quads < 1 ||
+      (xbar_arbitration != "AGE" && xbar_arbitration != "ROUND_ROBIN" &&
+       xbar_arbitration != "WEIGHTED")) {
+    std::cerr << "Bad crossbar settings, xbar_bandwidth and num_quads have to "
+                 "be positive, xbar_arbitration AGE, ROUND_ROBIN or WEIGHTED"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  num_cubes = GetInteger("hmc", "num_cubes", 1);
+  cube_topology = reader.Get("hmc", "cube_topology", "CHAIN");
+  cube_hop_latency = GetInteger("hmc", "cube_hop_latency", 8);
+  cube_links = GetInteger("hmc", "cube_links", 1);
+  if (num_cubes < 1 || cube_hop_latency < 1 || cube_links < 1 ||
+      (cube_topology != "CHAIN" && cube_topology != "STAR")) {
+    std::cerr << "Bad cube settings, num_cubes, cube_hop_latency and "
+                 "cube_links have to be positive, cube_topology CHAIN or STAR"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
   if (IsHMC()) {
     // the BL for HMC is determined by max block_size, which is a multiple
     // of 32B, each "device" transfer 32b per half cycle therefore BL is 8
@@ -181,7 +368,63 @@ void Config::InitOtherParams() {
   output_prefix = output_dir + reader.Get("other", "output_prefix", "dramsim3");
   json_stats_name = output_prefix + ".json";
   json_epoch_name = output_prefix + "epoch.json";
+  csv_epoch_name = output_prefix + "epoch.csv";
   txt_stats_name = output_prefix + ".txt";
+  std::string epoch_format = reader.Get("other", "epoch_format", "json");
+  if (epoch_format != "json" && epoch_format != "csv" &&
+      epoch_format != "both") {
+    std::cerr << "Unknown epoch_format " << epoch_format << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  epoch_json = epoch_format != "csv";
+  epoch_csv = epoch_format != "json";
+  cmd_trace = reader.GetBoolean("other", "cmd_trace", false);
+  addr_trace = reader.GetBoolean("other", "addr_trace", false);
+  profile = reader.GetBoolean("other", "profile", false);
+  return;
+}
+
+void Config::InitCacheParams() {
+  const auto &reader = *reader_;
+  cache_size = GetInteger("cache", "size", 0);
+  cache_assoc = GetInteger("cache", "associativity", 8);
+  cache_line_size = GetInteger("cache", "line_size", request_size_bytes);
+  cache_hit_latency = GetInteger("cache", "hit_latency", 10);
+  std::string write_policy = reader.Get("cache", "write_policy", "WRITE_BACK");
+  if (write_policy == "WRITE_BACK") {
+    cache_write_back = true;
+  } else if (write_policy == "WRITE_THROUGH") {
+    cache_write_back = false;
+  } else {
+    std::cerr << "Unknown cache write_policy " << write_policy << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  if (cache_size <= 0) {
+    return;
+  }
+  if (cache_assoc <= 0 || cache_hit_latency < 0 ||
+      cache_line_size < request_size_bytes ||
+      cache_line_size % request_size_bytes != 0 ||
+      (cache_size * 1024) % (cache_line_size * cache_assoc) != 0) {
+    std::cerr << "The cache needs lines of a multiple of the "
+              << request_size_bytes
+              << " byte requests and a size of a multiple of "
+                 "line_size * associativity"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  if (sampling || IsHMC() || memory_model != "JEDEC") {
+    std::cerr << "The memory-side cache only works with the JEDEC "
+                 "memory_model, without sampling"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  if (qos_classes > 1 || !qos_source_caps.empty()) {
+    std::cerr << "QoS does not work with the memory-side cache, its fills "
+                 "have no source"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
   return;
 }
 
@@ -192,7 +435,7 @@ void Config::InitPowerParams() {
   double IDD0 = reader.GetReal("power", "IDD0", 48);
   double IDD2P = reader.GetReal("power", "IDD2P", 25);
   double IDD2N = reader.GetReal("power", "IDD2N", 34);
-  // double IDD3P = reader.GetReal("power", "IDD3P", 37);
+  double IDD3P = reader.GetReal("power", "IDD3P", 37);
   double IDD3N = reader.GetReal("power", "IDD3N", 43);
   double IDD4W = reader.GetReal("power", "IDD4W", 123);
   double IDD4R = reader.GetReal("power", "IDD4R", 135);
@@ -213,6 +456,7 @@ void Config::InitPowerParams() {
   // the following are added per cycle
   act_stb_energy_inc = VDD * IDD3N * devices;
   pre_stb_energy_inc = VDD * IDD2N * devices;
+  act_pd_energy_inc = VDD * IDD3P * devices;
   pre_pd_energy_inc = VDD * IDD2P * devices;
   sref_energy_inc = VDD * IDD6x * devices;
   return;
@@ -223,13 +467,54 @@ void Config::InitSystemParams() {
   channel_size = GetInteger("system", "channel_size", 1024);
   channels = GetInteger("system", "channels", 1);
   bus_width = GetInteger("system", "bus_width", 64);
+  sub_channels = GetInteger("system", "sub_channels", 1);
+  shared_cmd_bus = reader.GetBoolean("system", "shared_cmd_bus", true);
   address_mapping = reader.Get("system", "address_mapping", "chrobabgraco");
+  address_xor = reader.Get("system", "address_xor", "");
   queue_structure = reader.Get("system", "queue_structure", "PER_BANK");
+  scheduler = reader.Get("system", "scheduler", "FIRST_READY");
+  row_hit_cap = GetInteger("system", "row_hit_cap", 4);
+  trans_per_cycle = GetInteger("system", "trans_per_cycle", 1);
+  if (row_hit_cap <= 0 || trans_per_cycle <= 0) {
+    std::cerr << "row_hit_cap and trans_per_cycle have to be positive"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
   row_buf_policy = reader.Get("system", "row_buf_policy", "OPEN_PAGE");
+  row_buf_timeout = GetInteger("system", "row_buf_timeout", 50);
+  if (row_buf_timeout <= 0) {
+    std::cerr << "row_buf_timeout has to be positive" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
   cmd_queue_size = GetInteger("system", "cmd_queue_size", 16);
   trans_queue_size = GetInteger("system", "trans_queue_size", 32);
   unified_queue = reader.GetBoolean("system", "unified_queue", false);
   write_buf_size = GetInteger("system", "write_buf_size", 16);
+  write_drain_high =
+      GetInteger("system", "write_drain_high", trans_queue_size);
+  write_drain_low = GetInteger("system", "write_drain_low", 0);
+  write_drain_idle_threshold =
+      GetInteger("system", "write_drain_idle_threshold", 8);
+  write_drain_on_read_gap =
+      reader.GetBoolean("system", "write_drain_on_read_gap", false);
+  write_drain_batching =
+      reader.GetBoolean("system", "write_drain_batching", false);
+  column_batch_length = GetInteger("system", "column_batch_length", 0);
+  column_batch_fairness_cycles =
+      GetInteger("system", "column_batch_fairness_cycles", 64);
+  if (column_batch_length < 0 || column_batch_fairness_cycles <= 0) {
+    std::cerr << "column_batch_length cannot be negative and "
+                 "column_batch_fairness_cycles has to be positive"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  if (write_drain_low < 0 || write_drain_low >= write_drain_high ||
+      write_drain_high > trans_queue_size) {
+    std::cerr << "Write drain watermarks need 0 <= write_drain_low < "
+                 "write_drain_high <= trans_queue_size"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
   std::string ref_policy =
       reader.Get("system", "refresh_policy", "RANK_LEVEL_STAGGERED");
   if (ref_policy == "RANK_LEVEL_SIMULTANEOUS") {
@@ -238,15 +523,130 @@ void Config::InitSystemParams() {
     refresh_policy = RefreshPolicy::RANK_LEVEL_STAGGERED;
   } else if (ref_policy == "BANK_LEVEL_STAGGERED") {
     refresh_policy = RefreshPolicy::BANK_LEVEL_STAGGERED;
+  } else if (ref_policy == "SAME_BANK_STAGGERED") {
+    refresh_policy = RefreshPolicy::SAME_BANK_STAGGERED;
   } else {
     AbruptExit(__FILE__, __LINE__);
   }
+  refresh_postpone_max = GetInteger("system", "refresh_postpone_max", 0);
+  refresh_pull_in_max = GetInteger("system", "refresh_pull_in_max", 0);
+  if (refresh_postpone_max < 0 || refresh_postpone_max > 8 ||
+      refresh_pull_in_max < 0 || refresh_pull_in_max > 8) {
+    std::cerr << "refresh_postpone_max and refresh_pull_in_max have to be "
+                 "within 0 and 8"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  refresh_derate_temp = reader.GetReal("system", "refresh_derate_temp", 85.0);
 
   enable_self_refresh =
       reader.GetBoolean("system", "enable_self_refresh", false);
   sref_threshold = GetInteger("system", "sref_threshold", 1000);
+  enable_power_down = reader.GetBoolean("system", "enable_power_down", false);
+  std::string pd_policy =
+      reader.Get("system", "power_down_policy", "PREDICTOR");
+  if (pd_policy == "TIMEOUT") {
+    power_down_policy = PowerDownPolicy::TIMEOUT;
+  } else if (pd_policy == "PREDICTOR") {
+    power_down_policy = PowerDownPolicy::PREDICTOR;
+  } else {
+    std::cerr << "Unknown power_down_policy " << pd_policy << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  power_down_threshold = GetInteger("system", "power_down_threshold", 100);
+  power_down_latency_weight =
+      reader.GetReal("system", "power_down_latency_weight", 1.0);
   aggressive_precharging_enabled =
       reader.GetBoolean("system", "aggressive_precharging_enabled", false);
+  skip_idle_cycles = reader.GetBoolean("system", "skip_idle_cycles", false);
+  num_threads = GetInteger("system", "num_threads", 1);
+  sampling = reader.GetBoolean("system", "sampling", false);
+  sample_fast_forward_cycles =
+      GetInteger("system", "sample_fast_forward_cycles", 1000000);
+  sample_warmup_cycles = GetInteger("system", "sample_warmup_cycles", 20000);
+  sample_measure_cycles = GetInteger("system", "sample_measure_cycles", 10000);
+  if (sampling &&
+      (sample_fast_forward_cycles < 0 || sample_warmup_cycles < 0 ||
+       sample_measure_cycles <= 0)) {
+    std::cerr << "Sampling needs a positive sample_measure_cycles and "
+                 "non-negative fast-forward and warm-up cycles"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  memory_model = reader.Get("system", "memory_model", "JEDEC");
+  analytical_calibration_cycles =
+      GetInteger("system", "analytical_calibration_cycles", 0);
+  if (memory_model != "JEDEC" && memory_model != "IDEAL" &&
+      memory_model != "ANALYTICAL") {
+    std::cerr << "Unknown memory_model " << memory_model << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  if (memory_model != "JEDEC" && sampling) {
+    std::cerr << "memory_model " << memory_model
+              << " does not work with sampling" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  if (analytical_calibration_cycles < 0) {
+    std::cerr << "analytical_calibration_cycles can't be negative"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+
+  qos_classes = GetInteger("system", "qos_classes", 1);
+  qos_arbitration = reader.Get("system", "qos_arbitration", "STRICT");
+  qos_starvation_cycles = GetInteger("system", "qos_starvation_cycles", 0);
+  if (qos_classes <= 0 || qos_starvation_cycles < 0) {
+    std::cerr << "qos_classes has to be positive and qos_starvation_cycles "
+                 "can't be negative"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  if (qos_arbitration != "STRICT" && qos_arbitration != "WEIGHTED") {
+    std::cerr << "Unknown qos_arbitration " << qos_arbitration << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  std::string weights = reader.Get("system", "qos_weights", "");
+  qos_weights.assign(qos_classes, 1);
+  if (!weights.empty()) {
+    std::vector<std::string> values = StringSplit(weights, ',');
+    if (values.size() != static_cast<size_t>(qos_classes)) {
+      std::cerr << "qos_weights needs one weight per class" << std::endl;
+      AbruptExit(__FILE__, __LINE__);
+    }
+    for (int i = 0; i < qos_classes; i++) {
+      qos_weights[i] = std::stoi(values[i]);
+      if (qos_weights[i] <= 0) {
+        std::cerr << "qos_weights have to be positive" << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+      }
+    }
+  }
+  qos_source_caps.clear();
+  for (const auto &entry :
+       StringSplit(reader.Get("system", "qos_source_caps", ""), ',')) {
+    size_t colon = entry.find(':');
+    if (entry.find_first_not_of(' ') == std::string::npos) {
+      continue;
+    }
+    int source = colon == std::string::npos ? -1 : std::stoi(entry);
+    double share =
+        colon == std::string::npos ? 0.0 : std::stod(entry.substr(colon + 1));
+    if (source < 0 || share <= 0.0 || share > 1.0) {
+      std::cerr << "qos_source_caps takes source:share entries with a share "
+                   "in (0, 1], not "
+                << entry << std::endl;
+      AbruptExit(__FILE__, __LINE__);
+    }
+    if (qos_source_caps.size() <= static_cast<size_t>(source)) {
+      qos_source_caps.resize(source + 1, 0.0);
+    }
+    qos_source_caps[source] = share;
+  }
+  if ((qos_classes > 1 || !qos_source_caps.empty()) &&
+      memory_model != "JEDEC") {
+    std::cerr << "QoS only works with the JEDEC memory_model" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
 
   return;
 }
@@ -291,6 +691,19 @@ void Config::InitThermalParams() {
     chip_dim_y = reader.GetReal("thermal", "chip_dim_y", 0.01);
     amb_temp = reader.GetReal("thermal", "amb_temp", 40);
   }
+  transient_solver = reader.Get("thermal", "transient_solver", "EXPLICIT");
+  implicit_steps = GetInteger("thermal", "implicit_steps", 4);
+  thermal_async = reader.GetBoolean("thermal", "async", false);
+  thermal_async_deterministic =
+      reader.GetBoolean("thermal", "async_deterministic", true);
+  thermal_refresh = reader.GetBoolean("thermal", "refresh_feedback", false);
+  if ((transient_solver != "EXPLICIT" && transient_solver != "IMPLICIT") ||
+      implicit_steps < 1) {
+    std::cerr << "thermal.transient_solver has to be EXPLICIT or IMPLICIT and "
+                 "thermal.implicit_steps positive"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
   return;
 }
 #endif  // THERMAL
@@ -323,6 +736,7 @@ void Config::InitTimingParams() {
   tXS = GetInteger("timing", "tXS", 432);
   tXP = GetInteger("timing", "tXP", 8);
   tRFCb = GetInteger("timing", "tRFCb", 20);
+  tREFSBRD = GetInteger("timing", "tREFSBRD", tRRD_L);
   tREFI = GetInteger("timing", "tREFI", 7800);
   tREFIb = GetInteger("timing", "tREFIb", 1950);
   tFAW = GetInteger("timing", "tFAW", 50);
@@ -347,6 +761,13 @@ void Config::InitTimingParams() {
   return;
 }
 
+void Config::SetAddressMapping(const std::string &mapping,
+                               const std::string &xor_fields) {
+  address_mapping = mapping;
+  address_xor = xor_fields;
+  SetAddressMapping();
+}
+
 void Config::SetAddressMapping() {
   // memory addresses are byte addressable, but each request comes with
   // multiple bytes because of bus width, and burst length
@@ -404,6 +825,47 @@ void Config::SetAddressMapping() {
   ba_mask = (1 << field_widths.at("ba")) - 1;
   ro_mask = (1 << field_widths.at("ro")) - 1;
   co_mask = (1 << field_widths.at("co")) - 1;
+
+  // XOR hashing, each hashed field takes the next row bits
+  ch_xor_pos = ra_xor_pos = bg_xor_pos = ba_xor_pos = 0;
+  ch_xor_mask = ra_xor_mask = bg_xor_mask = ba_xor_mask = 0;
+  if (address_xor.size() % 2 != 0) {
+    std::cerr << "Unknown address xor fields (each 2 chars required)"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  int row_bit = ro_pos;
+  for (size_t i = 0; i < address_xor.size(); i += 2) {
+    std::string token = address_xor.substr(i, 2);
+    int *xor_pos;
+    uint64_t *xor_mask;
+    if (token == "ch") {
+      xor_pos = &ch_xor_pos;
+      xor_mask = &ch_xor_mask;
+    } else if (token == "ra") {
+      xor_pos = &ra_xor_pos;
+      xor_mask = &ra_xor_mask;
+    } else if (token == "bg") {
+      xor_pos = &bg_xor_pos;
+      xor_mask = &bg_xor_mask;
+    } else if (token == "ba") {
+      xor_pos = &ba_xor_pos;
+      xor_mask = &ba_xor_mask;
+    } else {
+      std::cerr << "Field cannot be XOR hashed: " << token << std::endl;
+      AbruptExit(__FILE__, __LINE__);
+      return;
+    }
+    int width = field_widths.at(token);
+    if (row_bit + width > ro_pos + field_widths.at("ro")) {
+      std::cerr << "Not enough row bits to XOR hash " << address_xor
+                << std::endl;
+      AbruptExit(__FILE__, __LINE__);
+    }
+    *xor_pos = row_bit;
+    *xor_mask = (1 << width) - 1;
+    row_bit += width;
+  }
 }
 
 }  // namespace dramsim3
@@ -3,6 +3,8 @@
 
 #include "common.h"
 #include <fstream>
+#include <map>
+#include <memory>
 #include <string>
 
 #include "INIReader.h"
@@ -28,13 +30,62 @@ enum class RefreshPolicy {
   RANK_LEVEL_SIMULTANEOUS,  // impractical due to high power requirement
   RANK_LEVEL_STAGGERED,
   BANK_LEVEL_STAGGERED,
+  SAME_BANK_STAGGERED,  // DDR5 REFsb, one bank of every bankgroup at a time
   SIZE
 };
 
+/// @brief When an idle rank is powered down, see enable_power_down.
+enum class PowerDownPolicy {
+  TIMEOUT,    // after power_down_threshold idle cycles
+  PREDICTOR,  // right away if the predicted idle period pays off the exit
+  SIZE
+};
+
+/// @brief Values that replace (or add to) the ones in a config file, keyed
+/// by "section.name", e.g. {"system.trans_queue_size", "64"}.
+typedef std::map<std::string, std::string> ConfigOverrides;
+
 class Config {
 public:
-  Config(std::string config_file, std::string out_dir);
-  Address AddressMapping(uint64_t hex_addr) const;
+  Config(std::string config_file, std::string out_dir,
+         const ConfigOverrides &overrides = ConfigOverrides());
+  /// @brief Derive a config from the already parsed values of a config file.
+  Config(const INIReader &values, std::string out_dir,
+         const ConfigOverrides &overrides = ConfigOverrides());
+  /// @brief Decode an address. Every field is a shift and a mask, and the
+  /// XOR hashed fields (see address_xor) fold in row bits with a mask that is
+  /// 0 for the fields that are not hashed, so there is no branch.
+  Address AddressMapping(uint64_t hex_addr) const {
+    hex_addr >>= shift_bits;
+    int channel = static_cast<int>(
+        ((hex_addr >> ch_pos) ^ ((hex_addr >> ch_xor_pos) & ch_xor_mask)) &
+        ch_mask);
+    int rank = static_cast<int>(
+        ((hex_addr >> ra_pos) ^ ((hex_addr >> ra_xor_pos) & ra_xor_mask)) &
+        ra_mask);
+    int bg = static_cast<int>(
+        ((hex_addr >> bg_pos) ^ ((hex_addr >> bg_xor_pos) & bg_xor_mask)) &
+        bg_mask);
+    int ba = static_cast<int>(
+        ((hex_addr >> ba_pos) ^ ((hex_addr >> ba_xor_pos) & ba_xor_mask)) &
+        ba_mask);
+    int ro = static_cast<int>((hex_addr >> ro_pos) & ro_mask);
+    int co = static_cast<int>((hex_addr >> co_pos) & co_mask);
+    return Address(channel, rank, bg, ba, ro, co);
+  }
+  /// @brief Switch to another address_mapping and address_xor, e.g. to try
+  /// out mappings on a copy of a config.
+  void SetAddressMapping(const std::string &mapping,
+                         const std::string &xor_fields);
+  /// @brief The sub-channel the rank is in.
+  int SubChannel(int rank) const { return rank * sub_channels / ranks; }
+  /// @brief Only the channel field of AddressMapping.
+  int AddressChannel(uint64_t hex_addr) const {
+    hex_addr >>= shift_bits;
+    return static_cast<int>(
+        ((hex_addr >> ch_pos) ^ ((hex_addr >> ch_xor_pos) & ch_xor_mask)) &
+        ch_mask);
+  }
   // DRAM physical structure
   DRAMProtocol protocol;
   int channel_size;
@@ -49,11 +100,23 @@ public:
   int bus_width;
   int devices_per_rank;
   int BL;
+  /// @brief Independent sub-channels of a channel, DDR5 sub-channels or HBM
+  /// pseudo channels, served by the one controller. The ranks are split
+  /// evenly among them, each has a data bus of bus_width bits of its own, so
+  /// ranks of different sub-channels have no rank to rank switching between
+  /// them, and trans_queue_size transactions of its own.
+  int sub_channels;
+  /// @brief Whether the sub-channels share one command bus (HBM pseudo
+  /// channels), otherwise each of them can be sent a command every cycle.
+  bool shared_cmd_bus;
 
   // Address mapping numbers
   int shift_bits;
   int ch_pos, ra_pos, bg_pos, ba_pos, ro_pos, co_pos;
   uint64_t ch_mask, ra_mask, bg_mask, ba_mask, ro_mask, co_mask;
+  // row bits XORed into the ch/ra/bg/ba fields, masks are 0 if not hashed
+  int ch_xor_pos, ra_xor_pos, bg_xor_pos, ba_xor_pos;
+  uint64_t ch_xor_mask, ra_xor_mask, bg_xor_mask, ba_xor_mask;
 
   // Generic DRAM timing parameters
   double tCK;
@@ -185,6 +248,9 @@ public:
   /// represents a fundamental architectural shift from DDR4's global refresh
   /// mechanism.
   int tRFCb;
+  /// Same-bank refresh (REFsb) to ACT or REFsb of another bank, DDR5
+  /// tREFSBRD. Defaults to tRRD_L.
+  int tREFSBRD;
   /// Refresh Interval, the average time between automatic refresh commands.
   int tREFI;
   /// Per-bank refresh interval.
@@ -219,6 +285,7 @@ public:
   double refb_energy_inc;
   double act_stb_energy_inc;
   double pre_stb_energy_inc;
+  double act_pd_energy_inc;
   double pre_pd_energy_inc;
   double sref_energy_inc;
 
@@ -230,20 +297,151 @@ public:
   int num_vaults;
   int block_size;  // block size in bytes
   int xbar_queue_depth;
+  /// @brief Crossbar flits per logic cycle of every input and output, the
+  /// quadrants the vaults are split into (vault % num_quads), and the order
+  /// in which waiting inputs go: AGE (longest stalled first), ROUND_ROBIN or
+  /// WEIGHTED (stalled cycles times packets waiting).
+  int xbar_bandwidth;
+  int num_quads;
+  std::string xbar_arbitration;
+  /// @brief Cubes behind the host, each with its own slice of the address
+  /// space, see HMCChainSystem. cube_topology is CHAIN (cube k is k hops
+  /// from the host side cube 0) or STAR (every other cube is one hop from
+  /// cube 0), cube_hop_latency the pass-through cycles of every hop and
+  /// cube_links the links between two cubes.
+  int num_cubes;
+  std::string cube_topology;
+  int cube_hop_latency;
+  int cube_links;
 
   // System
   std::string address_mapping;
+  /// @brief Fields (2 chars each, out of ch, ra, bg and ba) whose bits are
+  /// XORed with row bits, e.g. "babg" for the common row ^ bank hashing. The
+  /// fields take successive row bits starting from the lowest one. Empty by
+  /// default, i.e. no hashing.
+  std::string address_xor;
   std::string queue_structure;
+  /// @brief Command scheduling policy of the command queues. FIRST_READY
+  /// issues the first issuable command of each queue in queue order, FRFCFS
+  /// issues ready row hits of any queue before anything else, oldest first.
+  std::string scheduler;
+  /// @brief Number of row hits a bank may serve while a command to another
+  /// row waits before the row is closed anyway.
+  int row_hit_cap;
+  /// @brief Max number of transactions moved into the command queue per cycle.
+  int trans_per_cycle;
+  /// @brief OPEN_PAGE leaves rows open until a conflict or a refresh closes
+  /// them, CLOSE_PAGE closes them with every access (READ_PRECHARGE and
+  /// WRITE_PRECHARGE). TIMEOUT closes a row once it has not been used for
+  /// row_buf_timeout cycles and no queued command goes to it. PREDICTOR
+  /// closes a row with the access unless a queued command goes to it or the
+  /// history of its bank says the row is likely used again, see
+  /// Controller::TrainRowPredictor.
   std::string row_buf_policy;
+  int row_buf_timeout;
   RefreshPolicy refresh_policy;
+  /// @brief Up to refresh_postpone_max refreshes of a rank (or bank) are
+  /// postponed while commands to it are queued, and caught up once it is
+  /// idle. Up to refresh_pull_in_max refreshes are issued ahead of time
+  /// while it is idle. JEDEC allows 8 of each, 0 disables them.
+  int refresh_postpone_max;
+  int refresh_pull_in_max;
+  /// @brief Refreshes of the ranks (or banks) hotter than this [C] are
+  /// doubled, see Refresh::SetBankTemperatures.
+  double refresh_derate_temp;
   int cmd_queue_size;
   bool unified_queue;
   int trans_queue_size;
   int write_buf_size;
+  /// @brief Write drain policy of the separate read and write queues. A
+  /// drain starts once write_drain_high writes are buffered (default
+  /// trans_queue_size, i.e. the buffer is full), or when more than
+  /// write_drain_idle_threshold are buffered and the command queue is empty,
+  /// and it issues writes until write_drain_low are left.
+  int write_drain_high;
+  int write_drain_low;
+  int write_drain_idle_threshold;
+  /// @brief Also start a drain whenever there is no read to schedule and
+  /// more than write_drain_low writes are buffered.
+  bool write_drain_on_read_gap;
+  /// @brief Drain writes to the rank of the last drained write first, row
+  /// hits first, to save rank switches and row conflicts.
+  bool write_drain_batching;
+  /// @brief Batching of the column commands in the command queues, 0 (the
+  /// default) disables it. A batch is up to column_batch_length reads or
+  /// writes to one rank. While the rank has a row hit of the batch that is
+  /// ready before a rank switch or a turnaround would let the data bus idle,
+  /// the other reads and writes of its data bus are held back, see
+  /// CommandQueue::BatchHoldsBack. Once one has been held back for
+  /// column_batch_fairness_cycles the batch ends early.
+  int column_batch_length;
+  int column_batch_fairness_cycles;
+  /// @brief Quality of service of the transaction queues, see
+  /// Controller::NextQoSTrans. Every transaction has a class in [0,
+  /// qos_classes) and each class gets trans_queue_size entries of the queues.
+  /// qos_arbitration STRICT serves the lowest class first, WEIGHTED gives
+  /// the classes with transactions shares of the scheduling in proportion to
+  /// qos_weights (one per class, all 1 by default), an idle class catches up
+  /// by at most one queue worth. A transaction that has waited for
+  /// qos_starvation_cycles (0 never) goes first whatever its class. Only the
+  /// transaction queues are arbitrated, the command queues of the banks are
+  /// shared by all classes.
+  int qos_classes;
+  std::string qos_arbitration;
+  std::vector<int> qos_weights;
+  int qos_starvation_cycles;
+  /// @brief Share of the peak bandwidth of a channel each source may use,
+  /// indexed by source, 0 is uncapped. Set as "source:share, ..." by
+  /// qos_source_caps.
+  std::vector<double> qos_source_caps;
   bool enable_self_refresh;
   int sref_threshold;
+  /// @brief Power down the ranks without queued commands, active power-down
+  /// if a row is open, precharge power-down otherwise. The rank wakes up with
+  /// PD_EXIT and tXP as soon as a command or a refresh is for it.
+  bool enable_power_down;
+  PowerDownPolicy power_down_policy;
+  int power_down_threshold;
+  /// @brief PREDICTOR powers a rank down when the predicted idle period, a
+  /// moving average of its last ones, saves more background energy after the
+  /// tXP exit than power_down_latency_weight times the standby energy of tXP
+  /// cycles, the price put on the tXP a waking read waits. 0 powers down
+  /// whenever the idle period outlasts the exit, higher values less often.
+  double power_down_latency_weight;
   bool aggressive_precharging_enabled;
   bool enable_hbm_dual_cmd;
+  /// @brief Let a controller jump over cycles in which it provably cannot
+  /// issue a command or move a transaction. Stats are credited in bulk, so the
+  /// outputs are identical to cycle-by-cycle simulation.
+  bool skip_idle_cycles;
+  /// @brief Number of threads used to tick the channel controllers (the
+  /// vaults of an HMC), 1 ticks them serially on the calling thread.
+  int num_threads;
+  /// @brief Sampled simulation: fast-forward through a functional model that
+  /// only tracks open rows and refreshes, then run detailed warm-up and
+  /// measurement windows, and repeat. Stats measured in the measurement
+  /// windows are extrapolated (see SampledDRAMSystem).
+  bool sampling;
+  int sample_fast_forward_cycles;
+  int sample_warmup_cycles;
+  int sample_measure_cycles;
+  /// @brief Model behind a JEDEC config, system.memory_model: JEDEC (the
+  /// cycle-accurate controllers), IDEAL (a fixed ideal_memory_latency and
+  /// infinite bandwidth) or ANALYTICAL (see AnalyticalDRAMSystem). The
+  /// analytical model is calibrated on the first analytical_calibration_cycles
+  /// cycles, which are simulated in detail, 0 leaves it uncalibrated.
+  std::string memory_model;
+  int analytical_calibration_cycles;
+  /// @brief Memory-side cache in front of the controllers, see MemoryCache.
+  /// cache_size is in KB, 0 leaves it out, cache_hit_latency is in cycles.
+  /// With cache_write_back the host writes allocate lines and only dirty
+  /// victims are written to the DRAM, otherwise every write goes through.
+  int cache_size;
+  int cache_assoc;
+  int cache_line_size;
+  int cache_hit_latency;
+  bool cache_write_back;
 
   int epoch_period;
   int output_level;
@@ -251,7 +449,20 @@ public:
   std::string output_prefix;
   std::string json_stats_name;
   std::string json_epoch_name;
+  std::string csv_epoch_name;
   std::string txt_stats_name;
+  /// @brief Formats of the epoch stats, other.epoch_format is json, csv or
+  /// both, see StatsWriter.
+  bool epoch_json;
+  bool epoch_csv;
+  /// @brief Binary command traces (<prefix>ch_<n>cmd.btrace, one per
+  /// channel) and address trace (<prefix>addr.btrace), written by a
+  /// background thread, see TraceWriter. dramsim3tracedump decodes them.
+  bool cmd_trace;
+  bool addr_trace;
+  /// @brief Self-profiling of the controllers, host time per part of a tick
+  /// and event counters per channel into <prefix>profile.json, see Profiler.
+  bool profile;
 
   // Computed parameters
   int request_size_bytes;
@@ -289,6 +500,20 @@ public:
   int row_tile;
   int tile_row_num;
   double bank_asr;  // the aspect ratio of a bank: #row_bits / #col_bits
+  // EXPLICIT: forward Euler steps short enough to be stable every epoch,
+  // IMPLICIT: implicit_steps backward Euler steps on an LU factorization
+  // computed once, a lot faster but less accurate with few steps
+  std::string transient_solver;
+  int implicit_steps;
+  // solve the transient temperatures of an epoch on a background thread while
+  // the simulation goes on. The next epoch waits for them, or, without
+  // thermal_async_deterministic, is merged into the one after if the solver
+  // is still busy, so results depend on the host timing
+  bool thermal_async;
+  bool thermal_async_deterministic;
+  // feed the bank temperatures of every epoch back into the refresh rate of
+  // the controllers, see refresh_derate_temp
+  bool thermal_refresh;
 #endif              // THERMAL
 
 private:
@@ -297,6 +522,7 @@ private:
   DRAMProtocol GetDRAMProtocol(std::string protocol_str);
   int GetInteger(const std::string &sec, const std::string &opt,
                  int default_val) const;
+  void InitCacheParams();
   void InitDRAMParams();
   void InitOtherParams();
   void InitPowerParams();
@@ -308,5 +534,23 @@ private:
   void SetAddressMapping();
 };
 
+/// @brief Process wide registry of the loaded configs, so that the many
+/// short lived memory systems of a sweep or of per-phase sampling don't parse
+/// and derive the same config file over and over. A file is parsed once and
+/// every set of overrides is applied on top of its parsed values. The file is
+/// still read on every lookup, an edited file is parsed again. Thread safe.
+class ConfigCache {
+public:
+  /// @brief The config of config_file with overrides applied, shared with
+  /// every other caller asking for the same.
+  static std::shared_ptr<const Config> Get(
+      const std::string &config_file, const std::string &out_dir,
+      const ConfigOverrides &overrides = ConfigOverrides());
+  static void Clear();
+  /// @brief Files parsed and configs derived since the last Clear().
+  static uint64_t NumFilesParsed();
+  static uint64_t NumConfigsDerived();
+};
+
 }  // namespace dramsim3
 #endif
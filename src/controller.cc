@@ -1,10 +1,19 @@
 #include "controller.h"
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
 #include <limits>
 
 namespace dramsim3 {
 
+namespace {
+
+// virtual time a transaction of weight 1 takes in the WEIGHTED arbitration
+const uint64_t kQoSStrideScale = 1 << 20;
+
+}  // namespace
+
 #ifdef THERMAL
 Controller::Controller(int channel, const Config &config, const Timing &timing,
                        ThermalCalculator &thermal_calc)
@@ -14,20 +23,82 @@ Controller::Controller(int channel, const Config &config, const Timing &timing)
     : channel_id_(channel), clk_(0), config_(config),
       simple_stats_(config_, channel_id_), channel_state_(config, timing),
       cmd_queue_(channel_id_, config, channel_state_, simple_stats_),
-      refresh_(config, channel_state_),
+      refresh_(config, channel_state_, cmd_queue_, simple_stats_),
 #ifdef THERMAL
       thermal_calc_(thermal_calc),
 #endif  // THERMAL
+#ifdef LATENCY_BREAKDOWN
+      latency_breakdown_(config, channel_state_, simple_stats_),
+#endif  // LATENCY_BREAKDOWN
       is_unified_queue_(config.unified_queue),
-      row_buf_policy_(config.row_buf_policy == "CLOSE_PAGE"
-                          ? RowBufPolicy::CLOSE_PAGE
-                          : RowBufPolicy::OPEN_PAGE),
-      last_trans_clk_(0), write_draining_(0) {
+      pending_rd_q_(config.trans_queue_size),
+      pending_wr_q_(config.trans_queue_size), return_seq_(0),
+      row_buf_policy_(RowBufPolicy::OPEN_PAGE),
+      row_last_use_(config.ranks * config.banks, 0),
+      row_predictor_(config.ranks * config.banks, 1),
+      policy_closed_row_(config.ranks * config.banks, -1),
+      row_conflict_(config.ranks * config.banks, false),
+      cmd_trace_ring_(nullptr), last_trans_clk_(0), write_draining_(0),
+      last_drain_rank_(-1),
+      qos_weighted_(config.qos_arbitration == "WEIGHTED"),
+      qos_pass_(config.qos_classes, 0), qos_vtime_(0),
+      qos_heads_(config.qos_classes, -1),
+      token_cost_(1000 * static_cast<uint64_t>(config.burst_cycle)),
+      token_depth_(token_cost_ * config.trans_queue_size),
+      last_rw_clk_(config.sub_channels, 0),
+      last_rw_was_write_(config.sub_channels, false),
+      last_rw_rank_(config.sub_channels, -1),
+      idle_until_(0), skipped_cycles_(0), num_trans_scheduled_(0),
+      rank_idle_start_(config.ranks, 0), predicted_idle_(config.ranks, 0.0),
+      pd_enter_clk_(config.ranks, 0), pd_wake_clk_(config.ranks, 0) {
+  // the energy saved over an idle period of L cycles is (standby - pd) *
+  // (L - tXP), weighed against the standby energy of the tXP exit cycles
+  double standby[2] = {config_.pre_stb_energy_inc, config_.act_stb_energy_inc};
+  double pd[2] = {config_.pre_pd_energy_inc, config_.act_pd_energy_inc};
+  for (int i = 0; i < 2; i++) {
+    pd_break_even_[i] =
+        standby[i] > pd[i]
+            ? config_.tXP * (1.0 + config_.power_down_latency_weight *
+                                       standby[i] / (standby[i] - pd[i]))
+            : std::numeric_limits<double>::max();
+  }
+  if (config_.row_buf_policy == "CLOSE_PAGE") {
+    row_buf_policy_ = RowBufPolicy::CLOSE_PAGE;
+  } else if (config_.row_buf_policy == "TIMEOUT") {
+    row_buf_policy_ = RowBufPolicy::TIMEOUT;
+  } else if (config_.row_buf_policy == "PREDICTOR") {
+    row_buf_policy_ = RowBufPolicy::PREDICTOR;
+  } else if (config_.row_buf_policy != "OPEN_PAGE") {
+    std::cerr << "Unsupported row buffer policy " << config_.row_buf_policy
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  size_t queue_size = static_cast<size_t>(config_.trans_queue_size) *
+                      config_.sub_channels * config_.qos_classes;
   if (is_unified_queue_) {
-    unified_queue_.reserve(config_.trans_queue_size);
+    unified_queue_.reserve(queue_size);
   } else {
-    read_queue_.reserve(config_.trans_queue_size);
-    write_buffer_.reserve(config_.trans_queue_size);
+    read_queue_.reserve(queue_size);
+    write_buffer_.reserve(queue_size);
+  }
+  // the caps are shares of one burst per burst_cycle on each sub-channel,
+  // the tokens are in 1/1000 of a burst
+  for (double share : config_.qos_source_caps) {
+    uint64_t rate = share > 0.0 ? std::max<uint64_t>(
+                                      std::llround(share * 1000.0), 1)
+                                : 0;
+    source_token_rate_.push_back(rate * config_.sub_channels);
+  }
+  for (int weight : config_.qos_weights) {
+    qos_stride_.push_back(kQoSStrideScale / weight);
+  }
+  source_tokens_.assign(source_token_rate_.size(), token_depth_);
+  source_token_clk_.assign(source_token_rate_.size(), 0);
+  InitStatHandles();
+  if (config_.profile) {
+    profiler_.reset(new Profiler());
+    channel_state_.SetProfiler(profiler_.get());
+    cmd_queue_.SetProfiler(profiler_.get());
   }
 
 #ifdef CMD_TRACE
@@ -38,33 +109,110 @@ Controller::Controller(int channel, const Config &config, const Timing &timing)
 #endif  // CMD_TRACE
 }
 
-std::pair<uint64_t, int> Controller::ReturnDoneTrans(uint64_t clk) {
-  auto it = return_queue_.begin();
-  while (it != return_queue_.end()) {
-    if (clk >= it->complete_cycle) {
-      if (it->is_write) {
-        simple_stats_.Increment("num_writes_done");
+void Controller::InitStatHandles() {
+  num_cycles_stat_ = simple_stats_.Counter("num_cycles");
+  reads_done_stat_ = simple_stats_.Counter("num_reads_done");
+  writes_done_stat_ = simple_stats_.Counter("num_writes_done");
+  read_cmds_stat_ = simple_stats_.Counter("num_read_cmds");
+  write_cmds_stat_ = simple_stats_.Counter("num_write_cmds");
+  read_row_hits_stat_ = simple_stats_.Counter("num_read_row_hits");
+  write_row_hits_stat_ = simple_stats_.Counter("num_write_row_hits");
+  act_cmds_stat_ = simple_stats_.Counter("num_act_cmds");
+  pre_cmds_stat_ = simple_stats_.Counter("num_pre_cmds");
+  ref_cmds_stat_ = simple_stats_.Counter("num_ref_cmds");
+  refb_cmds_stat_ = simple_stats_.Counter("num_refb_cmds");
+  srefe_cmds_stat_ = simple_stats_.Counter("num_srefe_cmds");
+  srefx_cmds_stat_ = simple_stats_.Counter("num_srefx_cmds");
+  pde_cmds_stat_ = simple_stats_.Counter("num_pde_cmds");
+  pdx_cmds_stat_ = simple_stats_.Counter("num_pdx_cmds");
+  hbm_dual_cmds_stat_ = simple_stats_.Counter("hbm_dual_cmds");
+  sub_channel_cmds_stat_ = simple_stats_.Counter("sub_channel_cmds");
+  epoch_num_stat_ = simple_stats_.Counter("epoch_num");
+  write_drains_stat_ = simple_stats_.Counter("num_write_drains");
+  turnaround_cycles_stat_ = simple_stats_.Counter("rw_turnaround_cycles");
+  rank_switch_cycles_stat_ = simple_stats_.Counter("rank_switch_cycles");
+  timeout_pres_stat_ = simple_stats_.Counter("num_timeout_pres");
+  predicted_pres_stat_ = simple_stats_.Counter("num_predicted_pres");
+  row_reopens_stat_ = simple_stats_.Counter("num_row_reopens");
+  sref_cycles_stat_ = simple_stats_.VecCounter("sref_cycles");
+  all_bank_idle_cycles_stat_ =
+      simple_stats_.VecCounter("all_bank_idle_cycles");
+  rank_active_cycles_stat_ = simple_stats_.VecCounter("rank_active_cycles");
+  act_pd_cycles_stat_ = simple_stats_.VecCounter("act_pd_cycles");
+  pre_pd_cycles_stat_ = simple_stats_.VecCounter("pre_pd_cycles");
+  row_buf_hits_stat_ = simple_stats_.VecCounter("row_buf_hits");
+  row_buf_conflicts_stat_ = simple_stats_.VecCounter("row_buf_conflicts");
+  row_buf_empties_stat_ = simple_stats_.VecCounter("row_buf_empties");
+  read_latency_stat_ = simple_stats_.Histo("read_latency");
+  write_latency_stat_ = simple_stats_.Histo("write_latency");
+  interarrival_latency_stat_ = simple_stats_.Histo("interarrival_latency");
+  pd_wakeup_latency_stat_ = simple_stats_.Histo("read_pd_wakeup_latency");
+  if (config_.qos_classes > 1) {
+    qos_starved_stat_ = simple_stats_.Counter("num_qos_starved");
+    qos_reads_done_stat_ = simple_stats_.VecCounter("qos_reads_done");
+    qos_writes_done_stat_ = simple_stats_.VecCounter("qos_writes_done");
+    for (int i = 0; i < config_.qos_classes; i++) {
+      qos_read_latency_stats_.push_back(simple_stats_.Histo(
+          "read_class" + std::to_string(i) + "_latency"));
+    }
+  }
+}
+
+const std::vector<Transaction> &Controller::ReturnDoneTrans(uint64_t clk) {
+  done_trans_.clear();
+  while (!return_queue_.empty() &&
+         clk >= return_queue_.front().trans.complete_cycle) {
+    std::pop_heap(return_queue_.begin(), return_queue_.end(), ReturnsLater);
+    const Transaction &trans = return_queue_.back().trans;
+    if (trans.is_write) {
+      simple_stats_.Increment(writes_done_stat_);
+    } else {
+      simple_stats_.Increment(reads_done_stat_);
+      simple_stats_.AddValue(read_latency_stat_, clk_ - trans.added_cycle);
+    }
+    if (config_.qos_classes > 1) {
+      if (trans.is_write) {
+        simple_stats_.IncrementVec(qos_writes_done_stat_, trans.qos_class);
       } else {
-        simple_stats_.Increment("num_reads_done");
-        simple_stats_.AddValue("read_latency", clk_ - it->added_cycle);
+        simple_stats_.IncrementVec(qos_reads_done_stat_, trans.qos_class);
+        simple_stats_.AddValue(qos_read_latency_stats_[trans.qos_class],
+                               clk_ - trans.added_cycle);
       }
-      auto pair = std::make_pair(it->addr, it->is_write);
-      it = return_queue_.erase(it);
-      return pair;
-    } else {
-      ++it;
     }
+    done_trans_.push_back(trans);
+    return_queue_.pop_back();
   }
-  return std::make_pair(-1, -1);
+  return done_trans_;
+}
+
+void Controller::AddToReturnQueue(const Transaction &trans) {
+  return_queue_.push_back(ReturnEntry{trans, return_seq_++});
+  std::push_heap(return_queue_.begin(), return_queue_.end(), ReturnsLater);
 }
 
 void Controller::ClockTick() {
+  /// Nothing can happen before idle_until_, so only keep the clock going and
+  /// leave the per-cycle bookkeeping to CreditIdleCycles.
+  if (clk_ < idle_until_) {
+    clk_++;
+    skipped_cycles_++;
+    ProfileCount(profiler_.get(), ProfileEvent::IDLE_TICKS);
+    return;
+  }
+  CreditIdleCycles();
+  ProfileCount(profiler_.get(), ProfileEvent::TICKS);
+  ProfileScope scope(profiler_.get(), ProfilePart::REFRESH);
+
   // update refresh counter
   /// Calculate if this cycle should do refresh, and append the refresh command
   /// into the refresh_q_. Here, the refresh controller will only send REFRESH
   /// or REFRESH_BANK command into the refresh_q_.
   refresh_.ClockTick();
+#ifdef LATENCY_BREAKDOWN
+  latency_breakdown_.TrackRefresh(clk_);
+#endif  // LATENCY_BREAKDOWN
 
+  scope.Next(ProfilePart::COMMAND_SELECT);
   bool cmd_issued = false;
   Command cmd;
   /// If the refresh_q_ is not empty, we will do some refresh.
@@ -93,23 +241,56 @@ void Controller::ClockTick() {
       if (second_cmd.IsValid()) {
         if (second_cmd.IsReadWrite() != cmd.IsReadWrite()) {
           IssueCommand(second_cmd);
-          simple_stats_.Increment("hbm_dual_cmds");
+          simple_stats_.Increment(hbm_dual_cmds_stat_);
+        }
+      }
+    }
+
+    if (!config_.shared_cmd_bus) {
+      // the other sub-channels have command buses of their own
+      int issued_sub_channel = config_.SubChannel(cmd.Rank());
+      for (int i = 0; i < config_.sub_channels; i++) {
+        if (i == issued_sub_channel) {
+          continue;
+        }
+        auto sub_channel_cmd = cmd_queue_.GetCommandToIssue(i);
+        if (sub_channel_cmd.IsValid()) {
+          IssueCommand(sub_channel_cmd);
+          simple_stats_.Increment(sub_channel_cmds_stat_);
         }
       }
     }
+#ifdef LATENCY_BREAKDOWN
+    // the next refresh may be up once one is issued
+    latency_breakdown_.TrackRefresh(clk_);
+#endif  // LATENCY_BREAKDOWN
+  }
+
+  // the command bus is free, close a row that timed out
+  if (!cmd_issued && row_buf_policy_ == RowBufPolicy::TIMEOUT) {
+    cmd_issued = CloseTimedOutRow();
   }
 
   // power updates pt 1
+  scope.Next(ProfilePart::POWER);
   for (int i = 0; i < config_.ranks; i++) {
     if (channel_state_.IsRankSelfRefreshing(i)) {
-      simple_stats_.IncrementVec("sref_cycles", i);
+      simple_stats_.IncrementVec(sref_cycles_stat_, i);
+    } else if (channel_state_.IsRankPoweredDown(i)) {
+      if (channel_state_.IsRankActivePowerDown(i)) {
+        simple_stats_.IncrementVec(act_pd_cycles_stat_, i);
+        channel_state_.rank_idle_cycles[i] = 0;
+      } else {
+        simple_stats_.IncrementVec(pre_pd_cycles_stat_, i);
+        channel_state_.rank_idle_cycles[i] += 1;
+      }
     } else {
       bool all_idle = channel_state_.IsAllBankIdleInRank(i);
       if (all_idle) {
-        simple_stats_.IncrementVec("all_bank_idle_cycles", i);
+        simple_stats_.IncrementVec(all_bank_idle_cycles_stat_, i);
         channel_state_.rank_idle_cycles[i] += 1;
       } else {
-        simple_stats_.IncrementVec("rank_active_cycles", i);
+        simple_stats_.IncrementVec(rank_active_cycles_stat_, i);
         // reset
         channel_state_.rank_idle_cycles[i] = 0;
       }
@@ -128,6 +309,7 @@ void Controller::ClockTick() {
           cmd = channel_state_.GetReadyCommand(cmd, clk_);
           if (cmd.IsValid()) {
             IssueCommand(cmd);
+            cmd_issued = true;
             break;
           }
         }
@@ -136,10 +318,12 @@ void Controller::ClockTick() {
             channel_state_.rank_idle_cycles[i] >= config_.sref_threshold) {
           auto addr = Address();
           addr.rank = i;
+          // a powered down rank is woken up first
           auto cmd = Command(CommandType::SREF_ENTER, addr, -1);
           cmd = channel_state_.GetReadyCommand(cmd, clk_);
           if (cmd.IsValid()) {
             IssueCommand(cmd);
+            cmd_issued = true;
             break;
           }
         }
@@ -147,14 +331,519 @@ void Controller::ClockTick() {
     }
   }
 
+  // power updates pt 3: power down idle ranks
+  if (config_.enable_power_down && !cmd_issued) {
+    PowerDownIdleRanks();
+  }
+
+  scope.Next(ProfilePart::SCHEDULE);
   ScheduleTransaction();
   clk_++;
   cmd_queue_.ClockTick();
-  simple_stats_.Increment("num_cycles");
+  simple_stats_.Increment(num_cycles_stat_);
+  if (config_.skip_idle_cycles) {
+    scope.Next(ProfilePart::NEXT_EVENT);
+    idle_until_ = NextEventCycle();
+  }
   return;
 }
 
-bool Controller::WillAcceptTransaction(uint64_t hex_addr, bool is_write) const {
+uint64_t Controller::NextEventCycle() const {
+  // a write drain would be triggered
+  if (ShouldStartWriteDrain()) {
+    return clk_;
+  }
+
+  // a transaction can be moved into the command queue, or will be once its
+  // source is under its bandwidth cap
+  uint64_t next = std::min(refresh_.NextRefreshCycle(),
+                           cmd_queue_.GetEarliestReadyCycle());
+  const std::vector<Transaction> &queue = is_unified_queue_ ? unified_queue_
+                                          : write_draining_ > 0
+                                              ? write_buffer_
+                                              : read_queue_;
+  for (const auto &trans : queue) {
+    const Address &addr = trans.mapped_addr;
+    if (!cmd_queue_.WillAcceptCommand(addr.rank, addr.bankgroup, addr.bank)) {
+      continue;
+    }
+    if (!Throttled(trans)) {
+      return clk_;
+    }
+    next = std::min(next, ThrottledUntil(trans.source));
+  }
+
+  if (channel_state_.IsRefreshWaiting()) {
+    next = std::min(
+        next, channel_state_.GetReadyCycle(channel_state_.PendingRefCommand()));
+  }
+  if (row_buf_policy_ == RowBufPolicy::TIMEOUT) {
+    next = std::min(next, NextRowTimeoutCycle());
+  }
+
+  if (config_.enable_self_refresh) {
+    for (int i = 0; i < config_.ranks; i++) {
+      if (channel_state_.IsRankSelfRefreshing(i)) {
+        if (!cmd_queue_.rank_q_empty[i]) {
+          return clk_;
+        }
+      } else if (cmd_queue_.rank_q_empty[i] &&
+                 channel_state_.IsAllBankIdleInRank(i)) {
+        // the idle counter is bumped once more before it is checked
+        uint64_t idle =
+            static_cast<uint64_t>(channel_state_.rank_idle_cycles[i]) + 1;
+        uint64_t threshold = static_cast<uint64_t>(config_.sref_threshold);
+        uint64_t sref_clk = idle >= threshold ? clk_ : clk_ + threshold - idle;
+        auto addr = Address();
+        addr.rank = i;
+        auto cmd = Command(CommandType::SREF_ENTER, addr, -1);
+        sref_clk = std::max(sref_clk, channel_state_.GetReadyCycle(cmd));
+        next = std::min(next, sref_clk);
+      }
+    }
+  }
+
+  if (config_.enable_power_down) {
+    for (int i = 0; i < config_.ranks; i++) {
+      if (!CanPowerDown(i)) {
+        continue;
+      }
+      uint64_t pd_clk = clk_;
+      if (config_.power_down_policy == PowerDownPolicy::TIMEOUT) {
+        pd_clk = rank_idle_start_[i] +
+                 static_cast<uint64_t>(config_.power_down_threshold);
+      } else if (!PredictsLongIdle(i)) {
+        continue;
+      }
+      auto addr = Address();
+      addr.rank = i;
+      auto cmd = Command(CommandType::PD_ENTER, addr, -1);
+      pd_clk = std::max(pd_clk, channel_state_.GetReadyCycle(cmd));
+      next = std::min(next, pd_clk);
+    }
+  }
+  return std::max(next, clk_);
+}
+
+bool Controller::CanPowerDown(int rank) const {
+  return !channel_state_.IsRankSelfRefreshing(rank) &&
+         !channel_state_.IsRankPoweredDown(rank) &&
+         cmd_queue_.rank_q_empty[rank] &&
+         !channel_state_.IsRefreshWaiting(rank) &&
+         !HasTransactionToSchedule(rank);
+}
+
+bool Controller::PredictsLongIdle(int rank) const {
+  bool active = !channel_state_.IsAllBankIdleInRank(rank);
+  return predicted_idle_[rank] >=
+         std::max(pd_break_even_[active ? 1 : 0],
+                  static_cast<double>(config_.tCKE));
+}
+
+void Controller::PowerDownIdleRanks() {
+  for (int i = 0; i < config_.ranks; i++) {
+    if (!CanPowerDown(i)) {
+      continue;
+    }
+    if (config_.power_down_policy == PowerDownPolicy::TIMEOUT) {
+      if (clk_ - rank_idle_start_[i] <
+          static_cast<uint64_t>(config_.power_down_threshold)) {
+        continue;
+      }
+    } else if (!PredictsLongIdle(i)) {
+      continue;
+    }
+    auto addr = Address();
+    addr.rank = i;
+    auto cmd = Command(CommandType::PD_ENTER, addr, -1);
+    cmd = channel_state_.GetReadyCommand(cmd, clk_);
+    if (cmd.IsValid()) {
+      IssueCommand(cmd);
+      break;
+    }
+  }
+}
+
+bool Controller::HasTransactionToSchedule(int rank) const {
+  // the queue ScheduleTransaction takes from, the buffered writes may wait
+  const std::vector<Transaction> &queue = is_unified_queue_ ? unified_queue_
+                                          : write_draining_ > 0
+                                              ? write_buffer_
+                                              : read_queue_;
+  for (const auto &trans : queue) {
+    if (trans.mapped_addr.rank == rank) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Controller::UpdateIdlePrediction(int rank) {
+  double idle = static_cast<double>(clk_ - rank_idle_start_[rank]);
+  predicted_idle_[rank] = 0.75 * predicted_idle_[rank] + 0.25 * idle;
+}
+
+bool Controller::CloseTimedOutRow() {
+  uint64_t timeout = static_cast<uint64_t>(config_.row_buf_timeout);
+  for (int i = 0; i < config_.ranks; i++) {
+    if (channel_state_.IsRankSelfRefreshing(i) ||
+        channel_state_.IsRankPoweredDown(i)) {
+      continue;
+    }
+    for (int j = 0; j < config_.bankgroups; j++) {
+      for (int k = 0; k < config_.banks_per_group; k++) {
+        if (!channel_state_.IsRowOpen(i, j, k) ||
+            clk_ < row_last_use_[BankIndex(i, j, k)] + timeout ||
+            clk_ < channel_state_.PrechargeReadyCycle(i, j, k) ||
+            cmd_queue_.HasPendingRowHit(i, j, k)) {
+          continue;
+        }
+        Address addr(channel_id_, i, j, k, channel_state_.OpenRow(i, j, k),
+                     -1);
+        IssueCommand(Command(CommandType::PRECHARGE, addr, 0));
+        simple_stats_.Increment(timeout_pres_stat_);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+uint64_t Controller::NextRowTimeoutCycle() const {
+  uint64_t timeout = static_cast<uint64_t>(config_.row_buf_timeout);
+  uint64_t next = std::numeric_limits<uint64_t>::max();
+  for (int i = 0; i < config_.ranks; i++) {
+    if (channel_state_.IsRankSelfRefreshing(i) ||
+        channel_state_.IsRankPoweredDown(i)) {
+      continue;
+    }
+    for (int j = 0; j < config_.bankgroups; j++) {
+      for (int k = 0; k < config_.banks_per_group; k++) {
+        // a row with pending hits is closed no sooner than they are issued
+        if (!channel_state_.IsRowOpen(i, j, k) ||
+            cmd_queue_.HasPendingRowHit(i, j, k)) {
+          continue;
+        }
+        next = std::min(
+            next, std::max(row_last_use_[BankIndex(i, j, k)] + timeout,
+                           channel_state_.PrechargeReadyCycle(i, j, k)));
+      }
+    }
+  }
+  return next;
+}
+
+Command Controller::PredictAutoPrecharge(const Command &cmd) {
+  if (!cmd.IsReadWrite() ||
+      row_predictor_[BankIndex(cmd.Rank(), cmd.Bankgroup(), cmd.Bank())] < 2 ||
+      cmd_queue_.HasPendingRowHit(cmd.Rank(), cmd.Bankgroup(), cmd.Bank())) {
+    return cmd;
+  }
+  simple_stats_.Increment(predicted_pres_stat_);
+  return Command(cmd.IsRead() ? CommandType::READ_PRECHARGE
+                              : CommandType::WRITE_PRECHARGE,
+                 cmd.addr, cmd.hex_addr);
+}
+
+void Controller::TrainRowPredictor(int bank_idx, bool closed) {
+  int &counter = row_predictor_[bank_idx];
+  counter = closed ? std::min(counter + 1, 3) : std::max(counter - 1, 0);
+}
+
+void Controller::UpdateRowBufState(const Command &cmd) {
+  if (cmd.IsRankCMD() || cmd.IsSameBankRefresh()) {
+    return;
+  }
+  int bank_idx = BankIndex(cmd.Rank(), cmd.Bankgroup(), cmd.Bank());
+  int open_row =
+      channel_state_.OpenRow(cmd.Rank(), cmd.Bankgroup(), cmd.Bank());
+  switch (cmd.cmd_type) {
+    case CommandType::ACTIVATE:
+      if (policy_closed_row_[bank_idx] >= 0) {
+        // closing the last row was right unless this opens it again
+        bool reopened = cmd.Row() == policy_closed_row_[bank_idx];
+        if (reopened) {
+          simple_stats_.Increment(row_reopens_stat_);
+        }
+        TrainRowPredictor(bank_idx, !reopened);
+        policy_closed_row_[bank_idx] = -1;
+      }
+      row_last_use_[bank_idx] = clk_;
+      break;
+    case CommandType::PRECHARGE:
+      // on-demand precharges carry the row of the command that needs the
+      // bank, refresh ones row -1 and timeout ones the open row
+      row_conflict_[bank_idx] = cmd.Row() >= 0 && cmd.Row() != open_row;
+      if (row_conflict_[bank_idx]) {
+        TrainRowPredictor(bank_idx, true);
+      }
+      policy_closed_row_[bank_idx] = cmd.Row() == open_row ? open_row : -1;
+      break;
+    case CommandType::READ:
+    case CommandType::WRITE:
+    case CommandType::READ_PRECHARGE:
+    case CommandType::WRITE_PRECHARGE:
+      if (channel_state_.RowHitCount(cmd.Rank(), cmd.Bankgroup(),
+                                     cmd.Bank()) != 0) {
+        simple_stats_.IncrementVec(row_buf_hits_stat_, bank_idx);
+        TrainRowPredictor(bank_idx, false);
+      } else if (row_conflict_[bank_idx]) {
+        simple_stats_.IncrementVec(row_buf_conflicts_stat_, bank_idx);
+      } else {
+        simple_stats_.IncrementVec(row_buf_empties_stat_, bank_idx);
+      }
+      row_last_use_[bank_idx] = clk_;
+      if (cmd.cmd_type == CommandType::READ_PRECHARGE ||
+          cmd.cmd_type == CommandType::WRITE_PRECHARGE) {
+        row_conflict_[bank_idx] = false;
+        policy_closed_row_[bank_idx] = open_row;
+      }
+      break;
+    default: break;
+  }
+}
+
+uint64_t Controller::NextReturnCycle() const {
+  return return_queue_.empty() ? std::numeric_limits<uint64_t>::max()
+                               : return_queue_.front().trans.complete_cycle;
+}
+
+void Controller::CreditIdleCycles() {
+  if (skipped_cycles_ == 0) {
+    return;
+  }
+  for (int i = 0; i < config_.ranks; i++) {
+    if (channel_state_.IsRankSelfRefreshing(i)) {
+      simple_stats_.IncrementVecBy(sref_cycles_stat_, i, skipped_cycles_);
+    } else if (channel_state_.IsRankPoweredDown(i)) {
+      if (channel_state_.IsRankActivePowerDown(i)) {
+        simple_stats_.IncrementVecBy(act_pd_cycles_stat_, i, skipped_cycles_);
+        channel_state_.rank_idle_cycles[i] = 0;
+      } else {
+        simple_stats_.IncrementVecBy(pre_pd_cycles_stat_, i, skipped_cycles_);
+        channel_state_.rank_idle_cycles[i] += skipped_cycles_;
+      }
+    } else if (channel_state_.IsAllBankIdleInRank(i)) {
+      simple_stats_.IncrementVecBy(all_bank_idle_cycles_stat_, i,
+                                   skipped_cycles_);
+      channel_state_.rank_idle_cycles[i] += skipped_cycles_;
+    } else {
+      simple_stats_.IncrementVecBy(rank_active_cycles_stat_, i,
+                                   skipped_cycles_);
+      channel_state_.rank_idle_cycles[i] = 0;
+    }
+  }
+  simple_stats_.IncrementBy(num_cycles_stat_, skipped_cycles_);
+  refresh_.FastForward(skipped_cycles_);
+  cmd_queue_.FastForward(skipped_cycles_);
+  skipped_cycles_ = 0;
+}
+
+uint64_t Controller::FunctionalAccess(uint64_t hex_addr, bool is_write) {
+  Transaction trans(hex_addr, is_write);
+  trans.mapped_addr = config_.AddressMapping(hex_addr);
+  uint64_t latency = is_write ? config_.write_delay : config_.read_delay;
+  switch (channel_state_.FunctionalAccess(TransToCommand(trans))) {
+    case CommandType::ACTIVATE: latency += config_.tRCD; break;
+    case CommandType::PRECHARGE: latency += config_.tRP + config_.tRCD; break;
+    case CommandType::SREF_EXIT: latency += config_.tXS + config_.tRCD; break;
+    case CommandType::PD_EXIT: latency += config_.tXP; break;
+    default: break;
+  }
+  return latency;
+}
+
+void Controller::FunctionalDrain(std::vector<Transaction> &done) {
+  CreditIdleCycles();
+  for (const auto &entry : return_queue_) {
+    done.push_back(entry.trans);
+  }
+  return_queue_.clear();
+
+  // every pending transaction is either waiting in a transaction queue or
+  // has its command in the command queue
+  std::vector<uint64_t> addrs;
+  for (const auto &trans : unified_queue_) {
+    addrs.push_back(trans.addr);
+  }
+  for (const auto &trans : read_queue_) {
+    addrs.push_back(trans.addr);
+  }
+  for (const auto &trans : write_buffer_) {
+    addrs.push_back(trans.addr);
+  }
+  std::vector<Command> cmds;
+  cmd_queue_.Drain(cmds);
+  for (const auto &cmd : cmds) {
+    addrs.push_back(cmd.hex_addr);
+  }
+  unified_queue_.clear();
+  read_queue_.clear();
+  write_buffer_.clear();
+  write_draining_ = 0;
+
+  Transaction trans;
+  for (uint64_t addr : addrs) {
+    // writes were returned when they were buffered
+    if (pending_wr_q_.PopFront(addr, trans)) {
+      FunctionalAccess(addr, true);
+    }
+    if (pending_rd_q_.Count(addr) > 0) {
+      uint64_t complete_cycle = clk_ + FunctionalAccess(addr, false);
+      while (pending_rd_q_.PopFront(addr, trans)) {
+        trans.complete_cycle = complete_cycle;
+        done.push_back(trans);
+      }
+    }
+  }
+  idle_until_ = clk_;
+}
+
+void Controller::SetBankTemperatures(const double *bank_temps) {
+  CreditIdleCycles();
+  refresh_.SetBankTemperatures(bank_temps);
+  // the next refresh may be due before the idle cycles known so far end
+  idle_until_ = clk_;
+}
+
+void Controller::FunctionalFastForward(uint64_t cycles) {
+  CreditIdleCycles();
+  clk_ += cycles;
+  refresh_.FunctionalFastForward(cycles);
+  cmd_queue_.FastForward(cycles);
+  idle_until_ = clk_;
+}
+
+Controller::SampleCounts Controller::GetSampleCounts() const {
+  SampleCounts counts;
+  counts.reads_done = simple_stats_.CounterTotal(reads_done_stat_);
+  counts.writes_done = simple_stats_.CounterTotal(writes_done_stat_);
+  counts.read_cmds = simple_stats_.CounterTotal(read_cmds_stat_);
+  counts.write_cmds = simple_stats_.CounterTotal(write_cmds_stat_);
+  counts.row_hits = simple_stats_.CounterTotal(read_row_hits_stat_) +
+                    simple_stats_.CounterTotal(write_row_hits_stat_);
+  counts.act_cmds = simple_stats_.CounterTotal(act_cmds_stat_);
+  counts.pre_cmds = simple_stats_.CounterTotal(pre_cmds_stat_);
+  counts.ref_cmds = simple_stats_.CounterTotal(ref_cmds_stat_) +
+                    simple_stats_.CounterTotal(refb_cmds_stat_);
+  uint64_t num_latencies;
+  simple_stats_.HistoTotal(read_latency_stat_, num_latencies,
+                           counts.read_latency_sum);
+  return counts;
+}
+
+void Controller::Save(CheckpointWriter &writer) const {
+  writer.Put(clk_);
+  simple_stats_.Save(writer);
+  channel_state_.Save(writer);
+  cmd_queue_.Save(writer);
+  refresh_.Save(writer);
+  writer.Put(unified_queue_);
+  writer.Put(read_queue_);
+  writer.Put(write_buffer_);
+  pending_rd_q_.Save(writer);
+  pending_wr_q_.Save(writer);
+  // the heap is stored as laid out, ties are broken by seq anyway
+  writer.Put(static_cast<uint64_t>(return_queue_.size()));
+  for (const auto &entry : return_queue_) {
+    writer.Put(entry.trans);
+    writer.Put(entry.seq);
+  }
+  writer.Put(return_seq_);
+  writer.Put(last_trans_clk_);
+  writer.Put(write_draining_);
+  writer.Put(last_drain_rank_);
+  writer.Put(qos_pass_);
+  writer.Put(qos_vtime_);
+  writer.Put(source_tokens_);
+  writer.Put(source_token_clk_);
+  writer.Put(last_rw_clk_);
+  writer.Put(last_rw_was_write_);
+  writer.Put(last_rw_rank_);
+  writer.Put(idle_until_);
+  writer.Put(skipped_cycles_);
+  writer.Put(num_trans_scheduled_);
+  writer.Put(rank_idle_start_);
+  writer.Put(predicted_idle_);
+  writer.Put(pd_enter_clk_);
+  writer.Put(pd_wake_clk_);
+  writer.Put(row_last_use_);
+  writer.Put(row_predictor_);
+  writer.Put(policy_closed_row_);
+  writer.Put(row_conflict_);
+#ifdef LATENCY_BREAKDOWN
+  latency_breakdown_.Save(writer);
+#endif  // LATENCY_BREAKDOWN
+}
+
+void Controller::Load(CheckpointReader &reader) {
+  reader.Get(clk_);
+  simple_stats_.Load(reader);
+  channel_state_.Load(reader);
+  cmd_queue_.Load(reader);
+  refresh_.Load(reader);
+  reader.Get(unified_queue_);
+  reader.Get(read_queue_);
+  reader.Get(write_buffer_);
+  pending_rd_q_.Load(reader);
+  pending_wr_q_.Load(reader);
+  uint64_t num_returns;
+  reader.Get(num_returns);
+  return_queue_.clear();
+  for (uint64_t i = 0; i < num_returns; i++) {
+    ReturnEntry entry;
+    reader.Get(entry.trans);
+    reader.Get(entry.seq);
+    return_queue_.push_back(entry);
+  }
+  reader.Get(return_seq_);
+  reader.Get(last_trans_clk_);
+  reader.Get(write_draining_);
+  reader.Get(last_drain_rank_);
+  reader.Get(qos_pass_);
+  reader.Get(qos_vtime_);
+  reader.Get(source_tokens_);
+  reader.Get(source_token_clk_);
+  // the caps are policy, the sources capped since the checkpoint start with
+  // full buckets
+  source_tokens_.resize(source_token_rate_.size(), token_depth_);
+  source_token_clk_.resize(source_token_rate_.size(), clk_);
+  reader.Get(last_rw_clk_);
+  reader.Get(last_rw_was_write_);
+  reader.Get(last_rw_rank_);
+  reader.Get(idle_until_);
+  reader.Get(skipped_cycles_);
+  reader.Get(num_trans_scheduled_);
+  reader.Get(rank_idle_start_);
+  reader.Get(predicted_idle_);
+  reader.Get(pd_enter_clk_);
+  reader.Get(pd_wake_clk_);
+  reader.Get(row_last_use_);
+  reader.Get(row_predictor_);
+  reader.Get(policy_closed_row_);
+  reader.Get(row_conflict_);
+#ifdef LATENCY_BREAKDOWN
+  latency_breakdown_.Load(reader);
+#endif  // LATENCY_BREAKDOWN
+}
+
+bool Controller::WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                                       int qos_class) const {
+  if (config_.sub_channels > 1 || config_.qos_classes > 1) {
+    // every sub-channel and class has trans_queue_size entries of the queue
+    const std::vector<Transaction> &queue = is_unified_queue_ ? unified_queue_
+                                            : is_write        ? write_buffer_
+                                                              : read_queue_;
+    int sub_channel = config_.SubChannel(config_.AddressMapping(hex_addr).rank);
+    int queued = 0;
+    for (const auto &trans : queue) {
+      if (config_.SubChannel(trans.mapped_addr.rank) == sub_channel &&
+          trans.qos_class == qos_class) {
+        queued++;
+      }
+    }
+    return queued < config_.trans_queue_size;
+  }
   if (is_unified_queue_) {
     return unified_queue_.size() < unified_queue_.capacity();
   } else if (!is_write) {
@@ -165,8 +854,21 @@ bool Controller::WillAcceptTransaction(uint64_t hex_addr, bool is_write) const {
 }
 
 bool Controller::AddTransaction(Transaction trans) {
+  if (trans.qos_class < 0 || trans.qos_class >= config_.qos_classes ||
+      trans.source < 0) {
+    std::cerr << "Transaction of source " << trans.source << " has class "
+              << trans.qos_class << ", not one of the " << config_.qos_classes
+              << " qos_classes" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  // wake up, the new transaction may be scheduled right away
+  idle_until_ = clk_;
   trans.added_cycle = clk_;
-  simple_stats_.AddValue("interarrival_latency", clk_ - last_trans_clk_);
+  trans.mapped_addr = config_.AddressMapping(trans.addr);
+#ifdef LATENCY_BREAKDOWN
+  latency_breakdown_.Stamp(trans, clk_);
+#endif  // LATENCY_BREAKDOWN
+  simple_stats_.AddValue(interarrival_latency_stat_, clk_ - last_trans_clk_);
   last_trans_clk_ = clk_;
 
   /// @brief If the trans is write, we should first check if there has been a
@@ -180,8 +882,8 @@ bool Controller::AddTransaction(Transaction trans) {
   /// append this trans in the tailing of pending read queue and also unified
   /// queue or read buffer.
   if (trans.is_write) {
-    if (pending_wr_q_.count(trans.addr) == 0) {  // can not merge writes
-      pending_wr_q_.insert(std::make_pair(trans.addr, trans));
+    if (pending_wr_q_.Count(trans.addr) == 0) {  // can not merge writes
+      pending_wr_q_.Insert(trans);
       if (is_unified_queue_) {
         unified_queue_.push_back(trans);
       } else {
@@ -189,17 +891,17 @@ bool Controller::AddTransaction(Transaction trans) {
       }
     }
     trans.complete_cycle = clk_ + 1;
-    return_queue_.push_back(trans);
+    AddToReturnQueue(trans);
     return true;
   } else {  // read
     // if in write buffer, use the write buffer value
-    if (pending_wr_q_.count(trans.addr) > 0) {
+    if (pending_wr_q_.Count(trans.addr) > 0) {
       trans.complete_cycle = clk_ + 1;
-      return_queue_.push_back(trans);
+      AddToReturnQueue(trans);
       return true;
     }
-    pending_rd_q_.insert(std::make_pair(trans.addr, trans));
-    if (pending_rd_q_.count(trans.addr) == 1) {
+    pending_rd_q_.Insert(trans);
+    if (pending_rd_q_.Count(trans.addr) == 1) {
       if (is_unified_queue_) {
         unified_queue_.push_back(trans);
       } else {
@@ -210,93 +912,336 @@ bool Controller::AddTransaction(Transaction trans) {
   }
 }
 
+bool Controller::ShouldStartWriteDrain() const {
+  if (write_draining_ > 0 || is_unified_queue_) {
+    return false;
+  }
+  // we basically have a upper and lower threshold for write buffer
+  size_t size = write_buffer_.size();
+  size_t low = static_cast<size_t>(config_.write_drain_low);
+  size_t high = std::min(static_cast<size_t>(config_.write_drain_high),
+                         write_buffer_.capacity());
+  if (size >= high) {
+    return true;
+  }
+  // the idle threshold may be below the low watermark
+  if (size > static_cast<size_t>(config_.write_drain_idle_threshold) &&
+      size > low && cmd_queue_.QueueEmpty()) {
+    return true;
+  }
+  return config_.write_drain_on_read_gap && size > low && read_queue_.empty();
+}
+
+std::vector<Transaction>::iterator Controller::NextDrainWrite() {
+  // same rank row hits, then same rank, then the oldest acceptable one
+  auto same_rank = write_buffer_.end();
+  auto oldest = write_buffer_.end();
+  for (auto it = write_buffer_.begin(); it != write_buffer_.end(); it++) {
+    const Address &addr = it->mapped_addr;
+    if (!Schedulable(*it)) {
+      continue;
+    }
+    if (oldest == write_buffer_.end()) {
+      oldest = it;
+    }
+    if (addr.rank == last_drain_rank_) {
+      if (channel_state_.OpenRow(addr.rank, addr.bankgroup, addr.bank) ==
+          addr.row) {
+        return it;
+      }
+      if (same_rank == write_buffer_.end()) {
+        same_rank = it;
+      }
+    }
+  }
+  return same_rank != write_buffer_.end() ? same_rank : oldest;
+}
+
 void Controller::ScheduleTransaction() {
   // determine whether to schedule read or write
-  if (write_draining_ == 0 && !is_unified_queue_) {
-    // we basically have a upper and lower threshold for write buffer
-    if ((write_buffer_.size() >= write_buffer_.capacity()) ||
-        (write_buffer_.size() > 8 && cmd_queue_.QueueEmpty())) {
-      write_draining_ = write_buffer_.size();
-    }
+  if (ShouldStartWriteDrain()) {
+    write_draining_ = write_buffer_.size() - config_.write_drain_low;
+    simple_stats_.Increment(write_drains_stat_);
   }
 
-  std::vector<Transaction> &queue = is_unified_queue_     ? unified_queue_
-                                    : write_draining_ > 0 ? write_buffer_
-                                                          : read_queue_;
-  for (auto it = queue.begin(); it != queue.end(); it++) {
+  std::vector<Transaction> *queue = is_unified_queue_     ? &unified_queue_
+                                    : write_draining_ > 0 ? &write_buffer_
+                                                          : &read_queue_;
+  bool batching = config_.write_drain_batching && write_draining_ > 0;
+  // up to trans_per_cycle transactions, the search resumes where the last
+  // one was taken from
+  int scheduled = 0;
+  auto it = queue->begin();
+  while (scheduled < config_.trans_per_cycle) {
+    if (batching) {
+      it = NextDrainWrite();
+    } else if (config_.qos_classes > 1) {
+      it = NextQoSTrans(*queue);
+    }
+    if (it == queue->end()) {
+      break;
+    }
+    if (!Schedulable(*it)) {
+      it++;
+      continue;
+    }
     auto cmd = TransToCommand(*it);
-    if (cmd_queue_.WillAcceptCommand(cmd.Rank(), cmd.Bankgroup(), cmd.Bank())) {
-      if (!is_unified_queue_ && cmd.IsWrite()) {
-        // Enforce R->W dependency
-        if (pending_rd_q_.count(it->addr) > 0) {
-          write_draining_ = 0;
-          break;
-        }
-        write_draining_ -= 1;
+    if (!is_unified_queue_ && cmd.IsWrite()) {
+      // Enforce R->W dependency, the drain ends and the reads go on in this
+      // cycle, or a full write buffer would restart it before they could
+      if (pending_rd_q_.Count(it->addr) > 0) {
+        write_draining_ = 0;
+        batching = false;
+        queue = &read_queue_;
+        it = queue->begin();
+        continue;
       }
-      cmd_queue_.AddCommand(cmd);
-      queue.erase(it);
+      // the drain ends once the writes it was started for are issued
+      if (write_draining_ == 0) {
+        break;
+      }
+      write_draining_ -= 1;
+      last_drain_rank_ = cmd.Rank();
+    }
+#ifdef LATENCY_BREAKDOWN
+    // the pending copy is the one that is served, it is the oldest one of
+    // its address as later ones are merged into it
+    TransactionIndex &pending = it->is_write ? pending_wr_q_ : pending_rd_q_;
+    latency_breakdown_.Stamp(*pending.Find(it->addr), clk_);
+#endif  // LATENCY_BREAKDOWN
+    if (config_.enable_power_down && cmd_queue_.rank_q_empty[cmd.Rank()]) {
+      UpdateIdlePrediction(cmd.Rank());
+    }
+    QoSScheduled(*it);
+    cmd_queue_.AddCommand(cmd);
+    it = queue->erase(it);
+    num_trans_scheduled_++;
+    scheduled++;
+  }
+}
+
+uint64_t Controller::SourceTokens(int source) const {
+  uint64_t earned =
+      source_token_rate_[source] * (clk_ - source_token_clk_[source]);
+  return std::min(source_tokens_[source] + earned, token_depth_);
+}
+
+bool Controller::Throttled(const Transaction &trans) const {
+  size_t source = static_cast<size_t>(trans.source);
+  return source < source_token_rate_.size() &&
+         source_token_rate_[source] > 0 &&
+         SourceTokens(trans.source) < token_cost_;
+}
+
+uint64_t Controller::ThrottledUntil(int source) const {
+  uint64_t missing = token_cost_ - SourceTokens(source);
+  uint64_t rate = source_token_rate_[source];
+  return clk_ + (missing + rate - 1) / rate;
+}
+
+bool Controller::Schedulable(const Transaction &trans) const {
+  const Address &addr = trans.mapped_addr;
+  return cmd_queue_.WillAcceptCommand(addr.rank, addr.bankgroup, addr.bank) &&
+         !Throttled(trans);
+}
+
+std::vector<Transaction>::iterator Controller::NextQoSTrans(
+    std::vector<Transaction> &queue) {
+  // the queue is in arrival order, the first schedulable transaction is the
+  // oldest one and the first one of each class the oldest of the class
+  std::fill(qos_heads_.begin(), qos_heads_.end(), -1);
+  uint64_t starvation = static_cast<uint64_t>(config_.qos_starvation_cycles);
+  int found = 0;
+  for (size_t i = 0; i < queue.size() && found < config_.qos_classes; i++) {
+    const Transaction &trans = queue[i];
+    if (qos_heads_[trans.qos_class] >= 0 || !Schedulable(trans)) {
+      continue;
+    }
+    if (found == 0 && starvation > 0 &&
+        clk_ - trans.added_cycle >= starvation) {
+      return queue.begin() + i;
+    }
+    qos_heads_[trans.qos_class] = static_cast<int>(i);
+    found++;
+  }
+
+  // STRICT takes the lowest class, WEIGHTED the one furthest behind in
+  // virtual time. Most of the time only one class has a transaction whose
+  // bank has room, so a class that was passed over may catch up on the
+  // others later, but by no more than a queue of transactions, or a class
+  // that was idle for long would lock the others out
+  int pick = -1;
+  for (int i = 0; i < config_.qos_classes; i++) {
+    if (qos_heads_[i] < 0) {
+      continue;
+    }
+    if (!qos_weighted_) {
+      pick = i;
       break;
     }
+    uint64_t max_lag = qos_stride_[i] * config_.trans_queue_size;
+    if (qos_vtime_ > max_lag) {
+      qos_pass_[i] = std::max(qos_pass_[i], qos_vtime_ - max_lag);
+    }
+    if (pick < 0 || qos_pass_[i] < qos_pass_[pick]) {
+      pick = i;
+    }
   }
+  return pick < 0 ? queue.end() : queue.begin() + qos_heads_[pick];
 }
 
-void Controller::IssueCommand(const Command &cmd) {
+void Controller::QoSScheduled(const Transaction &trans) {
+  size_t source = static_cast<size_t>(trans.source);
+  if (source < source_token_rate_.size() && source_token_rate_[source] > 0) {
+    source_tokens_[source] = SourceTokens(trans.source) - token_cost_;
+    source_token_clk_[source] = clk_;
+  }
+  if (config_.qos_classes == 1) {
+    return;
+  }
+  if (config_.qos_starvation_cycles > 0 &&
+      clk_ - trans.added_cycle >=
+          static_cast<uint64_t>(config_.qos_starvation_cycles)) {
+    simple_stats_.Increment(qos_starved_stat_);
+  }
+  // starving transactions are charged to their class as well
+  if (qos_weighted_) {
+    qos_vtime_ = qos_pass_[trans.qos_class];
+    qos_pass_[trans.qos_class] += qos_stride_[trans.qos_class];
+  }
+}
+
+void Controller::IssueCommand(const Command &issued) {
+  const Command cmd = row_buf_policy_ == RowBufPolicy::PREDICTOR
+                          ? PredictAutoPrecharge(issued)
+                          : issued;
+  ProfileScope scope(profiler_.get(), ProfilePart::ISSUE);
+  ProfileCount(profiler_.get(), ProfileEvent::COMMANDS_ISSUED);
 #ifdef CMD_TRACE
-  cmd_trace_ << std::left << std::setw(18) << clk_ << " " << cmd << std::endl;
+  cmd_trace_ << std::left << std::setw(18) << clk_ << " " << cmd << "\n";
 #endif  // CMD_TRACE
+  if (cmd_trace_ring_ != nullptr) {
+    cmd_trace_ring_->Push(TraceEntry{clk_, cmd.hex_addr, cmd.addr,
+                                      static_cast<int>(cmd.cmd_type)});
+  }
 #ifdef THERMAL
   // add channel in, only needed by thermal module
   thermal_calc_.UpdateCMDPower(channel_id_, cmd, clk_);
 #endif  // THERMAL
   // if read/write, update pending queue and return queue
   if (cmd.IsRead()) {
-    auto num_reads = pending_rd_q_.count(cmd.hex_addr);
-    if (num_reads == 0) {
+    if (pending_rd_q_.Count(cmd.hex_addr) == 0) {
       std::cerr << cmd.hex_addr << " not in read queue! " << std::endl;
       exit(1);
     }
     // if there are multiple reads pending return them all
-    while (num_reads > 0) {
-      auto it = pending_rd_q_.find(cmd.hex_addr);
-      it->second.complete_cycle = clk_ + config_.read_delay;
-      return_queue_.push_back(it->second);
-      pending_rd_q_.erase(it);
-      num_reads -= 1;
+    Transaction trans;
+    uint64_t wake_clk = pd_wake_clk_[cmd.Rank()];
+    while (pending_rd_q_.PopFront(cmd.hex_addr, trans)) {
+#ifdef LATENCY_BREAKDOWN
+      latency_breakdown_.Attribute(trans, cmd, clk_);
+#endif  // LATENCY_BREAKDOWN
+      // the read came while the rank was powered down or waking up
+      if (trans.added_cycle < wake_clk) {
+        simple_stats_.AddValue(
+            pd_wakeup_latency_stat_,
+            wake_clk -
+                std::max(trans.added_cycle, pd_enter_clk_[cmd.Rank()]));
+      }
+      trans.complete_cycle = clk_ + config_.read_delay;
+      AddToReturnQueue(trans);
     }
   } else if (cmd.IsWrite()) {
     // there should be only 1 write to the same location at a time
-    auto it = pending_wr_q_.find(cmd.hex_addr);
-    if (it == pending_wr_q_.end()) {
+    Transaction trans;
+    if (!pending_wr_q_.PopFront(cmd.hex_addr, trans)) {
       std::cerr << cmd.hex_addr << " not in write queue!" << std::endl;
       exit(1);
     }
-    auto wr_lat = clk_ - it->second.added_cycle + config_.write_delay;
-    simple_stats_.AddValue("write_latency", wr_lat);
-    pending_wr_q_.erase(it);
+    auto wr_lat = clk_ - trans.added_cycle + config_.write_delay;
+    simple_stats_.AddValue(write_latency_stat_, wr_lat);
+#ifdef LATENCY_BREAKDOWN
+    latency_breakdown_.Attribute(trans, cmd, clk_);
+#endif  // LATENCY_BREAKDOWN
+  }
+  if (cmd.IsReadWrite()) {
+    CountTurnaround(cmd);
+    cmd_queue_.ColumnIssued(cmd);
+    if (cmd_queue_.rank_q_empty[cmd.Rank()]) {
+      rank_idle_start_[cmd.Rank()] = clk_;
+    }
+  } else if (cmd.cmd_type == CommandType::PD_ENTER) {
+    pd_enter_clk_[cmd.Rank()] = clk_;
+  } else if (cmd.cmd_type == CommandType::PD_EXIT) {
+    pd_wake_clk_[cmd.Rank()] = clk_ + config_.tXP;
+  }
+#ifdef LATENCY_BREAKDOWN
+  if (!cmd.IsReadWrite()) {
+    latency_breakdown_.CommandIssued(cmd, clk_);
   }
+#endif  // LATENCY_BREAKDOWN
   // must update stats before states (for row hits)
+  scope.Next(ProfilePart::STATS);
+  UpdateRowBufState(cmd);
   UpdateCommandStats(cmd);
+  scope.Next(ProfilePart::TIMING_UPDATE);
   channel_state_.UpdateTimingAndStates(cmd, clk_);
+  cmd_queue_.InvalidateReadyBounds(cmd);
 }
 
-Command Controller::TransToCommand(const Transaction &trans) {
-  auto addr = config_.AddressMapping(trans.addr);
+void Controller::CountTurnaround(const Command &cmd) {
+  bool is_write = cmd.IsWrite();
+  int sub_channel = config_.SubChannel(cmd.Rank());
+  if (last_rw_clk_[sub_channel] > 0 &&
+      (is_write != last_rw_was_write_[sub_channel] ||
+       cmd.Rank() != last_rw_rank_[sub_channel])) {
+    // cycles between the two column commands beyond back to back spacing,
+    // as far as the turnaround or the rank switch could have caused them
+    uint64_t gap = clk_ - last_rw_clk_[sub_channel];
+    uint64_t spacing = static_cast<uint64_t>(
+        std::max(config_.burst_cycle, config_.tCCD_S));
+    if (is_write != last_rw_was_write_[sub_channel]) {
+      uint64_t turnaround = static_cast<uint64_t>(
+          is_write
+              ? config_.RL + config_.burst_cycle - config_.WL + config_.tRTRS
+              : config_.write_delay + config_.tWTR_S);
+      uint64_t lost = std::min(gap, turnaround);
+      if (lost > spacing) {
+        simple_stats_.IncrementBy(turnaround_cycles_stat_, lost - spacing);
+      }
+    } else if (!is_write) {
+      // reads of two ranks are tRTRS apart on the data bus, writes are not
+      uint64_t lost = std::min(
+          gap, static_cast<uint64_t>(config_.burst_cycle + config_.tRTRS));
+      if (lost > spacing) {
+        simple_stats_.IncrementBy(rank_switch_cycles_stat_, lost - spacing);
+      }
+    }
+  }
+  last_rw_clk_[sub_channel] = clk_;
+  last_rw_was_write_[sub_channel] = is_write;
+  last_rw_rank_[sub_channel] = cmd.Rank();
+}
+
+Command Controller::TransToCommand(const Transaction &trans) const {
+  // TIMEOUT and PREDICTOR close rows when the commands are issued
   CommandType cmd_type;
-  if (row_buf_policy_ == RowBufPolicy::OPEN_PAGE) {
+  if (row_buf_policy_ != RowBufPolicy::CLOSE_PAGE) {
     cmd_type = trans.is_write ? CommandType::WRITE : CommandType::READ;
   } else {
     cmd_type = trans.is_write ? CommandType::WRITE_PRECHARGE
                               : CommandType::READ_PRECHARGE;
   }
-  return Command(cmd_type, addr, trans.addr);
+  return Command(cmd_type, trans.mapped_addr, trans.addr);
 }
 
 int Controller::QueueUsage() const { return cmd_queue_.QueueUsage(); }
 
-void Controller::PrintEpochStats() {
-  simple_stats_.Increment("epoch_num");
-  simple_stats_.PrintEpochStats();
+void Controller::PrintEpochStats(StatsWriter &writer) {
+  ProfileScope scope(profiler_.get(), ProfilePart::STATS);
+  CreditIdleCycles();
+  simple_stats_.Increment(epoch_num_stat_);
+  simple_stats_.PrintEpochStats(writer);
 #ifdef THERMAL
   for (int r = 0; r < config_.ranks; r++) {
     double bg_energy = simple_stats_.RankBackgroundEnergy(r);
@@ -307,6 +1252,8 @@ void Controller::PrintEpochStats() {
 }
 
 void Controller::PrintFinalStats() {
+  ProfileScope scope(profiler_.get(), ProfilePart::STATS);
+  CreditIdleCycles();
   simple_stats_.PrintFinalStats();
 
 #ifdef THERMAL
@@ -318,36 +1265,44 @@ void Controller::PrintFinalStats() {
   return;
 }
 
+void Controller::ResetStats() {
+  CreditIdleCycles();
+  simple_stats_.Reset();
+  return;
+}
+
 void Controller::UpdateCommandStats(const Command &cmd) {
   switch (cmd.cmd_type) {
     case CommandType::READ:
     case CommandType::READ_PRECHARGE:
-      simple_stats_.Increment("num_read_cmds");
+      simple_stats_.Increment(read_cmds_stat_);
       if (channel_state_.RowHitCount(cmd.Rank(), cmd.Bankgroup(), cmd.Bank()) !=
           0) {
-        simple_stats_.Increment("num_read_row_hits");
+        simple_stats_.Increment(read_row_hits_stat_);
       }
       break;
     case CommandType::WRITE:
     case CommandType::WRITE_PRECHARGE:
-      simple_stats_.Increment("num_write_cmds");
+      simple_stats_.Increment(write_cmds_stat_);
       if (channel_state_.RowHitCount(cmd.Rank(), cmd.Bankgroup(), cmd.Bank()) !=
           0) {
-        simple_stats_.Increment("num_write_row_hits");
+        simple_stats_.Increment(write_row_hits_stat_);
       }
       break;
-    case CommandType::ACTIVATE: simple_stats_.Increment("num_act_cmds"); break;
-    case CommandType::PRECHARGE: simple_stats_.Increment("num_pre_cmds"); break;
-    case CommandType::REFRESH: simple_stats_.Increment("num_ref_cmds"); break;
+    case CommandType::ACTIVATE: simple_stats_.Increment(act_cmds_stat_); break;
+    case CommandType::PRECHARGE: simple_stats_.Increment(pre_cmds_stat_); break;
+    case CommandType::REFRESH: simple_stats_.Increment(ref_cmds_stat_); break;
     case CommandType::REFRESH_BANK:
-      simple_stats_.Increment("num_refb_cmds");
+      simple_stats_.Increment(refb_cmds_stat_);
       break;
     case CommandType::SREF_ENTER:
-      simple_stats_.Increment("num_srefe_cmds");
+      simple_stats_.Increment(srefe_cmds_stat_);
       break;
     case CommandType::SREF_EXIT:
-      simple_stats_.Increment("num_srefx_cmds");
+      simple_stats_.Increment(srefx_cmds_stat_);
       break;
+    case CommandType::PD_ENTER: simple_stats_.Increment(pde_cmds_stat_); break;
+    case CommandType::PD_EXIT: simple_stats_.Increment(pdx_cmds_stat_); break;
     default: AbruptExit(__FILE__, __LINE__);
   }
 }
@@ -4,10 +4,13 @@
 #include "channel_state.h"
 #include "command_queue.h"
 #include "common.h"
+#include "profiler.h"
 #include "refresh.h"
 #include "simple_stats.h"
+#include "trace_writer.h"
+#include "trans_index.h"
 #include <fstream>
-#include <map>
+#include <memory>
 #include <unordered_set>
 #include <vector>
 
@@ -15,9 +18,14 @@
 #include "thermal.h"
 #endif  // THERMAL
 
+#ifdef LATENCY_BREAKDOWN
+#include "latency_breakdown.h"
+#endif  // LATENCY_BREAKDOWN
+
 namespace dramsim3 {
 
-enum class RowBufPolicy { OPEN_PAGE, CLOSE_PAGE, SIZE };
+/// @brief See Config::row_buf_policy.
+enum class RowBufPolicy { OPEN_PAGE, CLOSE_PAGE, TIMEOUT, PREDICTOR, SIZE };
 
 /// @brief Each channel has one its own controller. This controller has a
 /// refresh controller.
@@ -30,14 +38,68 @@ public:
   Controller(int channel, const Config &config, const Timing &timing);
 #endif  // THERMAL
   void ClockTick();
-  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const;
+  /// @brief Whether the queue of the class (and sub-channel) of hex_addr has
+  /// room, see Config::qos_classes.
+  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                             int qos_class = 0) const;
   bool AddTransaction(Transaction trans);
   int QueueUsage() const;
   // Stats output
-  void PrintEpochStats();
+  void PrintEpochStats(StatsWriter &writer);
   void PrintFinalStats();
-  void ResetStats() { simple_stats_.Reset(); }
-  std::pair<uint64_t, int> ReturnDoneTrans(uint64_t clock);
+  void ResetStats();
+  /// @brief Pop every transaction completed by clock, ordered by complete
+  /// cycle and then by the order they were completed in. The returned buffer
+  /// is reused by the next call.
+  const std::vector<Transaction> &ReturnDoneTrans(uint64_t clock);
+  /// @brief The earliest cycle at which this controller may change its state
+  /// (issue a command, schedule a transaction, insert a refresh), assuming no
+  /// new transaction arrives. Returns clk_ if something may happen right now.
+  uint64_t NextEventCycle() const;
+  /// @brief Whether the next ClockTick is known to be an idle one.
+  bool IsIdle() const { return clk_ < idle_until_; }
+  /// @brief Number of upcoming ClockTicks that are known to be idle.
+  uint64_t IdleCycles() const {
+    return clk_ < idle_until_ ? idle_until_ - clk_ : 0;
+  }
+  /// @brief Jump over cycles known to be idle, cycles <= IdleCycles().
+  void SkipIdleCycles(uint64_t cycles) {
+    clk_ += cycles;
+    skipped_cycles_ += cycles;
+    ProfileCount(profiler_.get(), ProfileEvent::IDLE_TICKS, cycles);
+  }
+  /// @brief The earliest complete cycle in the return queue.
+  uint64_t NextReturnCycle() const;
+  /// @brief Number of transactions moved from the transaction queues to the
+  /// command queue so far, i.e. transaction queue slots freed.
+  uint64_t NumTransScheduled() const { return num_trans_scheduled_; }
+  /// @brief Derate the refreshes, see Refresh::SetBankTemperatures.
+  void SetBankTemperatures(const double *bank_temps);
+  /// @brief Record every issued command into ring, see TraceWriter.
+  void SetCommandTrace(TraceRing *ring) { cmd_trace_ring_ = ring; }
+  /// @brief The profiler of the channel, null unless other.profile is set.
+  Profiler *GetProfiler() const { return profiler_.get(); }
+
+  /// @brief Sampled simulation, see SampledDRAMSystem.
+  /// Access the row of hex_addr without modeling any timing, only the open
+  /// rows change. Returns the latency of the access on an idle channel.
+  uint64_t FunctionalAccess(uint64_t hex_addr, bool is_write);
+  /// @brief Finish every pending transaction functionally and append them
+  /// to done with their complete cycle, leaving the controller empty.
+  void FunctionalDrain(std::vector<Transaction> &done);
+  /// @brief Advance cycles cycles functionally, the refreshes due meanwhile
+  /// close the open rows. Only valid on a drained controller.
+  void FunctionalFastForward(uint64_t cycles);
+  /// @brief Running totals of the stats a measurement window is made of.
+  struct SampleCounts {
+    uint64_t reads_done, writes_done, read_cmds, write_cmds, row_hits;
+    uint64_t act_cmds, pre_cmds, ref_cmds, read_latency_sum;
+  };
+  SampleCounts GetSampleCounts() const;
+
+  // checkpointing, see MemorySystem::SaveCheckpoint
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
 
   int channel_id_;
 
@@ -57,6 +119,10 @@ private:
   ThermalCalculator &thermal_calc_;
 #endif  // THERMAL
 
+#ifdef LATENCY_BREAKDOWN
+  LatencyBreakdown latency_breakdown_;
+#endif  // LATENCY_BREAKDOWN
+
   // queue that takes transactions from CPU side
   /// @brief Whether the unified queue (combined read queue and write queue) is
   /// used.
@@ -65,28 +131,159 @@ private:
   std::vector<Transaction> read_queue_;
   std::vector<Transaction> write_buffer_;
 
-  // transactions that are not completed, use map for convenience
-  std::multimap<uint64_t, Transaction> pending_rd_q_;
-  std::multimap<uint64_t, Transaction> pending_wr_q_;
+  // transactions that are not completed, indexed by address
+  TransactionIndex pending_rd_q_;
+  TransactionIndex pending_wr_q_;
 
-  // completed transactions
-  std::vector<Transaction> return_queue_;
+  // completed transactions, a min-heap on (complete_cycle, seq)
+  struct ReturnEntry {
+    Transaction trans;
+    uint64_t seq;
+  };
+  static bool ReturnsLater(const ReturnEntry &a, const ReturnEntry &b) {
+    return a.trans.complete_cycle != b.trans.complete_cycle
+               ? a.trans.complete_cycle > b.trans.complete_cycle
+               : a.seq > b.seq;
+  }
+  std::vector<ReturnEntry> return_queue_;
+  uint64_t return_seq_;
+  std::vector<Transaction> done_trans_;
+  void AddToReturnQueue(const Transaction &trans);
 
   // row buffer policy
   RowBufPolicy row_buf_policy_;
+  // per bank, the last cycle its open row was activated or accessed, the
+  // 2 bit counter of the predictor (the row is closed with the access at 2
+  // and above), the row the policy closed last (-1 once a row is opened
+  // again) and whether the open row was opened after a conflict
+  std::vector<uint64_t> row_last_use_;
+  std::vector<int> row_predictor_;
+  std::vector<int> policy_closed_row_;
+  std::vector<bool> row_conflict_;
+  int BankIndex(int rank, int bankgroup, int bank) const {
+    return rank * config_.banks + bankgroup * config_.banks_per_group + bank;
+  }
+  /// @brief TIMEOUT, issue a PRECHARGE to a row left unused for
+  /// row_buf_timeout cycles. Returns whether one was issued.
+  bool CloseTimedOutRow();
+  /// @brief TIMEOUT, the earliest cycle CloseTimedOutRow may close a row.
+  uint64_t NextRowTimeoutCycle() const;
+  /// @brief PREDICTOR, the column command cmd is issued as, with an auto
+  /// precharge if the row is predicted not to be used again.
+  Command PredictAutoPrecharge(const Command &cmd);
+  /// @brief Move the counter of the bank towards closing the row with the
+  /// access if closed is true, towards keeping it open otherwise.
+  void TrainRowPredictor(int bank_idx, bool closed);
+  /// @brief Row buffer stats and predictor training, before cmd is applied.
+  void UpdateRowBufState(const Command &cmd);
 
 #ifdef CMD_TRACE
   std::ofstream cmd_trace_;
 #endif  // CMD_TRACE
+  TraceRing *cmd_trace_ring_;
+  std::unique_ptr<Profiler> profiler_;
 
   // used to calculate inter-arrival latency
   uint64_t last_trans_clk_;
 
-  // transaction queueing
+  // transaction queueing, number of writes left in the current drain
   int write_draining_;
+  int last_drain_rank_;
+  bool ShouldStartWriteDrain() const;
+  /// @brief The write to drain next when write_drain_batching.
+  std::vector<Transaction>::iterator NextDrainWrite();
+
+  // quality of service, see Config::qos_classes. WEIGHTED is stride
+  // scheduling: per class, the virtual time its next transaction starts at
+  // and the virtual time a transaction takes, inversely proportional to its
+  // weight, and the start of the last scheduled transaction. Also per class,
+  // the index of its oldest schedulable transaction at the last NextQoSTrans
+  // (-1 if there is none)
+  bool qos_weighted_;
+  std::vector<uint64_t> qos_pass_;
+  std::vector<uint64_t> qos_stride_;
+  uint64_t qos_vtime_;
+  std::vector<int> qos_heads_;
+  // per source, the tokens its bandwidth cap adds per cycle (0 uncapped),
+  // its tokens as of source_token_clk_. A transaction takes token_cost_ and
+  // a source saves up to token_depth_ while it is idle
+  std::vector<uint64_t> source_token_rate_;
+  std::vector<uint64_t> source_tokens_;
+  std::vector<uint64_t> source_token_clk_;
+  uint64_t token_cost_;
+  uint64_t token_depth_;
+  uint64_t SourceTokens(int source) const;
+  /// @brief Whether the source of trans is over its bandwidth cap.
+  bool Throttled(const Transaction &trans) const;
+  /// @brief The cycle the source of a throttled transaction is under its cap.
+  uint64_t ThrottledUntil(int source) const;
+  /// @brief Whether trans can be moved into the command queue right now.
+  bool Schedulable(const Transaction &trans) const;
+  /// @brief The transaction of queue to schedule next when there are several
+  /// classes: the oldest schedulable one if it has waited for
+  /// qos_starvation_cycles, otherwise the oldest schedulable one of the class
+  /// the arbitration picks.
+  std::vector<Transaction>::iterator NextQoSTrans(
+      std::vector<Transaction> &queue);
+  /// @brief Charge the source and the class of trans for scheduling it.
+  void QoSScheduled(const Transaction &trans);
+
+  // read/write turnaround and rank switch accounting, last column command
+  // of each sub-channel (data bus)
+  std::vector<uint64_t> last_rw_clk_;
+  std::vector<bool> last_rw_was_write_;
+  std::vector<int> last_rw_rank_;
+  void CountTurnaround(const Command &cmd);
+
+  // idle cycle skipping, cycles before idle_until_ are known to be idle and
+  // their per-cycle stats are credited lazily in CreditIdleCycles
+  uint64_t idle_until_;
+  uint64_t skipped_cycles_;
+  uint64_t num_trans_scheduled_;
+  void CreditIdleCycles();
+
+  // power-down, see Config::enable_power_down. Per rank, the cycle its
+  // command queues last went empty, the predicted length of its idle periods,
+  // the cycle it last entered power-down and the one its last wake up ends
+  std::vector<uint64_t> rank_idle_start_;
+  std::vector<double> predicted_idle_;
+  std::vector<uint64_t> pd_enter_clk_;
+  std::vector<uint64_t> pd_wake_clk_;
+  // shortest idle periods that pay off a precharge and an active power-down
+  double pd_break_even_[2];
+  /// @brief Whether the rank is idle and may be powered down, whatever the
+  /// power_down_policy says.
+  bool CanPowerDown(int rank) const;
+  bool PredictsLongIdle(int rank) const;
+  void PowerDownIdleRanks();
+  bool HasTransactionToSchedule(int rank) const;
+  void UpdateIdlePrediction(int rank);
+
+  // stat handles, looked up once so that updating a stat is an indexed add
+  CounterHandle num_cycles_stat_, reads_done_stat_, writes_done_stat_;
+  CounterHandle read_cmds_stat_, write_cmds_stat_, read_row_hits_stat_;
+  CounterHandle write_row_hits_stat_, act_cmds_stat_, pre_cmds_stat_;
+  CounterHandle ref_cmds_stat_, refb_cmds_stat_, srefe_cmds_stat_;
+  CounterHandle srefx_cmds_stat_, hbm_dual_cmds_stat_, epoch_num_stat_;
+  CounterHandle sub_channel_cmds_stat_;
+  CounterHandle write_drains_stat_, turnaround_cycles_stat_;
+  CounterHandle rank_switch_cycles_stat_;
+  CounterHandle pde_cmds_stat_, pdx_cmds_stat_;
+  CounterHandle timeout_pres_stat_, predicted_pres_stat_, row_reopens_stat_;
+  CounterHandle qos_starved_stat_;
+  VecCounterHandle qos_reads_done_stat_, qos_writes_done_stat_;
+  std::vector<HistoHandle> qos_read_latency_stats_;
+  VecCounterHandle sref_cycles_stat_, all_bank_idle_cycles_stat_;
+  VecCounterHandle rank_active_cycles_stat_, act_pd_cycles_stat_;
+  VecCounterHandle pre_pd_cycles_stat_, row_buf_hits_stat_;
+  VecCounterHandle row_buf_conflicts_stat_, row_buf_empties_stat_;
+  HistoHandle read_latency_stat_, write_latency_stat_;
+  HistoHandle interarrival_latency_stat_, pd_wakeup_latency_stat_;
+  void InitStatHandles();
+
   void ScheduleTransaction();
-  void IssueCommand(const Command &tmp_cmd);
-  Command TransToCommand(const Transaction &trans);
+  void IssueCommand(const Command &issued);
+  Command TransToCommand(const Transaction &trans) const;
   void UpdateCommandStats(const Command &cmd);
 };
 }  // namespace dramsim3
@@ -1,4 +1,7 @@
 #include "cpu.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
 
 namespace dramsim3 {
 
@@ -63,6 +66,10 @@ TraceBasedCPU::TraceBasedCPU(const std::string &config_file,
                              const std::string &output_dir,
                              const std::string &trace_file)
     : CPU(config_file, output_dir) {
+  if (BinaryTraceReader::IsBinaryTrace(trace_file)) {
+    binary_trace_.reset(new BinaryTraceReader(trace_file));
+    return;
+  }
   trace_file_.open(trace_file);
   if (trace_file_.fail()) {
     std::cerr << "Trace file does not exist" << std::endl;
@@ -72,21 +79,274 @@ TraceBasedCPU::TraceBasedCPU(const std::string &config_file,
 
 void TraceBasedCPU::ClockTick() {
   memory_system_.ClockTick();
-  if (!trace_file_.eof()) {
+  if (binary_trace_) {
+    if (get_next_) {
+      get_next_ = false;
+      binary_trace_done_ = !binary_trace_->Next(trans_);
+    }
+    if (!binary_trace_done_) {
+      TryAddTransaction();
+    }
+  } else if (!trace_file_.eof()) {
     if (get_next_) {
       get_next_ = false;
       trace_file_ >> trans_;
     }
-    if (trans_.added_cycle <= clk_) {
-      get_next_ =
-          memory_system_.WillAcceptTransaction(trans_.addr, trans_.is_write);
-      if (get_next_) {
-        memory_system_.AddTransaction(trans_.addr, trans_.is_write);
+    TryAddTransaction();
+  }
+  clk_++;
+  return;
+}
+
+void TraceBasedCPU::TryAddTransaction() {
+  if (trans_.added_cycle <= clk_) {
+    get_next_ =
+        memory_system_.WillAcceptTransaction(trans_.addr, trans_.is_write);
+    if (get_next_) {
+      memory_system_.AddTransaction(trans_.addr, trans_.is_write);
+    }
+  }
+}
+
+TraceStream::TraceStream(const std::string &trace_file) {
+  if (BinaryTraceReader::IsBinaryTrace(trace_file)) {
+    binary_.reset(new BinaryTraceReader(trace_file));
+    return;
+  }
+  text_.open(trace_file);
+  if (text_.fail()) {
+    std::cerr << "Trace file " << trace_file << " does not exist" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+}
+
+bool TraceStream::Next(Transaction &trans) {
+  if (binary_) {
+    return binary_->Next(trans);
+  }
+  return static_cast<bool>(text_ >> trans);
+}
+
+MultiTraceCPU::MultiTraceCPU(const std::string &config_file,
+                             const std::string &output_dir,
+                             const std::vector<std::string> &trace_files,
+                             int mshrs, const std::string &arbiter)
+    : CPU(config_file, output_dir), mshrs_(mshrs), rr_start_(0) {
+  if (mshrs_ < 1) {
+    std::cerr << "Need at least 1 MSHR per core" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  if (arbiter == "age") {
+    age_arbiter_ = true;
+  } else if (arbiter == "rr") {
+    age_arbiter_ = false;
+  } else {
+    std::cerr << "Unknown arbiter " << arbiter << ", use rr or age"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  for (const auto &trace_file : trace_files) {
+    cores_.emplace_back(new Core(trace_file));
+  }
+  ready_cores_.reserve(cores_.size());
+}
+
+void MultiTraceCPU::ClockTick() {
+  memory_system_.ClockTick();
+
+  // cores whose next request is due this cycle
+  ready_cores_.clear();
+  int num_cores = static_cast<int>(cores_.size());
+  for (int i = 0; i < num_cores; i++) {
+    int core_id = (rr_start_ + i) % num_cores;
+    Core &core = *cores_[core_id];
+    if (!core.has_next && !core.trace_done) {
+      core.has_next = core.trace.Next(core.next);
+      core.trace_done = !core.has_next;
+    }
+    if (core.has_next && DueCycle(core) <= clk_) {
+      ready_cores_.push_back(core_id);
+    }
+  }
+  if (age_arbiter_) {
+    std::stable_sort(ready_cores_.begin(), ready_cores_.end(),
+                     [this](int a, int b) {
+                       return DueCycle(*cores_[a]) < DueCycle(*cores_[b]);
+                     });
+  }
+
+  for (int core_id : ready_cores_) {
+    Core &core = *cores_[core_id];
+    const Transaction &trans = core.next;
+    if (core.outstanding >= mshrs_ ||
+        !memory_system_.WillAcceptTransaction(trans.addr, trans.is_write)) {
+      core.stall_cycles++;
+      continue;
+    }
+    memory_system_.AddTransaction(trans.addr, trans.is_write);
+    auto &in_flight = trans.is_write ? writes_in_flight_ : reads_in_flight_;
+    in_flight[trans.addr].push_back(Outstanding{core_id, clk_});
+    core.outstanding++;
+    core.has_next = false;
+  }
+  if (num_cores > 0) {
+    rr_start_ = (rr_start_ + 1) % num_cores;
+  }
+  clk_++;
+  return;
+}
+
+void MultiTraceCPU::ReadCallBack(uint64_t addr) { Complete(addr, false); }
+
+void MultiTraceCPU::WriteCallBack(uint64_t addr) { Complete(addr, true); }
+
+void MultiTraceCPU::Complete(uint64_t addr, bool is_write) {
+  auto &in_flight = is_write ? writes_in_flight_ : reads_in_flight_;
+  auto it = in_flight.find(addr);
+  if (it == in_flight.end()) {
+    if (restored_) {
+      // in flight when the checkpoint was taken
+      return;
+    }
+    std::cerr << std::hex << addr << std::dec << " returned but never issued"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  Outstanding req = it->second.front();
+  it->second.erase(it->second.begin());
+  if (it->second.empty()) {
+    in_flight.erase(it);
+  }
+  Core &core = *cores_[req.core];
+  core.outstanding--;
+  if (is_write) {
+    core.writes++;
+  } else {
+    core.reads++;
+    core.read_latency[clk_ - req.issue_cycle]++;
+  }
+}
+
+void MultiTraceCPU::PrintStats() {
+  CPU::PrintStats();
+  std::cout << "core    reads   writes  avg_rd_lat  p50  p99   max  stalls"
+            << std::endl;
+  for (size_t i = 0; i < cores_.size(); i++) {
+    const Core &core = *cores_[i];
+    std::vector<std::pair<uint64_t, uint64_t>> lat(core.read_latency.begin(),
+                                                   core.read_latency.end());
+    std::sort(lat.begin(), lat.end());
+    uint64_t sum = 0, seen = 0, p50 = 0, p99 = 0;
+    for (const auto &it : lat) {
+      sum += it.first * it.second;
+    }
+    for (const auto &it : lat) {
+      seen += it.second;
+      if (p50 == 0 && seen * 2 >= core.reads) {
+        p50 = it.first;
       }
+      if (p99 == 0 && seen * 100 >= core.reads * 99) {
+        p99 = it.first;
+      }
+    }
+    double avg = core.reads == 0 ? 0.0 : static_cast<double>(sum) / core.reads;
+    std::cout << std::setw(4) << i << std::setw(9) << core.reads
+              << std::setw(9) << core.writes << std::fixed
+              << std::setprecision(1) << std::setw(12) << avg << std::setw(5)
+              << p50 << std::setw(5) << p99 << std::setw(6)
+              << (lat.empty() ? 0 : lat.back().first) << std::setw(8)
+              << core.stall_cycles << std::endl;
+  }
+}
+
+SyntheticCPU::SyntheticCPU(const std::string &config_file,
+                           const std::string &output_dir,
+                           const std::string &spec_file)
+    : CPU(config_file, output_dir),
+      generator_(ReadWorkloadSpec(spec_file)), has_next_(false),
+      credits_(0.0), in_flight_(0), issued_(0), stall_cycles_(0),
+      stream_stats_(generator_.Spec().streams.size()) {}
+
+void SyntheticCPU::ClockTick() {
+  memory_system_.ClockTick();
+  const PhaseSpec &phase = generator_.Phase(clk_);
+  bool closed_loop = phase.outstanding > 0;
+  if (!closed_loop) {
+    credits_ = std::min(credits_ + phase.rate, phase.rate + 1.0);
+  }
+  while (closed_loop ? in_flight_ < phase.outstanding : credits_ >= 1.0) {
+    if (!has_next_ && !generator_.Next(next_)) {
+      // every stream waits for a pointer chase
+      break;
+    }
+    has_next_ = true;
+    if (!memory_system_.WillAcceptTransaction(next_.addr, next_.is_write)) {
+      stall_cycles_++;
+      break;
     }
+    memory_system_.AddTransaction(next_.addr, next_.is_write);
+    auto &in_flight = next_.is_write ? writes_in_flight_ : reads_in_flight_;
+    in_flight[next_.addr].push_back(Outstanding{next_.stream, clk_});
+    in_flight_++;
+    issued_++;
+    credits_ -= closed_loop ? 0.0 : 1.0;
+    has_next_ = false;
   }
   clk_++;
   return;
 }
 
+void SyntheticCPU::ReadCallBack(uint64_t addr) { Complete(addr, false); }
+
+void SyntheticCPU::WriteCallBack(uint64_t addr) { Complete(addr, true); }
+
+void SyntheticCPU::Complete(uint64_t addr, bool is_write) {
+  auto &in_flight = is_write ? writes_in_flight_ : reads_in_flight_;
+  auto it = in_flight.find(addr);
+  if (it == in_flight.end()) {
+    if (restored_) {
+      // in flight when the checkpoint was taken
+      return;
+    }
+    std::cerr << std::hex << addr << std::dec << " returned but never issued"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  Outstanding req = it->second.front();
+  it->second.erase(it->second.begin());
+  if (it->second.empty()) {
+    in_flight.erase(it);
+  }
+  in_flight_--;
+  StreamStats &stats = stream_stats_[req.stream];
+  if (is_write) {
+    stats.writes++;
+  } else {
+    stats.reads++;
+    stats.read_latency_sum += clk_ - req.issue_cycle;
+    generator_.ReadDone(req.stream);
+  }
+}
+
+void SyntheticCPU::PrintStats() {
+  CPU::PrintStats();
+  std::cout << "Issued " << issued_ << " requests in " << clk_ << " cycles ("
+            << std::fixed << std::setprecision(3)
+            << (clk_ == 0 ? 0.0 : static_cast<double>(issued_) / clk_)
+            << " per cycle), " << stall_cycles_ << " stalled cycles"
+            << std::endl;
+  std::cout << "stream              reads   writes  avg_rd_lat" << std::endl;
+  const auto &streams = generator_.Spec().streams;
+  for (size_t i = 0; i < streams.size(); i++) {
+    const StreamStats &stats = stream_stats_[i];
+    double avg =
+        stats.reads == 0
+            ? 0.0
+            : static_cast<double>(stats.read_latency_sum) / stats.reads;
+    std::cout << std::left << std::setw(16) << streams[i].name << std::right
+              << std::setw(9) << stats.reads << std::setw(9) << stats.writes
+              << std::setprecision(1) << std::setw(12) << avg << std::endl;
+  }
+}
+
 }  // namespace dramsim3
@@ -1,11 +1,16 @@
 #ifndef __CPU_H
 #define __CPU_H
 
+#include "binary_trace.h"
 #include "memory_system.h"
+#include "workload.h"
 #include <fstream>
 #include <functional>
+#include <memory>
 #include <random>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace dramsim3 {
 
@@ -16,15 +21,25 @@ public:
             config_file, output_dir,
             std::bind(&CPU::ReadCallBack, this, std::placeholders::_1),
             std::bind(&CPU::WriteCallBack, this, std::placeholders::_1)),
-        clk_(0) {}
+        clk_(0), restored_(false) {}
+  virtual ~CPU() {}
   virtual void ClockTick() = 0;
-  void ReadCallBack(uint64_t addr) { return; }
-  void WriteCallBack(uint64_t addr) { return; }
-  void PrintStats() { memory_system_.PrintStats(); }
+  virtual void ReadCallBack(uint64_t addr) { return; }
+  virtual void WriteCallBack(uint64_t addr) { return; }
+  virtual void PrintStats() { memory_system_.PrintStats(); }
+  void SaveCheckpoint(const std::string &file) const {
+    memory_system_.SaveCheckpoint(file);
+  }
+  void LoadCheckpoint(const std::string &file) {
+    memory_system_.LoadCheckpoint(file);
+    restored_ = true;
+  }
 
 protected:
   MemorySystem memory_system_;
   uint64_t clk_;
+  // the memory system was restored and may return requests issued before
+  bool restored_;
 };
 
 class RandomCPU : public CPU {
@@ -54,6 +69,8 @@ private:
   const int stride_ = 64;                // stride in bytes
 };
 
+/// @brief Replays a text trace, or a binary one (see binary_trace.h), which
+/// is told apart by its magic.
 class TraceBasedCPU : public CPU {
 public:
   TraceBasedCPU(const std::string &config_file, const std::string &output_dir,
@@ -62,9 +79,120 @@ public:
   void ClockTick() override;
 
 private:
+  void TryAddTransaction();
+
   std::ifstream trace_file_;
+  std::unique_ptr<BinaryTraceReader> binary_trace_;
   Transaction trans_;
   bool get_next_ = true;
+  bool binary_trace_done_ = false;
+};
+
+/// @brief Reads transactions from a text or binary trace.
+class TraceStream {
+public:
+  explicit TraceStream(const std::string &trace_file);
+  /// @brief Read the next transaction, return false at the end of the trace.
+  bool Next(Transaction &trans);
+
+private:
+  std::ifstream text_;
+  std::unique_ptr<BinaryTraceReader> binary_;
+};
+
+/// @brief Replays one trace per core at the same time. Each core keeps up to
+/// mshrs requests outstanding, slots are freed by the read/write callbacks.
+/// A core whose next request is due but cannot issue (full window, or the
+/// memory system does not accept it) stalls, which delays the rest of its
+/// trace by the same amount. Every cycle the arbiter offers each core with a
+/// due request one issue slot, either round robin or oldest request first.
+class MultiTraceCPU : public CPU {
+public:
+  MultiTraceCPU(const std::string &config_file, const std::string &output_dir,
+                const std::vector<std::string> &trace_files, int mshrs,
+                const std::string &arbiter);
+  void ClockTick() override;
+  void ReadCallBack(uint64_t addr) override;
+  void WriteCallBack(uint64_t addr) override;
+  void PrintStats() override;
+  /// @brief Requests of a core issued to the memory system and not returned.
+  int InFlight(int core) const { return cores_[core]->outstanding; }
+  /// @brief Reads of a core returned so far.
+  uint64_t Reads(int core) const { return cores_[core]->reads; }
+  /// @brief Writes of a core returned so far.
+  uint64_t Writes(int core) const { return cores_[core]->writes; }
+
+private:
+  struct Core {
+    explicit Core(const std::string &trace_file) : trace(trace_file) {}
+    TraceStream trace;
+    Transaction next;
+    bool has_next = false;
+    bool trace_done = false;
+    int outstanding = 0;
+    uint64_t stall_cycles = 0;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    // read latency (cycles) -> count
+    std::unordered_map<uint64_t, uint64_t> read_latency;
+  };
+  struct Outstanding {
+    int core;
+    uint64_t issue_cycle;
+  };
+
+  uint64_t DueCycle(const Core &core) const {
+    return core.next.added_cycle + core.stall_cycles;
+  }
+  void Complete(uint64_t addr, bool is_write);
+
+  std::vector<std::unique_ptr<Core>> cores_;
+  int mshrs_;
+  bool age_arbiter_;
+  int rr_start_;
+  std::vector<int> ready_cores_;
+  // requests in flight by address, oldest first
+  std::unordered_map<uint64_t, std::vector<Outstanding>> reads_in_flight_;
+  std::unordered_map<uint64_t, std::vector<Outstanding>> writes_in_flight_;
+};
+
+/// @brief Runs the synthetic workload of a spec file, see ReadWorkloadSpec.
+/// The requests are generated on the fly. In an open loop phase the CPU
+/// offers rate requests per cycle, a request the memory system does not take
+/// waits, and at most one cycle worth of offers is kept up while it does. In
+/// a closed loop phase it keeps outstanding requests in flight.
+class SyntheticCPU : public CPU {
+public:
+  SyntheticCPU(const std::string &config_file, const std::string &output_dir,
+               const std::string &spec_file);
+  void ClockTick() override;
+  void ReadCallBack(uint64_t addr) override;
+  void WriteCallBack(uint64_t addr) override;
+  void PrintStats() override;
+
+private:
+  struct StreamStats {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t read_latency_sum = 0;
+  };
+  struct Outstanding {
+    int stream;
+    uint64_t issue_cycle;
+  };
+  void Complete(uint64_t addr, bool is_write);
+
+  WorkloadGenerator generator_;
+  WorkloadRequest next_;
+  bool has_next_;
+  double credits_;
+  int in_flight_;
+  uint64_t issued_;
+  uint64_t stall_cycles_;
+  std::vector<StreamStats> stream_stats_;
+  // requests in flight by address, oldest first
+  std::unordered_map<uint64_t, std::vector<Outstanding>> reads_in_flight_;
+  std::unordered_map<uint64_t, std::vector<Outstanding>> writes_in_flight_;
 };
 
 }  // namespace dramsim3
@@ -1,60 +1,132 @@
 #include "dram_system.h"
 
+#include <algorithm>
 #include <assert.h>
 
 namespace dramsim3 {
 
-// alternative way is to assign the id in constructor but this is less
-// destructive
-int BaseDRAMSystem::total_channels_ = 0;
-
-BaseDRAMSystem::BaseDRAMSystem(Config &config, const std::string &output_dir,
-                               std::function<void(uint64_t)> read_callback,
-                               std::function<void(uint64_t)> write_callback)
+BaseDRAMSystem::BaseDRAMSystem(
+    const Config &config, const std::string &output_dir,
+    std::function<void(uint64_t)> read_callback,
+    std::function<void(uint64_t)> write_callback)
     : read_callback_(read_callback), write_callback_(write_callback),
-      last_req_clk_(0), config_(config), timing_(config_),
+      total_channels_(config.channels), num_returns_(0), num_slots_freed_(0),
+      last_req_clk_(0), config_(config),
+      timing_(config_),
+      parallel_cycles_(0), serial_cycles_(0),
 #ifdef THERMAL
       thermal_calc_(config_),
 #endif  // THERMAL
-      clk_(0) {
-  total_channels_ += config_.channels;
-
+      clk_(0), stats_writer_(config_), cache_(nullptr), trace_writer_(nullptr),
+      addr_trace_ring_(nullptr), thread_pool_(nullptr) {
 #ifdef ADDR_TRACE
   std::string addr_trace_name = config_.output_prefix + "addr.trace";
   address_trace_.open(addr_trace_name);
 #endif
 }
 
+BaseDRAMSystem::~BaseDRAMSystem() {
+  delete cache_;
+  delete thread_pool_;
+  // finishes the trace files
+  delete trace_writer_;
+}
+
+int BaseDRAMSystem::ThreadPoolSize(int num_tasks) const {
+#ifdef THERMAL
+  // the thermal calculator is shared by all the channels
+  if (config_.num_threads > 1) {
+    std::cout << "WARNING: num_threads ignored with thermal simulation"
+              << std::endl;
+  }
+  return 1;
+#else
+  int num_threads = std::min(config_.num_threads, num_tasks);
+  int hw_threads = static_cast<int>(std::thread::hardware_concurrency());
+  if (hw_threads > 0 && num_threads > hw_threads) {
+    std::cout << "WARNING: num_threads " << num_threads
+              << " exceeds the hardware concurrency, using " << hw_threads
+              << std::endl;
+    num_threads = hw_threads;
+  }
+  return num_threads;
+#endif  // THERMAL
+}
+
+void BaseDRAMSystem::StartThreadPool() {
+  int num_threads = ThreadPoolSize(static_cast<int>(ctrls_.size()));
+  if (num_threads > 1) {
+    thread_pool_ = new ThreadPool(num_threads);
+    tick_ctrl_ = [this](int i) { ctrls_[i]->ClockTick(); };
+  }
+}
+
+void BaseDRAMSystem::TickControllers() {
+  // only worth a dispatch if at least two channels have real work to do
+  int busy_ctrls = 0;
+  if (thread_pool_ != nullptr) {
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+      if (!ctrls_[i]->IsIdle()) {
+        busy_ctrls++;
+      }
+    }
+  }
+  if (busy_ctrls > 1) {
+    thread_pool_->ParallelFor(static_cast<int>(ctrls_.size()), tick_ctrl_);
+    parallel_cycles_++;
+  } else {
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+      ctrls_[i]->ClockTick();
+    }
+    serial_cycles_++;
+  }
+}
+
+void BaseDRAMSystem::StartTraces() {
+  if (!config_.cmd_trace && !config_.addr_trace) {
+    return;
+  }
+  trace_writer_ = new TraceWriter();
+  if (config_.addr_trace) {
+    addr_trace_ring_ =
+        trace_writer_->AddAddressTrace(config_.output_prefix + "addr.btrace");
+  }
+  if (config_.cmd_trace) {
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+      std::string trace_file = config_.output_prefix + "ch_" +
+                               std::to_string(i) + "cmd.btrace";
+      ctrls_[i]->SetCommandTrace(
+          trace_writer_->AddCommandTrace(trace_file, static_cast<int>(i)));
+    }
+  }
+  trace_writer_->Start();
+}
+
 int BaseDRAMSystem::GetChannel(uint64_t hex_addr) const {
-  hex_addr >>= config_.shift_bits;
-  return (hex_addr >> config_.ch_pos) & config_.ch_mask;
+  return config_.AddressChannel(hex_addr);
 }
 
 void BaseDRAMSystem::PrintEpochStats() {
-  // first epoch, print bracket
-  if (clk_ - config_.epoch_period == 0) {
-    std::ofstream epoch_out(config_.json_epoch_name, std::ofstream::out);
-    epoch_out << "[";
-  }
   for (size_t i = 0; i < ctrls_.size(); i++) {
-    ctrls_[i]->PrintEpochStats();
-    std::ofstream epoch_out(config_.json_epoch_name, std::ofstream::app);
-    epoch_out << "," << std::endl;
+    ctrls_[i]->PrintEpochStats(stats_writer_);
   }
 #ifdef THERMAL
   thermal_calc_.PrintTransPT(clk_);
+  if (config_.thermal_refresh) {
+    const std::vector<double> &temps = thermal_calc_.BankTemperatures();
+    size_t channel_banks = static_cast<size_t>(config_.ranks * config_.banks);
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+      ctrls_[i]->SetBankTemperatures(temps.data() +
+                                     ctrls_[i]->channel_id_ * channel_banks);
+    }
+  }
 #endif  // THERMAL
   return;
 }
 
 void BaseDRAMSystem::PrintStats() {
-  // Finish epoch output, remove last comma and append ]
-  std::ofstream epoch_out(config_.json_epoch_name, std::ios_base::in |
-                                                       std::ios_base::out |
-                                                       std::ios_base::ate);
-  epoch_out.seekp(-2, std::ios_base::cur);
-  epoch_out.write("]", 1);
-  epoch_out.close();
+  // finish the epoch output
+  stats_writer_.Close();
 
   std::ofstream json_out(config_.json_stats_name, std::ofstream::out);
   json_out << "{";
@@ -71,6 +143,20 @@ void BaseDRAMSystem::PrintStats() {
   json_out.open(config_.json_stats_name, std::ofstream::app);
   json_out << "}";
 
+  if (config_.profile) {
+    nlohmann::json j;
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+      j[std::to_string(i)] = ctrls_[i]->GetProfiler()->Report();
+    }
+    std::ofstream(config_.output_prefix + "profile.json")
+        << j.dump(2) << std::endl;
+  }
+
+  if (cache_ != nullptr) {
+    std::ofstream(config_.output_prefix + "cache.json")
+        << cache_->Stats().dump(2) << std::endl;
+  }
+
 #ifdef THERMAL
   thermal_calc_.PrintFinalPT(clk_);
 #endif  // THERMAL
@@ -80,19 +166,143 @@ void BaseDRAMSystem::ResetStats() {
   for (size_t i = 0; i < ctrls_.size(); i++) {
     ctrls_[i]->ResetStats();
   }
+  if (cache_ != nullptr) {
+    cache_->ResetStats();
+  }
+}
+
+void BaseDRAMSystem::Save(CheckpointWriter &writer) const {
+  // what the layout of the state depends on, checked by Load
+  writer.Put(static_cast<uint64_t>(config_.IsHMC()));
+  writer.Put(static_cast<uint64_t>(config_.sampling));
+  writer.Put(config_.memory_model);
+  writer.Put(static_cast<uint64_t>(ctrls_.size()));
+  writer.Put(static_cast<uint64_t>(config_.ranks));
+  writer.Put(static_cast<uint64_t>(config_.sub_channels));
+  writer.Put(static_cast<uint64_t>(config_.bankgroups));
+  writer.Put(static_cast<uint64_t>(config_.banks_per_group));
+  writer.Put(static_cast<uint64_t>(config_.trans_queue_size));
+  writer.Put(static_cast<uint64_t>(config_.unified_queue));
+  writer.Put(static_cast<uint64_t>(config_.qos_classes));
+  writer.Put(config_.queue_structure);
+  writer.Put(static_cast<uint64_t>(config_.cache_size));
+  writer.Put(static_cast<uint64_t>(config_.cache_assoc));
+  writer.Put(static_cast<uint64_t>(config_.cache_line_size));
+
+  writer.Put(num_returns_);
+  writer.Put(num_slots_freed_);
+  writer.Put(last_req_clk_);
+  writer.Put(parallel_cycles_);
+  writer.Put(serial_cycles_);
+  writer.Put(clk_);
+  for (const auto ctrl : ctrls_) {
+    ctrl->Save(writer);
+  }
+  if (cache_ != nullptr) {
+    cache_->Save(writer);
+  }
+#ifdef THERMAL
+  thermal_calc_.Save(writer);
+#endif  // THERMAL
+}
+
+void BaseDRAMSystem::Load(CheckpointReader &reader) {
+  reader.Expect(config_.IsHMC(), "HMC");
+  reader.Expect(config_.sampling, "sampling");
+  std::string memory_model;
+  reader.Get(memory_model);
+  if (memory_model != config_.memory_model) {
+    std::cerr << "Checkpoint was taken with memory_model " << memory_model
+              << ", this memory system has " << config_.memory_model
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  reader.Expect(ctrls_.size(), "controllers");
+  reader.Expect(config_.ranks, "ranks");
+  reader.Expect(config_.sub_channels, "sub_channels");
+  reader.Expect(config_.bankgroups, "bankgroups");
+  reader.Expect(config_.banks_per_group, "banks_per_group");
+  reader.Expect(config_.trans_queue_size, "trans_queue_size");
+  reader.Expect(config_.unified_queue, "unified_queue");
+  reader.Expect(config_.qos_classes, "qos_classes");
+  std::string queue_structure;
+  reader.Get(queue_structure);
+  if (queue_structure != config_.queue_structure) {
+    std::cerr << "Checkpoint was taken with queue_structure "
+              << queue_structure << ", this memory system has "
+              << config_.queue_structure << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  reader.Expect(config_.cache_size, "cache size");
+  reader.Expect(config_.cache_assoc, "cache associativity");
+  reader.Expect(config_.cache_line_size, "cache line_size");
+
+  reader.Get(num_returns_);
+  reader.Get(num_slots_freed_);
+  reader.Get(last_req_clk_);
+  reader.Get(parallel_cycles_);
+  reader.Get(serial_cycles_);
+  reader.Get(clk_);
+  for (auto ctrl : ctrls_) {
+    ctrl->Load(reader);
+  }
+  if (cache_ != nullptr) {
+    cache_->Load(reader);
+  }
+#ifdef THERMAL
+  thermal_calc_.Load(reader);
+#endif  // THERMAL
+}
+
+uint64_t BaseDRAMSystem::ClockTickN(uint64_t cycles) {
+  uint64_t start_events = HostEvents();
+  uint64_t elapsed = 0;
+  while (elapsed < cycles) {
+    ClockTick();
+    elapsed++;
+    if (HostEvents() != start_events) {
+      break;
+    }
+  }
+  return elapsed;
+}
+
+uint64_t BaseDRAMSystem::RunUntil(uint64_t cycle) {
+  return cycle > clk_ ? ClockTickN(cycle - clk_) : 0;
 }
 
 void BaseDRAMSystem::RegisterCallbacks(
     std::function<void(uint64_t)> read_callback,
     std::function<void(uint64_t)> write_callback) {
-  // TODO this should be propagated to controllers
+  // the controllers hand their finished transactions to the system, which
+  // calls the host, so there is nothing to propagate to them
   read_callback_ = read_callback;
   write_callback_ = write_callback;
 }
 
-JedecDRAMSystem::JedecDRAMSystem(Config &config, const std::string &output_dir,
-                                 std::function<void(uint64_t)> read_callback,
-                                 std::function<void(uint64_t)> write_callback)
+void BaseDRAMSystem::RegisterCompletionCallback(CompletionCallback callback) {
+  completion_callback_ = callback;
+}
+
+void BaseDRAMSystem::RegisterBatchCallback(BatchCallback callback) {
+  DeliverBatch();
+  batch_callback_ = callback;
+}
+
+void BaseDRAMSystem::DeliverBatch() {
+  if (done_batch_.empty()) {
+    return;
+  }
+  if (batch_callback_) {
+    batch_callback_(done_batch_.data(), done_batch_.size());
+  }
+  done_batch_.clear();
+}
+
+JedecDRAMSystem::JedecDRAMSystem(
+    const Config &config, const std::string &output_dir,
+    std::function<void(uint64_t)> read_callback,
+    std::function<void(uint64_t)> write_callback)
     : BaseDRAMSystem(config, output_dir, read_callback, write_callback) {
   if (config_.IsHMC()) {
     std::cerr << "Initialized a memory system with an HMC config file!"
@@ -108,6 +318,11 @@ JedecDRAMSystem::JedecDRAMSystem(Config &config, const std::string &output_dir,
     ctrls_.push_back(new Controller(i, config_, timing_));
 #endif  // THERMAL
   }
+  if (config_.cache_size > 0) {
+    cache_ = new MemoryCache(config_);
+  }
+  StartTraces();
+  StartThreadPool();
 }
 
 JedecDRAMSystem::~JedecDRAMSystem() {
@@ -116,25 +331,42 @@ JedecDRAMSystem::~JedecDRAMSystem() {
   }
 }
 
-bool JedecDRAMSystem::WillAcceptTransaction(uint64_t hex_addr,
-                                            bool is_write) const {
+bool JedecDRAMSystem::WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                                            int qos_class) const {
+  if (cache_ != nullptr) {
+    return cache_->WillAcceptTransaction();
+  }
   int channel = GetChannel(hex_addr);
-  return ctrls_[channel]->WillAcceptTransaction(hex_addr, is_write);
+  return ctrls_[channel]->WillAcceptTransaction(hex_addr, is_write, qos_class);
 }
 
-bool JedecDRAMSystem::AddTransaction(uint64_t hex_addr, bool is_write) {
+bool JedecDRAMSystem::AddTransaction(uint64_t hex_addr, bool is_write,
+                                     uint64_t tag, int source, int qos_class) {
 // Record trace - Record address trace for debugging or other purposes
 #ifdef ADDR_TRACE
   address_trace_ << std::hex << hex_addr << std::dec << " "
-                 << (is_write ? "WRITE " : "READ ") << clk_ << std::endl;
+                 << (is_write ? "WRITE " : "READ ") << clk_ << "\n";
 #endif
+  TraceTransaction(hex_addr, is_write);
 
+  if (cache_ != nullptr) {
+    bool ok = cache_->WillAcceptTransaction();
+    if (ok) {
+      cache_->AddTransaction(hex_addr, is_write, tag, clk_);
+    }
+    last_req_clk_ = clk_;
+    return ok;
+  }
   int channel = GetChannel(hex_addr);
-  bool ok = ctrls_[channel]->WillAcceptTransaction(hex_addr, is_write);
+  bool ok =
+      ctrls_[channel]->WillAcceptTransaction(hex_addr, is_write, qos_class);
 
   assert(ok);
   if (ok) {
     Transaction trans = Transaction(hex_addr, is_write);
+    trans.id = tag;
+    trans.source = source;
+    trans.qos_class = qos_class;
     ctrls_[channel]->AddTransaction(trans);
   }
   last_req_clk_ = clk_;
@@ -143,21 +375,26 @@ bool JedecDRAMSystem::AddTransaction(uint64_t hex_addr, bool is_write) {
 
 void JedecDRAMSystem::ClockTick() {
   for (size_t i = 0; i < ctrls_.size(); i++) {
+    ProfileScope scope(ctrls_[i]->GetProfiler(), ProfilePart::CALLBACKS);
     // look ahead and return earlier
-    while (true) {
-      auto pair = ctrls_[i]->ReturnDoneTrans(clk_);
-      if (pair.second == 1) {
-        write_callback_(pair.first);
-      } else if (pair.second == 0) {
-        read_callback_(pair.first);
+    for (const auto &trans : ctrls_[i]->ReturnDoneTrans(clk_)) {
+      if (cache_ != nullptr) {
+        cache_->DramDone(trans, clk_);
       } else {
-        break;
+        ReturnTransaction(trans.addr, trans.id, trans.is_write);
       }
     }
   }
-  for (size_t i = 0; i < ctrls_.size(); i++) {
-    ctrls_[i]->ClockTick();
+  if (cache_ != nullptr) {
+    std::vector<Transaction> done;
+    cache_->TakeDone(clk_, done);
+    for (const auto &trans : done) {
+      ReturnTransaction(trans.addr, trans.id, trans.is_write);
+    }
+    ForwardCacheRequests();
   }
+
+  TickControllers();
   clk_++;
 
   if (clk_ % config_.epoch_period == 0) {
@@ -166,30 +403,104 @@ void JedecDRAMSystem::ClockTick() {
   return;
 }
 
-IdealDRAMSystem::IdealDRAMSystem(Config &config, const std::string &output_dir,
-                                 std::function<void(uint64_t)> read_callback,
-                                 std::function<void(uint64_t)> write_callback)
+uint64_t JedecDRAMSystem::ClockTickN(uint64_t cycles) {
+  uint64_t start_events = HostEvents();
+  uint64_t elapsed = 0;
+  while (elapsed < cycles) {
+    uint64_t idle_cycles = IdleCycles(cycles - elapsed);
+    if (idle_cycles > 0) {
+      for (size_t i = 0; i < ctrls_.size(); i++) {
+        ctrls_[i]->SkipIdleCycles(idle_cycles);
+      }
+      clk_ += idle_cycles;
+      elapsed += idle_cycles;
+      continue;
+    }
+    ClockTick();
+    elapsed++;
+    if (HostEvents() != start_events) {
+      break;
+    }
+  }
+  return elapsed;
+}
+
+void JedecDRAMSystem::ForwardCacheRequests() {
+  cache_->TakeRequests([this](const Transaction &trans) {
+    Controller *ctrl = ctrls_[GetChannel(trans.addr)];
+    if (!ctrl->WillAcceptTransaction(trans.addr, trans.is_write)) {
+      return false;
+    }
+    ctrl->AddTransaction(trans);
+    return true;
+  });
+}
+
+uint64_t JedecDRAMSystem::HostEvents() const {
+  uint64_t events = BaseDRAMSystem::HostEvents();
+  if (cache_ != nullptr) {
+    events += cache_->NumForwarded();
+  }
+  for (size_t i = 0; i < ctrls_.size(); i++) {
+    events += ctrls_[i]->NumTransScheduled();
+  }
+  return events;
+}
+
+uint64_t JedecDRAMSystem::IdleCycles(uint64_t max_cycles) const {
+  // the tick that lands on an epoch boundary has to print the epoch stats
+  uint64_t epoch = static_cast<uint64_t>(config_.epoch_period);
+  uint64_t idle_cycles = std::min(max_cycles, epoch - clk_ % epoch - 1);
+  if (cache_ != nullptr) {
+    if (cache_->HasRequests()) {
+      return 0;
+    }
+    uint64_t next_done = cache_->NextDoneCycle();
+    idle_cycles =
+        std::min(idle_cycles, next_done > clk_ ? next_done - clk_ : 0);
+  }
+  for (size_t i = 0; i < ctrls_.size() && idle_cycles > 0; i++) {
+    idle_cycles = std::min(idle_cycles, ctrls_[i]->IdleCycles());
+    uint64_t next_return = ctrls_[i]->NextReturnCycle();
+    idle_cycles = std::min(idle_cycles,
+                           next_return > clk_ ? next_return - clk_ : 0);
+  }
+  return idle_cycles;
+}
+
+IdealDRAMSystem::IdealDRAMSystem(
+    const Config &config, const std::string &output_dir,
+    std::function<void(uint64_t)> read_callback,
+    std::function<void(uint64_t)> write_callback)
     : BaseDRAMSystem(config, output_dir, read_callback, write_callback),
       latency_(config_.ideal_memory_latency) {}
 
 IdealDRAMSystem::~IdealDRAMSystem() {}
 
-bool IdealDRAMSystem::AddTransaction(uint64_t hex_addr, bool is_write) {
+bool IdealDRAMSystem::AddTransaction(uint64_t hex_addr, bool is_write,
+                                     uint64_t tag, int source, int qos_class) {
   auto trans = Transaction(hex_addr, is_write);
+  trans.id = tag;
   trans.added_cycle = clk_;
   infinite_buffer_q_.push_back(trans);
   return true;
 }
 
+void IdealDRAMSystem::Save(CheckpointWriter &writer) const {
+  BaseDRAMSystem::Save(writer);
+  writer.Put(infinite_buffer_q_);
+}
+
+void IdealDRAMSystem::Load(CheckpointReader &reader) {
+  BaseDRAMSystem::Load(reader);
+  reader.Get(infinite_buffer_q_);
+}
+
 void IdealDRAMSystem::ClockTick() {
   for (auto trans_it = infinite_buffer_q_.begin();
        trans_it != infinite_buffer_q_.end();) {
     if (clk_ - trans_it->added_cycle >= static_cast<uint64_t>(latency_)) {
-      if (trans_it->is_write) {
-        write_callback_(trans_it->addr);
-      } else {
-        read_callback_(trans_it->addr);
-      }
+      ReturnTransaction(trans_it->addr, trans_it->id, trans_it->is_write);
       trans_it = infinite_buffer_q_.erase(trans_it++);
     }
     if (trans_it != infinite_buffer_q_.end()) {
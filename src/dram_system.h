@@ -5,10 +5,15 @@
 #include <string>
 #include <vector>
 
+#include "checkpoint.h"
 #include "common.h"
 #include "configuration.h"
 #include "controller.h"
+#include "memory_cache.h"
+#include "stats_writer.h"
+#include "thread_pool.h"
 #include "timing.h"
+#include "trace_writer.h"
 
 #ifdef THERMAL
 #include "thermal.h"
@@ -18,31 +23,83 @@ namespace dramsim3 {
 
 class BaseDRAMSystem {
 public:
-  BaseDRAMSystem(Config &config, const std::string &output_dir,
+  BaseDRAMSystem(const Config &config, const std::string &output_dir,
                  std::function<void(uint64_t)> read_callback,
                  std::function<void(uint64_t)> write_callback);
-  virtual ~BaseDRAMSystem() {}
+  virtual ~BaseDRAMSystem();
   void RegisterCallbacks(std::function<void(uint64_t)> read_callback,
                          std::function<void(uint64_t)> write_callback);
+  /// @brief Callbacks that get the tags of the transactions, they take the
+  /// place of the address callbacks once registered. The batch callback
+  /// takes the place of the other two, see DeliverBatch.
+  void RegisterCompletionCallback(CompletionCallback callback);
+  void RegisterBatchCallback(BatchCallback callback);
+  /// @brief Hand the completions collected for the batch callback to it, if
+  /// there are any. Called once per ClockTick or ClockTickN of the host.
+  void DeliverBatch();
   void PrintEpochStats();
-  void PrintStats();
-  void ResetStats();
+  virtual void PrintStats();
+  virtual void ResetStats();
 
-  virtual bool WillAcceptTransaction(uint64_t hex_addr,
-                                     bool is_write) const = 0;
-  virtual bool AddTransaction(uint64_t hex_addr, bool is_write) = 0;
+  virtual bool WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                                     int qos_class = 0) const = 0;
+  /// @brief tag is handed back as is with the completion of the transaction.
+  /// source and qos_class are only used by the JEDEC controllers, see
+  /// Config::qos_classes.
+  virtual bool AddTransaction(uint64_t hex_addr, bool is_write,
+                              uint64_t tag = 0, int source = 0,
+                              int qos_class = 0) = 0;
   virtual void ClockTick() = 0;
+  /// @brief Advance up to cycles cycles, stopping right after the cycle in
+  /// which a completion is delivered or a transaction queue slot frees up.
+  /// Returns the number of cycles that actually elapsed.
+  virtual uint64_t ClockTickN(uint64_t cycles);
+  /// @brief ClockTickN until the clock reaches cycle.
+  uint64_t RunUntil(uint64_t cycle);
   /// @brief Calculate the channel according to the acess address.
   int GetChannel(uint64_t hex_addr) const;
+  /// @brief Write or restore the whole state of the system. Derived systems
+  /// add their own state after that of the base.
+  virtual void Save(CheckpointWriter &writer) const;
+  virtual void Load(CheckpointReader &reader);
 
   std::function<void(uint64_t req_id)> read_callback_, write_callback_;
-  static int total_channels_;
+  /// @brief Channels of this system, kept per instance so that independent
+  /// systems can live side by side (e.g. in a sweep).
+  int total_channels_;
 
 protected:
-  uint64_t id_;
+  /// @brief Hand a finished transaction to the host, through whichever
+  /// callback is registered.
+  void ReturnTransaction(uint64_t hex_addr, uint64_t tag, bool is_write) {
+    num_returns_++;
+    if (batch_callback_) {
+      done_batch_.push_back(Completion{hex_addr, tag, is_write});
+    } else if (completion_callback_) {
+      completion_callback_(Completion{hex_addr, tag, is_write});
+    } else if (is_write) {
+      write_callback_(hex_addr);
+    } else {
+      read_callback_(hex_addr);
+    }
+  }
+  CompletionCallback completion_callback_;
+  BatchCallback batch_callback_;
+  std::vector<Completion> done_batch_;
+
+  /// @brief Counts the events that end a ClockTickN: completions handed to
+  /// the callbacks plus transaction queue slots freed.
+  virtual uint64_t HostEvents() const {
+    return num_returns_ + num_slots_freed_;
+  }
+  uint64_t num_returns_;
+  uint64_t num_slots_freed_;
+
   uint64_t last_req_clk_;
-  Config &config_;
+  const Config &config_;
   Timing timing_;
+  /// @brief Cycles in which the controllers were ticked on the thread pool,
+  /// and cycles in which they were ticked on the calling thread.
   uint64_t parallel_cycles_;
   uint64_t serial_cycles_;
 
@@ -51,29 +108,77 @@ protected:
 #endif  // THERMAL
 
   uint64_t clk_;
+  /// @brief The epoch stats of every channel, after a restore the epochs go
+  /// to new files.
+  StatsWriter stats_writer_;
   /// @brief Each channel has one its own cntroller.
   std::vector<Controller *> ctrls_;
+  /// @brief The memory-side cache in front of the controllers, nullptr
+  /// without one (config_.cache_size), only JedecDRAMSystem has one.
+  MemoryCache *cache_;
 
 #ifdef ADDR_TRACE
   std::ofstream address_trace_;
 #endif  // ADDR_TRACE
+
+  /// @brief The binary traces of config_.cmd_trace and config_.addr_trace,
+  /// StartTraces is called once the controllers are created.
+  TraceWriter *trace_writer_;
+  TraceRing *addr_trace_ring_;
+  void StartTraces();
+
+  /// @brief Ticks the controllers in parallel when config_.num_threads > 1,
+  /// StartThreadPool is called once the controllers are created. The
+  /// controllers only interact through the system, whose completion
+  /// callbacks are still delivered serially, in channel order, before the
+  /// controllers tick, so the results do not depend on it.
+  ThreadPool *thread_pool_;
+  std::function<void(int)> tick_ctrl_;
+  void StartThreadPool();
+  void TickControllers();
+  /// @brief Threads worth using for num_tasks tasks per cycle, with the
+  /// warnings about num_threads.
+  int ThreadPoolSize(int num_tasks) const;
+
+  void TraceTransaction(uint64_t hex_addr, bool is_write) {
+    if (addr_trace_ring_ != nullptr) {
+      addr_trace_ring_->Push(
+          TraceEntry{clk_, hex_addr, Address(), is_write ? 1 : 0});
+    }
+  }
 };
 
 // hmmm not sure this is the best naming...
 class JedecDRAMSystem : public BaseDRAMSystem {
 public:
-  JedecDRAMSystem(Config &config, const std::string &output_dir,
+  JedecDRAMSystem(const Config &config, const std::string &output_dir,
                   std::function<void(uint64_t)> read_callback,
                   std::function<void(uint64_t)> write_callback);
   ~JedecDRAMSystem();
   /// @brief Calculate the channel index of the address and then see if the
   /// channel will accept this address.
-  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const override;
-  bool AddTransaction(uint64_t hex_addr, bool is_write) override;
+  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                             int qos_class = 0) const override;
+  bool AddTransaction(uint64_t hex_addr, bool is_write, uint64_t tag = 0,
+                      int source = 0, int qos_class = 0) override;
   /// @brief Erase all of the trans that has been in the return queue, cause
   /// they has been completed. Then make all of the controllers that belongs to
   /// the current DRAM execute for a cycle.
   void ClockTick() override;
+  /// @brief Same as BaseDRAMSystem::ClockTickN, but jumps over the cycles in
+  /// which every controller is known to be idle (see skip_idle_cycles).
+  uint64_t ClockTickN(uint64_t cycles) override;
+
+protected:
+  uint64_t HostEvents() const override;
+
+private:
+  /// @brief Hand the transactions of the cache to the controllers that take
+  /// them.
+  void ForwardCacheRequests();
+  /// @brief Number of upcoming cycles, at most max_cycles, in which no
+  /// controller does anything and nothing is returned or printed.
+  uint64_t IdleCycles(uint64_t max_cycles) const;
 };
 
 // Model a memorysystem with an infinite bandwidth and a fixed latency (possibly
@@ -81,15 +186,19 @@ public:
 // cannot do for a given application
 class IdealDRAMSystem : public BaseDRAMSystem {
 public:
-  IdealDRAMSystem(Config &config, const std::string &output_dir,
+  IdealDRAMSystem(const Config &config, const std::string &output_dir,
                   std::function<void(uint64_t)> read_callback,
                   std::function<void(uint64_t)> write_callback);
   ~IdealDRAMSystem();
-  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const override {
+  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                             int qos_class = 0) const override {
     return true;
   };
-  bool AddTransaction(uint64_t hex_addr, bool is_write) override;
+  bool AddTransaction(uint64_t hex_addr, bool is_write, uint64_t tag = 0,
+                      int source = 0, int qos_class = 0) override;
   void ClockTick() override;
+  void Save(CheckpointWriter &writer) const override;
+  void Load(CheckpointReader &reader) override;
 
 private:
   int latency_;
@@ -1,13 +1,20 @@
 #include "hmc.h"
 
+#include <algorithm>
+#include <fstream>
+
+#include "json.hpp"
+
 namespace dramsim3 {
 
-HMCRequest::HMCRequest(HMCReqType req_type, uint64_t hex_addr, int vault)
-    : type(req_type), mem_operand(hex_addr), vault(vault) {
+HMCRequest::HMCRequest(HMCReqType req_type, uint64_t hex_addr, int vault,
+                       int num_quads)
+    : type(req_type), mem_operand(hex_addr), vault(vault), exit_time(0),
+      tag(0), host_tag(0) {
   is_write = type >= HMCReqType::WR0 && type <= HMCReqType::P_WR256;
-  // given that vaults could be 16 (Gen1) or 32(Gen2), using % 4
-  // to partition vaults to quads
-  quad = vault % 4;
+  // given that vaults could be 16 (Gen1) or 32(Gen2), vaults are partitioned
+  // to quads by vault % quads
+  quad = vault % num_quads;
   switch (req_type) {
     case HMCReqType::RD0:
     case HMCReqType::WR0: flits = 0; break;
@@ -69,7 +76,8 @@ HMCRequest::HMCRequest(HMCReqType req_type, uint64_t hex_addr, int vault)
 
 HMCResponse::HMCResponse(uint64_t id, HMCReqType req_type, int dest_link,
                          int src_quad)
-    : resp_id(id), link(dest_link), quad(src_quad) {
+    : resp_id(id), link(dest_link), quad(src_quad), exit_time(0),
+      host_tag(0) {
   switch (req_type) {
     case HMCReqType::RD0:
       type = HMCRespType::RD_RS;
@@ -196,9 +204,151 @@ HMCResponse::HMCResponse(uint64_t id, HMCReqType req_type, int dest_link,
   return;
 }
 
-HMCMemorySystem::HMCMemorySystem(Config &config, const std::string &output_dir,
-                                 std::function<void(uint64_t)> read_callback,
-                                 std::function<void(uint64_t)> write_callback)
+namespace {
+
+void PutPacket(CheckpointWriter &writer, const HMCRequest &req) {
+  writer.Put(req.type);
+  writer.Put(req.mem_operand);
+  writer.Put(req.link);
+  writer.Put(req.quad);
+  writer.Put(req.vault);
+  writer.Put(req.flits);
+  writer.Put(req.is_write);
+  writer.Put(req.exit_time);
+  writer.Put(req.tag);
+  writer.Put(req.host_tag);
+}
+
+void PutPacket(CheckpointWriter &writer, const HMCResponse &resp) {
+  writer.Put(resp.resp_id);
+  writer.Put(resp.type);
+  writer.Put(resp.link);
+  writer.Put(resp.quad);
+  writer.Put(resp.flits);
+  writer.Put(resp.exit_time);
+  writer.Put(resp.host_tag);
+}
+
+void GetPacket(CheckpointReader &reader, HMCRequest &req) {
+  reader.Get(req.type);
+  reader.Get(req.mem_operand);
+  reader.Get(req.link);
+  reader.Get(req.quad);
+  reader.Get(req.vault);
+  reader.Get(req.flits);
+  reader.Get(req.is_write);
+  reader.Get(req.exit_time);
+  reader.Get(req.tag);
+  reader.Get(req.host_tag);
+}
+
+void GetPacket(CheckpointReader &reader, HMCResponse &resp) {
+  reader.Get(resp.resp_id);
+  reader.Get(resp.type);
+  reader.Get(resp.link);
+  reader.Get(resp.quad);
+  reader.Get(resp.flits);
+  reader.Get(resp.exit_time);
+  reader.Get(resp.host_tag);
+}
+
+// the request of a block_size transaction
+HMCReqType BlockRequestType(int block_size, bool is_write) {
+  if (is_write) {
+    switch (block_size) {
+      case 0: return HMCReqType::WR0;
+      case 32: return HMCReqType::WR32;
+      case 64: return HMCReqType::WR64;
+      case 128: return HMCReqType::WR128;
+      case 256: return HMCReqType::WR256;
+      default: break;
+    }
+  } else {
+    switch (block_size) {
+      case 0: return HMCReqType::RD0;
+      case 32: return HMCReqType::RD32;
+      case 64: return HMCReqType::RD64;
+      case 128: return HMCReqType::RD128;
+      case 256: return HMCReqType::RD256;
+      default: break;
+    }
+  }
+  AbruptExit(__FILE__, __LINE__);
+  return HMCReqType::SIZE;
+}
+
+HMCRequest EmptyPacket(const HMCRequest *) {
+  return HMCRequest(HMCReqType::RD0, 0, 0);
+}
+
+HMCResponse EmptyPacket(const HMCResponse *) {
+  return HMCResponse(0, HMCReqType::RD0, 0, 0);
+}
+
+}  // namespace
+
+// free slots are stored too, the slots in the queues and the vaults have to
+// stay valid
+template <typename T>
+void PacketPool<T>::Save(CheckpointWriter &writer) const {
+  writer.Put(static_cast<uint64_t>(packets_.size()));
+  for (const auto &packet : packets_) {
+    PutPacket(writer, packet);
+  }
+  writer.Put(free_slots_);
+}
+
+template <typename T>
+void PacketPool<T>::Load(CheckpointReader &reader) {
+  uint64_t size;
+  reader.Get(size);
+  packets_.assign(size, EmptyPacket(static_cast<const T *>(nullptr)));
+  for (auto &packet : packets_) {
+    GetPacket(reader, packet);
+  }
+  reader.Get(free_slots_);
+}
+
+PacketQueue::PacketQueue(size_t capacity) : head_(0), size_(0) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  slots_.resize(size);
+}
+
+void PacketQueue::Grow() {
+  std::vector<uint64_t> slots(slots_.size() * 2);
+  for (size_t i = 0; i < size_; i++) {
+    slots[i] = (*this)[i];
+  }
+  slots_.swap(slots);
+  head_ = 0;
+}
+
+void PacketQueue::Save(CheckpointWriter &writer) const {
+  writer.Put(static_cast<uint64_t>(size_));
+  for (size_t i = 0; i < size_; i++) {
+    writer.Put((*this)[i]);
+  }
+}
+
+void PacketQueue::Load(CheckpointReader &reader) {
+  uint64_t size;
+  reader.Get(size);
+  head_ = 0;
+  size_ = 0;
+  for (uint64_t i = 0; i < size; i++) {
+    uint64_t slot;
+    reader.Get(slot);
+    push_back(slot);
+  }
+}
+
+HMCMemorySystem::HMCMemorySystem(
+    const Config &config, const std::string &output_dir,
+    std::function<void(uint64_t)> read_callback,
+    std::function<void(uint64_t)> write_callback, int cube)
     : BaseDRAMSystem(config, output_dir, read_callback, write_callback),
       logic_clk_(0), logic_ps_(0), dram_ps_(0), next_link_(0) {
   // sanity check, this constructor should only be intialized using HMC
@@ -213,12 +363,20 @@ HMCMemorySystem::HMCMemorySystem(Config &config, const std::string &output_dir,
 
   ctrls_.reserve(config_.channels);
   for (int i = 0; i < config_.channels; i++) {
+    int vault = cube * config_.channels + i;
 #ifdef THERMAL
-    ctrls_.push_back(new Controller(i, config_, timing_, thermal_calc_));
+    ctrls_.push_back(new Controller(vault, config_, timing_, thermal_calc_));
 #else
-    ctrls_.push_back(new Controller(i, config_, timing_));
+    ctrls_.push_back(new Controller(vault, config_, timing_));
 #endif  // THERMAL
   }
+  // in a chain of cubes HMCChainSystem does these for all of them
+  if (config_.num_cubes == 1) {
+    StartTraces();
+    // the vaults only meet at the crossbar, which runs serially on the logic
+    // clock between the DRAM cycles, so they can tick in parallel
+    StartThreadPool();
+  }
   // initialize vaults and crossbar
   // the first layer of xbar will be num_links * 4 (4 for quadrants)
   // the second layer will be a 1:8 xbar
@@ -226,20 +384,23 @@ HMCMemorySystem::HMCMemorySystem(Config &config, const std::string &output_dir,
   // quadrant)
   queue_depth_ = static_cast<size_t>(config_.xbar_queue_depth);
   links_ = config_.num_links;
-  link_req_queues_.reserve(links_);
-  link_resp_queues_.reserve(links_);
-  for (int i = 0; i < links_; i++) {
-    link_req_queues_.push_back(std::vector<HMCRequest *>());
-    link_resp_queues_.push_back(std::vector<HMCResponse *>());
-  }
-
-  // don't want to hard coding it but there are 4 quads so it's kind of fixed
-  quad_req_queues_.reserve(4);
-  quad_resp_queues_.reserve(4);
-  for (int i = 0; i < 4; i++) {
-    quad_req_queues_.push_back(std::vector<HMCRequest *>());
-    quad_resp_queues_.push_back(std::vector<HMCResponse *>());
+  quads_ = config_.num_quads;
+  xbar_bandwidth_ = config_.xbar_bandwidth;
+  if (config_.xbar_arbitration == "ROUND_ROBIN") {
+    xbar_policy_ = XbarPolicy::ROUND_ROBIN;
+  } else if (config_.xbar_arbitration == "WEIGHTED") {
+    xbar_policy_ = XbarPolicy::WEIGHTED;
+  } else {
+    xbar_policy_ = XbarPolicy::AGE;
   }
+  link_req_queues_.assign(links_, PacketQueue(queue_depth_));
+  link_resp_queues_.assign(links_, PacketQueue(queue_depth_));
+  quad_req_queues_.assign(quads_, PacketQueue(queue_depth_));
+  quad_resp_queues_.assign(quads_, PacketQueue(queue_depth_));
+  quad_busy_.assign(quads_, 0);
+  quad_age_counter_.assign(quads_, 0);
+  link_order_.reserve(links_);
+  quad_order_.reserve(quads_);
 
   link_busy_.reserve(links_);
   link_age_counter_.reserve(links_);
@@ -255,6 +416,62 @@ HMCMemorySystem::~HMCMemorySystem() {
   }
 }
 
+void HMCMemorySystem::Save(CheckpointWriter &writer) const {
+  BaseDRAMSystem::Save(writer);
+  writer.Put(static_cast<uint64_t>(links_));
+  writer.Put(static_cast<uint64_t>(quads_));
+  writer.Put(logic_clk_);
+  writer.Put(logic_ps_);
+  writer.Put(dram_ps_);
+  writer.Put(next_link_);
+  req_pool_.Save(writer);
+  resp_pool_.Save(writer);
+  for (const auto &queue : link_req_queues_) {
+    queue.Save(writer);
+  }
+  for (const auto &queue : link_resp_queues_) {
+    queue.Save(writer);
+  }
+  for (const auto &queue : quad_req_queues_) {
+    queue.Save(writer);
+  }
+  for (const auto &queue : quad_resp_queues_) {
+    queue.Save(writer);
+  }
+  writer.Put(link_busy_);
+  writer.Put(quad_busy_);
+  writer.Put(link_age_counter_);
+  writer.Put(quad_age_counter_);
+}
+
+void HMCMemorySystem::Load(CheckpointReader &reader) {
+  BaseDRAMSystem::Load(reader);
+  reader.Expect(links_, "num_links");
+  reader.Expect(quads_, "num_quads");
+  reader.Get(logic_clk_);
+  reader.Get(logic_ps_);
+  reader.Get(dram_ps_);
+  reader.Get(next_link_);
+  req_pool_.Load(reader);
+  resp_pool_.Load(reader);
+  for (auto &queue : link_req_queues_) {
+    queue.Load(reader);
+  }
+  for (auto &queue : link_resp_queues_) {
+    queue.Load(reader);
+  }
+  for (auto &queue : quad_req_queues_) {
+    queue.Load(reader);
+  }
+  for (auto &queue : quad_resp_queues_) {
+    queue.Load(reader);
+  }
+  reader.Get(link_busy_);
+  reader.Get(quad_busy_);
+  reader.Get(link_age_counter_);
+  reader.Get(quad_age_counter_);
+}
+
 void HMCMemorySystem::SetClockRatio() {
   // There are 3 clock domains here, Link (super fast), logic (fast), DRAM
   // (slow) We assume the logic process 1 flit per logic cycle and since the
@@ -280,8 +497,8 @@ inline void HMCMemorySystem::IterateNextLink() {
   return;
 }
 
-bool HMCMemorySystem::WillAcceptTransaction(uint64_t hex_addr,
-                                            bool is_write) const {
+bool HMCMemorySystem::WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                                            int qos_class) const {
   bool insertable = false;
   for (auto link_queue = link_req_queues_.begin();
        link_queue != link_req_queues_.end(); link_queue++) {
@@ -293,53 +510,31 @@ bool HMCMemorySystem::WillAcceptTransaction(uint64_t hex_addr,
   return insertable;
 }
 
-bool HMCMemorySystem::AddTransaction(uint64_t hex_addr, bool is_write) {
+bool HMCMemorySystem::AddTransaction(uint64_t hex_addr, bool is_write,
+                                     uint64_t tag, int source, int qos_class) {
   // to be compatible with other protocol we have this interface
   // when using this intreface the size of each transaction will be block_size
-  HMCReqType req_type;
-  if (is_write) {
-    switch (config_.block_size) {
-      case 0: req_type = HMCReqType::WR0; break;
-      case 32: req_type = HMCReqType::WR32; break;
-      case 64: req_type = HMCReqType::WR64; break;
-      case 128: req_type = HMCReqType::WR128; break;
-      case 256: req_type = HMCReqType::WR256; break;
-      default:
-        req_type = HMCReqType::SIZE;
-        AbruptExit(__FILE__, __LINE__);
-        break;
-    }
-  } else {
-    switch (config_.block_size) {
-      case 0: req_type = HMCReqType::RD0; break;
-      case 32: req_type = HMCReqType::RD32; break;
-      case 64: req_type = HMCReqType::RD64; break;
-      case 128: req_type = HMCReqType::RD128; break;
-      case 256: req_type = HMCReqType::RD256; break;
-      default:
-        req_type = HMCReqType::SIZE;
-        AbruptExit(__FILE__, __LINE__);
-        break;
-    }
-  }
+  HMCReqType req_type = BlockRequestType(config_.block_size, is_write);
   int vault = GetChannel(hex_addr);
-  HMCRequest *req = new HMCRequest(req_type, hex_addr, vault);
+  HMCRequest req(req_type, hex_addr, vault, quads_);
+  req.host_tag = tag;
   return InsertHMCReq(req);
 }
 
-bool HMCMemorySystem::InsertReqToLink(HMCRequest *req, int link) {
+bool HMCMemorySystem::InsertReqToLink(const HMCRequest &req, int link) {
   // These things need to happen when an HMC request is inserted to a link:
   // 1. check if link queue full
   // 2. set link field in the request packet
   // 3. create corresponding response
   // 4. increment link_age_counter_ so that arbitrate logic works
   if (link_req_queues_[link].size() < queue_depth_) {
-    req->link = link;
-    link_req_queues_[link].push_back(req);
-    HMCResponse *resp =
-        new HMCResponse(req->mem_operand, req->type, link, req->quad);
-    resp_lookup_table_.insert(
-        std::pair<uint64_t, HMCResponse *>(resp->resp_id, resp));
+    uint64_t req_slot = req_pool_.Allocate(req);
+    HMCRequest &queued = req_pool_[req_slot];
+    queued.link = link;
+    HMCResponse resp(req.mem_operand, req.type, link, req.quad);
+    resp.host_tag = req.host_tag;
+    queued.tag = resp_pool_.Allocate(resp);
+    link_req_queues_[link].push_back(req_slot);
     link_age_counter_[link] = 1;
     // stats_.interarrival_latency.AddValue(clk_ - last_req_clk_);
     last_req_clk_ = clk_;
@@ -349,7 +544,7 @@ bool HMCMemorySystem::InsertReqToLink(HMCRequest *req, int link) {
   }
 }
 
-bool HMCMemorySystem::InsertHMCReq(HMCRequest *req) {
+bool HMCMemorySystem::InsertHMCReq(const HMCRequest &req) {
   // most CPU models does not support simultaneous insertions
   // if you want to actually simulate the multi-link feature
   // then you have to call this function multiple times in 1 cycle
@@ -376,16 +571,17 @@ bool HMCMemorySystem::InsertHMCReq(HMCRequest *req) {
 
 void HMCMemorySystem::DrainRequests() {
   // drain quad request queue to vaults
-  for (int i = 0; i < 4; i++) {
+  for (int i = 0; i < quads_; i++) {
     if (!quad_req_queues_[i].empty() &&
         quad_resp_queues_[i].size() < queue_depth_) {
-      HMCRequest *req = quad_req_queues_[i].front();
-      if (req->exit_time <= logic_clk_) {
-        if (ctrls_[req->vault]->WillAcceptTransaction(req->mem_operand,
-                                                      req->is_write)) {
+      uint64_t req_slot = quad_req_queues_[i].front();
+      const HMCRequest &req = req_pool_[req_slot];
+      if (req.exit_time <= logic_clk_) {
+        if (ctrls_[req.vault]->WillAcceptTransaction(req.mem_operand,
+                                                     req.is_write)) {
           InsertReqToDRAM(req);
-          delete (req);
-          quad_req_queues_[i].erase(quad_req_queues_[i].begin());
+          req_pool_.Free(req_slot);
+          quad_req_queues_[i].pop_front();
         }
       }
     }
@@ -394,22 +590,23 @@ void HMCMemorySystem::DrainRequests() {
   // drain xbar
   for (auto &&i : quad_busy_) {
     if (i > 0) {
-      i -= 2;
+      i -= xbar_bandwidth_;
     }
   }
 
   // drain requests from link to quad buffers
-  std::vector<int> age_queue = BuildAgeQueue(link_age_counter_);
-  while (!age_queue.empty()) {
-    int src_link = age_queue.front();
-    int dest_quad = link_req_queues_[src_link].front()->quad;
+  XbarArbitrate(link_age_counter_, link_req_queues_, link_order_);
+  for (int src_link : link_order_) {
+    uint64_t req_slot = link_req_queues_[src_link].front();
+    HMCRequest &req = req_pool_[req_slot];
+    int dest_quad = req.quad;
     if (quad_req_queues_[dest_quad].size() < queue_depth_ &&
         quad_busy_[dest_quad] <= 0) {
-      HMCRequest *req = link_req_queues_[src_link].front();
-      link_req_queues_[src_link].erase(link_req_queues_[src_link].begin());
-      quad_req_queues_[dest_quad].push_back(req);
-      quad_busy_[dest_quad] = req->flits;
-      req->exit_time = logic_clk_ + req->flits;
+      link_req_queues_[src_link].pop_front();
+      num_slots_freed_++;
+      quad_req_queues_[dest_quad].push_back(req_slot);
+      quad_busy_[dest_quad] = req.flits;
+      req.exit_time = logic_clk_ + req.flits;
       if (link_req_queues_[src_link].empty()) {
         link_age_counter_[src_link] = 0;
       } else {
@@ -418,24 +615,20 @@ void HMCMemorySystem::DrainRequests() {
     } else {  // stalled this cycle, update age counter
       link_age_counter_[src_link]++;
     }
-    age_queue.erase(age_queue.begin());
   }
-  age_queue.clear();
 }
 
 void HMCMemorySystem::DrainResponses() {
   // Link resp to CPU
   for (int i = 0; i < links_; i++) {
     if (!link_resp_queues_[i].empty()) {
-      HMCResponse *resp = link_resp_queues_[i].front();
-      if (resp->exit_time <= logic_clk_) {
-        if (resp->type == HMCRespType::RD_RS) {
-          read_callback_(resp->resp_id);
-        } else {
-          write_callback_(resp->resp_id);
-        }
-        delete (resp);
-        link_resp_queues_[i].erase(link_resp_queues_[i].begin());
+      uint64_t resp_slot = link_resp_queues_[i].front();
+      const HMCResponse &resp = resp_pool_[resp_slot];
+      if (resp.exit_time <= logic_clk_) {
+        ReturnTransaction(resp.resp_id, resp.host_tag,
+                          resp.type != HMCRespType::RD_RS);
+        resp_pool_.Free(resp_slot);
+        link_resp_queues_[i].pop_front();
       }
     }
   }
@@ -443,22 +636,22 @@ void HMCMemorySystem::DrainResponses() {
   // drain xbar
   for (auto &&i : link_busy_) {
     if (i > 0) {
-      i -= 2;
+      i -= xbar_bandwidth_;
     }
   }
 
   // drain responses from quad to link buffers
-  auto age_queue = BuildAgeQueue(quad_age_counter_);
-  while (!age_queue.empty()) {
-    int src_quad = age_queue.front();
-    int dest_link = quad_resp_queues_[src_quad].front()->link;
+  XbarArbitrate(quad_age_counter_, quad_resp_queues_, quad_order_);
+  for (int src_quad : quad_order_) {
+    uint64_t resp_slot = quad_resp_queues_[src_quad].front();
+    HMCResponse &resp = resp_pool_[resp_slot];
+    int dest_link = resp.link;
     if (link_resp_queues_[dest_link].size() < queue_depth_ &&
         link_busy_[dest_link] <= 0) {
-      HMCResponse *resp = quad_resp_queues_[src_quad].front();
-      quad_resp_queues_[src_quad].erase(quad_resp_queues_[src_quad].begin());
-      link_resp_queues_[dest_link].push_back(resp);
-      link_busy_[dest_link] = resp->flits;
-      resp->exit_time = logic_clk_ + resp->flits;
+      quad_resp_queues_[src_quad].pop_front();
+      link_resp_queues_[dest_link].push_back(resp_slot);
+      link_busy_[dest_link] = resp.flits;
+      resp.exit_time = logic_clk_ + resp.flits;
       if (quad_resp_queues_[src_quad].size() == 0) {
         quad_age_counter_[src_quad] = 0;
       } else {
@@ -467,31 +660,22 @@ void HMCMemorySystem::DrainResponses() {
     } else {  // stalled this cycle, update age counter
       quad_age_counter_[src_quad]++;
     }
-    age_queue.erase(age_queue.begin());
   }
-  age_queue.clear();
 }
 
 void HMCMemorySystem::DRAMClockTick() {
   for (size_t i = 0; i < ctrls_.size(); i++) {
+    ProfileScope scope(ctrls_[i]->GetProfiler(), ProfilePart::CALLBACKS);
     // look ahead and return earlier
-    while (true) {
-      auto pair = ctrls_[i]->ReturnDoneTrans(clk_);
-      if (pair.second == 1) {  // write
-        VaultCallback(pair.first);
-      } else if (pair.second == 0) {  // read
-        VaultCallback(pair.first);
-      } else {
-        break;
-      }
+    for (const auto &trans : ctrls_[i]->ReturnDoneTrans(clk_)) {
+      VaultCallback(trans.id);
     }
   }
-  for (size_t i = 0; i < ctrls_.size(); i++) {
-    ctrls_[i]->ClockTick();
-  }
+  TickControllers();
   clk_++;
 
-  if (clk_ % config_.epoch_period == 0) {
+  // a chain prints the epochs of all its cubes
+  if (clk_ % config_.epoch_period == 0 && config_.num_cubes == 1) {
     PrintEpochStats();
   }
   return;
@@ -517,52 +701,334 @@ void HMCMemorySystem::ClockTick() {
   return;
 }
 
-std::vector<int> HMCMemorySystem::BuildAgeQueue(std::vector<int> &age_counter) {
-  // return a vector of indices sorted in decending order
-  // meaning that the oldest age link/quad should be processed first
-  std::vector<int> age_queue;
-  int queue_len = age_counter.size();
-  age_queue.reserve(queue_len);
+void HMCMemorySystem::XbarArbitrate(const std::vector<int> &age_counter,
+                                    const std::vector<PacketQueue> &queues,
+                                    std::vector<int> &order) const {
+  auto priority = [&](int input) {
+    switch (xbar_policy_) {
+      case XbarPolicy::AGE: return static_cast<uint64_t>(age_counter[input]);
+      case XbarPolicy::WEIGHTED:
+        return static_cast<uint64_t>(age_counter[input]) *
+               queues[input].size();
+      default: return static_cast<uint64_t>(0);
+    }
+  };
+  order.clear();
+  int queue_len = static_cast<int>(age_counter.size());
   int start_pos = logic_clk_ % queue_len;  // round robin start pos
   for (int i = 0; i < queue_len; i++) {
     int pos = (i + start_pos) % queue_len;
     if (age_counter[pos] > 0) {
-      bool is_inserted = false;
-      for (auto it = age_queue.begin(); it != age_queue.end(); it++) {
-        if (age_counter[pos] > *it) {
-          age_queue.insert(it, pos);
-          is_inserted = true;
-          break;
-        }
-      }
-      if (!is_inserted) {
-        age_queue.push_back(pos);
+      // behind every input of the same or a higher priority, there are only
+      // a few inputs so an insertion is enough
+      uint64_t pos_priority = priority(pos);
+      auto it = order.end();
+      while (it != order.begin() && priority(*(it - 1)) < pos_priority) {
+        it--;
       }
+      order.insert(it, pos);
     }
   }
-  return age_queue;
 }
 
-void HMCMemorySystem::InsertReqToDRAM(HMCRequest *req) {
-  Transaction trans(req->mem_operand, req->is_write);
-  ctrls_[req->vault]->AddTransaction(trans);
+void HMCMemorySystem::InsertReqToDRAM(const HMCRequest &req) {
+  Transaction trans(req.mem_operand, req.is_write);
+  trans.id = req.tag;
+  ctrls_[req.vault]->AddTransaction(trans);
   return;
 }
 
-void HMCMemorySystem::VaultCallback(uint64_t req_id) {
-  // we will use hex addr as the req_id and use a multimap to lookup the
-  // requests the vaults cannot directly talk to the CPU so this callback will
-  // be passed to the vaults and is responsible to put the responses back to
-  // response queues
-
-  auto it = resp_lookup_table_.find(req_id);
-  HMCResponse *resp = it->second;
-  // all data from dram received, put packet in xbar and return
-  resp_lookup_table_.erase(it);
-  // put it in xbar
-  quad_resp_queues_[resp->quad].push_back(resp);
-  quad_age_counter_[resp->quad] = 1;
+void HMCMemorySystem::VaultCallback(uint64_t resp_slot) {
+  // the vaults cannot directly talk to the CPU so this callback is
+  // responsible to put the responses back to response queues, all data from
+  // dram received, put packet in xbar and return
+  int quad = resp_pool_[resp_slot].quad;
+  quad_resp_queues_[quad].push_back(resp_slot);
+  quad_age_counter_[quad] = 1;
   return;
 }
 
+HMCChainSystem::HMCChainSystem(
+    const Config &config, const std::string &output_dir,
+    std::function<void(uint64_t)> read_callback,
+    std::function<void(uint64_t)> write_callback)
+    : BaseDRAMSystem(config, output_dir, read_callback, write_callback),
+      is_star_(config.cube_topology == "STAR"),
+      cube_bytes_(static_cast<uint64_t>(config.channels) *
+                  static_cast<uint64_t>(config.channel_size) << 20),
+      queue_depth_(static_cast<size_t>(config.xbar_queue_depth)),
+      outstanding_(config.num_cubes, 0),
+      max_outstanding_(static_cast<uint64_t>(config.num_links) *
+                       config.xbar_queue_depth),
+      down_links_(config.num_cubes, CubeLink{{}, 0, 0}),
+      up_links_(config.num_cubes, CubeLink{{}, 0, 0}),
+      cube_returns_(config.num_cubes), cube_reqs_(config.num_cubes, 0),
+      req_link_cycles_(config.num_cubes, 0),
+      resp_link_cycles_(config.num_cubes, 0) {
+#ifdef THERMAL
+  std::cerr << "Thermal simulation of several HMC cubes is not supported"
+            << std::endl;
+  AbruptExit(__FILE__, __LINE__);
+#endif  // THERMAL
+  for (int i = 0; i < config_.num_cubes; i++) {
+    auto &returns = cube_returns_[i];
+    cubes_.push_back(
+        new HMCMemorySystem(config_, output_dir, nullptr, nullptr, i));
+    cubes_[i]->RegisterCompletionCallback(
+        [&returns](const Completion &done) { returns.push_back(done); });
+    // the vaults of every cube are printed, checkpointed and traced as the
+    // channels of this system, still owned by their cubes
+    ctrls_.insert(ctrls_.end(), cubes_[i]->ctrls_.begin(),
+                  cubes_[i]->ctrls_.end());
+  }
+  total_channels_ = static_cast<int>(ctrls_.size());
+  ps_per_dram_ = cubes_[0]->ps_per_dram_;
+  int link_cycles_per_flit = 128 / config_.link_width;
+  ps_per_flit_ = static_cast<uint64_t>(link_cycles_per_flit * 1000000.0 /
+                                       config_.link_speed / config_.cube_links);
+  StartTraces();
+  int num_threads = ThreadPoolSize(config_.num_cubes);
+  if (num_threads > 1) {
+    thread_pool_ = new ThreadPool(num_threads);
+    tick_cube_ = [this](int i) { cubes_[i]->ClockTick(); };
+  }
+}
+
+HMCChainSystem::~HMCChainSystem() {
+  for (auto cube : cubes_) {
+    delete cube;
+  }
+}
+
+int HMCChainSystem::Parent(int cube) const { return is_star_ ? 0 : cube - 1; }
+
+int HMCChainSystem::Hops(int cube) const {
+  return is_star_ ? (cube > 0 ? 1 : 0) : cube;
+}
+
+bool HMCChainSystem::WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                                           int qos_class) const {
+  int cube = GetCube(hex_addr);
+  if (cube == 0) {
+    return cubes_[0]->WillAcceptTransaction(hex_addr, is_write);
+  }
+  // the first hop buffers the requests for the other cubes
+  int first = is_star_ ? cube : 1;
+  return down_links_[first].packets.size() < queue_depth_ &&
+         outstanding_[cube] < max_outstanding_;
+}
+
+bool HMCChainSystem::AddTransaction(uint64_t hex_addr, bool is_write,
+                                    uint64_t tag, int source, int qos_class) {
+  TraceTransaction(hex_addr, is_write);
+  int cube = GetCube(hex_addr);
+  last_req_clk_ = clk_;
+  cube_reqs_[cube]++;
+  if (cube == 0) {
+    return cubes_[0]->AddTransaction(hex_addr, is_write, tag);
+  }
+  outstanding_[cube]++;
+  HMCRequest req(BlockRequestType(config_.block_size, is_write), hex_addr, 0);
+  SendDown(ChainPacket{hex_addr, tag, is_write, cube, req.flits, clk_, 0}, 0);
+  return true;
+}
+
+void HMCChainSystem::Send(CubeLink &link, ChainPacket &packet) {
+  uint64_t start_ps = std::max(clk_ * ps_per_dram_, link.free_ps);
+  link.free_ps = start_ps + static_cast<uint64_t>(packet.flits) * ps_per_flit_;
+  link.flits += static_cast<uint64_t>(packet.flits);
+  packet.arrive_clk = (link.free_ps + ps_per_dram_ - 1) / ps_per_dram_ +
+                      static_cast<uint64_t>(config_.cube_hop_latency);
+  link.packets.push_back(packet);
+}
+
+void HMCChainSystem::SendDown(ChainPacket packet, int from) {
+  Send(down_links_[is_star_ ? packet.cube : from + 1], packet);
+}
+
+void HMCChainSystem::SendUp(ChainPacket packet, int from) {
+  Send(up_links_[from], packet);
+}
+
+void HMCChainSystem::ReturnToHost(const ChainPacket &packet) {
+  if (packet.cube > 0) {
+    outstanding_[packet.cube]--;
+  }
+  ReturnTransaction(packet.addr, packet.tag, packet.is_write);
+}
+
+void HMCChainSystem::MoveLinks() {
+  for (size_t i = 1; i < down_links_.size(); i++) {
+    auto &packets = down_links_[i].packets;
+    int cube = static_cast<int>(i);
+    while (!packets.empty() && packets.front().arrive_clk <= clk_) {
+      ChainPacket &packet = packets.front();
+      if (packet.cube != cube) {
+        SendDown(packet, cube);
+      } else if (cubes_[cube]->WillAcceptTransaction(packet.addr,
+                                                     packet.is_write)) {
+        cubes_[cube]->AddTransaction(packet.addr, packet.is_write,
+                                     packet.tag);
+        req_link_cycles_[cube] += clk_ - packet.start_clk;
+      } else {
+        // blocks the link until the cube takes it
+        break;
+      }
+      if (Parent(cube) == 0) {
+        num_slots_freed_++;
+      }
+      packets.pop_front();
+    }
+  }
+  for (size_t i = 1; i < up_links_.size(); i++) {
+    auto &packets = up_links_[i].packets;
+    int parent = Parent(static_cast<int>(i));
+    while (!packets.empty() && packets.front().arrive_clk <= clk_) {
+      const ChainPacket &packet = packets.front();
+      if (parent == 0) {
+        resp_link_cycles_[packet.cube] += clk_ - packet.start_clk;
+        ReturnToHost(packet);
+      } else {
+        SendUp(packet, parent);
+      }
+      packets.pop_front();
+    }
+  }
+}
+
+void HMCChainSystem::ClockTick() {
+  MoveLinks();
+  if (thread_pool_ != nullptr) {
+    thread_pool_->ParallelFor(static_cast<int>(cubes_.size()), tick_cube_);
+    parallel_cycles_++;
+  } else {
+    for (auto cube : cubes_) {
+      cube->ClockTick();
+    }
+    serial_cycles_++;
+  }
+  // hand the returns on in cube order, whatever thread ticked the cube
+  for (size_t i = 0; i < cubes_.size(); i++) {
+    int cube = static_cast<int>(i);
+    for (const auto &done : cube_returns_[i]) {
+      HMCResponse resp(0, BlockRequestType(config_.block_size, done.is_write),
+                       0, 0);
+      ChainPacket packet{done.hex_addr, done.tag, done.is_write, cube,
+                         resp.flits, clk_, 0};
+      if (cube == 0) {
+        ReturnToHost(packet);
+      } else {
+        SendUp(packet, cube);
+      }
+    }
+    cube_returns_[i].clear();
+  }
+  clk_++;
+
+  if (clk_ % config_.epoch_period == 0) {
+    PrintEpochStats();
+  }
+}
+
+uint64_t HMCChainSystem::HostEvents() const {
+  return BaseDRAMSystem::HostEvents() + cubes_[0]->num_slots_freed_;
+}
+
+void HMCChainSystem::PrintStats() {
+  BaseDRAMSystem::PrintStats();
+  nlohmann::json j;
+  j["topology"] = config_.cube_topology;
+  j["hop_latency"] = config_.cube_hop_latency;
+  double link_ps = static_cast<double>(clk_ * ps_per_dram_);
+  for (size_t i = 0; i < cubes_.size(); i++) {
+    int cube = static_cast<int>(i);
+    nlohmann::json c;
+    c["cube"] = cube;
+    c["hops"] = Hops(cube);
+    c["requests"] = cube_reqs_[i];
+    double reqs = cube_reqs_[i] > 0 ? static_cast<double>(cube_reqs_[i]) : 1;
+    c["average_request_link_latency"] = req_link_cycles_[i] / reqs;
+    c["average_response_link_latency"] = resp_link_cycles_[i] / reqs;
+    if (cube > 0 && link_ps > 0) {
+      c["request_link_utilization"] =
+          down_links_[i].flits * ps_per_flit_ / link_ps;
+      c["response_link_utilization"] =
+          up_links_[i].flits * ps_per_flit_ / link_ps;
+    }
+    j["cubes"].push_back(c);
+  }
+  std::string cubes_name = config_.output_prefix + "cubes.json";
+  std::ofstream(cubes_name) << j.dump(2) << std::endl;
+}
+
+void HMCChainSystem::Save(CheckpointWriter &writer) const {
+  writer.Put(static_cast<uint64_t>(cubes_.size()));
+  writer.Put(num_returns_);
+  writer.Put(num_slots_freed_);
+  writer.Put(last_req_clk_);
+  writer.Put(parallel_cycles_);
+  writer.Put(serial_cycles_);
+  writer.Put(clk_);
+  for (const auto *links : {&down_links_, &up_links_}) {
+    for (const auto &link : *links) {
+      writer.Put(static_cast<uint64_t>(link.packets.size()));
+      for (const auto &packet : link.packets) {
+        writer.Put(packet.addr);
+        writer.Put(packet.tag);
+        writer.Put(packet.is_write);
+        writer.Put(packet.cube);
+        writer.Put(packet.flits);
+        writer.Put(packet.start_clk);
+        writer.Put(packet.arrive_clk);
+      }
+      writer.Put(link.free_ps);
+      writer.Put(link.flits);
+    }
+  }
+  writer.Put(outstanding_);
+  writer.Put(cube_reqs_);
+  writer.Put(req_link_cycles_);
+  writer.Put(resp_link_cycles_);
+  for (const auto cube : cubes_) {
+    cube->Save(writer);
+  }
+}
+
+void HMCChainSystem::Load(CheckpointReader &reader) {
+  reader.Expect(cubes_.size(), "num_cubes");
+  reader.Get(num_returns_);
+  reader.Get(num_slots_freed_);
+  reader.Get(last_req_clk_);
+  reader.Get(parallel_cycles_);
+  reader.Get(serial_cycles_);
+  reader.Get(clk_);
+  for (auto *links : {&down_links_, &up_links_}) {
+    for (auto &link : *links) {
+      uint64_t size;
+      reader.Get(size);
+      link.packets.clear();
+      for (uint64_t i = 0; i < size; i++) {
+        ChainPacket packet;
+        reader.Get(packet.addr);
+        reader.Get(packet.tag);
+        reader.Get(packet.is_write);
+        reader.Get(packet.cube);
+        reader.Get(packet.flits);
+        reader.Get(packet.start_clk);
+        reader.Get(packet.arrive_clk);
+        link.packets.push_back(packet);
+      }
+      reader.Get(link.free_ps);
+      reader.Get(link.flits);
+    }
+  }
+  reader.Get(outstanding_);
+  reader.Get(cube_reqs_);
+  reader.Get(req_link_cycles_);
+  reader.Get(resp_link_cycles_);
+  for (auto cube : cubes_) {
+    cube->Load(reader);
+  }
+}
+
 }  // namespace dramsim3
@@ -1,8 +1,9 @@
 #ifndef __HMC_H
 #define __HMC_H
 
+#include <deque>
 #include <functional>
-#include <map>
+#include <utility>
 #include <vector>
 
 #include "dram_system.h"
@@ -76,9 +77,12 @@ enum class HMCRespType { NONE, RD_RS, WR_RS, ERR, SIZE };
 // for future use
 enum class HMCLinkType { HOST_TO_DEV, DEV_TO_DEV, SIZE };
 
+enum class XbarPolicy { AGE, ROUND_ROBIN, WEIGHTED };
+
 class HMCRequest {
 public:
-  HMCRequest(HMCReqType req_type, uint64_t hex_addr, int vault);
+  HMCRequest(HMCReqType req_type, uint64_t hex_addr, int vault,
+             int num_quads = 4);
   HMCReqType type;
   uint64_t mem_operand;
   int link;
@@ -88,6 +92,11 @@ public:
   bool is_write;
   // this exit_time is the time to exit xbar to vaults
   uint64_t exit_time;
+  // slot of the response in the response pool, the vault hands it back as
+  // the transaction id
+  uint64_t tag;
+  // tag of the host, returned with the response
+  uint64_t host_tag;
 };
 
 class HMCResponse {
@@ -100,13 +109,78 @@ public:
   int flits;
   // this exit_time is the time to exit xbar to cpu
   uint64_t exit_time;
+  uint64_t host_tag;
+};
+
+/// @brief Slab of packets, a packet is known by its slot, which is reused
+/// once the packet is freed, so packets are not allocated one by one.
+template <typename T>
+class PacketPool {
+public:
+  uint64_t Allocate(const T &packet) {
+    if (free_slots_.empty()) {
+      packets_.push_back(packet);
+      return packets_.size() - 1;
+    }
+    uint64_t slot = free_slots_.back();
+    free_slots_.pop_back();
+    packets_[slot] = packet;
+    return slot;
+  }
+  void Free(uint64_t slot) { free_slots_.push_back(slot); }
+  T &operator[](uint64_t slot) { return packets_[slot]; }
+  const T &operator[](uint64_t slot) const { return packets_[slot]; }
+
+  // checkpointing, see MemorySystem::SaveCheckpoint
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
+
+private:
+  std::vector<T> packets_;
+  std::vector<uint64_t> free_slots_;
+};
+
+/// @brief FIFO ring of pool slots, sized for the xbar queue depth up front
+/// and only grown if a queue is pushed past it.
+class PacketQueue {
+public:
+  explicit PacketQueue(size_t capacity);
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+  uint64_t front() const { return slots_[head_]; }
+  uint64_t operator[](size_t i) const {
+    return slots_[(head_ + i) & (slots_.size() - 1)];
+  }
+  void push_back(uint64_t slot) {
+    if (size_ == slots_.size()) {
+      Grow();
+    }
+    slots_[(head_ + size_) & (slots_.size() - 1)] = slot;
+    size_++;
+  }
+  void pop_front() {
+    head_ = (head_ + 1) & (slots_.size() - 1);
+    size_--;
+  }
+
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
+
+private:
+  void Grow();
+
+  std::vector<uint64_t> slots_;
+  size_t head_;
+  size_t size_;
 };
 
 class HMCMemorySystem : public BaseDRAMSystem {
 public:
-  HMCMemorySystem(Config &config, const std::string &output_dir,
+  /// @brief cube is the position of the cube in an HMCChainSystem, its
+  /// vaults are numbered after those of the cubes before it.
+  HMCMemorySystem(const Config &config, const std::string &output_dir,
                   std::function<void(uint64_t)> read_callback,
-                  std::function<void(uint64_t)> write_callback);
+                  std::function<void(uint64_t)> write_callback, int cube = 0);
   ~HMCMemorySystem();
   // assuming there are 2 clock domains one for logic die one for DRAM
   // we can unify them as one but then we'll have to convert all the
@@ -114,47 +188,154 @@ public:
   void ClockTick() override;
 
   // had to have 3 insert interfaces cuz HMC is so different...
-  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const override;
-  bool AddTransaction(uint64_t hex_addr, bool is_write) override;
-  bool InsertReqToLink(HMCRequest *req, int link);
-  bool InsertHMCReq(HMCRequest *req);
+  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                             int qos_class = 0) const override;
+  bool AddTransaction(uint64_t hex_addr, bool is_write, uint64_t tag = 0,
+                      int source = 0, int qos_class = 0) override;
+  bool InsertReqToLink(const HMCRequest &req, int link);
+  bool InsertHMCReq(const HMCRequest &req);
+  void Save(CheckpointWriter &writer) const override;
+  void Load(CheckpointReader &reader) override;
 
 private:
+  friend class HMCChainSystem;
   uint64_t logic_clk_, ps_per_dram_, ps_per_logic_, logic_ps_, dram_ps_;
 
   void SetClockRatio();
   void DRAMClockTick();
   void DrainRequests();
   void DrainResponses();
-  void InsertReqToDRAM(HMCRequest *req);
-  void VaultCallback(uint64_t req_id);
-  std::vector<int> BuildAgeQueue(std::vector<int> &age_counter);
-  void XbarArbitrate();
+  void InsertReqToDRAM(const HMCRequest &req);
+  void VaultCallback(uint64_t resp_slot);
+  /// @brief The inputs of one side of the crossbar with a packet waiting,
+  /// into order in the order they may go. Ties, and every input under
+  /// ROUND_ROBIN, go round robin.
+  void XbarArbitrate(const std::vector<int> &age_counter,
+                     const std::vector<PacketQueue> &queues,
+                     std::vector<int> &order) const;
   inline void IterateNextLink();
 
   int next_link_;
   int links_;
+  int quads_;
   size_t queue_depth_;
 
   // number of flits xbar can process per logic cycle
-  const int xbar_bandwidth_ = 2;
+  int xbar_bandwidth_;
+  XbarPolicy xbar_policy_;
+  // the arbitration orders of this cycle, kept to not allocate every cycle
+  std::vector<int> link_order_;
+  std::vector<int> quad_order_;
 
-  // had to use a multimap because the controller callback return hex addr
-  // instead of unique id
-  std::multimap<uint64_t, HMCResponse *> resp_lookup_table_;
-  // these are essentially input/output buffers for xbars
-  std::vector<std::vector<HMCRequest *>> link_req_queues_;
-  std::vector<std::vector<HMCResponse *>> link_resp_queues_;
-  std::vector<std::vector<HMCRequest *>> quad_req_queues_;
-  std::vector<std::vector<HMCResponse *>> quad_resp_queues_;
+  // every packet in flight, the response of a request is allocated when the
+  // request enters a link and its slot goes through the vault as the
+  // transaction id, so the vault callback finds it directly
+  PacketPool<HMCRequest> req_pool_;
+  PacketPool<HMCResponse> resp_pool_;
+  // these are essentially input/output buffers for xbars, of pool slots
+  std::vector<PacketQueue> link_req_queues_;
+  std::vector<PacketQueue> link_resp_queues_;
+  std::vector<PacketQueue> quad_req_queues_;
+  std::vector<PacketQueue> quad_resp_queues_;
 
   // input/output busy indicators, since each packet could be several
   // flits, as long as this != 0 then they're busy
   std::vector<int> link_busy_;
-  std::vector<int> quad_busy_ = {0, 0, 0, 0};
-  // used for arbitration
+  std::vector<int> quad_busy_;
+  // cycles the front packet of an input stalled, plus one, 0 if the input
+  // is empty, used for arbitration
   std::vector<int> link_age_counter_;
-  std::vector<int> quad_age_counter_ = {0, 0, 0, 0};
+  std::vector<int> quad_age_counter_;
+};
+
+/// @brief Several cubes behind one host (hmc.num_cubes > 1), each an
+/// HMCMemorySystem holding the next slice of the address space. The host
+/// links end at cube 0 and the other cubes are reached through DEV_TO_DEV
+/// links, as a chain or a star around cube 0 (hmc.cube_topology). Every hop
+/// serializes the packet at hmc.cube_links times the link_width/link_speed of
+/// a link and adds hmc.cube_hop_latency cycles of pass-through routing, per
+/// direction. Like the host links of a cube, each of the other cubes takes
+/// at most num_links * xbar_queue_depth requests at a time.
+/// The cubes tick in parallel with system.num_threads. The links are moved
+/// serially between the cycles, so the results do not depend on it. The
+/// vault stats of all the cubes go to the usual stats files, the per cube
+/// link stats to <output_prefix>cubes.json.
+class HMCChainSystem : public BaseDRAMSystem {
+public:
+  HMCChainSystem(const Config &config, const std::string &output_dir,
+                 std::function<void(uint64_t)> read_callback,
+                 std::function<void(uint64_t)> write_callback);
+  ~HMCChainSystem();
+  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                             int qos_class = 0) const override;
+  bool AddTransaction(uint64_t hex_addr, bool is_write, uint64_t tag = 0,
+                      int source = 0, int qos_class = 0) override;
+  void ClockTick() override;
+  void PrintStats() override;
+  void Save(CheckpointWriter &writer) const override;
+  void Load(CheckpointReader &reader) override;
+  int GetCube(uint64_t hex_addr) const {
+    return static_cast<int>((hex_addr / cube_bytes_) % cubes_.size());
+  }
+  /// @brief DEV_TO_DEV hops between the host side cube and cube.
+  int Hops(int cube) const;
+
+protected:
+  uint64_t HostEvents() const override;
+
+private:
+  /// @brief A request on its way to its cube or a response on its way back.
+  struct ChainPacket {
+    uint64_t addr;
+    uint64_t tag;
+    bool is_write;
+    int cube;
+    int flits;
+    // when it left the host or its cube, and when it reaches the far end of
+    // the link it is on
+    uint64_t start_clk;
+    uint64_t arrive_clk;
+  };
+  /// @brief One direction of the link between a cube and its parent.
+  struct CubeLink {
+    std::deque<ChainPacket> packets;
+    // the link is busy sending until then
+    uint64_t free_ps;
+    uint64_t flits;
+  };
+  /// @brief The cube the host side of cube's link is attached to.
+  int Parent(int cube) const;
+  /// @brief Put packet on the link from cube from towards packet.cube (down)
+  /// or towards the host (up).
+  void SendDown(ChainPacket packet, int from);
+  void SendUp(ChainPacket packet, int from);
+  void Send(CubeLink &link, ChainPacket &packet);
+  void MoveLinks();
+  void ReturnToHost(const ChainPacket &packet);
+
+  std::vector<HMCMemorySystem *> cubes_;
+  bool is_star_;
+  uint64_t cube_bytes_;
+  uint64_t ps_per_dram_;
+  uint64_t ps_per_flit_;
+  size_t queue_depth_;
+  // requests of each cube not returned to the host yet, and the most a cube
+  // behind cube 0 may have
+  std::vector<uint64_t> outstanding_;
+  uint64_t max_outstanding_;
+  // down_links_[k] goes from the parent of cube k to cube k, up_links_[k]
+  // back, there are none for cube 0
+  std::vector<CubeLink> down_links_;
+  std::vector<CubeLink> up_links_;
+  // what each cube returned in the current cycle, filled by its callbacks
+  std::vector<std::vector<Completion>> cube_returns_;
+  std::function<void(int)> tick_cube_;
+
+  // per cube requests and the cycles their requests and responses spent on
+  // the links
+  std::vector<uint64_t> cube_reqs_;
+  std::vector<uint64_t> req_link_cycles_;
+  std::vector<uint64_t> resp_link_cycles_;
 };
 
 }  // namespace dramsim3
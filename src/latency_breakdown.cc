@@ -0,0 +1,153 @@
+#include "latency_breakdown.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace dramsim3 {
+
+namespace {
+
+const uint64_t kNever = std::numeric_limits<uint64_t>::max();
+
+}  // namespace
+
+LatencyBreakdown::LatencyBreakdown(const Config &config,
+                                   const ChannelState &channel_state,
+                                   SimpleStats &simple_stats)
+    : config_(config), channel_state_(channel_state),
+      simple_stats_(simple_stats),
+      pre_clk_(config.ranks * config.banks, kNever),
+      act_clk_(config.ranks * config.banks, kNever),
+      act_faw_delay_(config.ranks * config.banks, 0),
+      ref_blocked_(config.ranks * config.banks, 0),
+      ref_start_(config.ranks * config.banks, 0),
+      ref_end_(config.ranks * config.banks, 0), ref_tracked_(false) {
+  for (int i = 0; i < kNumLatencyParts; i++) {
+    std::string part = kLatencyPartNames[i];
+    read_stats_[i] = simple_stats_.Histo("read_" + part + "_latency");
+    write_stats_[i] = simple_stats_.Histo("write_" + part + "_latency");
+  }
+}
+
+void LatencyBreakdown::Stamp(Transaction &trans, uint64_t clk) const {
+  trans.stage_cycle = clk;
+  trans.stage_refresh = RefreshBlocked(BankIndex(trans.mapped_addr), clk);
+}
+
+uint64_t LatencyBreakdown::RefreshBlocked(int bank, uint64_t clk) const {
+  uint64_t blocked = ref_blocked_[bank];
+  if (clk > ref_start_[bank]) {
+    blocked += std::min(clk, ref_end_[bank]) - ref_start_[bank];
+  }
+  return blocked;
+}
+
+void LatencyBreakdown::RefreshedBanks(const Command &ref) {
+  refresh_banks_.clear();
+  int rank_base = ref.Rank() * config_.banks;
+  if (ref.IsRankCMD()) {
+    for (int i = 0; i < config_.banks; i++) {
+      refresh_banks_.push_back(rank_base + i);
+    }
+  } else if (ref.IsSameBankRefresh()) {
+    for (int j = 0; j < config_.bankgroups; j++) {
+      refresh_banks_.push_back(rank_base + j * config_.banks_per_group +
+                               ref.Bank());
+    }
+  } else {
+    refresh_banks_.push_back(BankIndex(ref.addr));
+  }
+}
+
+void LatencyBreakdown::TrackRefresh(uint64_t clk) {
+  if (ref_tracked_ || !channel_state_.IsRefreshWaiting()) {
+    return;
+  }
+  RefreshedBanks(channel_state_.PendingRefCommand());
+  for (int bank : refresh_banks_) {
+    // the last block is over by the time the bank is accessed again
+    ref_blocked_[bank] += ref_end_[bank] - ref_start_[bank];
+    ref_start_[bank] = std::max(clk, ref_end_[bank]);
+    ref_end_[bank] = kNever;
+  }
+  ref_tracked_ = true;
+}
+
+void LatencyBreakdown::CommandIssued(const Command &cmd, uint64_t clk) {
+  if (cmd.IsRefresh()) {
+    // a same-bank refresh is a REFRESH_BANK too
+    uint64_t duration = static_cast<uint64_t>(
+        cmd.cmd_type == CommandType::REFRESH ? config_.tRFC : config_.tRFCb);
+    // a refresh may be issued the cycle it is queued
+    TrackRefresh(clk);
+    RefreshedBanks(cmd);
+    for (int bank : refresh_banks_) {
+      ref_end_[bank] = clk + duration;
+    }
+    ref_tracked_ = false;
+  } else if (cmd.cmd_type == CommandType::PRECHARGE) {
+    pre_clk_[BankIndex(cmd.addr)] = clk;
+  } else if (cmd.cmd_type == CommandType::ACTIVATE) {
+    int bank = BankIndex(cmd.addr);
+    act_clk_[bank] = clk;
+    act_faw_delay_[bank] = channel_state_.ActivationWindowDelay(cmd, clk);
+  }
+}
+
+void LatencyBreakdown::Attribute(const Transaction &trans, const Command &cmd,
+                                 uint64_t clk) {
+  uint64_t parts[kNumLatencyParts] = {0};
+  int bank = BankIndex(cmd.addr);
+  uint64_t start = trans.stage_cycle;
+  uint64_t wait = clk - start;
+  parts[static_cast<int>(LatencyPart::TRANS_QUEUE)] =
+      start - trans.added_cycle;
+  uint64_t refresh =
+      std::min(wait, RefreshBlocked(bank, clk) - trans.stage_refresh);
+  parts[static_cast<int>(LatencyPart::REFRESH)] = refresh;
+  wait -= refresh;
+  // the row was opened, and maybe closed first, for this transaction
+  if (act_clk_[bank] != kNever && act_clk_[bank] >= start) {
+    uint64_t row_miss = static_cast<uint64_t>(
+        cmd.IsRead() ? config_.tRCDRD : config_.tRCDWR);
+    if (pre_clk_[bank] != kNever && pre_clk_[bank] >= start) {
+      row_miss += config_.tRP;
+    }
+    row_miss = std::min(wait, row_miss);
+    parts[static_cast<int>(LatencyPart::ROW_MISS)] = row_miss;
+    wait -= row_miss;
+    uint64_t faw = std::min(wait, act_faw_delay_[bank]);
+    parts[static_cast<int>(LatencyPart::FAW)] = faw;
+    wait -= faw;
+  }
+  parts[static_cast<int>(LatencyPart::CMD_QUEUE)] = wait;
+  parts[static_cast<int>(LatencyPart::DATA_BUS)] = static_cast<uint64_t>(
+      cmd.IsRead() ? config_.read_delay : config_.write_delay);
+
+  const HistoHandle *stats = cmd.IsRead() ? read_stats_ : write_stats_;
+  for (int i = 0; i < kNumLatencyParts; i++) {
+    simple_stats_.AddValue(stats[i], parts[i]);
+  }
+}
+
+void LatencyBreakdown::Save(CheckpointWriter &writer) const {
+  writer.Put(pre_clk_);
+  writer.Put(act_clk_);
+  writer.Put(act_faw_delay_);
+  writer.Put(ref_blocked_);
+  writer.Put(ref_start_);
+  writer.Put(ref_end_);
+  writer.Put(ref_tracked_);
+}
+
+void LatencyBreakdown::Load(CheckpointReader &reader) {
+  reader.Get(pre_clk_);
+  reader.Get(act_clk_);
+  reader.Get(act_faw_delay_);
+  reader.Get(ref_blocked_);
+  reader.Get(ref_start_);
+  reader.Get(ref_end_);
+  reader.Get(ref_tracked_);
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,98 @@
+#ifndef __LATENCY_BREAKDOWN_H
+#define __LATENCY_BREAKDOWN_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "channel_state.h"
+#include "checkpoint.h"
+#include "common.h"
+#include "configuration.h"
+#include "simple_stats.h"
+
+namespace dramsim3 {
+
+/// @brief The parts the latency of a read or write is split into, in the
+/// order they are charged:
+///   trans_queue  waiting in the transaction queue (or write buffer)
+///   refresh      in the command queue while a refresh blocks the bank
+///   row_miss     the tRP and tRCD of the PRECHARGE/ACTIVATE issued for it
+///   faw          the ACTIVATE held back by tFAW/t32AW
+///   cmd_queue    the rest of the command queue wait, i.e. other commands
+///   data_bus     from the column command to the end of the burst
+/// The histograms are named read_<part>_latency and write_<part>_latency.
+enum class LatencyPart {
+  TRANS_QUEUE,
+  REFRESH,
+  ROW_MISS,
+  FAW,
+  CMD_QUEUE,
+  DATA_BUS,
+  SIZE
+};
+const char *const kLatencyPartNames[] = {"trans_queue", "refresh", "row_miss",
+                                         "faw",         "cmd_queue",
+                                         "data_bus"};
+const int kNumLatencyParts = static_cast<int>(LatencyPart::SIZE);
+
+/// @brief Per transaction latency attribution of a controller, only built
+/// with -DLATENCY_BREAKDOWN. Transactions are stamped when they arrive and
+/// when they move to the command queue. The bank history (last PRECHARGE and
+/// ACTIVATE, refresh blocked time) splits up their command queue wait when
+/// their column command is issued, so nothing is done per cycle.
+class LatencyBreakdown {
+public:
+  LatencyBreakdown(const Config &config, const ChannelState &channel_state,
+                   SimpleStats &simple_stats);
+  /// @brief trans starts its next stage at clk, called when it arrives and
+  /// again when it is moved to the command queue.
+  void Stamp(Transaction &trans, uint64_t clk) const;
+  /// @brief Record the pending refresh, if any, as blocking its banks from
+  /// clk on, called whenever a refresh may have been queued.
+  void TrackRefresh(uint64_t clk);
+  /// @brief cmd, which is not a READ or WRITE, is about to be issued at clk.
+  void CommandIssued(const Command &cmd, uint64_t clk);
+  /// @brief trans is served by the column command cmd issued at clk, add
+  /// its latency parts to the histograms.
+  void Attribute(const Transaction &trans, const Command &cmd, uint64_t clk);
+
+  // checkpointing, see MemorySystem::SaveCheckpoint
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
+
+private:
+  const Config &config_;
+  const ChannelState &channel_state_;
+  SimpleStats &simple_stats_;
+  HistoHandle read_stats_[kNumLatencyParts];
+  HistoHandle write_stats_[kNumLatencyParts];
+
+  int BankIndex(const Address &addr) const {
+    return (addr.rank * config_.bankgroups + addr.bankgroup) *
+               config_.banks_per_group +
+           addr.bank;
+  }
+  /// @brief Refresh blocked cycles of bank before clk.
+  uint64_t RefreshBlocked(int bank, uint64_t clk) const;
+  /// @brief The banks a refresh command blocks, into refresh_banks_.
+  void RefreshedBanks(const Command &ref);
+
+  // per bank, cycle of the last PRECHARGE and ACTIVATE (kNever if none) and
+  // how long that ACTIVATE waited for the activation window
+  std::vector<uint64_t> pre_clk_;
+  std::vector<uint64_t> act_clk_;
+  std::vector<uint64_t> act_faw_delay_;
+
+  // per bank refresh blocked time, the total of the finished blocks plus the
+  // current one [ref_start_, ref_end_), ref_end_ is kNever until the refresh
+  // is issued
+  std::vector<uint64_t> ref_blocked_;
+  std::vector<uint64_t> ref_start_;
+  std::vector<uint64_t> ref_end_;
+  // whether the pending refresh is already tracked
+  bool ref_tracked_;
+  std::vector<int> refresh_banks_;
+};
+
+}  // namespace dramsim3
+#endif  // __LATENCY_BREAKDOWN_H
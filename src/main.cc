@@ -10,7 +10,11 @@ int main(int argc, const char **argv) {
       "Examples: \n."
       "./build/dramsim3main configs/DDR4_8Gb_x8_3200.ini -c 100 -t "
       "sample_trace.txt\n"
-      "./build/dramsim3main configs/DDR4_8Gb_x8_3200.ini -s random -c 100");
+      "./build/dramsim3main configs/DDR4_8Gb_x8_3200.ini -s random -c 100\n"
+      "./build/dramsim3main configs/DDR4_8Gb_x8_3200.ini -c 100000 -w "
+      "configs/workloads/mixed.ini\n"
+      "./build/dramsim3main configs/DDR4_8Gb_x8_3200.ini -c 100 -t core0.trace "
+      "-t core1.trace --mshrs 8");
   args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
   args::ValueFlag<uint64_t> num_cycles_arg(parser, "num_cycles",
                                            "Number of cycles to simulate",
@@ -21,9 +25,32 @@ int main(int argc, const char **argv) {
   args::ValueFlag<std::string> stream_arg(
       parser, "stream_type", "address stream generator - (random), stream",
       {'s', "stream"}, "");
-  args::ValueFlag<std::string> trace_file_arg(
-      parser, "trace", "Trace file, setting this option will ignore -s option",
+  args::ValueFlag<std::string> workload_arg(
+      parser, "spec",
+      "Synthetic workload spec file, generates its requests on the fly, "
+      "setting this option will ignore -s option",
+      {'w', "workload"}, "");
+  args::ValueFlagList<std::string> trace_file_arg(
+      parser, "trace",
+      "Trace file (text or binary), setting this option will ignore -s "
+      "option. Repeat it to replay one trace per core",
       {'t', "trace"});
+  args::ValueFlag<int> mshrs_arg(
+      parser, "mshrs",
+      "Outstanding requests per core, replays the trace(s) with multiple "
+      "requests in flight",
+      {"mshrs"}, 0);
+  args::ValueFlag<std::string> arbiter_arg(
+      parser, "arbiter",
+      "Arbiter between cores replaying traces - (rr) round robin, age",
+      {"arbiter"}, "rr");
+  args::ValueFlag<std::string> save_checkpoint_arg(
+      parser, "file", "Save the memory system state to file after the run",
+      {"save-checkpoint"}, "");
+  args::ValueFlag<std::string> load_checkpoint_arg(
+      parser, "file",
+      "Restore the memory system state from file before the run",
+      {"load-checkpoint"}, "");
   args::Positional<std::string> config_arg(parser, "config",
                                            "The config file name (mandatory)");
 
@@ -46,12 +73,20 @@ int main(int argc, const char **argv) {
 
   uint64_t cycles = args::get(num_cycles_arg);
   std::string output_dir = args::get(output_dir_arg);
-  std::string trace_file = args::get(trace_file_arg);
+  std::vector<std::string> trace_files = args::get(trace_file_arg);
   std::string stream_type = args::get(stream_arg);
+  std::string workload_file = args::get(workload_arg);
+  int mshrs = args::get(mshrs_arg);
 
   CPU *cpu;
-  if (!trace_file.empty()) {
-    cpu = new TraceBasedCPU(config_file, output_dir, trace_file);
+  if (trace_files.size() > 1 || (!trace_files.empty() && mshrs > 0)) {
+    // 16 outstanding misses per core unless told otherwise
+    cpu = new MultiTraceCPU(config_file, output_dir, trace_files,
+                            mshrs > 0 ? mshrs : 16, args::get(arbiter_arg));
+  } else if (!trace_files.empty()) {
+    cpu = new TraceBasedCPU(config_file, output_dir, trace_files[0]);
+  } else if (!workload_file.empty()) {
+    cpu = new SyntheticCPU(config_file, output_dir, workload_file);
   } else {
     if (stream_type == "stream" || stream_type == "s") {
       cpu = new StreamCPU(config_file, output_dir);
@@ -60,9 +95,17 @@ int main(int argc, const char **argv) {
     }
   }
 
+  std::string load_checkpoint = args::get(load_checkpoint_arg);
+  if (!load_checkpoint.empty()) {
+    cpu->LoadCheckpoint(load_checkpoint);
+  }
   for (uint64_t clk = 0; clk < cycles; clk++) {
     cpu->ClockTick();
   }
+  std::string save_checkpoint = args::get(save_checkpoint_arg);
+  if (!save_checkpoint.empty()) {
+    cpu->SaveCheckpoint(save_checkpoint);
+  }
   cpu->PrintStats();
 
   delete cpu;
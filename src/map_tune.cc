@@ -0,0 +1,250 @@
+#include "./../ext/headers/args.hxx"
+#include "address_profile.h"
+#include "cpu.h"
+#include "json.hpp"
+#include "memory_system.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+using namespace dramsim3;
+
+namespace {
+
+struct TraceRecord {
+  uint64_t addr;
+  uint64_t cycle;
+  bool is_write;
+};
+
+struct Measured {
+  uint64_t cycles;
+  uint64_t requests;
+  double average_read_latency;
+};
+
+std::string RunName(const MappingPrediction &prediction) {
+  std::string name = prediction.address_mapping;
+  if (!prediction.address_xor.empty()) {
+    name += "_xor-" + prediction.address_xor;
+  }
+  return name;
+}
+
+// run fn(i) for i in [0, num) on num_threads threads
+template <class Fn>
+void ParallelFor(size_t num, int num_threads, Fn fn) {
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < num; i = next++) {
+      fn(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+// replays the trace the same way TraceBasedCPU does until every request has
+// returned, the tag of a request is the cycle it was added in
+Measured Validate(const std::string &config_file, const std::string &output_dir,
+                  const MappingPrediction &prediction,
+                  const std::vector<TraceRecord> &trace) {
+  ConfigOverrides overrides;
+  overrides["system.address_mapping"] = prediction.address_mapping;
+  overrides["system.address_xor"] = prediction.address_xor;
+  overrides["other.output_prefix"] = "dramsim3";
+  MemorySystem memory_system(config_file, output_dir, nullptr, nullptr,
+                             overrides);
+  uint64_t clk = 0;
+  uint64_t num_done = 0;
+  uint64_t num_reads = 0;
+  uint64_t read_latency = 0;
+  memory_system.RegisterCompletionCallback([&](const Completion &done) {
+    num_done++;
+    if (!done.is_write) {
+      num_reads++;
+      read_latency += clk - done.tag;
+    }
+  });
+  size_t next = 0;
+  while (num_done < trace.size()) {
+    memory_system.ClockTick();
+    if (next < trace.size() && trace[next].cycle <= clk) {
+      const TraceRecord &record = trace[next];
+      if (memory_system.WillAcceptTransaction(record.addr, record.is_write)) {
+        memory_system.AddTransaction(record.addr, record.is_write, clk);
+        next++;
+      }
+    }
+    clk++;
+  }
+  memory_system.PrintStats();
+  return Measured{clk, trace.size(),
+                  num_reads == 0 ? 0.0
+                                 : static_cast<double>(read_latency) /
+                                       num_reads};
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  args::ArgumentParser parser(
+      "DRAM address mapping tuner, ranks every address_mapping (and "
+      "address_xor hashing) of a config by what it is predicted to do with a "
+      "trace and simulates the best ones.",
+      "Example: \n"
+      "./build/dramsim3maptune configs/DDR4_8Gb_x8_3200.ini -t "
+      "sample_trace.txt -k 4 -o maptune_out");
+  args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+  args::ValueFlag<std::string> trace_file_arg(
+      parser, "trace", "Trace file (text or binary), mandatory",
+      {'t', "trace"});
+  args::ValueFlag<uint64_t> sample_arg(
+      parser, "requests", "Requests the predictions are made on",
+      {'n', "sample"}, 200000);
+  args::ValueFlag<uint64_t> validate_arg(
+      parser, "requests", "Requests each of the best mappings is simulated on",
+      {'v', "validate"}, 100000);
+  args::ValueFlag<int> top_arg(parser, "k", "Number of mappings to simulate",
+                               {'k', "top"}, 4);
+  args::Flag no_xor_arg(parser, "no-xor", "Leave out XOR hashed mappings",
+                        {"no-xor"});
+  args::ValueFlag<int> num_threads_arg(
+      parser, "num_threads",
+      "Threads for the predictions and simulations, 0 for one per hardware "
+      "thread",
+      {'j', "jobs"}, 0);
+  args::ValueFlag<std::string> output_dir_arg(
+      parser, "output_dir",
+      "Output directory, each simulation writes to a sub directory of its "
+      "mapping and the results go to maptune.json",
+      {'o', "output-dir"}, ".");
+  args::Positional<std::string> config_arg(parser, "config",
+                                           "The config file name (mandatory)");
+
+  try {
+    parser.ParseCLI(argc, argv);
+  } catch (const args::Help &) {
+    std::cout << parser;
+    return 0;
+  } catch (const args::ParseError &e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return 1;
+  }
+
+  std::string config_file = args::get(config_arg);
+  std::string trace_file = args::get(trace_file_arg);
+  if (config_file.empty() || trace_file.empty()) {
+    std::cerr << parser;
+    return 1;
+  }
+  std::string output_dir = args::get(output_dir_arg);
+  uint64_t num_sample = args::get(sample_arg);
+  uint64_t num_validate = args::get(validate_arg);
+  int num_threads = args::get(num_threads_arg);
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const Config config(config_file, output_dir);
+
+  // one pass over the trace, profiling every request and keeping the heads
+  // the predictions and the simulations are made on
+  AddressProfile profile(config);
+  std::vector<uint64_t> sample;
+  std::vector<TraceRecord> head;
+  TraceStream stream(trace_file);
+  Transaction trans;
+  while (stream.Next(trans)) {
+    profile.Add(trans.addr);
+    if (sample.size() < num_sample) {
+      sample.push_back(trans.addr);
+    }
+    if (head.size() < num_validate) {
+      head.push_back(TraceRecord{trans.addr, trans.added_cycle, trans.is_write});
+    }
+  }
+  if (head.empty()) {
+    std::cerr << trace_file << " has no requests" << std::endl;
+    return 1;
+  }
+  // simulations start from the first request
+  uint64_t first_cycle = head.front().cycle;
+  for (auto &record : head) {
+    record.cycle -= std::min(record.cycle, first_cycle);
+  }
+
+  auto candidates = CandidateMappings(config, !no_xor_arg);
+  std::vector<MappingPrediction> predictions(candidates.size());
+  ParallelFor(candidates.size(), num_threads, [&](size_t i) {
+    Config candidate = config;
+    candidate.SetAddressMapping(candidates[i].first, candidates[i].second);
+    predictions[i] = PredictMapping(candidate, sample);
+  });
+  std::stable_sort(predictions.begin(), predictions.end(),
+                   [](const MappingPrediction &a, const MappingPrediction &b) {
+                     if (a.requests_per_cycle != b.requests_per_cycle) {
+                       return a.requests_per_cycle > b.requests_per_cycle;
+                     }
+                     return a.row_hit_rate > b.row_hit_rate;
+                   });
+  std::cout << "Profiled " << profile.Count() << " requests, predicted "
+            << predictions.size() << " mappings" << std::endl;
+
+  size_t top = std::min(predictions.size(),
+                        static_cast<size_t>(std::max(0, args::get(top_arg))));
+  std::vector<Measured> measured(top);
+  for (size_t i = 0; i < top; i++) {
+    mkdir((output_dir + "/" + RunName(predictions[i])).c_str(), 0755);
+  }
+  ParallelFor(top, std::min(num_threads, static_cast<int>(top)),
+              [&](size_t i) {
+                measured[i] =
+                    Validate(config_file,
+                             output_dir + "/" + RunName(predictions[i]),
+                             predictions[i], head);
+              });
+
+  nlohmann::json results;
+  results["config"] = config_file;
+  results["trace"] = trace_file;
+  results["bits"] = profile.ToJson();
+  // the 20 best predictions and the current mapping of the config
+  for (size_t i = 0; i < std::min(predictions.size(), size_t(20)); i++) {
+    results["predicted"].push_back(predictions[i].ToJson());
+  }
+  results["config_mapping"] = PredictMapping(config, sample).ToJson();
+  size_t best = 0;
+  for (size_t i = 0; i < top; i++) {
+    nlohmann::json j_run = predictions[i].ToJson();
+    j_run["cycles"] = measured[i].cycles;
+    j_run["requests"] = measured[i].requests;
+    j_run["average_read_latency"] = measured[i].average_read_latency;
+    results["simulated"].push_back(j_run);
+    if (measured[i].cycles < measured[best].cycles ||
+        (measured[i].cycles == measured[best].cycles &&
+         measured[i].average_read_latency <
+             measured[best].average_read_latency)) {
+      best = i;
+    }
+  }
+  if (top > 0) {
+    results["best"] = predictions[best].ToJson();
+    std::cout << "Best mapping: address_mapping = "
+              << predictions[best].address_mapping
+              << ", address_xor = " << predictions[best].address_xor
+              << std::endl;
+  }
+  std::ofstream(output_dir + "/maptune.json") << results.dump(2) << std::endl;
+  std::cout << "Results written to " << output_dir << "/maptune.json"
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,264 @@
+#include "memory_cache.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace dramsim3 {
+
+MemoryCache::MemoryCache(const Config &config)
+    : config_(config),
+      num_sets_(config.cache_size * 1024 /
+                (config.cache_line_size * config.cache_assoc)),
+      requests_per_line_(config.cache_line_size / config.request_size_bytes),
+      lines_(static_cast<size_t>(num_sets_) * config.cache_assoc,
+             Line{0, 0, false, false}),
+      use_clk_(0), num_forwarded_(0) {
+  ResetStats();
+}
+
+bool MemoryCache::WillAcceptTransaction() const {
+  return requests_.size() <
+         static_cast<size_t>(config_.trans_queue_size) * config_.channels;
+}
+
+void MemoryCache::AddTransaction(uint64_t hex_addr, bool is_write,
+                                 uint64_t tag, uint64_t clk) {
+  Transaction trans(hex_addr, is_write);
+  trans.id = tag;
+  trans.added_cycle = clk;
+  trans.complete_cycle = clk + config_.cache_hit_latency;
+  uint64_t line_addr = hex_addr / config_.cache_line_size;
+  if (!is_write) {
+    reads_++;
+    auto miss = misses_.find(line_addr);
+    if (miss != misses_.end()) {
+      miss_merges_++;
+      miss->second.waiting.push_back(trans);
+      return;
+    }
+    if (Find(line_addr) != nullptr) {
+      read_hits_++;
+      done_.push_back(trans);
+      return;
+    }
+    // nothing is allocated on a read miss until the fill
+    StartMiss(line_addr).waiting.push_back(trans);
+    return;
+  }
+
+  writes_++;
+  Line *line = Find(line_addr);
+  write_hits_ += line != nullptr ? 1 : 0;
+  if (config_.cache_write_back) {
+    if (line != nullptr) {
+      line->dirty = true;
+    } else if (requests_per_line_ == 1) {
+      // the write covers the whole line
+      Allocate(line_addr).dirty = true;
+    } else {
+      // the rest of the line is fetched, the write goes into the fill
+      miss_merges_ += misses_.count(line_addr);
+      StartMiss(line_addr).dirty = true;
+    }
+    done_.push_back(trans);
+  } else {
+    // the line stays clean, the write is done once the DRAM has it
+    requests_.push_back(trans);
+    dram_writes_++;
+  }
+}
+
+MemoryCache::Miss &MemoryCache::StartMiss(uint64_t line_addr) {
+  auto it = misses_.find(line_addr);
+  if (it != misses_.end()) {
+    return it->second;
+  }
+  Miss &miss = misses_[line_addr];
+  miss.reads_out = requests_per_line_;
+  miss.dirty = false;
+  SendLine(line_addr, false);
+  return miss;
+}
+
+MemoryCache::Line *MemoryCache::Find(uint64_t line_addr) {
+  uint64_t set = line_addr % num_sets_;
+  uint64_t tag = line_addr / num_sets_;
+  Line *begin = &lines_[set * config_.cache_assoc];
+  for (Line *line = begin; line != begin + config_.cache_assoc; line++) {
+    if (line->valid && line->tag == tag) {
+      line->last_use = ++use_clk_;
+      return line;
+    }
+  }
+  return nullptr;
+}
+
+MemoryCache::Line &MemoryCache::Allocate(uint64_t line_addr) {
+  uint64_t set = line_addr % num_sets_;
+  Line *begin = &lines_[set * config_.cache_assoc];
+  Line *victim = begin;
+  for (Line *line = begin; line != begin + config_.cache_assoc; line++) {
+    if (!line->valid) {
+      victim = line;
+      break;
+    }
+    if (line->last_use < victim->last_use) {
+      victim = line;
+    }
+  }
+  if (victim->valid && victim->dirty) {
+    writebacks_++;
+    SendLine(victim->tag * num_sets_ + set, true);
+  }
+  victim->tag = line_addr / num_sets_;
+  victim->last_use = ++use_clk_;
+  victim->valid = true;
+  victim->dirty = false;
+  return *victim;
+}
+
+void MemoryCache::SendLine(uint64_t line_addr, bool is_write) {
+  uint64_t base = line_addr * config_.cache_line_size;
+  for (int i = 0; i < requests_per_line_; i++) {
+    requests_.push_back(Transaction(
+        base + static_cast<uint64_t>(i) * config_.request_size_bytes,
+        is_write));
+  }
+  (is_write ? dram_writes_ : dram_reads_) += requests_per_line_;
+}
+
+void MemoryCache::DramDone(const Transaction &trans, uint64_t clk) {
+  if (trans.is_write) {
+    // only the writes of a write-through cache are the host's
+    if (!config_.cache_write_back) {
+      done_.push_back(trans);
+      done_.back().complete_cycle = clk;
+    }
+    return;
+  }
+  uint64_t line_addr = trans.addr / config_.cache_line_size;
+  auto it = misses_.find(line_addr);
+  if (it == misses_.end() || --it->second.reads_out > 0) {
+    return;
+  }
+  Fill(line_addr, clk);
+}
+
+void MemoryCache::Fill(uint64_t line_addr, uint64_t clk) {
+  fills_++;
+  Miss &miss = misses_[line_addr];
+  Line *line = Find(line_addr);
+  if (line == nullptr) {
+    line = &Allocate(line_addr);
+  }
+  line->dirty = line->dirty || miss.dirty;
+  for (auto &trans : miss.waiting) {
+    trans.complete_cycle = clk;
+    done_.push_back(trans);
+  }
+  misses_.erase(line_addr);
+}
+
+void MemoryCache::TakeDone(uint64_t clk, std::vector<Transaction> &done) {
+  auto it = std::stable_partition(
+      done_.begin(), done_.end(),
+      [clk](const Transaction &trans) { return trans.complete_cycle > clk; });
+  done.insert(done.end(), it, done_.end());
+  done_.erase(it, done_.end());
+}
+
+uint64_t MemoryCache::NextDoneCycle() const {
+  uint64_t next = std::numeric_limits<uint64_t>::max();
+  for (const auto &trans : done_) {
+    next = std::min(next, trans.complete_cycle);
+  }
+  return next;
+}
+
+nlohmann::json MemoryCache::Stats() const {
+  nlohmann::json j;
+  j["reads"] = reads_;
+  j["writes"] = writes_;
+  j["read_hits"] = read_hits_;
+  j["write_hits"] = write_hits_;
+  j["miss_merges"] = miss_merges_;
+  j["fills"] = fills_;
+  j["writebacks"] = writebacks_;
+  j["dram_reads"] = dram_reads_;
+  j["dram_writes"] = dram_writes_;
+  uint64_t accesses = reads_ + writes_;
+  j["hit_rate"] = accesses == 0 ? 0.0
+                                : static_cast<double>(read_hits_ + write_hits_) /
+                                      accesses;
+  // DRAM requests the cache saved, negative if it added some
+  j["dram_requests_saved"] = static_cast<int64_t>(accesses) -
+                             static_cast<int64_t>(dram_reads_ + dram_writes_);
+  return j;
+}
+
+void MemoryCache::ResetStats() {
+  reads_ = 0;
+  writes_ = 0;
+  read_hits_ = 0;
+  write_hits_ = 0;
+  miss_merges_ = 0;
+  fills_ = 0;
+  writebacks_ = 0;
+  dram_reads_ = 0;
+  dram_writes_ = 0;
+}
+
+void MemoryCache::Save(CheckpointWriter &writer) const {
+  for (const auto &line : lines_) {
+    writer.Put(line.tag);
+    writer.Put(line.last_use);
+    writer.Put(line.valid);
+    writer.Put(line.dirty);
+  }
+  writer.Put(use_clk_);
+  writer.Put(static_cast<uint64_t>(misses_.size()));
+  for (const auto &miss : misses_) {
+    writer.Put(miss.first);
+    writer.Put(miss.second.reads_out);
+    writer.Put(miss.second.waiting);
+    writer.Put(miss.second.dirty);
+  }
+  writer.Put(requests_);
+  writer.Put(done_);
+  writer.Put(num_forwarded_);
+  for (uint64_t stat : {reads_, writes_, read_hits_, write_hits_, miss_merges_,
+                        fills_, writebacks_, dram_reads_, dram_writes_}) {
+    writer.Put(stat);
+  }
+}
+
+void MemoryCache::Load(CheckpointReader &reader) {
+  for (auto &line : lines_) {
+    reader.Get(line.tag);
+    reader.Get(line.last_use);
+    reader.Get(line.valid);
+    reader.Get(line.dirty);
+  }
+  reader.Get(use_clk_);
+  uint64_t num_misses;
+  reader.Get(num_misses);
+  misses_.clear();
+  for (uint64_t i = 0; i < num_misses; i++) {
+    uint64_t line_addr;
+    reader.Get(line_addr);
+    Miss &miss = misses_[line_addr];
+    reader.Get(miss.reads_out);
+    reader.Get(miss.waiting);
+    reader.Get(miss.dirty);
+  }
+  reader.Get(requests_);
+  reader.Get(done_);
+  reader.Get(num_forwarded_);
+  for (uint64_t *stat : {&reads_, &writes_, &read_hits_, &write_hits_,
+                         &miss_merges_, &fills_, &writebacks_, &dram_reads_,
+                         &dram_writes_}) {
+    reader.Get(*stat);
+  }
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,106 @@
+#ifndef __MEMORY_CACHE_H
+#define __MEMORY_CACHE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "common.h"
+#include "configuration.h"
+#include "json.hpp"
+
+namespace dramsim3 {
+
+/// @brief Set associative, LRU memory-side cache (SRAM, eDRAM or a DRAM
+/// cache) between the host and the controllers of a JedecDRAMSystem, set in
+/// the [cache] section of the config. Hits return after cache_hit_latency
+/// cycles without reaching a controller. A read miss fetches the whole line,
+/// line_size / request size reads, and later misses to a line in flight wait
+/// for the same fill. Write-back caches allocate the lines of writes and
+/// fetch the rest of the line on a write miss (the write is done right away
+/// and the line is dirty once filled), and write dirty victims back;
+/// write-through caches send every write to the DRAM and return it once the
+/// controller does. The DRAM requests wait in the cache until the controllers
+/// take them, see TakeRequests. Stats go to <output_prefix>cache.json.
+class MemoryCache {
+public:
+  explicit MemoryCache(const Config &config);
+  /// @brief False while the requests for the DRAM fill the queue of the
+  /// cache, trans_queue_size per channel.
+  bool WillAcceptTransaction() const;
+  void AddTransaction(uint64_t hex_addr, bool is_write, uint64_t tag,
+                      uint64_t clk);
+  /// @brief A request of the cache returned from the DRAM.
+  void DramDone(const Transaction &trans, uint64_t clk);
+  /// @brief Move the host transactions that are done by clk into done.
+  void TakeDone(uint64_t clk, std::vector<Transaction> &done);
+  /// @brief Hand the requests for the DRAM to take, which returns true for
+  /// each one it takes. A request that is not taken holds back the later
+  /// ones of its channel.
+  template <class Take>
+  void TakeRequests(Take take) {
+    std::vector<bool> blocked(config_.channels, false);
+    for (auto it = requests_.begin(); it != requests_.end();) {
+      int channel = config_.AddressChannel(it->addr);
+      if (!blocked[channel] && take(*it)) {
+        it = requests_.erase(it);
+        num_forwarded_++;
+      } else {
+        blocked[channel] = true;
+        it++;
+      }
+    }
+  }
+  bool HasRequests() const { return !requests_.empty(); }
+  /// @brief Requests handed to the DRAM so far, each frees a queue slot.
+  uint64_t NumForwarded() const { return num_forwarded_; }
+  /// @brief Earliest cycle a host transaction is done, UINT64_MAX if none is
+  /// waiting for a cycle.
+  uint64_t NextDoneCycle() const;
+  nlohmann::json Stats() const;
+  void ResetStats();
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
+
+private:
+  struct Line {
+    uint64_t tag;
+    uint64_t last_use;
+    bool valid;
+    bool dirty;
+  };
+  // the line of line_addr marked as used, nullptr on a miss
+  Line *Find(uint64_t line_addr);
+  // an invalid or the LRU line of the set, a dirty victim is written back
+  Line &Allocate(uint64_t line_addr);
+  void SendLine(uint64_t line_addr, bool is_write);
+  void Fill(uint64_t line_addr, uint64_t clk);
+
+  const Config &config_;
+  int num_sets_;
+  int requests_per_line_;
+  std::vector<Line> lines_;
+  uint64_t use_clk_;
+  // misses in flight by line, the DRAM reads still out, the host reads
+  // waiting for the line and whether it was written meanwhile
+  struct Miss {
+    int reads_out;
+    std::vector<Transaction> waiting;
+    bool dirty;
+  };
+  // fetch the line, unless a fill of it is in flight
+  Miss &StartMiss(uint64_t line_addr);
+  std::map<uint64_t, Miss> misses_;
+  std::vector<Transaction> requests_;
+  // host transactions by the cycle they are done
+  std::vector<Transaction> done_;
+  uint64_t num_forwarded_;
+
+  uint64_t reads_, writes_, read_hits_, write_hits_, miss_merges_;
+  uint64_t fills_, writebacks_, dram_reads_, dram_writes_;
+};
+
+}  // namespace dramsim3
+#endif  // __MEMORY_CACHE_H
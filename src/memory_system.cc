@@ -4,12 +4,24 @@ namespace dramsim3 {
 MemorySystem::MemorySystem(const std::string &config_file,
                            const std::string &output_dir,
                            std::function<void(uint64_t)> read_callback,
-                           std::function<void(uint64_t)> write_callback)
-    : config_(new Config(config_file, output_dir)) {
-  // TODO: ideal memory type?
-  if (config_->IsHMC()) {
+                           std::function<void(uint64_t)> write_callback,
+                           const ConfigOverrides &overrides)
+    : config_(ConfigCache::Get(config_file, output_dir, overrides)) {
+  if (config_->IsHMC() && config_->num_cubes > 1) {
+    dram_system_ = new HMCChainSystem(*config_, output_dir, read_callback,
+                                      write_callback);
+  } else if (config_->IsHMC()) {
     dram_system_ = new HMCMemorySystem(*config_, output_dir, read_callback,
                                        write_callback);
+  } else if (config_->memory_model == "IDEAL") {
+    dram_system_ = new IdealDRAMSystem(*config_, output_dir, read_callback,
+                                       write_callback);
+  } else if (config_->memory_model == "ANALYTICAL") {
+    dram_system_ = new AnalyticalDRAMSystem(*config_, output_dir,
+                                            read_callback, write_callback);
+  } else if (config_->sampling) {
+    dram_system_ = new SampledDRAMSystem(*config_, output_dir, read_callback,
+                                         write_callback);
   } else {
     dram_system_ = new JedecDRAMSystem(*config_, output_dir, read_callback,
                                        write_callback);
@@ -18,10 +30,24 @@ MemorySystem::MemorySystem(const std::string &config_file,
 
 MemorySystem::~MemorySystem() {
   delete (dram_system_);
-  delete (config_);
 }
 
-void MemorySystem::ClockTick() { dram_system_->ClockTick(); }
+void MemorySystem::ClockTick() {
+  dram_system_->ClockTick();
+  dram_system_->DeliverBatch();
+}
+
+uint64_t MemorySystem::ClockTickN(uint64_t cycles) {
+  uint64_t elapsed = dram_system_->ClockTickN(cycles);
+  dram_system_->DeliverBatch();
+  return elapsed;
+}
+
+uint64_t MemorySystem::RunUntil(uint64_t cycle) {
+  uint64_t elapsed = dram_system_->RunUntil(cycle);
+  dram_system_->DeliverBatch();
+  return elapsed;
+}
 
 double MemorySystem::GetTCK() const { return config_->tCK; }
 
@@ -31,25 +57,56 @@ int MemorySystem::GetBurstLength() const { return config_->BL; }
 
 int MemorySystem::GetQueueSize() const { return config_->trans_queue_size; }
 
+int MemorySystem::GetChannel(uint64_t hex_addr) const {
+  return dram_system_->GetChannel(hex_addr);
+}
+
+int MemorySystem::GetChannels() const { return config_->channels; }
+
 void MemorySystem::RegisterCallbacks(
     std::function<void(uint64_t)> read_callback,
     std::function<void(uint64_t)> write_callback) {
   dram_system_->RegisterCallbacks(read_callback, write_callback);
 }
 
-bool MemorySystem::WillAcceptTransaction(uint64_t hex_addr,
-                                         bool is_write) const {
-  return dram_system_->WillAcceptTransaction(hex_addr, is_write);
+void MemorySystem::RegisterCompletionCallback(CompletionCallback callback) {
+  dram_system_->RegisterCompletionCallback(callback);
 }
 
-bool MemorySystem::AddTransaction(uint64_t hex_addr, bool is_write) {
-  return dram_system_->AddTransaction(hex_addr, is_write);
+void MemorySystem::RegisterBatchCallback(BatchCallback callback) {
+  dram_system_->RegisterBatchCallback(callback);
+}
+
+bool MemorySystem::WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                                         int qos_class) const {
+  return dram_system_->WillAcceptTransaction(hex_addr, is_write, qos_class);
+}
+
+bool MemorySystem::AddTransaction(uint64_t hex_addr, bool is_write,
+                                  uint64_t tag, int source, int qos_class) {
+  return dram_system_->AddTransaction(hex_addr, is_write, tag, source,
+                                      qos_class);
 }
 
 void MemorySystem::PrintStats() const { dram_system_->PrintStats(); }
 
 void MemorySystem::ResetStats() { dram_system_->ResetStats(); }
 
+void MemorySystem::SaveCheckpoint(const std::string &file) const {
+  CheckpointWriter writer(file);
+  dram_system_->Save(writer);
+}
+
+void MemorySystem::LoadCheckpoint(const std::string &file) {
+  CheckpointReader reader(file);
+  dram_system_->Load(reader);
+  if (!reader.AtEnd()) {
+    std::cerr << "Checkpoint " << file << " has trailing data, it was taken "
+              << "with a different kind of memory system" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+}
+
 MemorySystem *GetMemorySystem(const std::string &config_file,
                               const std::string &output_dir,
                               std::function<void(uint64_t)> read_callback,
@@ -2,39 +2,73 @@
 #define __MEMORY_SYSTEM__H
 
 #include <functional>
+#include <memory>
 #include <string>
 
+#include "analytical_system.h"
 #include "configuration.h"
 #include "dram_system.h"
 #include "hmc.h"
+#include "sampled_system.h"
 
 namespace dramsim3 {
 
 // This should be the interface class that deals with CPU
 class MemorySystem {
 public:
+  /// overrides replace values of the config file, see ConfigOverrides.
   MemorySystem(const std::string &config_file, const std::string &output_dir,
                std::function<void(uint64_t)> read_callback,
-               std::function<void(uint64_t)> write_callback);
+               std::function<void(uint64_t)> write_callback,
+               const ConfigOverrides &overrides = ConfigOverrides());
   ~MemorySystem();
   void ClockTick();
+  /// Advance up to cycles DRAM cycles in one call, returning early right after
+  /// a completion callback or a freed transaction queue slot. Returns the
+  /// number of cycles that actually elapsed.
+  uint64_t ClockTickN(uint64_t cycles);
+  /// ClockTickN until the memory clock reaches cycle.
+  uint64_t RunUntil(uint64_t cycle);
   void RegisterCallbacks(std::function<void(uint64_t)> read_callback,
                          std::function<void(uint64_t)> write_callback);
+  /// Callback that gets the tag along with the address of every finished
+  /// transaction, in place of the address callbacks. A batch callback
+  /// instead gets all the completions of a ClockTick, ClockTickN or RunUntil
+  /// call as one array, at the end of the call.
+  void RegisterCompletionCallback(CompletionCallback callback);
+  void RegisterBatchCallback(BatchCallback callback);
   double GetTCK() const;
   int GetBusBits() const;
   int GetBurstLength() const;
   int GetQueueSize() const;
+  /// The channel of an address, in [0, GetChannels()).
+  int GetChannel(uint64_t hex_addr) const;
+  int GetChannels() const;
   void PrintStats() const;
   void ResetStats();
+  /// Write the whole state of the memory system to a binary checkpoint file.
+  /// LoadCheckpoint restores it into a memory system of the same config, or
+  /// of a config that only differs in timing and policy parameters, so that
+  /// many experiments can start from one warmed up state. The callbacks and
+  /// the state of the front end are not part of the checkpoint.
+  void SaveCheckpoint(const std::string &file) const;
+  void LoadCheckpoint(const std::string &file);
 
-  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write) const;
-  bool AddTransaction(uint64_t hex_addr, bool is_write);
+  /// qos_class is the class the transaction would be added with.
+  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                             int qos_class = 0) const;
+  /// tag is handed back as is with the completion of the transaction. source
+  /// and qos_class pick its bandwidth cap and priority class, see
+  /// system.qos_classes.
+  bool AddTransaction(uint64_t hex_addr, bool is_write, uint64_t tag = 0,
+                      int source = 0, int qos_class = 0);
 
 private:
   // These have to be pointers because Gem5 will try to push this object
   // into container which will invoke a copy constructor, using pointers
-  // here is safe
-  Config *config_;
+  // here is safe. The config is shared with the other memory systems of the
+  // same config, see ConfigCache
+  std::shared_ptr<const Config> config_;
   BaseDRAMSystem *dram_system_;
 };
 
@@ -0,0 +1,49 @@
+#include "profiler.h"
+
+namespace dramsim3 {
+
+Profiler::Profiler()
+    : ticks_(), calls_(), events_(), current_(ProfilePart::NONE),
+      last_tsc_(ReadTsc()), start_tsc_(last_tsc_),
+      start_time_(std::chrono::steady_clock::now()) {}
+
+nlohmann::json Profiler::Report() const {
+  // time stamp counter rate, measured over the life of the profiler
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start_time_)
+                       .count();
+  uint64_t elapsed_tsc = ReadTsc() - start_tsc_;
+  double tsc_per_sec = seconds > 0 ? elapsed_tsc / seconds : 1;
+
+  nlohmann::json j;
+  uint64_t total_ticks = 0;
+  for (int i = 1; i < static_cast<int>(ProfilePart::SIZE); i++) {
+    total_ticks += ticks_[i];
+  }
+  j["seconds"] = total_ticks / tsc_per_sec;
+  for (int i = 1; i < static_cast<int>(ProfilePart::SIZE); i++) {
+    nlohmann::json part;
+    part["seconds"] = ticks_[i] / tsc_per_sec;
+    part["share"] =
+        total_ticks > 0 ? static_cast<double>(ticks_[i]) / total_ticks : 0.0;
+    part["calls"] = calls_[i];
+    j["parts"][kProfilePartNames[i]] = part;
+  }
+  for (int i = 0; i < static_cast<int>(ProfileEvent::SIZE); i++) {
+    j["events"][kProfileEventNames[i]] = events_[i];
+  }
+
+  auto ratio = [this](ProfileEvent a, ProfileEvent b) {
+    uint64_t d = events_[static_cast<int>(b)];
+    return d > 0 ? static_cast<double>(events_[static_cast<int>(a)]) / d : 0.0;
+  };
+  j["get_ready_calls_per_command"] =
+      ratio(ProfileEvent::GET_READY_CALLS, ProfileEvent::COMMANDS_ISSUED);
+  j["average_scan_length"] =
+      ratio(ProfileEvent::COMMANDS_SCANNED, ProfileEvent::QUEUES_SCANNED);
+  j["timing_updates_per_command"] =
+      ratio(ProfileEvent::TIMING_UPDATES, ProfileEvent::COMMANDS_ISSUED);
+  return j;
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,153 @@
+#ifndef __PROFILER_H
+#define __PROFILER_H
+
+#include <stdint.h>
+#include <chrono>
+
+#include "json.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace dramsim3 {
+
+/// @brief The parts of a controller tick the host time is split into.
+///   refresh         Refresh::ClockTick
+///   command_select  picking the next command, FinishRefresh and
+///                   GetCommandToIssue
+///   issue           IssueCommand bookkeeping, pending queues, returns, traces
+///   stats           SimpleStats updates and the epoch/final stats output
+///   timing_update   ChannelState::UpdateTimingAndStates and the ready bounds
+///   power           self-refresh and power-down decisions
+///   schedule        ScheduleTransaction
+///   next_event      NextEventCycle, finding the ticks that can be skipped
+///   callbacks       returning the done transactions to the front end
+enum class ProfilePart {
+  NONE,
+  REFRESH,
+  COMMAND_SELECT,
+  ISSUE,
+  STATS,
+  TIMING_UPDATE,
+  POWER,
+  SCHEDULE,
+  NEXT_EVENT,
+  CALLBACKS,
+  SIZE
+};
+const char *const kProfilePartNames[] = {
+    "none",  "refresh",  "command_select", "issue",    "stats", "timing_update",
+    "power", "schedule", "next_event",     "callbacks"};
+
+/// @brief Event counters, the report derives GetReadyCommand calls per
+/// issued command, the average queue scan length and the timing update
+/// fan-out per command from them.
+///   ticks            controller ticks that were simulated
+///   idle_ticks       controller ticks that were skipped as idle
+///   commands_issued  commands issued to the channel
+///   get_ready_calls  GetReadyCommand calls of the command queue
+///   queues_scanned   command queues searched for a ready command
+///   commands_scanned queued commands looked at in those searches
+///   timing_updates   bank timing table entries updated by issued commands
+enum class ProfileEvent {
+  TICKS,
+  IDLE_TICKS,
+  COMMANDS_ISSUED,
+  GET_READY_CALLS,
+  QUEUES_SCANNED,
+  COMMANDS_SCANNED,
+  TIMING_UPDATES,
+  SIZE
+};
+const char *const kProfileEventNames[] = {
+    "ticks",          "idle_ticks",     "commands_issued", "get_ready_calls",
+    "queues_scanned", "commands_scanned", "timing_updates"};
+
+/// @brief Self-profiling of one channel (other.profile). Host time is read
+/// from the time stamp counter and charged to the part that is current, so
+/// nested parts are exclusive: entering one pauses the one it is nested in.
+/// Instrumented code holds a Profiler pointer that is null when profiling is
+/// off, so a disabled profiler costs a null check.
+class Profiler {
+public:
+  Profiler();
+  /// @brief Make part the current one, returns the one it replaces.
+  ProfilePart Enter(ProfilePart part) {
+    calls_[static_cast<int>(part)]++;
+    return Resume(part);
+  }
+  /// @brief Like Enter, but not counted as a call of part, used to return
+  /// to an enclosing part.
+  ProfilePart Resume(ProfilePart part) {
+    uint64_t now = ReadTsc();
+    ticks_[static_cast<int>(current_)] += now - last_tsc_;
+    last_tsc_ = now;
+    ProfilePart prev = current_;
+    current_ = part;
+    return prev;
+  }
+  void Count(ProfileEvent event, uint64_t count = 1) {
+    events_[static_cast<int>(event)] += count;
+  }
+  /// @brief The report of the channel, see Profiler::Report in profiler.cc.
+  nlohmann::json Report() const;
+
+  static uint64_t ReadTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+private:
+  uint64_t ticks_[static_cast<int>(ProfilePart::SIZE)];
+  uint64_t calls_[static_cast<int>(ProfilePart::SIZE)];
+  uint64_t events_[static_cast<int>(ProfileEvent::SIZE)];
+  ProfilePart current_;
+  uint64_t last_tsc_;
+  // to convert time stamp counter ticks into seconds
+  uint64_t start_tsc_;
+  std::chrono::steady_clock::time_point start_time_;
+};
+
+/// @brief Charges the host time of a scope to a part, and returns to the
+/// enclosing part when it ends. Next switches to another part without
+/// leaving the scope. Does nothing with a null profiler.
+class ProfileScope {
+public:
+  ProfileScope(Profiler *profiler, ProfilePart part)
+      : profiler_(profiler), prev_(ProfilePart::NONE) {
+    if (profiler_ != nullptr) {
+      prev_ = profiler_->Enter(part);
+    }
+  }
+  ~ProfileScope() {
+    if (profiler_ != nullptr) {
+      profiler_->Resume(prev_);
+    }
+  }
+  void Next(ProfilePart part) {
+    if (profiler_ != nullptr) {
+      profiler_->Enter(part);
+    }
+  }
+
+private:
+  Profiler *profiler_;
+  ProfilePart prev_;
+};
+
+/// @brief Count an event on a profiler that may be null.
+inline void ProfileCount(Profiler *profiler, ProfileEvent event,
+                         uint64_t count = 1) {
+  if (profiler != nullptr) {
+    profiler->Count(event, count);
+  }
+}
+
+}  // namespace dramsim3
+#endif  // __PROFILER_H
@@ -1,10 +1,20 @@
 #include "refresh.h"
 
+#include <algorithm>
+
 namespace dramsim3 {
-Refresh::Refresh(const Config &config, ChannelState &channel_state)
+Refresh::Refresh(const Config &config, ChannelState &channel_state,
+                 const CommandQueue &cmd_queue, SimpleStats &simple_stats)
     : clk_(0), config_(config), channel_state_(channel_state),
+      cmd_queue_(cmd_queue), simple_stats_(simple_stats),
+      postponed_stat_(simple_stats.Counter("num_postponed_refs")),
+      pulled_in_stat_(simple_stats.Counter("num_pulled_in_refs")),
+      derated_refs_stat_(simple_stats.Counter("num_derated_refs")),
+      derated_cycles_stat_(simple_stats.Counter("derated_ref_cycles")),
       refresh_policy_(config.refresh_policy), next_rank_(0), next_bg_(0),
-      next_bank_(0) {
+      next_bank_(0), max_derate_(1), round_(0),
+      postpone_max_(config.refresh_postpone_max),
+      pull_in_max_(config.refresh_pull_in_max), next_target_(0) {
   if (refresh_policy_ == RefreshPolicy::RANK_LEVEL_SIMULTANEOUS) {
     /// All Rank is refreshed at the same time at the tREFI interval (Global
     /// Refresh Interval).
@@ -13,35 +23,236 @@ Refresh::Refresh(const Config &config, ChannelState &channel_state)
     /// Bank interleaved refresh with tREFIb interval (Bank-level refresh
     /// interval).
     refresh_interval_ = config_.tREFIb;
+  } else if (refresh_policy_ == RefreshPolicy::SAME_BANK_STAGGERED) {
+    /// Every bank set (the same bank of each bankgroup) of every rank is
+    /// refreshed once per tREFI.
+    refresh_interval_ =
+        config_.tREFI / (config_.ranks * config_.banks_per_group);
   } else {  // default refresh scheme: RANK STAGGERED
     /// Rank staggered refreshes at intervals of tREFI / ranks (evenly split to
     /// each rank). This means that every interval of tREFI / ranks is refreshed
     /// by one rank.
     refresh_interval_ = config_.tREFI / config_.ranks;
   }
+  base_interval_ = refresh_interval_;
+  derate_.resize(NumTargets(), 1);
+  owed_.resize(NumTargets(), 0);
+  // every target may pull in refreshes from the start
+  num_may_act_ = pull_in_max_ > 0 ? NumTargets() : 0;
 }
 
 void Refresh::ClockTick() {
   if (clk_ % refresh_interval_ == 0 && clk_ > 0) {
     InsertRefresh();
   }
+  if (num_may_act_ > 0) {
+    CatchUp();
+  }
   clk_++;
   return;
 }
 
+uint64_t Refresh::NextRefreshCycle() const {
+  if (num_may_act_ > 0) {
+    // an idle time refresh may happen any time
+    return clk_;
+  }
+  uint64_t interval = static_cast<uint64_t>(refresh_interval_);
+  if (clk_ == 0) {
+    return interval;
+  }
+  return (clk_ + interval - 1) / interval * interval;
+}
+
+void Refresh::SetBankTemperatures(const double *bank_temps) {
+  int num_targets = NumTargets();
+  max_derate_ = 1;
+  for (int target = 0; target < num_targets; target++) {
+    int rank, bankgroup, bank;
+    TargetAddress(target, rank, bankgroup, bank);
+    // the hottest of the banks the target refreshes
+    double temp = bank_temps[rank * config_.banks];
+    for (int i = 0; i < config_.banks; i++) {
+      bool refreshed =
+          bank < 0 ||
+          (bankgroup < 0 ? i % config_.banks_per_group == bank
+                         : i == bankgroup * config_.banks_per_group + bank);
+      if (refreshed) {
+        temp = std::max(temp, bank_temps[rank * config_.banks + i]);
+      }
+    }
+    derate_[target] = temp > config_.refresh_derate_temp ? 2 : 1;
+    max_derate_ = std::max(max_derate_, derate_[target]);
+  }
+  refresh_interval_ = base_interval_ / max_derate_;
+}
+
+void Refresh::Save(CheckpointWriter &writer) const {
+  writer.Put(clk_);
+  writer.Put(next_rank_);
+  writer.Put(next_bg_);
+  writer.Put(next_bank_);
+  writer.Put(refresh_interval_);
+  writer.Put(derate_);
+  writer.Put(max_derate_);
+  writer.Put(round_);
+  writer.Put(owed_);
+  writer.Put(next_target_);
+}
+
+void Refresh::Load(CheckpointReader &reader) {
+  reader.Get(clk_);
+  reader.Get(next_rank_);
+  reader.Get(next_bg_);
+  reader.Get(next_bank_);
+  reader.Get(refresh_interval_);
+  reader.Get(derate_);
+  reader.Get(max_derate_);
+  reader.Get(round_);
+  reader.Get(owed_);
+  reader.Get(next_target_);
+  num_may_act_ = 0;
+  for (int i = 0; i < NumTargets(); i++) {
+    num_may_act_ += MayAct(i) ? 1 : 0;
+  }
+}
+
+int Refresh::NumTargets() const {
+  switch (refresh_policy_) {
+    case RefreshPolicy::BANK_LEVEL_STAGGERED:
+      return config_.ranks * config_.banks;
+    case RefreshPolicy::SAME_BANK_STAGGERED:
+      return config_.ranks * config_.banks_per_group;
+    default: return config_.ranks;
+  }
+}
+
+int Refresh::TargetIndex(int rank, int bankgroup, int bank) const {
+  switch (refresh_policy_) {
+    case RefreshPolicy::BANK_LEVEL_STAGGERED:
+      return rank * config_.banks + bankgroup * config_.banks_per_group + bank;
+    case RefreshPolicy::SAME_BANK_STAGGERED:
+      return rank * config_.banks_per_group + bank;
+    default: return rank;
+  }
+}
+
+void Refresh::TargetAddress(int target, int &rank, int &bankgroup,
+                            int &bank) const {
+  switch (refresh_policy_) {
+    case RefreshPolicy::BANK_LEVEL_STAGGERED:
+      rank = target / config_.banks;
+      bankgroup = (target % config_.banks) / config_.banks_per_group;
+      bank = target % config_.banks_per_group;
+      return;
+    case RefreshPolicy::SAME_BANK_STAGGERED:
+      rank = target / config_.banks_per_group;
+      bankgroup = -1;
+      bank = target % config_.banks_per_group;
+      return;
+    default:
+      rank = target;
+      bankgroup = -1;
+      bank = -1;
+      return;
+  }
+}
+
+void Refresh::AddOwed(int target, int delta) {
+  bool may_act = MayAct(target);
+  owed_[target] += delta;
+  num_may_act_ += (MayAct(target) ? 1 : 0) - (may_act ? 1 : 0);
+}
+
+void Refresh::CatchUp() {
+  // one at a time, refreshes that are already queued go first
+  if (channel_state_.IsRefreshWaiting()) {
+    return;
+  }
+  int num_targets = NumTargets();
+  for (int i = 0; i < num_targets; i++) {
+    int target = (next_target_ + i) % num_targets;
+    if (!MayAct(target)) {
+      continue;
+    }
+    int rank, bankgroup, bank;
+    TargetAddress(target, rank, bankgroup, bank);
+    if (channel_state_.IsRankSelfRefreshing(rank) ||
+        cmd_queue_.HasPendingCommands(rank, bankgroup, bank)) {
+      continue;
+    }
+    if (owed_[target] <= 0) {
+      simple_stats_.Increment(pulled_in_stat_);
+    }
+    QueueRefresh(rank, bankgroup, bank);
+    AddOwed(target, -1);
+    next_target_ = (target + 1) % num_targets;
+    return;
+  }
+}
+
+void Refresh::RefreshTarget(int rank, int bankgroup, int bank,
+                            bool functional) {
+  int target = TargetIndex(rank, bankgroup, bank);
+  if (round_ % (max_derate_ / derate_[target]) != 0) {
+    // not derated, refreshed in the other rounds only
+    return;
+  }
+  if (functional) {
+    channel_state_.FunctionalRefresh(rank, bankgroup, bank);
+    return;
+  }
+  if (round_ % max_derate_ != 0) {
+    // a refresh the target would not need at its nominal temperature
+    simple_stats_.Increment(derated_refs_stat_);
+    simple_stats_.IncrementBy(
+        derated_cycles_stat_,
+        static_cast<uint64_t>(bank < 0 ? config_.tRFC : config_.tRFCb));
+  }
+  if (owed_[target] < 0) {
+    // pulled in already
+    AddOwed(target, 1);
+    return;
+  }
+  if (owed_[target] < postpone_max_ &&
+      cmd_queue_.HasPendingCommands(rank, bankgroup, bank)) {
+    simple_stats_.Increment(postponed_stat_);
+    AddOwed(target, 1);
+    return;
+  }
+  QueueRefresh(rank, bankgroup, bank);
+}
+
+void Refresh::QueueRefresh(int rank, int bankgroup, int bank) {
+  if (bank < 0) {
+    channel_state_.RankNeedRefresh(rank, true);
+  } else {
+    channel_state_.BankNeedRefresh(rank, bankgroup, bank, true);
+  }
+}
+
+void Refresh::FunctionalFastForward(uint64_t cycles) {
+  uint64_t end = clk_ + cycles;
+  uint64_t interval = static_cast<uint64_t>(refresh_interval_);
+  for (uint64_t next = NextRefreshCycle(); next < end; next += interval) {
+    InsertRefresh(true);
+  }
+  clk_ = end;
+}
+
 /// IsRankSelfRefreshing: Self-Refresh Mode is a low-power state in which Rank
 /// stops responding to external commands (such as read and write requests) when
 /// it enters this mode, relying solely on internal circuitry to periodically
 /// refresh data to maintain content. When the CommandType::SREF_ENTER command
 /// is sent, rank enters self-refresh mode; and when the CommandType::SREF_EXIT
 /// command is sent, it exits self-refresh mode.
-void Refresh::InsertRefresh() {
+void Refresh::InsertRefresh(bool functional) {
   switch (refresh_policy_) {
     // Simultaneous all rank refresh
     case RefreshPolicy::RANK_LEVEL_SIMULTANEOUS:
       for (auto i = 0; i < config_.ranks; i++) {
         if (!channel_state_.IsRankSelfRefreshing(i)) {
-          channel_state_.RankNeedRefresh(i, true);
+          RefreshTarget(i, -1, -1, functional);
           break;
         }
       }
@@ -49,19 +260,30 @@ void Refresh::InsertRefresh() {
     // Staggered all rank refresh
     case RefreshPolicy::RANK_LEVEL_STAGGERED:
       if (!channel_state_.IsRankSelfRefreshing(next_rank_)) {
-        channel_state_.RankNeedRefresh(next_rank_, true);
+        RefreshTarget(next_rank_, -1, -1, functional);
       }
       IterateNext();
       break;
     // Fully staggered per bank refresh
     case RefreshPolicy::BANK_LEVEL_STAGGERED:
       if (!channel_state_.IsRankSelfRefreshing(next_rank_)) {
-        channel_state_.BankNeedRefresh(next_rank_, next_bg_, next_bank_, true);
+        RefreshTarget(next_rank_, next_bg_, next_bank_, functional);
+      }
+      IterateNext();
+      break;
+    // Staggered same-bank refresh of one bank set at a time
+    case RefreshPolicy::SAME_BANK_STAGGERED:
+      if (!channel_state_.IsRankSelfRefreshing(next_rank_)) {
+        RefreshTarget(next_rank_, -1, next_bank_, functional);
       }
       IterateNext();
       break;
     default: AbruptExit(__FILE__, __LINE__); break;
   }
+  // every target has had its slot, always so with simultaneous refreshes
+  if (next_rank_ == 0 && next_bg_ == 0 && next_bank_ == 0) {
+    round_++;
+  }
   return;
 }
 
@@ -81,6 +303,12 @@ void Refresh::IterateNext() {
         }
       }
       return;
+    case RefreshPolicy::SAME_BANK_STAGGERED:
+      next_bank_ = (next_bank_ + 1) % config_.banks_per_group;
+      if (next_bank_ == 0) {
+        next_rank_ = (next_rank_ + 1) % config_.ranks;
+      }
+      return;
     default: AbruptExit(__FILE__, __LINE__); return;
   }
 }
@@ -2,27 +2,77 @@
 #define __REFRESH_H
 
 #include "channel_state.h"
+#include "command_queue.h"
 #include "common.h"
 #include "configuration.h"
+#include "simple_stats.h"
 #include <vector>
 
 namespace dramsim3 {
 
 class Refresh {
 public:
-  Refresh(const Config &config, ChannelState &channel_state);
+  Refresh(const Config &config, ChannelState &channel_state,
+          const CommandQueue &cmd_queue, SimpleStats &simple_stats);
   void ClockTick();
+  /// @brief The first cycle from now on at which a refresh may be inserted.
+  uint64_t NextRefreshCycle() const;
+  void FastForward(uint64_t cycles) { clk_ += cycles; }
+  /// @brief Advance cycles cycles, applying the refreshes due meanwhile
+  /// straight to the bank states (see ChannelState::FunctionalRefresh).
+  void FunctionalFastForward(uint64_t cycles);
+  /// @brief Temperature derating: the targets with a bank hotter than
+  /// refresh_derate_temp are refreshed twice as often, like JEDEC devices
+  /// above 85C. bank_temps has the temperatures [C] of the banks of each
+  /// rank of the channel, indexed by rank * banks + bank.
+  void SetBankTemperatures(const double *bank_temps);
+  // checkpointing, see MemorySystem::SaveCheckpoint
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
 
 private:
   uint64_t clk_;
   int refresh_interval_;
   const Config &config_;
   ChannelState &channel_state_;
+  const CommandQueue &cmd_queue_;
+  SimpleStats &simple_stats_;
+  CounterHandle postponed_stat_, pulled_in_stat_;
+  CounterHandle derated_refs_stat_, derated_cycles_stat_;
   RefreshPolicy refresh_policy_;
 
   int next_rank_, next_bg_, next_bank_;
 
-  void InsertRefresh();
+  /// @brief Temperature derating. Each target is refreshed every
+  /// max_derate_ / derate_[.] rounds of refresh_interval_, which is
+  /// base_interval_ / max_derate_, a round refreshing every target once.
+  int base_interval_;
+  std::vector<int> derate_;
+  int max_derate_;
+  uint64_t round_;
+
+  /// @brief Refresh postponing and pulling in. Each refresh target (a rank,
+  /// a bank or a bank set, depending on the policy) owes owed_[.] postponed
+  /// refreshes, or has issued -owed_[.] in advance if negative.
+  int postpone_max_, pull_in_max_;
+  std::vector<int> owed_;
+  // number of targets that may issue an idle time refresh
+  int num_may_act_;
+  int next_target_;
+  bool MayAct(int target) const { return owed_[target] > -pull_in_max_; }
+  void AddOwed(int target, int delta);
+  int NumTargets() const;
+  int TargetIndex(int rank, int bankgroup, int bank) const;
+  void TargetAddress(int target, int &rank, int &bankgroup, int &bank) const;
+  /// @brief Issue a postponed or a pulled in refresh to an idle target.
+  void CatchUp();
+
+  // queue a refresh, or apply it to the bank states right away if functional
+  void InsertRefresh(bool functional = false);
+  // refresh a rank if bank is negative, one bank or one bank set otherwise,
+  // unless it is postponed or was pulled in
+  void RefreshTarget(int rank, int bankgroup, int bank, bool functional);
+  void QueueRefresh(int rank, int bankgroup, int bank);
 
   void IterateNext();
 };
@@ -0,0 +1,318 @@
+#include "sampled_system.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+
+#include "json.hpp"
+
+namespace dramsim3 {
+
+namespace {
+
+Controller::SampleCounts Difference(const Controller::SampleCounts &end,
+                                    const Controller::SampleCounts &begin) {
+  Controller::SampleCounts diff;
+  diff.reads_done = end.reads_done - begin.reads_done;
+  diff.writes_done = end.writes_done - begin.writes_done;
+  diff.read_cmds = end.read_cmds - begin.read_cmds;
+  diff.write_cmds = end.write_cmds - begin.write_cmds;
+  diff.row_hits = end.row_hits - begin.row_hits;
+  diff.act_cmds = end.act_cmds - begin.act_cmds;
+  diff.pre_cmds = end.pre_cmds - begin.pre_cmds;
+  diff.ref_cmds = end.ref_cmds - begin.ref_cmds;
+  diff.read_latency_sum = end.read_latency_sum - begin.read_latency_sum;
+  return diff;
+}
+
+void PutCounts(CheckpointWriter &writer,
+               const Controller::SampleCounts &counts) {
+  writer.Put(counts.reads_done);
+  writer.Put(counts.writes_done);
+  writer.Put(counts.read_cmds);
+  writer.Put(counts.write_cmds);
+  writer.Put(counts.row_hits);
+  writer.Put(counts.act_cmds);
+  writer.Put(counts.pre_cmds);
+  writer.Put(counts.ref_cmds);
+  writer.Put(counts.read_latency_sum);
+}
+
+void GetCounts(CheckpointReader &reader, Controller::SampleCounts &counts) {
+  reader.Get(counts.reads_done);
+  reader.Get(counts.writes_done);
+  reader.Get(counts.read_cmds);
+  reader.Get(counts.write_cmds);
+  reader.Get(counts.row_hits);
+  reader.Get(counts.act_cmds);
+  reader.Get(counts.pre_cmds);
+  reader.Get(counts.ref_cmds);
+  reader.Get(counts.read_latency_sum);
+}
+
+// sample mean and the half width of its 95% confidence interval
+nlohmann::json Summarize(const std::vector<double> &samples) {
+  nlohmann::json j;
+  double n = static_cast<double>(samples.size());
+  double mean = 0.0;
+  for (double sample : samples) {
+    mean += sample;
+  }
+  mean = samples.empty() ? 0.0 : mean / n;
+  double var = 0.0;
+  for (double sample : samples) {
+    var += (sample - mean) * (sample - mean);
+  }
+  var = samples.size() > 1 ? var / (n - 1) : 0.0;
+  j["mean"] = mean;
+  j["ci95"] = samples.size() > 1 ? 1.96 * std::sqrt(var / n) : 0.0;
+  j["samples"] = samples.size();
+  return j;
+}
+
+}  // namespace
+
+SampledDRAMSystem::SampledDRAMSystem(
+    const Config &config, const std::string &output_dir,
+    std::function<void(uint64_t)> read_callback,
+    std::function<void(uint64_t)> write_callback)
+    : JedecDRAMSystem(config, output_dir, read_callback, write_callback),
+      ff_cycles_(config_.sample_fast_forward_cycles),
+      warmup_cycles_(config_.sample_warmup_cycles),
+      measure_cycles_(config_.sample_measure_cycles),
+      ff_pending_(ctrls_.size(), 0), functional_seq_(0), num_functional_(0),
+      window_start_(TotalCounts()) {}
+
+SampledDRAMSystem::Phase SampledDRAMSystem::CurrentPhase() const {
+  uint64_t pos = clk_ % (ff_cycles_ + warmup_cycles_ + measure_cycles_);
+  if (pos < ff_cycles_) {
+    return Phase::FAST_FORWARD;
+  } else if (pos < ff_cycles_ + warmup_cycles_) {
+    return Phase::WARMUP;
+  }
+  return Phase::MEASURE;
+}
+
+bool SampledDRAMSystem::WillAcceptTransaction(uint64_t hex_addr,
+                                              bool is_write,
+                                              int qos_class) const {
+  return CurrentPhase() == Phase::FAST_FORWARD ||
+         JedecDRAMSystem::WillAcceptTransaction(hex_addr, is_write, qos_class);
+}
+
+bool SampledDRAMSystem::AddTransaction(uint64_t hex_addr, bool is_write,
+                                       uint64_t tag, int source,
+                                       int qos_class) {
+  if (CurrentPhase() != Phase::FAST_FORWARD) {
+    return JedecDRAMSystem::AddTransaction(hex_addr, is_write, tag, source,
+                                           qos_class);
+  }
+#ifdef ADDR_TRACE
+  address_trace_ << std::hex << hex_addr << std::dec << " "
+                 << (is_write ? "WRITE " : "READ ") << clk_ << "\n";
+#endif
+  TraceTransaction(hex_addr, is_write);
+  int channel = GetChannel(hex_addr);
+  CatchUp(channel);
+  uint64_t latency = ctrls_[channel]->FunctionalAccess(hex_addr, is_write);
+  // writes are buffered, same as in the detailed model
+  AddFunctionalReturn(hex_addr, tag, is_write,
+                      clk_ + (is_write ? 1 : latency));
+  num_functional_++;
+  last_req_clk_ = clk_;
+  return true;
+}
+
+void SampledDRAMSystem::AddFunctionalReturn(uint64_t addr, uint64_t tag,
+                                            bool is_write, uint64_t cycle) {
+  functional_returns_.push_back(
+      FunctionalReturn{cycle, functional_seq_++, addr, tag, is_write});
+  std::push_heap(functional_returns_.begin(), functional_returns_.end(),
+                 ReturnsLater);
+}
+
+void SampledDRAMSystem::CatchUp(int i) {
+  if (ff_pending_[i] > 0) {
+    ctrls_[i]->FunctionalFastForward(ff_pending_[i]);
+    ff_pending_[i] = 0;
+  }
+}
+
+void SampledDRAMSystem::DeliverFunctionalReturns() {
+  while (!functional_returns_.empty() &&
+         functional_returns_.front().cycle <= clk_) {
+    std::pop_heap(functional_returns_.begin(), functional_returns_.end(),
+                  ReturnsLater);
+    const FunctionalReturn &ret = functional_returns_.back();
+    ReturnTransaction(ret.addr, ret.tag, ret.is_write);
+    functional_returns_.pop_back();
+  }
+}
+
+void SampledDRAMSystem::ClockTick() {
+  uint64_t pos = clk_ % (ff_cycles_ + warmup_cycles_ + measure_cycles_);
+  if (pos == 0 && ff_cycles_ > 0) {
+    // what is left of the last detailed phase finishes functionally
+    std::vector<Transaction> drained;
+    for (auto ctrl : ctrls_) {
+      ctrl->FunctionalDrain(drained);
+    }
+    for (const auto &trans : drained) {
+      AddFunctionalReturn(trans.addr, trans.id, trans.is_write,
+                          trans.complete_cycle);
+    }
+  } else if (pos == ff_cycles_) {
+    for (size_t i = 0; i < ctrls_.size(); i++) {
+      CatchUp(i);
+    }
+  }
+  DeliverFunctionalReturns();
+
+  Phase phase = CurrentPhase();
+  if (phase != Phase::FAST_FORWARD) {
+    if (pos == ff_cycles_ + warmup_cycles_) {
+      window_start_ = TotalCounts();
+    }
+    JedecDRAMSystem::ClockTick();
+    if (pos + 1 == ff_cycles_ + warmup_cycles_ + measure_cycles_) {
+      RecordWindow();
+    }
+    return;
+  }
+
+  // the controllers are left behind and caught up on their next transaction
+  for (size_t i = 0; i < ctrls_.size(); i++) {
+    ff_pending_[i]++;
+  }
+  clk_++;
+
+  if (clk_ % config_.epoch_period == 0) {
+    PrintEpochStats();
+  }
+}
+
+Controller::SampleCounts SampledDRAMSystem::TotalCounts() const {
+  Controller::SampleCounts total = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+  for (const auto ctrl : ctrls_) {
+    Controller::SampleCounts counts = ctrl->GetSampleCounts();
+    total.reads_done += counts.reads_done;
+    total.writes_done += counts.writes_done;
+    total.read_cmds += counts.read_cmds;
+    total.write_cmds += counts.write_cmds;
+    total.row_hits += counts.row_hits;
+    total.act_cmds += counts.act_cmds;
+    total.pre_cmds += counts.pre_cmds;
+    total.ref_cmds += counts.ref_cmds;
+    total.read_latency_sum += counts.read_latency_sum;
+  }
+  return total;
+}
+
+void SampledDRAMSystem::RecordWindow() {
+  windows_.push_back(Difference(TotalCounts(), window_start_));
+}
+
+void SampledDRAMSystem::Save(CheckpointWriter &writer) const {
+  JedecDRAMSystem::Save(writer);
+  writer.Put(ff_pending_);
+  writer.Put(static_cast<uint64_t>(functional_returns_.size()));
+  for (const auto &ret : functional_returns_) {
+    writer.Put(ret.cycle);
+    writer.Put(ret.seq);
+    writer.Put(ret.addr);
+    writer.Put(ret.tag);
+    writer.Put(ret.is_write);
+  }
+  writer.Put(functional_seq_);
+  writer.Put(num_functional_);
+  PutCounts(writer, window_start_);
+  writer.Put(static_cast<uint64_t>(windows_.size()));
+  for (const auto &window : windows_) {
+    PutCounts(writer, window);
+  }
+}
+
+void SampledDRAMSystem::Load(CheckpointReader &reader) {
+  JedecDRAMSystem::Load(reader);
+  reader.Get(ff_pending_);
+  uint64_t size;
+  reader.Get(size);
+  functional_returns_.resize(size);
+  for (auto &ret : functional_returns_) {
+    reader.Get(ret.cycle);
+    reader.Get(ret.seq);
+    reader.Get(ret.addr);
+    reader.Get(ret.tag);
+    reader.Get(ret.is_write);
+  }
+  reader.Get(functional_seq_);
+  reader.Get(num_functional_);
+  GetCounts(reader, window_start_);
+  reader.Get(size);
+  windows_.resize(size);
+  for (auto &window : windows_) {
+    GetCounts(reader, window);
+  }
+}
+
+void SampledDRAMSystem::PrintStats() {
+  BaseDRAMSystem::PrintStats();
+
+  // per window samples of each metric, rates are skipped in windows where
+  // they are undefined
+  std::vector<double> bandwidth, read_latency, row_hit_rate;
+  std::map<std::string, std::vector<double>> counts;
+  double window_ns = measure_cycles_ * config_.tCK;
+  for (const auto &w : windows_) {
+    bandwidth.push_back((w.reads_done + w.writes_done) *
+                        config_.request_size_bytes / window_ns);
+    if (w.reads_done > 0) {
+      read_latency.push_back(static_cast<double>(w.read_latency_sum) /
+                             w.reads_done);
+    }
+    if (w.read_cmds + w.write_cmds > 0) {
+      row_hit_rate.push_back(static_cast<double>(w.row_hits) /
+                             (w.read_cmds + w.write_cmds));
+    }
+    counts["num_reads_done"].push_back(w.reads_done);
+    counts["num_writes_done"].push_back(w.writes_done);
+    counts["num_read_cmds"].push_back(w.read_cmds);
+    counts["num_write_cmds"].push_back(w.write_cmds);
+    counts["num_act_cmds"].push_back(w.act_cmds);
+    counts["num_pre_cmds"].push_back(w.pre_cmds);
+    counts["num_ref_cmds"].push_back(w.ref_cmds);
+  }
+
+  nlohmann::json j;
+  j["fast_forward_cycles"] = ff_cycles_;
+  j["warmup_cycles"] = warmup_cycles_;
+  j["measure_cycles"] = measure_cycles_;
+  j["total_cycles"] = clk_;
+  j["windows"] = windows_.size();
+  j["functional_transactions"] = num_functional_;
+  j["metrics"]["average_bandwidth"] = Summarize(bandwidth);
+  j["metrics"]["average_read_latency"] = Summarize(read_latency);
+  j["metrics"]["row_hit_rate"] = Summarize(row_hit_rate);
+  // counts scale with the simulated time, per window means are extrapolated
+  double scale = static_cast<double>(clk_) / measure_cycles_;
+  for (const auto &it : counts) {
+    j["metrics"][it.first] = Summarize(it.second);
+    double mean = j["metrics"][it.first]["mean"];
+    double ci95 = j["metrics"][it.first]["ci95"];
+    j["extrapolated"][it.first]["value"] = mean * scale;
+    j["extrapolated"][it.first]["ci95"] = ci95 * scale;
+  }
+
+  std::string sampling_name = config_.output_prefix + "sampling.json";
+  std::ofstream(sampling_name) << j.dump(2) << std::endl;
+
+  std::cout << "Sampled " << windows_.size() << " windows of "
+            << measure_cycles_ << " cycles, average bandwidth "
+            << j["metrics"]["average_bandwidth"]["mean"].get<double>()
+            << " +/- "
+            << j["metrics"]["average_bandwidth"]["ci95"].get<double>()
+            << " GB/s, written to " << sampling_name << std::endl;
+}
+
+}  // namespace dramsim3
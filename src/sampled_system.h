@@ -0,0 +1,71 @@
+#ifndef __SAMPLED_SYSTEM_H
+#define __SAMPLED_SYSTEM_H
+
+#include <string>
+#include <vector>
+
+#include "dram_system.h"
+
+namespace dramsim3 {
+
+/// @brief Sampled simulation of a JEDEC system (system.sampling). The
+/// simulation repeats a functional fast-forward phase, in which transactions
+/// only open and close rows and complete after a fixed latency, a detailed
+/// warm-up phase and a detailed measurement phase. Each measurement window
+/// gives one sample of every metric and the samples are extrapolated to the
+/// whole run, with a 95% confidence interval, in <output_prefix>sampling.json.
+/// The regular stats only cover the detailed cycles.
+class SampledDRAMSystem : public JedecDRAMSystem {
+public:
+  SampledDRAMSystem(const Config &config, const std::string &output_dir,
+                    std::function<void(uint64_t)> read_callback,
+                    std::function<void(uint64_t)> write_callback);
+  bool WillAcceptTransaction(uint64_t hex_addr, bool is_write,
+                             int qos_class = 0) const override;
+  bool AddTransaction(uint64_t hex_addr, bool is_write, uint64_t tag = 0,
+                      int source = 0, int qos_class = 0) override;
+  void ClockTick() override;
+  /// @brief No idle cycle skipping, the phases advance one cycle at a time.
+  uint64_t ClockTickN(uint64_t cycles) override {
+    return BaseDRAMSystem::ClockTickN(cycles);
+  }
+  void PrintStats() override;
+  void Save(CheckpointWriter &writer) const override;
+  void Load(CheckpointReader &reader) override;
+
+private:
+  enum class Phase { FAST_FORWARD, WARMUP, MEASURE };
+  Phase CurrentPhase() const;
+  /// @brief Bring controller i, left behind while fast-forwarding, up to now.
+  void CatchUp(int i);
+  void AddFunctionalReturn(uint64_t addr, uint64_t tag, bool is_write,
+                           uint64_t cycle);
+  void DeliverFunctionalReturns();
+  Controller::SampleCounts TotalCounts() const;
+  void RecordWindow();
+
+  uint64_t ff_cycles_, warmup_cycles_, measure_cycles_;
+  // cycles each controller is behind the system clock
+  std::vector<uint64_t> ff_pending_;
+
+  // functionally completed transactions, a min-heap on (cycle, seq)
+  struct FunctionalReturn {
+    uint64_t cycle, seq, addr, tag;
+    bool is_write;
+  };
+  static bool ReturnsLater(const FunctionalReturn &a,
+                           const FunctionalReturn &b) {
+    return a.cycle != b.cycle ? a.cycle > b.cycle : a.seq > b.seq;
+  }
+  std::vector<FunctionalReturn> functional_returns_;
+  uint64_t functional_seq_;
+  uint64_t num_functional_;
+
+  // totals at the start of the current measurement window
+  Controller::SampleCounts window_start_;
+  // one entry per finished window
+  std::vector<Controller::SampleCounts> windows_;
+};
+
+}  // namespace dramsim3
+#endif  // __SAMPLED_SYSTEM_H
@@ -1,7 +1,12 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 #include "fmt/format.h"
 #include "simple_stats.h"
+#ifdef LATENCY_BREAKDOWN
+#include "latency_breakdown.h"
+#endif  // LATENCY_BREAKDOWN
 
 namespace dramsim3 {
 
@@ -35,7 +40,30 @@ SimpleStats::SimpleStats(const Config &config, int channel_id)
   InitStat("num_refb_cmds", "counter", "Number of REFb commands");
   InitStat("num_srefe_cmds", "counter", "Number of SREFE commands");
   InitStat("num_srefx_cmds", "counter", "Number of SREFX commands");
+  InitStat("num_pde_cmds", "counter", "Number of PDE commands");
+  InitStat("num_pdx_cmds", "counter", "Number of PDX commands");
   InitStat("hbm_dual_cmds", "counter", "Number of cycles dual cmds issued");
+  InitStat("sub_channel_cmds", "counter",
+           "Number of cmds issued on the cmd bus of another sub-channel");
+  InitStat("num_write_drains", "counter", "Number of write drains started");
+  InitStat("num_postponed_refs", "counter", "Number of postponed refreshes");
+  InitStat("num_pulled_in_refs", "counter", "Number of pulled in refreshes");
+  InitStat("num_derated_refs", "counter",
+           "Number of refreshes added by temperature derating");
+  InitStat("derated_ref_cycles", "counter",
+           "Refresh cycles added by temperature derating");
+  InitStat("rw_turnaround_cycles", "counter",
+           "Cycles lost to read/write turnarounds");
+  InitStat("rank_switch_cycles", "counter",
+           "Cycles lost to switching ranks between reads");
+  InitStat("num_column_batches", "counter",
+           "Number of column command batches to one rank and direction");
+  InitStat("num_timeout_pres", "counter",
+           "Number of PRE commands closing rows unused for row_buf_timeout");
+  InitStat("num_predicted_pres", "counter",
+           "Number of READP/WRITEP commands the row predictor chose");
+  InitStat("num_row_reopens", "counter",
+           "Number of rows opened again after the policy closed them");
 
   // double stats
   InitStat("act_energy", "double", "Activation energy");
@@ -51,6 +79,20 @@ SimpleStats::SimpleStats(const Config &config, int channel_id)
               "rank", config_.ranks);
   InitVecStat("sref_cycles", "vec_counter", "Cyles of rank in SREF mode",
               "rank", config_.ranks);
+  InitVecStat("act_pd_cycles", "vec_counter",
+              "Cyles of rank in active power-down", "rank", config_.ranks);
+  InitVecStat("pre_pd_cycles", "vec_counter",
+              "Cyles of rank in precharge power-down", "rank", config_.ranks);
+  int num_banks = config_.ranks * config_.banks;
+  InitVecStat("row_buf_hits", "vec_counter",
+              "Reads and writes to the open row of the bank", "bank",
+              num_banks);
+  InitVecStat("row_buf_conflicts", "vec_counter",
+              "Reads and writes that closed another row of the bank", "bank",
+              num_banks);
+  InitVecStat("row_buf_empties", "vec_counter",
+              "Reads and writes that found the bank closed", "bank",
+              num_banks);
 
   // Vector of double stats
   InitVecStat("act_stb_energy", "vec_double", "Active standby energy", "rank",
@@ -59,12 +101,54 @@ SimpleStats::SimpleStats(const Config &config, int channel_id)
               "rank", config_.ranks);
   InitVecStat("sref_energy", "vec_double", "SREF energy", "rank",
               config_.ranks);
+  InitVecStat("act_pd_energy", "vec_double", "Active power-down energy",
+              "rank", config_.ranks);
+  InitVecStat("pre_pd_energy", "vec_double", "Precharge power-down energy",
+              "rank", config_.ranks);
 
   // Histogram stats
   InitHistoStat("read_latency", "Read request latency (cycles)", 0, 200, 10);
   InitHistoStat("write_latency", "Write cmd latency (cycles)", 0, 200, 10);
   InitHistoStat("interarrival_latency", "Request interarrival latency (cycles)",
                 0, 100, 10);
+  InitHistoStat("read_pd_wakeup_latency",
+                "Read latency added by power-down exits (cycles)", 0, 50, 10);
+#ifdef LATENCY_BREAKDOWN
+  for (int i = 0; i < kNumLatencyParts; i++) {
+    std::string part = kLatencyPartNames[i];
+    InitHistoStat("read_" + part + "_latency",
+                  "Read latency part " + part + " (cycles)", 0, 200, 10);
+    InitHistoStat("write_" + part + "_latency",
+                  "Write latency part " + part + " (cycles)", 0, 200, 10);
+    percentile_histos_.push_back("read_" + part + "_latency");
+    percentile_histos_.push_back("write_" + part + "_latency");
+  }
+  percentile_histos_.push_back("read_latency");
+  percentile_histos_.push_back("write_latency");
+#endif  // LATENCY_BREAKDOWN
+
+  // QoS stats, see Config::qos_classes
+  if (config_.qos_classes > 1) {
+    InitStat("num_qos_starved", "counter",
+             "Transactions scheduled after qos_starvation_cycles");
+    InitVecStat("qos_reads_done", "vec_counter", "Reads done", "class",
+                config_.qos_classes);
+    InitVecStat("qos_writes_done", "vec_counter", "Writes done", "class",
+                config_.qos_classes);
+    InitVecStat("qos_bandwidth", "vec_double", "Average bandwidth", "class",
+                config_.qos_classes);
+    InitVecStat("qos_read_latency", "vec_double",
+                "Average read request latency (cycles)", "class",
+                config_.qos_classes);
+    for (int i = 0; i < config_.qos_classes; i++) {
+      std::string name = "read_class" + std::to_string(i) + "_latency";
+      InitHistoStat(name,
+                    "Read latency of class " + std::to_string(i) +
+                        " (cycles)",
+                    0, 200, 10);
+      percentile_histos_.push_back(name);
+    }
+  }
 
   // some irregular stats
   InitStat("average_bandwidth", "calculated", "Average bandwidth");
@@ -76,12 +160,85 @@ SimpleStats::SimpleStats(const Config &config, int channel_id)
            "Average request interarrival latency (cycles)");
 }
 
-void SimpleStats::AddValue(const std::string name, const int value) {
-  auto &epoch_counts = epoch_histo_counts_[name];
-  if (epoch_counts.count(value) <= 0) {
-    epoch_counts[value] = 1;
-  } else {
-    epoch_counts[value] += 1;
+CounterHandle SimpleStats::Counter(const std::string &name) const {
+  auto it = counter_index_.find(name);
+  if (it == counter_index_.end()) {
+    std::cerr << "Unknown counter stat " << name << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  return CounterHandle{it->second};
+}
+
+VecCounterHandle SimpleStats::VecCounter(const std::string &name) const {
+  auto it = vec_counter_index_.find(name);
+  if (it == vec_counter_index_.end()) {
+    std::cerr << "Unknown vector counter stat " << name << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  return VecCounterHandle{it->second};
+}
+
+HistoHandle SimpleStats::Histo(const std::string &name) const {
+  auto it = histo_index_.find(name);
+  if (it == histo_index_.end()) {
+    std::cerr << "Unknown histogram stat " << name << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  return HistoHandle{it->second};
+}
+
+void SimpleStats::Save(CheckpointWriter &writer) const {
+  writer.Put(counters_);
+  writer.Put(epoch_counters_);
+  writer.Put(vec_counters_);
+  writer.Put(epoch_vec_counters_);
+  writer.Put(doubles_);
+  writer.Put(vec_doubles_);
+  writer.Put(calculated_);
+  writer.Put(histo_counts_);
+  writer.Put(epoch_histo_counts_);
+  writer.Put(histo_bins_);
+  writer.Put(epoch_histo_bins_);
+}
+
+void SimpleStats::Load(CheckpointReader &reader) {
+  // maps are loaded in place so that the histogram handles stay valid, but
+  // the counts of each histogram are replaced
+  for (auto &it : histo_counts_) {
+    it.second.clear();
+  }
+  for (auto &it : epoch_histo_counts_) {
+    it.second.clear();
+  }
+  reader.Get(counters_);
+  reader.Get(epoch_counters_);
+  reader.Get(vec_counters_);
+  reader.Get(epoch_vec_counters_);
+  reader.Get(doubles_);
+  reader.Get(vec_doubles_);
+  reader.Get(calculated_);
+  reader.Get(histo_counts_);
+  reader.Get(epoch_histo_counts_);
+  reader.Get(histo_bins_);
+  reader.Get(epoch_histo_bins_);
+}
+
+void SimpleStats::HistoTotal(HistoHandle stat, uint64_t &count,
+                             uint64_t &sum) const {
+  count = 0;
+  sum = 0;
+  for (const auto &it : histo_index_) {
+    if (it.second != stat.index) {
+      continue;
+    }
+    const HistoCount *parts[] = {&histo_counts_.at(it.first),
+                                 epoch_histo_refs_[stat.index]};
+    for (const HistoCount *counts : parts) {
+      for (const auto &value_count : *counts) {
+        sum += value_count.first * value_count.second;
+        count += value_count.second;
+      }
+    }
   }
 }
 
@@ -100,14 +257,15 @@ std::string SimpleStats::GetTextHeader(bool is_final) const {
 double SimpleStats::RankBackgroundEnergy(const int rank) const {
   return vec_doubles_.at("act_stb_energy")[rank] +
          vec_doubles_.at("pre_stb_energy")[rank] +
-         vec_doubles_.at("sref_energy")[rank];
+         vec_doubles_.at("sref_energy")[rank] +
+         vec_doubles_.at("act_pd_energy")[rank] +
+         vec_doubles_.at("pre_pd_energy")[rank];
 }
 
-void SimpleStats::PrintEpochStats() {
+void SimpleStats::PrintEpochStats(StatsWriter &writer) {
   UpdateEpochStats();
   if (config_.output_level >= 1) {
-    std::ofstream j_out(config_.json_epoch_name, std::ofstream::app);
-    j_out << j_data_;
+    writer.WriteEpoch(j_data_);
   }
   if (config_.output_level >= 2) {
     std::cout << GetTextHeader(false);
@@ -144,15 +302,11 @@ void SimpleStats::Reset() {
   for (auto &it : counters_) {
     it.second = 0;
   }
-  for (auto &it : epoch_counters_) {
-    it.second = 0;
-  }
+  std::fill(epoch_counters_.begin(), epoch_counters_.end(), 0);
   for (auto &vec : vec_counters_) {
     std::fill(vec.second.begin(), vec.second.end(), 0);
   }
-  for (auto &vec : epoch_vec_counters_) {
-    std::fill(vec.second.begin(), vec.second.end(), 0);
-  }
+  std::fill(epoch_vec_counters_.begin(), epoch_vec_counters_.end(), 0);
   for (auto &it : doubles_) {
     it.second = 0.0;
   }
@@ -175,7 +329,9 @@ void SimpleStats::InitStat(std::string name, std::string stat_type,
   header_descs_.emplace(name, description);
   if (stat_type == "counter") {
     counters_.emplace(name, 0);
-    epoch_counters_.emplace(name, 0);
+    counter_index_.emplace(name, static_cast<int>(epoch_counters_.size()));
+    counter_names_.push_back(name);
+    epoch_counters_.push_back(0);
   } else if (stat_type == "double") {
     doubles_.emplace(name, 0.0);
   } else if (stat_type == "calculated") {
@@ -194,7 +350,9 @@ void SimpleStats::InitVecStat(std::string name, std::string stat_type,
   }
   if (stat_type == "vec_counter") {
     vec_counters_.emplace(name, std::vector<uint64_t>(vec_len, 0));
-    epoch_vec_counters_.emplace(name, std::vector<uint64_t>(vec_len, 0));
+    vec_counter_index_.emplace(name,
+                               static_cast<int>(epoch_vec_counters_.size()));
+    epoch_vec_counters_.resize(epoch_vec_counters_.size() + vec_len, 0);
   } else if (stat_type == "vec_double") {
     vec_doubles_.emplace(name, std::vector<double>(vec_len, 0));
   }
@@ -207,6 +365,8 @@ void SimpleStats::InitHistoStat(std::string name, std::string description,
   histo_bounds_.emplace(name, std::make_pair(start_val, end_val));
   histo_counts_.emplace(name, std::unordered_map<int, uint64_t>());
   epoch_histo_counts_.emplace(name, std::unordered_map<int, uint64_t>());
+  histo_index_.emplace(name, static_cast<int>(epoch_histo_refs_.size()));
+  epoch_histo_refs_.push_back(&epoch_histo_counts_[name]);
 
   // initialize headers, descriptions
   std::vector<std::string> headers;
@@ -232,12 +392,13 @@ void SimpleStats::InitHistoStat(std::string name, std::string description,
 }
 
 void SimpleStats::UpdateCounters() {
-  for (const auto &it : epoch_counters_) {
-    counters_[it.first] += it.second;
+  for (size_t i = 0; i < epoch_counters_.size(); i++) {
+    counters_[counter_names_[i]] += epoch_counters_[i];
   }
-  for (const auto &vec : epoch_vec_counters_) {
-    for (size_t i = 0; i < vec.second.size(); i++) {
-      vec_counters_[vec.first][i] += vec.second[i];
+  for (const auto &it : vec_counter_index_) {
+    auto &vec = vec_counters_[it.first];
+    for (size_t i = 0; i < vec.size(); i++) {
+      vec[i] += epoch_vec_counters_[it.second + i];
     }
   }
 }
@@ -293,24 +454,44 @@ double SimpleStats::GetHistoAvg(const HistoCount &hist_counts) const {
              : static_cast<double>(accu_sum) / static_cast<double>(count);
 }
 
+uint64_t SimpleStats::GetHistoPercentile(const HistoCount &hist_counts,
+                                         double fraction) const {
+  std::vector<std::pair<int, uint64_t>> sorted(hist_counts.begin(),
+                                               hist_counts.end());
+  std::sort(sorted.begin(), sorted.end());
+  uint64_t count = 0;
+  for (const auto &it : sorted) {
+    count += it.second;
+  }
+  // the smallest value at least fraction of the values are not above
+  uint64_t rank = static_cast<uint64_t>(std::ceil(fraction * count));
+  uint64_t accu_count = 0;
+  for (const auto &it : sorted) {
+    accu_count += it.second;
+    if (accu_count >= rank) {
+      return it.first;
+    }
+  }
+  return 0;
+}
+
 void SimpleStats::UpdatePrints(bool epoch) {
   j_data_["channel"] = channel_id_;
 
-  std::unordered_map<std::string, uint64_t> &ref_counters =
-      epoch ? epoch_counters_ : counters_;
-  for (const auto &it : ref_counters) {
-    print_pairs_.emplace_back(it.first, std::to_string(it.second));
-    j_data_[it.first] = it.second;
+  for (const auto &it : counters_) {
+    uint64_t value = epoch ? EpochCounter(it.first) : it.second;
+    print_pairs_.emplace_back(it.first, std::to_string(value));
+    j_data_[it.first] = value;
   }
   j_data_["epoch_num"] = counters_["epoch_num"];
 
-  VecStat &ref_vcounter = epoch ? epoch_vec_counters_ : vec_counters_;
-  for (const auto &it : ref_vcounter) {
+  for (const auto &it : vec_counters_) {
     Json j_list;
     for (size_t i = 0; i < it.second.size(); i++) {
       std::string name = it.first + "." + std::to_string(i);
-      print_pairs_.emplace_back(name, std::to_string(it.second[i]));
-      j_list[std::to_string(i)] = it.second[i];
+      uint64_t value = epoch ? EpochVecCounter(it.first, i) : it.second[i];
+      print_pairs_.emplace_back(name, std::to_string(value));
+      j_list[std::to_string(i)] = value;
     }
     j_data_[it.first] = j_list;
   }
@@ -334,6 +515,17 @@ void SimpleStats::UpdatePrints(bool epoch) {
       }
       j_data_[name_hist.first] = j_list;
     }
+    const std::pair<std::string, double> percentiles[] = {
+        {"_p50", 0.5}, {"_p99", 0.99}, {"_p999", 0.999}};
+    for (const auto &name : percentile_histos_) {
+      for (const auto &percentile : percentiles) {
+        uint64_t value =
+            GetHistoPercentile(histo_counts_.at(name), percentile.second);
+        print_pairs_.emplace_back(name + percentile.first,
+                                  std::to_string(value));
+        j_data_[name + percentile.first] = value;
+      }
+    }
   }
 
   for (const auto &it : doubles_) {
@@ -362,37 +554,43 @@ void SimpleStats::UpdateEpochStats() {
 
   // update computed stats
   doubles_["act_energy"] =
-      epoch_counters_["num_act_cmds"] * config_.act_energy_inc;
+      EpochCounter("num_act_cmds") * config_.act_energy_inc;
   doubles_["read_energy"] =
-      epoch_counters_["num_read_cmds"] * config_.read_energy_inc;
+      EpochCounter("num_read_cmds") * config_.read_energy_inc;
   doubles_["write_energy"] =
-      epoch_counters_["num_write_cmds"] * config_.write_energy_inc;
+      EpochCounter("num_write_cmds") * config_.write_energy_inc;
   doubles_["ref_energy"] =
-      epoch_counters_["num_ref_cmds"] * config_.ref_energy_inc;
+      EpochCounter("num_ref_cmds") * config_.ref_energy_inc;
   doubles_["refb_energy"] =
-      epoch_counters_["num_refb_cmds"] * config_.refb_energy_inc;
+      EpochCounter("num_refb_cmds") * config_.refb_energy_inc;
 
   // vector doubles, update first, then push
   double background_energy = 0.0;
   for (int i = 0; i < config_.ranks; i++) {
-    double act_stb = epoch_vec_counters_["rank_active_cycles"][i] *
+    double act_stb = EpochVecCounter("rank_active_cycles", i) *
                      config_.act_stb_energy_inc;
-    double pre_stb = epoch_vec_counters_["all_bank_idle_cycles"][i] *
+    double pre_stb = EpochVecCounter("all_bank_idle_cycles", i) *
                      config_.pre_stb_energy_inc;
     double sref_energy =
-        epoch_vec_counters_["sref_cycles"][i] * config_.sref_energy_inc;
+        EpochVecCounter("sref_cycles", i) * config_.sref_energy_inc;
+    double act_pd = EpochVecCounter("act_pd_cycles", i) *
+                    config_.act_pd_energy_inc;
+    double pre_pd = EpochVecCounter("pre_pd_cycles", i) *
+                    config_.pre_pd_energy_inc;
     vec_doubles_["act_stb_energy"][i] = act_stb;
     vec_doubles_["pre_stb_energy"][i] = pre_stb;
     vec_doubles_["sref_energy"][i] = sref_energy;
-    background_energy += act_stb + pre_stb + sref_energy;
+    vec_doubles_["act_pd_energy"][i] = act_pd;
+    vec_doubles_["pre_pd_energy"][i] = pre_pd;
+    background_energy += act_stb + pre_stb + sref_energy + act_pd + pre_pd;
   }
 
   UpdateHistoBins();
 
   // calculated stats
   uint64_t total_reqs =
-      epoch_counters_["num_reads_done"] + epoch_counters_["num_writes_done"];
-  double total_time = epoch_counters_["num_cycles"] * config_.tCK;
+      EpochCounter("num_reads_done") + EpochCounter("num_writes_done");
+  double total_time = EpochCounter("num_cycles") * config_.tCK;
   double avg_bw = total_reqs * config_.request_size_bytes / total_time;
   calculated_["average_bandwidth"] = avg_bw;
 
@@ -400,19 +598,25 @@ void SimpleStats::UpdateEpochStats() {
                         doubles_["write_energy"] + doubles_["ref_energy"] +
                         doubles_["refb_energy"] + background_energy;
   calculated_["total_energy"] = total_energy;
-  calculated_["average_power"] = total_energy / epoch_counters_["num_cycles"];
+  calculated_["average_power"] = total_energy / EpochCounter("num_cycles");
   calculated_["average_read_latency"] =
       GetHistoAvg(epoch_histo_counts_.at("read_latency"));
   calculated_["average_interarrival"] =
       GetHistoAvg(epoch_histo_counts_.at("interarrival_latency"));
+  if (config_.qos_classes > 1) {
+    for (int i = 0; i < config_.qos_classes; i++) {
+      uint64_t reqs = EpochVecCounter("qos_reads_done", i) +
+                      EpochVecCounter("qos_writes_done", i);
+      vec_doubles_["qos_bandwidth"][i] =
+          reqs * config_.request_size_bytes / total_time;
+      vec_doubles_["qos_read_latency"][i] = GetHistoAvg(epoch_histo_counts_.at(
+          "read_class" + std::to_string(i) + "_latency"));
+    }
+  }
 
   UpdatePrints(true);
-  for (auto &it : epoch_counters_) {
-    it.second = 0;
-  }
-  for (auto &vec : epoch_vec_counters_) {
-    std::fill(vec.second.begin(), vec.second.end(), 0);
-  }
+  std::fill(epoch_counters_.begin(), epoch_counters_.end(), 0);
+  std::fill(epoch_vec_counters_.begin(), epoch_vec_counters_.end(), 0);
   for (auto &it : epoch_histo_counts_) {
     it.second.clear();
   }
@@ -441,10 +645,16 @@ void SimpleStats::UpdateFinalStats() {
         vec_counters_["all_bank_idle_cycles"][i] * config_.pre_stb_energy_inc;
     double sref_energy =
         vec_counters_["sref_cycles"][i] * config_.sref_energy_inc;
+    double act_pd =
+        vec_counters_["act_pd_cycles"][i] * config_.act_pd_energy_inc;
+    double pre_pd =
+        vec_counters_["pre_pd_cycles"][i] * config_.pre_pd_energy_inc;
     vec_doubles_["act_stb_energy"][i] = act_stb;
     vec_doubles_["pre_stb_energy"][i] = pre_stb;
     vec_doubles_["sref_energy"][i] = sref_energy;
-    background_energy += act_stb + pre_stb + sref_energy;
+    vec_doubles_["act_pd_energy"][i] = act_pd;
+    vec_doubles_["pre_pd_energy"][i] = pre_pd;
+    background_energy += act_stb + pre_stb + sref_energy + act_pd + pre_pd;
   }
 
   // histograms
@@ -467,6 +677,16 @@ void SimpleStats::UpdateFinalStats() {
       GetHistoAvg(histo_counts_.at("read_latency"));
   calculated_["average_interarrival"] =
       GetHistoAvg(histo_counts_.at("interarrival_latency"));
+  if (config_.qos_classes > 1) {
+    for (int i = 0; i < config_.qos_classes; i++) {
+      uint64_t reqs = vec_counters_["qos_reads_done"][i] +
+                      vec_counters_["qos_writes_done"][i];
+      vec_doubles_["qos_bandwidth"][i] =
+          reqs * config_.request_size_bytes / total_time;
+      vec_doubles_["qos_read_latency"][i] = GetHistoAvg(
+          histo_counts_.at("read_class" + std::to_string(i) + "_latency"));
+    }
+  }
 
   UpdatePrints(false);
   return;
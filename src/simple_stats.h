@@ -6,35 +6,85 @@
 #include <unordered_map>
 #include <vector>
 
+#include "checkpoint.h"
 #include "configuration.h"
 #include "json.hpp"
+#include "stats_writer.h"
 
 namespace dramsim3 {
 
+/// @brief Handles of registered stats, looked up once by name so that the
+/// hot path updates a flat array instead of hashing stat names.
+struct CounterHandle {
+  int index;
+};
+/// @brief Handle of a vector counter, the index of its element 0.
+struct VecCounterHandle {
+  int index;
+};
+struct HistoHandle {
+  int index;
+};
+
 class SimpleStats {
 public:
   SimpleStats(const Config &config, int channel_id);
+
+  // look up stat handles by name, exits if the stat is not registered
+  CounterHandle Counter(const std::string &name) const;
+  VecCounterHandle VecCounter(const std::string &name) const;
+  HistoHandle Histo(const std::string &name) const;
+
   // incrementing counter
-  void Increment(const std::string name) { epoch_counters_[name] += 1; }
+  void Increment(CounterHandle stat) { epoch_counters_[stat.index] += 1; }
+
+  // incrementing counter by number
+  void IncrementBy(CounterHandle stat, uint64_t num) {
+    epoch_counters_[stat.index] += num;
+  }
 
   // incrementing for vec counter
-  void IncrementVec(const std::string name, int pos) {
-    epoch_vec_counters_[name][pos] += 1;
+  void IncrementVec(VecCounterHandle stat, int pos) {
+    epoch_vec_counters_[stat.index + pos] += 1;
   }
 
   // increment vec counter by number
-  void IncrementVecBy(const std::string name, int pos, int num) {
-    epoch_vec_counters_[name][pos] += num;
+  void IncrementVecBy(VecCounterHandle stat, int pos, uint64_t num) {
+    epoch_vec_counters_[stat.index + pos] += num;
   }
 
   // add historgram value
-  void AddValue(const std::string name, const int value);
+  void AddValue(HistoHandle stat, const int value) {
+    (*epoch_histo_refs_[stat.index])[value] += 1;
+  }
+
+  // by name versions of the above, for code off the hot path
+  void Increment(const std::string &name) { Increment(Counter(name)); }
+  void IncrementBy(const std::string &name, uint64_t num) {
+    IncrementBy(Counter(name), num);
+  }
+  void IncrementVec(const std::string &name, int pos) {
+    IncrementVec(VecCounter(name), pos);
+  }
+  void IncrementVecBy(const std::string &name, int pos, uint64_t num) {
+    IncrementVecBy(VecCounter(name), pos, num);
+  }
+  void AddValue(const std::string &name, const int value) {
+    AddValue(Histo(name), value);
+  }
+
+  // running totals since the last Reset, the folded epochs plus this one
+  uint64_t CounterTotal(CounterHandle stat) const {
+    return counters_.at(counter_names_[stat.index]) +
+           epoch_counters_[stat.index];
+  }
+  void HistoTotal(HistoHandle stat, uint64_t &count, uint64_t &sum) const;
 
   // return per rank background energy
   double RankBackgroundEnergy(const int r) const;
 
-  // Epoch update
-  void PrintEpochStats();
+  // Epoch update, the JSON of the epoch goes to writer
+  void PrintEpochStats(StatsWriter &writer);
 
   // Final statas output
   void PrintFinalStats();
@@ -42,6 +92,10 @@ public:
   // Reset (usually after one phase of simulation)
   void Reset();
 
+  // checkpointing, every count so far, the outputs are rebuilt from them
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
+
 private:
   using VecStat = std::unordered_map<std::string, std::vector<uint64_t>>;
   using HistoCount = std::unordered_map<int, uint64_t>;
@@ -57,9 +111,17 @@ private:
   void UpdateHistoBins();
   void UpdatePrints(bool epoch);
   double GetHistoAvg(const HistoCount &histo_counts) const;
+  uint64_t GetHistoPercentile(const HistoCount &histo_counts,
+                              double fraction) const;
   std::string GetTextHeader(bool is_final) const;
   void UpdateEpochStats();
   void UpdateFinalStats();
+  uint64_t EpochCounter(const std::string &name) const {
+    return epoch_counters_[counter_index_.at(name)];
+  }
+  uint64_t EpochVecCounter(const std::string &name, int pos) const {
+    return epoch_vec_counters_[vec_counter_index_.at(name) + pos];
+  }
 
   const Config &config_;
   int channel_id_;
@@ -69,11 +131,16 @@ private:
 
   // counter stats, indexed by their name
   std::unordered_map<std::string, uint64_t> counters_;
-  std::unordered_map<std::string, uint64_t> epoch_counters_;
+  // epoch counters, indexed by handle, folded into counters_ every epoch
+  std::unordered_map<std::string, int> counter_index_;
+  std::vector<std::string> counter_names_;
+  std::vector<uint64_t> epoch_counters_;
 
   // vectored counter stats, first indexed by name then by index
   VecStat vec_counters_;
-  VecStat epoch_vec_counters_;
+  // all epoch vector counters back to back, a handle is the offset of one
+  std::unordered_map<std::string, int> vec_counter_index_;
+  std::vector<uint64_t> epoch_vec_counters_;
 
   // NOTE: doubles_ vec_doubles_ and calculated_ are basically one time
   // placeholders after each epoch they store the value for that epoch
@@ -92,8 +159,14 @@ private:
   std::unordered_map<std::string, int> bin_widths_;
   std::unordered_map<std::string, HistoCount> histo_counts_;
   std::unordered_map<std::string, HistoCount> epoch_histo_counts_;
+  // histogram handles index into this, elements of an unordered_map are
+  // never moved so the pointers stay valid
+  std::unordered_map<std::string, int> histo_index_;
+  std::vector<HistoCount *> epoch_histo_refs_;
   VecStat histo_bins_;
   VecStat epoch_histo_bins_;
+  // histograms whose p50, p99 and p999 are part of the final stats
+  std::vector<std::string> percentile_histos_;
 
   // outputs
   Json j_data_;
@@ -0,0 +1,102 @@
+#include "stats_writer.h"
+
+#include <iostream>
+
+#include "common.h"
+
+namespace dramsim3 {
+
+namespace {
+
+const size_t kStatsBufferSize = 1 << 20;
+
+// the columns of a row are the keys of stats in order, objects (the vector
+// stats) are expanded into one column per element
+template <class Visit>
+void ForEachColumn(const nlohmann::json &stats, Visit visit) {
+  for (auto it = stats.begin(); it != stats.end(); it++) {
+    if (it.value().is_object()) {
+      for (auto elem = it.value().begin(); elem != it.value().end(); elem++) {
+        visit(it.key() + "." + elem.key(), elem.value());
+      }
+    } else {
+      visit(it.key(), it.value());
+    }
+  }
+}
+
+}  // namespace
+
+StatsWriter::StatsWriter(const Config &config)
+    : config_(config), is_open_(false), num_rows_(0), num_columns_(0) {}
+
+void StatsWriter::Open() {
+  if (config_.epoch_json) {
+    json_buffer_.resize(kStatsBufferSize);
+    json_out_.rdbuf()->pubsetbuf(json_buffer_.data(), json_buffer_.size());
+    json_out_.open(config_.json_epoch_name, std::ofstream::out);
+    json_out_ << "[";
+  }
+  if (config_.epoch_csv) {
+    csv_buffer_.resize(kStatsBufferSize);
+    csv_out_.rdbuf()->pubsetbuf(csv_buffer_.data(), csv_buffer_.size());
+    csv_out_.open(config_.csv_epoch_name, std::ofstream::out);
+  }
+  is_open_ = true;
+  num_rows_ = 0;
+}
+
+void StatsWriter::WriteEpoch(const nlohmann::json &stats) {
+  if (!is_open_) {
+    Open();
+  }
+  if (config_.epoch_json) {
+    if (num_rows_ > 0) {
+      json_out_ << ",\n";
+    }
+    json_out_ << stats;
+  }
+  if (config_.epoch_csv) {
+    WriteCSVRow(stats);
+  }
+  num_rows_++;
+}
+
+void StatsWriter::WriteCSVRow(const nlohmann::json &stats) {
+  if (num_rows_ == 0) {
+    num_columns_ = 0;
+    ForEachColumn(stats, [this](const std::string &name,
+                                const nlohmann::json &value) {
+      csv_out_ << (num_columns_++ > 0 ? "," : "") << name;
+    });
+    csv_out_ << "\n";
+  }
+  size_t column = 0;
+  ForEachColumn(stats,
+                [this, &column](const std::string &name,
+                                const nlohmann::json &value) {
+                  csv_out_ << (column++ > 0 ? "," : "") << value;
+                });
+  if (column != num_columns_) {
+    std::cerr << "Epoch stats have " << column << " columns instead of "
+              << num_columns_ << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  csv_out_ << "\n";
+}
+
+void StatsWriter::Close() {
+  if (!is_open_) {
+    return;
+  }
+  if (json_out_.is_open()) {
+    json_out_ << "]" << std::endl;
+    json_out_.close();
+  }
+  if (csv_out_.is_open()) {
+    csv_out_.close();
+  }
+  is_open_ = false;
+}
+
+}  // namespace dramsim3
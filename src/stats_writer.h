@@ -0,0 +1,45 @@
+#ifndef __STATS_WRITER_H
+#define __STATS_WRITER_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "configuration.h"
+#include "json.hpp"
+
+namespace dramsim3 {
+
+/// @brief The epoch stats sink of a memory system. Its files are opened at
+/// the first epoch and stay open with large buffers, so an epoch costs one
+/// buffered write per channel. other.epoch_format selects the outputs:
+///   json  <prefix>epoch.json, a list of one object per channel and epoch
+///   csv   <prefix>epoch.csv, one row per channel and epoch, the vector
+///         stats flattened into <name>.<index> columns
+///   both  the two of them
+class StatsWriter {
+public:
+  explicit StatsWriter(const Config &config);
+  ~StatsWriter() { Close(); }
+  /// @brief Append the epoch stats of one channel.
+  void WriteEpoch(const nlohmann::json &stats);
+  /// @brief Terminate and close the files, a later epoch starts new ones.
+  void Close();
+
+private:
+  void Open();
+  void WriteCSVRow(const nlohmann::json &stats);
+
+  const Config &config_;
+  std::ofstream json_out_;
+  std::ofstream csv_out_;
+  std::vector<char> json_buffer_;
+  std::vector<char> csv_buffer_;
+  bool is_open_;
+  uint64_t num_rows_;
+  // number of csv columns, from the header written for the first row
+  size_t num_columns_;
+};
+
+}  // namespace dramsim3
+#endif  // __STATS_WRITER_H
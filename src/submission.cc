@@ -0,0 +1,170 @@
+#include "submission.h"
+
+#include <algorithm>
+
+namespace dramsim3 {
+
+namespace {
+
+size_t RingSize(size_t capacity) {
+  size_t size = 2;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  return size;
+}
+
+}  // namespace
+
+SubmissionRing::SubmissionRing(size_t capacity) : tail_(0), head_(0) {
+  size_t size = RingSize(capacity);
+  cells_.reset(new Cell[size]);
+  for (size_t i = 0; i < size; i++) {
+    cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+  mask_ = size - 1;
+}
+
+bool SubmissionRing::Push(const Submission &sub) {
+  size_t pos = tail_.load(std::memory_order_relaxed);
+  Cell *cell;
+  while (true) {
+    cell = &cells_[pos & mask_];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    // the cell is free for position pos once the consumer has popped the
+    // submission of pos - size from it
+    if (seq == pos) {
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (seq < pos) {
+      return false;
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+  cell->sub = sub;
+  cell->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+const Submission *SubmissionRing::Front() const {
+  const Cell &cell = cells_[head_ & mask_];
+  if (cell.seq.load(std::memory_order_acquire) != head_ + 1) {
+    return nullptr;
+  }
+  return &cell.sub;
+}
+
+void SubmissionRing::PopFront() {
+  cells_[head_ & mask_].seq.store(head_ + mask_ + 1, std::memory_order_release);
+  head_++;
+}
+
+CompletionRing::CompletionRing(size_t capacity) : head_(0), tail_(0) {
+  size_t size = RingSize(capacity);
+  completions_.resize(size);
+  mask_ = size - 1;
+}
+
+size_t CompletionRing::Pop(Completion *out, size_t max) {
+  size_t head = head_.load(std::memory_order_relaxed);
+  size_t tail = tail_.load(std::memory_order_acquire);
+  size_t num = std::min(max, tail - head);
+  for (size_t i = 0; i < num; i++) {
+    out[i] = completions_[(head + i) & mask_];
+  }
+  head_.store(head + num, std::memory_order_release);
+  return num;
+}
+
+SubmissionFrontEnd::Producer::Producer(int credits)
+    : completions(credits), tags(credits) {
+  for (int i = credits - 1; i >= 0; i--) {
+    free_credits.push_back(i);
+  }
+}
+
+SubmissionFrontEnd::SubmissionFrontEnd(MemorySystem &memory_system,
+                                       int num_producers, int credits)
+    : memory_system_(memory_system), credits_(credits) {
+  for (int i = 0; i < num_producers; i++) {
+    producers_.emplace_back(new Producer(credits));
+  }
+  // all the credits together bound what can be in a ring, so a push into
+  // one never fails
+  size_t ring_capacity = static_cast<size_t>(num_producers) * credits;
+  for (int i = 0; i < memory_system_.GetChannels(); i++) {
+    channel_rings_.emplace_back(new SubmissionRing(ring_capacity));
+  }
+  memory_system_.RegisterCompletionCallback(
+      [this](const Completion &done) { TransactionDone(done); });
+}
+
+bool SubmissionFrontEnd::Submit(int producer, uint64_t hex_addr,
+                                bool is_write, uint64_t tag) {
+  Producer &prod = *producers_[producer];
+  if (prod.free_credits.empty()) {
+    return false;
+  }
+  int credit = prod.free_credits.back();
+  uint64_t front_end_tag = static_cast<uint64_t>(producer) * credits_ + credit;
+  int channel = memory_system_.GetChannel(hex_addr);
+  if (!channel_rings_[channel]->Push({hex_addr, front_end_tag, is_write})) {
+    return false;
+  }
+  prod.free_credits.pop_back();
+  prod.tags[credit] = tag;
+  return true;
+}
+
+int SubmissionFrontEnd::Credits(int producer) const {
+  return static_cast<int>(producers_[producer]->free_credits.size());
+}
+
+size_t SubmissionFrontEnd::PollCompletions(int producer, Completion *out,
+                                           size_t max) {
+  Producer &prod = *producers_[producer];
+  size_t num = prod.completions.Pop(out, max);
+  for (size_t i = 0; i < num; i++) {
+    int credit = static_cast<int>(out[i].tag % credits_);
+    out[i].tag = prod.tags[credit];
+    prod.free_credits.push_back(credit);
+  }
+  return num;
+}
+
+void SubmissionFrontEnd::ClockTick() {
+  Drain();
+  memory_system_.ClockTick();
+}
+
+uint64_t SubmissionFrontEnd::ClockTickN(uint64_t cycles) {
+  uint64_t elapsed = 0;
+  while (elapsed < cycles) {
+    Drain();
+    elapsed += memory_system_.ClockTickN(cycles - elapsed);
+  }
+  return elapsed;
+}
+
+void SubmissionFrontEnd::Drain() {
+  // a channel stops at the first submission its controller does not take,
+  // keeping the submission order per channel
+  for (auto &ring : channel_rings_) {
+    const Submission *sub;
+    while ((sub = ring->Front()) != nullptr &&
+           memory_system_.WillAcceptTransaction(sub->hex_addr,
+                                                sub->is_write)) {
+      memory_system_.AddTransaction(sub->hex_addr, sub->is_write, sub->tag);
+      ring->PopFront();
+    }
+  }
+}
+
+void SubmissionFrontEnd::TransactionDone(const Completion &done) {
+  producers_[done.tag / credits_]->completions.Push(done);
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,131 @@
+#ifndef __SUBMISSION_H
+#define __SUBMISSION_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "memory_system.h"
+
+namespace dramsim3 {
+
+/// @brief A transaction on its way from a producer to the tick thread, tag
+/// is the one the front end adds it with.
+struct Submission {
+  uint64_t hex_addr;
+  uint64_t tag;
+  bool is_write;
+};
+
+/// @brief Bounded lock-free multi producer, single consumer ring. Every cell
+/// carries a sequence number that tells whether it is free for the producer
+/// that claimed its position or holds a submission for the consumer, so
+/// producers only contend on the claim of the tail.
+class SubmissionRing {
+public:
+  explicit SubmissionRing(size_t capacity);
+  /// @brief Any producer thread, false if the ring is full.
+  bool Push(const Submission &sub);
+  /// @brief The oldest submission, nullptr if there is none. Consumer side,
+  /// it stays in the ring until PopFront.
+  const Submission *Front() const;
+  void PopFront();
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    Submission sub;
+  };
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+  // next position to claim and to pop, on their own cache lines
+  char pad0_[64];
+  std::atomic<size_t> tail_;
+  char pad1_[64];
+  size_t head_;
+  char pad2_[64];
+};
+
+/// @brief Lock-free single producer, single consumer ring of completions,
+/// the same scheme as TraceRing. The front end sizes it so that it can not
+/// overflow.
+class CompletionRing {
+public:
+  explicit CompletionRing(size_t capacity);
+  void Push(const Completion &done) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    completions_[tail & mask_] = done;
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+  /// @brief Move up to max completions into out, consumer side.
+  size_t Pop(Completion *out, size_t max);
+
+private:
+  std::vector<Completion> completions_;
+  size_t mask_;
+  char pad0_[64];
+  std::atomic<size_t> head_;
+  char pad1_[64];
+  std::atomic<size_t> tail_;
+  char pad2_[64];
+};
+
+/// @brief Thread-safe front end of a memory system for hosts that generate
+/// requests on many threads. Producers submit into one lock-free ring per
+/// channel (see MemorySystem::GetChannel) and the thread that ticks the
+/// memory system moves the submissions into the controllers. Every producer
+/// has a fixed number of credits, one per transaction in flight, and gets
+/// its completions back through its own ring, so no producer ever blocks on
+/// a lock or runs a callback of another thread.
+///
+/// The front end takes over the callbacks of the memory system. It tags each
+/// transaction with its producer and credit, so the completions find their
+/// producer without a lookup.
+class SubmissionFrontEnd {
+public:
+  SubmissionFrontEnd(MemorySystem &memory_system, int num_producers,
+                     int credits);
+
+  // producer side, a producer id must only be used by one thread at a time
+  /// @brief Queue a transaction, false if the producer is out of credits.
+  /// tag is handed back with its completion.
+  bool Submit(int producer, uint64_t hex_addr, bool is_write,
+              uint64_t tag = 0);
+  /// @brief Credits left, i.e. transactions that can still be submitted.
+  int Credits(int producer) const;
+  /// @brief Move up to max completions into out, each returns a credit.
+  size_t PollCompletions(int producer, Completion *out, size_t max);
+
+  // tick side, the thread that ticks the memory system
+  /// @brief Move what was submitted into the controllers, as far as their
+  /// queues take it, and tick the memory system once.
+  void ClockTick();
+  /// @brief As MemorySystem::ClockTickN, submissions are moved into the
+  /// controllers each time it returns early.
+  uint64_t ClockTickN(uint64_t cycles);
+
+private:
+  // the state of a producer, on cache lines of its own
+  struct Producer {
+    explicit Producer(int credits);
+    // completions with the tags of the front end
+    CompletionRing completions;
+    // only touched by the producer thread, the tags of the producer by credit
+    // and the credits that are not in use
+    std::vector<uint64_t> tags;
+    std::vector<int> free_credits;
+    char pad[64];
+  };
+
+  void Drain();
+  void TransactionDone(const Completion &done);
+
+  MemorySystem &memory_system_;
+  int credits_;
+  std::vector<std::unique_ptr<Producer>> producers_;
+  std::vector<std::unique_ptr<SubmissionRing>> channel_rings_;
+};
+
+}  // namespace dramsim3
+#endif  // __SUBMISSION_H
@@ -0,0 +1,230 @@
+#include "./../ext/headers/args.hxx"
+#include "cpu.h"
+#include "json.hpp"
+#include "memory_system.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+using namespace dramsim3;
+
+namespace {
+
+// the trace is loaded once and shared read-only by all the simulations
+struct TraceRecord {
+  uint64_t addr;
+  uint64_t cycle;
+  bool is_write;
+};
+
+struct SweepRun {
+  std::string name;
+  std::string config_file;
+  ConfigOverrides overrides;
+  std::string output_dir;
+};
+
+std::string FileStem(const std::string &path) {
+  size_t begin = path.find_last_of('/');
+  begin = begin == std::string::npos ? 0 : begin + 1;
+  size_t end = path.find_last_of('.');
+  if (end == std::string::npos || end < begin) {
+    end = path.size();
+  }
+  return path.substr(begin, end - begin);
+}
+
+// "section.name=v1,v2,..." into the key and its values
+void ParseSweepParam(const std::string &param, std::string &key,
+                     std::vector<std::string> &values) {
+  size_t eq = param.find('=');
+  if (eq == std::string::npos || eq == 0) {
+    std::cerr << "Bad --set " << param << ", use section.name=v1,v2"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  key = param.substr(0, eq);
+  values = StringSplit(param.substr(eq + 1), ',');
+  if (values.empty()) {
+    values.push_back("");
+  }
+}
+
+// every combination of config file and swept values
+std::vector<SweepRun> BuildRuns(const std::vector<std::string> &configs,
+                                const std::vector<std::string> &params,
+                                const std::string &output_dir) {
+  std::vector<SweepRun> runs;
+  for (const auto &config : configs) {
+    SweepRun run;
+    run.name = FileStem(config);
+    run.config_file = config;
+    runs.push_back(run);
+  }
+  for (const auto &param : params) {
+    std::string key;
+    std::vector<std::string> values;
+    ParseSweepParam(param, key, values);
+    std::string short_key = key.substr(key.find('.') + 1);
+    std::vector<SweepRun> expanded;
+    for (const auto &run : runs) {
+      for (const auto &value : values) {
+        SweepRun new_run = run;
+        new_run.overrides[key] = value;
+        new_run.name += "_" + short_key + "-" + value;
+        expanded.push_back(new_run);
+      }
+    }
+    runs.swap(expanded);
+  }
+  for (auto &run : runs) {
+    run.output_dir = output_dir + "/" + run.name;
+  }
+  return runs;
+}
+
+std::vector<TraceRecord> LoadTrace(const std::string &trace_file) {
+  std::vector<TraceRecord> trace;
+  TraceStream stream(trace_file);
+  Transaction trans;
+  while (stream.Next(trans)) {
+    trace.push_back(TraceRecord{trans.addr, trans.added_cycle, trans.is_write});
+  }
+  return trace;
+}
+
+// replays the trace the same way TraceBasedCPU does
+void Simulate(const SweepRun &run, const std::vector<TraceRecord> &trace,
+              uint64_t cycles, const std::string &checkpoint) {
+  auto callback = [](uint64_t addr) {};
+  // fixed name so that the results can be collected
+  ConfigOverrides overrides = run.overrides;
+  overrides["other.output_prefix"] = "dramsim3";
+  MemorySystem memory_system(run.config_file, run.output_dir, callback,
+                             callback, overrides);
+  if (!checkpoint.empty()) {
+    memory_system.LoadCheckpoint(checkpoint);
+  }
+  size_t next = 0;
+  for (uint64_t clk = 0; clk < cycles; clk++) {
+    memory_system.ClockTick();
+    if (next < trace.size() && trace[next].cycle <= clk) {
+      const TraceRecord &record = trace[next];
+      if (memory_system.WillAcceptTransaction(record.addr, record.is_write)) {
+        memory_system.AddTransaction(record.addr, record.is_write);
+        next++;
+      }
+    }
+  }
+  memory_system.PrintStats();
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  args::ArgumentParser parser(
+      "DRAM Simulator parameter sweep, runs one simulation per config file "
+      "and combination of swept values on the same trace.",
+      "Example: \n"
+      "./build/dramsim3sweep configs/DDR4_8Gb_x8_3200.ini "
+      "configs/DDR4_8Gb_x8_2400.ini -t sample_trace.txt -c 100000 "
+      "--set system.trans_queue_size=16,32,64 "
+      "--set system.address_mapping=rochrababgco,rorabgbachco");
+  args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+  args::ValueFlag<uint64_t> num_cycles_arg(parser, "num_cycles",
+                                           "Number of cycles to simulate",
+                                           {'c', "cycles"}, 100000);
+  args::ValueFlag<std::string> output_dir_arg(
+      parser, "output_dir",
+      "Output directory, each run writes to a sub directory of its name and "
+      "the merged results go to sweep.json",
+      {'o', "output-dir"}, ".");
+  args::ValueFlag<std::string> trace_file_arg(
+      parser, "trace", "Trace file (text or binary), mandatory",
+      {'t', "trace"});
+  args::ValueFlag<int> num_threads_arg(
+      parser, "num_threads",
+      "Simulations run at the same time, 0 for one per hardware thread",
+      {'j', "jobs"}, 0);
+  args::ValueFlag<std::string> checkpoint_arg(
+      parser, "file",
+      "Checkpoint every run starts from, see dramsim3main --save-checkpoint",
+      {"checkpoint"}, "");
+  args::ValueFlagList<std::string> param_arg(
+      parser, "param", "Swept parameter, section.name=v1,v2,...", {"set"});
+  args::PositionalList<std::string> config_arg(
+      parser, "configs", "The config file names (at least one)");
+
+  try {
+    parser.ParseCLI(argc, argv);
+  } catch (const args::Help &) {
+    std::cout << parser;
+    return 0;
+  } catch (const args::ParseError &e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return 1;
+  }
+
+  std::vector<std::string> configs = args::get(config_arg);
+  std::string trace_file = args::get(trace_file_arg);
+  if (configs.empty() || trace_file.empty()) {
+    std::cerr << parser;
+    return 1;
+  }
+  uint64_t cycles = args::get(num_cycles_arg);
+  std::string checkpoint = args::get(checkpoint_arg);
+  std::string output_dir = args::get(output_dir_arg);
+
+  std::vector<SweepRun> runs =
+      BuildRuns(configs, args::get(param_arg), output_dir);
+  for (const auto &run : runs) {
+    mkdir(run.output_dir.c_str(), 0755);
+  }
+  const std::vector<TraceRecord> trace = LoadTrace(trace_file);
+  std::cout << "Loaded " << trace.size() << " requests, running "
+            << runs.size() << " simulations" << std::endl;
+
+  int num_threads = args::get(num_threads_arg);
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = std::min(num_threads, static_cast<int>(runs.size()));
+
+  // simulations take very different times, so hand them out one at a time
+  std::atomic<size_t> next_run(0);
+  auto worker = [&]() {
+    for (size_t i = next_run++; i < runs.size(); i = next_run++) {
+      Simulate(runs[i], trace, cycles, checkpoint);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  nlohmann::json results;
+  results["trace"] = trace_file;
+  results["cycles"] = cycles;
+  for (const auto &run : runs) {
+    nlohmann::json j_run;
+    j_run["name"] = run.name;
+    j_run["config"] = run.config_file;
+    j_run["overrides"] = run.overrides;
+    std::ifstream stats_file(run.output_dir + "/dramsim3.json");
+    if (stats_file.good()) {
+      j_run["stats"] = nlohmann::json::parse(stats_file);
+    }
+    results["runs"].push_back(j_run);
+  }
+  std::ofstream(output_dir + "/sweep.json") << results.dump(2) << std::endl;
+  std::cout << "Results of " << runs.size() << " runs written to "
+            << output_dir << "/sweep.json" << std::endl;
+  return 0;
+}
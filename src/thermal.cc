@@ -1,18 +1,26 @@
 #include "thermal.h"
 
-extern "C" double *steady_thermal_solver(double ***powerM, double W, double Lc,
+extern "C" ThermalFactor *factor_thermal_matrix(double *Midx, int count,
+                                                int n, double *Cap,
+                                                int layer_dim, double dt);
+extern "C" void free_thermal_factor(ThermalFactor *factor);
+extern "C" double *steady_thermal_solver(double *powerM, double W, double Lc,
                                          int numP, int dimX, int dimZ,
-                                         double **Midx, int count,
-                                         double Tamb_);
-extern "C" double *transient_thermal_solver(double ***powerM, double W,
-                                            double L, int numP, int dimX,
-                                            int dimZ, double **Midx,
-                                            int MidxSize, double *Cap,
-                                            int CapSize, double time, int iter,
-                                            double *T_trans, double Tamb_);
-extern "C" double **calculate_Midx_array(double W, double Lc, int numP,
-                                         int dimX, int dimZ, int *MidxSize,
+                                         ThermalFactor *factor, double Tamb_);
+extern "C" void transient_thermal_solver(double *powerM, double W, double L,
+                                         int numP, int dimX, int dimZ,
+                                         double *Midx, int MidxSize,
+                                         double *Cap, int CapSize, double time,
+                                         int iter, double *T_trans,
                                          double Tamb_);
+extern "C" void implicit_thermal_solver(double *powerM, double W, double Lc,
+                                        int numP, int dimX, int dimZ,
+                                        ThermalFactor *factor, double *Cap,
+                                        double time, int iter, double *T_trans,
+                                        double Tamb_);
+extern "C" double *calculate_Midx_array(double W, double Lc, int numP,
+                                        int dimX, int dimZ, int *MidxSize,
+                                        double Tamb_);
 extern "C" double *calculate_Cap_array(double W, double Lc, int numP, int dimX,
                                        int dimZ, int *CapSize);
 extern "C" double *initialize_Temperature(double W, double Lc, int numP,
@@ -20,10 +28,10 @@ extern "C" double *initialize_Temperature(double W, double Lc, int numP,
 
 namespace dramsim3 {
 
-std::function<Address(const Address &addr)> GetPhyAddress;
-
 ThermalCalculator::ThermalCalculator(const Config &config)
-    : config_(config), time_iter0(10), sample_id(0),
+    : config_(config), time_iter0(10), steady_factor_(nullptr),
+      trans_factor_(nullptr), sample_id(0), pending_epochs_(0),
+      epoch_done_(true),
       background_energy_(config_.channels,
                          std::vector<double>(config_.ranks, 0)),
       avg_logic_power_(0.0) {
@@ -81,20 +89,24 @@ ThermalCalculator::ThermalCalculator(const Config &config)
   std::cout << "number of devices is " << config_.devices_per_rank << std::endl;
 
   SetPhyAddressMapping();
+  SetBankOrigins();
 
   // Initialize the vectors
-  accu_Pmap = std::vector<std::vector<double>>(
-      num_case, std::vector<double>(numP * dimX * dimY, 0));
-  cur_Pmap = std::vector<std::vector<double>>(
-      num_case, std::vector<double>(numP * dimX * dimY, 0));
+  accu_Pmap = ThermalGrid(num_case, numP, dimX, dimY);
+  cur_Pmap = ThermalGrid(num_case, numP, dimX, dimY);
+  pending_Pmap_ = cur_Pmap;
+  epoch_Pmap_ = cur_Pmap;
   T_size = (numP * 3 + 1) * (dimX + num_dummy) * (dimY + num_dummy);
-  T_trans = new double *[num_case];
-  T_final = new double *[num_case];
-  for (int i = 0; i < num_case; i++) {
-    T_trans[i] = new double[T_size];
-  }
+  T_trans = ThermalGrid(num_case, numP * 3 + 1, dimX + num_dummy,
+                        dimY + num_dummy);
+  T_final = ThermalGrid(num_case, numP * 3 + 1, dimX + num_dummy,
+                        dimY + num_dummy);
+  powerM_.assign(numP * (dimX + num_dummy) * (dimY + num_dummy), 0.0);
 
   InitialParameters();
+  bank_temps_.assign(config_.channels * config_.ranks * config_.banks,
+                     config_.amb_temp);
+  solved_bank_temps_ = bank_temps_;
 
   refresh_count = std::vector<std::vector<int>>(
       config_.channels * config_.ranks, std::vector<int>(config_.banks, 0));
@@ -121,18 +133,22 @@ ThermalCalculator::ThermalCalculator(const Config &config)
   }
 }
 
-ThermalCalculator::~ThermalCalculator() {}
+ThermalCalculator::~ThermalCalculator() {
+  WaitEpochs();
+  free_thermal_factor(steady_factor_);
+  free_thermal_factor(trans_factor_);
+}
 
-void ThermalCalculator::SetPhyAddressMapping() {
-  std::string mapping_string = config_.loc_mapping;
-  if (mapping_string.empty()) {
+void PhyAddressMap::Init(const std::string &mapping_string,
+                         int column_offset) {
+  identity_ = mapping_string.empty();
+  if (identity_) {
     // if no location mapping specified, then do not map and use default
     // mapping...
-    GetPhyAddress = [](const Address &addr) { return Address(addr); };
     return;
   }
   std::vector<std::string> bit_fields = StringSplit(mapping_string, ',');
-  if (bit_fields.size() != 6) {
+  if (bit_fields.size() != NUM_FIELDS) {
     std::cerr << "loc_mapping should have 6 fields!" << std::endl;
     std::exit(1);
   }
@@ -178,53 +194,74 @@ void ThermalCalculator::SetPhyAddressMapping() {
   std::cout << std::endl;
 #endif  // DEBUG_LOC_MAPPING
 
-  int column_offset = LogBase2(config_.BL);
-
-  GetPhyAddress = [mapped_pos, column_offset](const Address &addr) {
-    uint64_t new_hex = 0;
-    // ch - ra - bg - ba - ro - co
-    int origin_pos[] = {addr.channel, addr.rank, addr.bankgroup,
-                        addr.bank,    addr.row,  addr.column};
-    int new_pos[] = {0, 0, 0, 0, 0, 0};
-    for (unsigned i = 0; i < mapped_pos.size(); i++) {
-      int field_width = mapped_pos[i].size();
-      for (int j = 0; j < field_width; j++) {
-        uint64_t this_bit = GetBitInPos(origin_pos[i], field_width - j - 1);
-        uint64_t new_bit = (this_bit << mapped_pos[i][j]);
-        new_hex |= new_bit;
-#ifdef DEBUG_LOC_MAPPING
-        std::cout << "mapping " << this_bit << " to " << mapped_pos[i][j]
-                  << ", result:" << std::hex << new_hex << std::dec
-                  << std::endl;
-#endif  // DEBUG_LOC_MAPPING
+  // ch - ra - bg - ba - ro - co, the mapped fields are read back from the
+  // column offset up, column first
+  int pos = column_offset;
+  for (int i = NUM_FIELDS - 1; i >= 0; i--) {
+    int field_width = mapped_pos[i].size();
+    width_[i] = field_width;
+    pos_[i] = pos;
+    pos += field_width;
+    // bit field_width - j - 1 of the field goes to mapped_pos[i][j]
+    int num_bytes = (field_width + 7) / 8;
+    scatter_[i].assign(num_bytes, std::array<uint64_t, 256>());
+    for (int b = 0; b < num_bytes; b++) {
+      for (int value = 0; value < 256; value++) {
+        uint64_t bits = 0;
+        for (int k = 0; k < 8; k++) {
+          int bit = 8 * b + k;
+          if (bit < field_width && GetBitInPos(value, k)) {
+            bits |= static_cast<uint64_t>(1)
+                    << mapped_pos[i][field_width - bit - 1];
+          }
+        }
+        scatter_[i][b][value] = bits;
       }
     }
+  }
+}
 
-    int pos = column_offset;
-    for (int i = mapped_pos.size() - 1; i >= 0; i--) {
-      new_pos[i] = ModuloWidth(new_hex, mapped_pos[i].size(), pos);
-      pos += mapped_pos[i].size();
-    }
+uint64_t PhyAddressMap::Scatter(const Address &addr) const {
+  return Scatter(CHANNEL, addr.channel) | Scatter(RANK, addr.rank) |
+         Scatter(BANKGROUP, addr.bankgroup) | Scatter(BANK, addr.bank) |
+         Scatter(ROW, addr.row) | Scatter(COLUMN, addr.column);
+}
 
-#ifdef DEBUG_LOC_MAPPING
-    std::cout << "new channel " << new_pos[0] << " vs old channel "
-              << addr.channel << std::endl;
-    std::cout << "new rank " << new_pos[1] << " vs old rank " << addr.rank
-              << std::endl;
-    std::cout << "new bg " << new_pos[2] << " vs old bg " << addr.bankgroup
-              << std::endl;
-    std::cout << "new bank " << new_pos[3] << " vs old bank " << addr.bank_
-              << std::endl;
-    std::cout << "new row " << new_pos[4] << " vs old row " << addr.row
-              << std::endl;
-    std::cout << "new col " << new_pos[5] << " vs old col " << addr.column
-              << std::endl;
-    std::cout << std::dec;
-#endif
-
-    return Address(new_pos[0], new_pos[1], new_pos[2], new_pos[3], new_pos[4],
-                   new_pos[5]);
-  };
+Address PhyAddressMap::Map(const Address &addr) const {
+  if (identity_) {
+    return addr;
+  }
+  uint64_t bits = Scatter(addr);
+  return Address(Extract(bits, CHANNEL), Extract(bits, RANK),
+                 Extract(bits, BANKGROUP), Extract(bits, BANK),
+                 Extract(bits, ROW), Extract(bits, COLUMN));
+}
+
+void ThermalCalculator::SetPhyAddressMapping() {
+  phy_map_.Init(config_.loc_mapping, LogBase2(config_.BL));
+}
+
+void ThermalCalculator::SetBankOrigins() {
+  int num_banks = config_.channels * config_.banks;
+  bank_origin_x_.resize(num_banks);
+  bank_origin_y_.resize(num_banks);
+  bank_origin_z_.resize(num_banks);
+  for (int channel = 0; channel < config_.channels; channel++) {
+    int vault_id_x, vault_id_y;
+    std::tie(vault_id_x, vault_id_y) = MapToVault(channel);
+    for (int bg = 0; bg < config_.bankgroups; bg++) {
+      for (int bank = 0; bank < config_.banks_per_group; bank++) {
+        int bank_id_x, bank_id_y;
+        std::tie(bank_id_x, bank_id_y) = MapToBank(bg, bank);
+        int origin = BankOrigin(channel, bg, bank);
+        bank_origin_x_[origin] = vault_id_x * (bank_x * config_.num_x_grids) +
+                                 bank_id_x * config_.num_x_grids;
+        bank_origin_y_[origin] = vault_id_y * (bank_y * config_.num_y_grids) +
+                                 bank_id_y * config_.num_y_grids;
+        bank_origin_z_[origin] = MapToZ(channel, bank);
+      }
+    }
+  }
 }
 
 std::pair<int, int> ThermalCalculator::MapToVault(int channel_id) {
@@ -307,66 +344,46 @@ int ThermalCalculator::MapToZ(int channel_id, int bank_id) {
   return z;
 }
 
-std::pair<std::vector<int>, std::vector<int>>
-ThermalCalculator::MapToXY(const Command &cmd, int vault_id_x, int vault_id_y,
-                           int bank_id_x, int bank_id_y) {
-  std::vector<int> x;
-  std::vector<int> y;
-
-  int row_id = cmd.Row();
-  int col_tile_id = row_id / config_.tile_row_num;
-  int grid_id_x = row_id / config_.mat_dim_x / config_.row_tile;
-
-  Address temp_addr = Address(cmd.addr);
-  for (int i = 0; i < config_.BL; i++) {
-    Address phy_loc = GetPhyAddress(temp_addr);
-    int col_id = phy_loc.column * config_.device_width;
-    int bank_x_offset = bank_x * config_.num_x_grids;
-    int bank_y_offset = bank_y * config_.num_y_grids;
-    for (int j = 0; j < config_.device_width; j++) {
-      int grid_id_y = col_id / config_.mat_dim_y +
-                      col_tile_id * (config_.num_y_grids / config_.row_tile);
-      int temp_x = vault_id_x * bank_x_offset +
-                   bank_id_x * config_.num_x_grids + grid_id_x;
-      x.push_back(temp_x);
-      int temp_y = vault_id_y * bank_y_offset +
-                   bank_id_y * config_.num_y_grids + grid_id_y;
-      y.push_back(temp_y);
-      col_id++;
-    }
-    temp_addr.column++;
-  }
-  return std::make_pair(x, y);
-}
-
 void ThermalCalculator::LocationMappingANDaddEnergy(const int channel,
                                                     const Command &cmd,
-                                                    int bank0, int row0,
                                                     int caseID_,
                                                     double add_energy) {
-  // get vault x y first
-  int vault_id_x, vault_id_y;
-  std::tie(vault_id_x, vault_id_y) = MapToVault(channel);
-
-  // get bank id x y
-  int bank_id_x, bank_id_y;
-  std::tie(bank_id_x, bank_id_y) = MapToBank(cmd.Bankgroup(), cmd.Bank());
-
-  // calculate x y z
-  auto xy = MapToXY(cmd, vault_id_x, vault_id_y, bank_id_x, bank_id_y);
-  auto &x = xy.first;
-  auto &y = xy.second;
-  int z = MapToZ(channel, cmd.Bank());
-
-  int z_offset = z * dimX * dimY;
+  int origin = BankOrigin(channel, cmd.Bankgroup(), cmd.Bank());
+  int row_id = cmd.Row();
+  int col_tile_id = row_id / config_.tile_row_num;
+  int x = bank_origin_x_[origin] +
+          row_id / config_.mat_dim_x / config_.row_tile;
+  int y = bank_origin_y_[origin] +
+          col_tile_id * (config_.num_y_grids / config_.row_tile);
+  int z = bank_origin_z_[origin];
+
+  // only the column changes over the burst, the rest is mapped once
+  uint64_t other_bits = 0;
+  if (!phy_map_.identity()) {
+    Address addr(cmd.addr);
+    addr.column = 0;
+    other_bits = phy_map_.Scatter(addr);
+  }
   double energy = add_energy / config_.device_width;
-  // add energy to engergy map
-  // iterate x y (they have same size)
-  for (size_t i = 0; i < x.size(); i++) {
-    int y_offset = y[i] * dimX;
-    int idx = z_offset + y_offset + x[i];
-    accu_Pmap[caseID_][idx] += energy;
-    cur_Pmap[caseID_][idx] += energy;
+  ThermalGrid &cur_map = CommandGrid(channel);
+  double *energy_map = cur_map.Case(caseID_);
+  for (int i = 0; i < config_.BL; i++) {
+    int column = cmd.Column() + i;
+    if (!phy_map_.identity()) {
+      column = phy_map_.Extract(
+          other_bits | phy_map_.Scatter(PhyAddressMap::COLUMN, column),
+          PhyAddressMap::COLUMN);
+    }
+    // the device_width bits of a column span one grid cell, or a few
+    int col_id = column * config_.device_width;
+    int col_end = col_id + config_.device_width;
+    while (col_id < col_end) {
+      int grid_id_y = col_id / config_.mat_dim_y;
+      int cell_end = std::min(col_end, (grid_id_y + 1) * config_.mat_dim_y);
+      energy_map[cur_map.Index(z, x, y + grid_id_y)] +=
+          energy * (cell_end - col_id);
+      col_id = cell_end;
+    }
   }
 }
 
@@ -385,57 +402,71 @@ void ThermalCalculator::LocationMappingANDaddEnergy_RF(const int channel,
   new_addr.row = row0;
   new_addr.bankgroup = bankgroup_id;
   new_addr.bank = bank_id;
+  int origin = BankOrigin(channel, bankgroup_id, bank_id);
 
-  int vault_id_x, vault_id_y;
-  std::tie(vault_id_x, vault_id_y) = MapToVault(channel);
-
-  // get bank id x y
-  int bank_id_x, bank_id_y;
-  std::tie(bank_id_x, bank_id_y) = MapToBank(bankgroup_id, bank_id);
-
-  int z = MapToZ(channel, bank_id);
-
-  Address phy_addr = GetPhyAddress(new_addr);  // actual row after mapping
-  // calculate x y z
-  int row_id = phy_addr.row;
-  int col_id = 0;  // refresh all units
+  // actual row after mapping, all the columns are refreshed
+  int row_id = phy_map_.Map(new_addr).row;
   int col_tile_id = row_id / config_.tile_row_num;
-  int grid_id_x = row_id / config_.mat_dim_x / config_.row_tile;
-  int grid_id_y = col_id / config_.mat_dim_y +
-                  col_tile_id * (config_.num_y_grids / config_.row_tile);
-  int x = vault_id_x * (bank_x * config_.num_x_grids) +
-          bank_id_x * config_.num_x_grids + grid_id_x;
-  int y = vault_id_y * (bank_y * config_.num_y_grids) +
-          bank_id_y * config_.num_y_grids + grid_id_y;
-
-  int z_offset = z * (dimX * dimY);
+  int x = bank_origin_x_[origin] +
+          row_id / config_.mat_dim_x / config_.row_tile;
+  int y = bank_origin_y_[origin] +
+          col_tile_id * (config_.num_y_grids / config_.row_tile);
+  int z = bank_origin_z_[origin];
+
+  ThermalGrid &cur_map = CommandGrid(channel);
+  double *energy_map = cur_map.Case(caseID_);
   for (int i = 0; i < config_.num_y_grids; i++) {
-    int y_offset = y * dimX;
-    int idx = z_offset + y_offset + x;
-    accu_Pmap[caseID_][idx] += add_energy;
-    cur_Pmap[caseID_][idx] += add_energy;
-    y++;
+    energy_map[cur_map.Index(z, x, y + i)] += add_energy;
   }
 }
 
 void ThermalCalculator::UpdatePowerMaps(double add_energy, bool trans,
                                         uint64_t clk) {
-  auto &p_map = trans ? cur_Pmap : accu_Pmap;
+  auto &p_map = trans ? pending_Pmap_ : accu_Pmap;
   double period = trans ? static_cast<double>(config_.epoch_period)
                         : static_cast<double>(clk);
+  double logic_energy = avg_logic_power_ / dimX / dimY * period;
+  int logic_layer = dimX * dimY * (numP - 1);
+  int case_size = p_map.CaseSize();
   for (int j = 0; j < num_case; j++) {
+    double *energy_map = p_map.Case(j);
     // universally update power map
-    for (int i = 0; i < dimX * dimY * (numP - 1); i++) {
-      p_map[j][i] += add_energy;
+    for (int i = 0; i < logic_layer; i++) {
+      energy_map[i] += add_energy;
     }
     // update logic power map
     // UpdateLogicPower();
-    for (int i = dimX * dimY * (numP - 1); i < dimX * dimY * numP; i++) {
-      p_map[j][i] += avg_logic_power_ / dimX / dimY * period;
+    for (int i = logic_layer; i < case_size; i++) {
+      energy_map[i] += logic_energy;
     }
   }
 }
 
+void ThermalCalculator::FoldCommandEnergy() {
+  std::vector<double> &accu = accu_Pmap.values();
+  std::vector<double> &pending = pending_Pmap_.values();
+  for (size_t g = 0; g <= channel_Pmaps_.size(); g++) {
+    std::vector<double> &cur =
+        g == 0 ? cur_Pmap.values() : channel_Pmaps_[g - 1].values();
+    for (size_t i = 0; i < accu.size(); i++) {
+      accu[i] += cur[i];
+      pending[i] += cur[i];
+      cur[i] = 0.0;
+    }
+  }
+}
+
+void ThermalCalculator::SplitChannelEnergy() {
+  channel_Pmaps_.assign(config_.channels, cur_Pmap);
+}
+
+void ThermalCalculator::RepeatEnergy(uint64_t times) {
+  FoldCommandEnergy();
+  for (double &energy : accu_Pmap.values()) {
+    energy *= static_cast<double>(times);
+  }
+}
+
 void ThermalCalculator::UpdateCMDPower(const int channel, const Command &cmd,
                                        const uint64_t clk) {
   int rank = cmd.Rank();
@@ -465,6 +496,22 @@ void ThermalCalculator::UpdateCMDPower(const int channel, const Command &cmd,
                                        energy / 1000.0 / device_scale);
       }
     }
+  } else if (cmd.IsSameBankRefresh()) {
+    // the bank set, one bank of each bankgroup sharing the refresh energy
+    int rank_idx = channel * config_.ranks + rank;
+    energy = config_.refb_energy_inc / config_.num_row_refresh /
+             config_.bankgroups / config_.num_y_grids;
+    for (int bg = 0; bg < config_.bankgroups; bg++) {
+      int ib = bg * config_.banks_per_group + cmd.Bank();
+      int row_s = refresh_count[rank_idx][ib] * config_.num_row_refresh;
+      refresh_count[rank_idx][ib]++;
+      if (refresh_count[rank_idx][ib] * config_.num_row_refresh == config_.rows)
+        refresh_count[rank_idx][ib] = 0;
+      for (int ir = row_s; ir < row_s + config_.num_row_refresh; ir++) {
+        LocationMappingANDaddEnergy_RF(channel, cmd, ib, ir, case_id,
+                                       energy / 1000.0 / device_scale);
+      }
+    }
   } else if (cmd.cmd_type == CommandType::REFRESH_BANK) {
     int ib = cmd.Bank();
     int rank_idx = channel * config_.ranks + rank;
@@ -491,7 +538,7 @@ void ThermalCalculator::UpdateCMDPower(const int channel, const Command &cmd,
     }
     if (energy > 0) {
       energy /= config_.BL;
-      LocationMappingANDaddEnergy(channel, cmd, -1, -1, case_id,
+      LocationMappingANDaddEnergy(channel, cmd, case_id,
                                   energy / 1000.0 / device_scale);
     }
   }
@@ -505,6 +552,8 @@ void ThermalCalculator::UpdateBackgroundEnergy(const int channel,
 }
 
 void ThermalCalculator::UpdateEpoch(uint64_t clk) {
+  // the command energy of this epoch, before the background is added
+  FoldCommandEnergy();
   if (config_.IsHBM() || config_.IsHMC()) {
     double bg_energy = 0;
     for (const auto &vec_rank_energy : background_energy_) {
@@ -519,9 +568,11 @@ void ThermalCalculator::UpdateEpoch(uint64_t clk) {
     for (int i = 0; i < config_.channels; i++) {
       for (int j = 0; j < config_.ranks; j++) {
         int case_id = i * config_.ranks + j;
-        double bg_energy = background_energy_[i][j] / (dimX * dimY * numP);
-        for (int k = 0; k < dimX * dimY * numP; i++) {
-          cur_Pmap[case_id][k] += bg_energy / 1000 / num_devices;
+        double bg_energy = background_energy_[i][j] / (dimX * dimY * numP) /
+                           1000 / num_devices;
+        double *energy_map = pending_Pmap_.Case(case_id);
+        for (int k = 0; k < pending_Pmap_.CaseSize(); k++) {
+          energy_map[k] += bg_energy;
         }
       }
     }
@@ -529,15 +580,79 @@ void ThermalCalculator::UpdateEpoch(uint64_t clk) {
   return;
 }
 
+void ThermalCalculator::Save(CheckpointWriter &writer) const {
+  WaitEpochs();
+  writer.Put(sample_id);
+  writer.Put(accu_Pmap.values());
+  writer.Put(cur_Pmap.values());
+  writer.Put(pending_Pmap_.values());
+  writer.Put(pending_epochs_);
+  writer.Put(refresh_count);
+  writer.Put(background_energy_);
+  writer.Put(avg_logic_power_);
+  writer.Put(static_cast<uint64_t>(T_size));
+  writer.Put(T_trans.values());
+  writer.Put(solved_bank_temps_);
+  writer.Put(bank_temps_);
+}
+
+void ThermalCalculator::Load(CheckpointReader &reader) {
+  WaitEpochs();
+  reader.Get(sample_id);
+  reader.Get(accu_Pmap.values());
+  reader.Get(cur_Pmap.values());
+  reader.Get(pending_Pmap_.values());
+  reader.Get(pending_epochs_);
+  reader.Get(refresh_count);
+  reader.Get(background_energy_);
+  reader.Get(avg_logic_power_);
+  reader.Expect(T_size, "thermal grid size");
+  reader.Get(T_trans.values());
+  reader.Get(solved_bank_temps_);
+  reader.Get(bank_temps_);
+}
+
 void ThermalCalculator::SetLogicPower(double logic_power) {
   avg_logic_power_ = logic_power;
 }
 
 void ThermalCalculator::PrintTransPT(uint64_t clk) {
   UpdateEpoch(clk);
+  pending_epochs_++;
+  if (epoch_thread_.joinable()) {
+    if (!config_.thermal_async_deterministic && !epoch_done_.load()) {
+      // the solver is behind, this epoch is solved with the next one
+      return;
+    }
+    epoch_thread_.join();
+    bank_temps_ = solved_bank_temps_;
+  }
+  std::swap(pending_Pmap_, epoch_Pmap_);
+  pending_Pmap_.Fill(0.0);
+  int epochs = pending_epochs_;
+  pending_epochs_ = 0;
+  if (config_.thermal_async) {
+    epoch_done_.store(false);
+    epoch_thread_ = std::thread([this, clk, epochs]() {
+      SolveEpochs(clk, epochs);
+      epoch_done_.store(true);
+    });
+  } else {
+    SolveEpochs(clk, epochs);
+    bank_temps_ = solved_bank_temps_;
+  }
+}
+
+void ThermalCalculator::WaitEpochs() const {
+  if (epoch_thread_.joinable()) {
+    epoch_thread_.join();
+  }
+}
+
+void ThermalCalculator::SolveEpochs(uint64_t clk, int epochs) {
   double ms = clk * config_.tCK * 1e-6;
   for (int ir = 0; ir < num_case; ir++) {
-    CalcTransT(ir);
+    CalcTransT(ir, epochs);
     double maxT = 0;
     for (int layer = 0; layer < numP; layer++) {
       double maxT_layer = GetMaxTofCaseLayer(T_trans, ir, layer);
@@ -553,17 +668,49 @@ void ThermalCalculator::PrintTransPT(uint64_t clk) {
               << " ms\n";
     // only outputs full file when output level >= 2
     if (config_.output_level >= 2) {
-      PrintCSV_trans(epoch_temperature_file_csv_, cur_Pmap, T_trans, ir,
-                     config_.epoch_period);
+      PrintCSV_trans(epoch_temperature_file_csv_, epoch_Pmap_, T_trans, ir,
+                     config_.epoch_period * epochs);
     }
   }
-  for (size_t i = 0; i < cur_Pmap.size(); i++) {
-    std::fill_n(cur_Pmap[i].begin(), numP * dimX * dimY, 0.0);
-  }
+  FindBankTemperatures();
   sample_id += 1;
 }
 
+void ThermalCalculator::FindBankTemperatures() {
+  int offset = num_dummy / 2;
+  for (int channel = 0; channel < config_.channels; channel++) {
+    for (int rank = 0; rank < config_.ranks; rank++) {
+      // the stacked dies are a single case
+      int case_id = num_case == 1 ? 0 : channel * config_.ranks + rank;
+      for (int bank = 0; bank < config_.banks; bank++) {
+        int origin = channel * config_.banks + bank;
+        int layer = layerP[bank_origin_z_[origin]] + 1;
+        int x0 = bank_origin_x_[origin] + offset;
+        int y0 = bank_origin_y_[origin] + offset;
+        double maxT = T_trans(case_id, layer, x0, y0);
+        for (int j = y0; j < y0 + config_.num_y_grids; j++) {
+          for (int i = x0; i < x0 + config_.num_x_grids; i++) {
+            maxT = std::max(maxT, T_trans(case_id, layer, i, j));
+          }
+        }
+        solved_bank_temps_[(channel * config_.ranks + rank) * config_.banks +
+                           bank] = maxT - T0;
+      }
+    }
+  }
+}
+
 void ThermalCalculator::PrintFinalPT(uint64_t clk) {
+  WaitEpochs();
+  if (pending_epochs_ > 0) {
+    // merged epochs the background solver did not get to
+    std::swap(pending_Pmap_, epoch_Pmap_);
+    pending_Pmap_.Fill(0.0);
+    SolveEpochs(clk, pending_epochs_);
+    pending_epochs_ = 0;
+  }
+  // the command energy since the last epoch
+  FoldCommandEnergy();
   if (config_.IsHBM() || config_.IsHMC()) {
     double bg_energy = 0;
     for (const auto &vec_rank_energy : background_energy_) {
@@ -578,9 +725,11 @@ void ThermalCalculator::PrintFinalPT(uint64_t clk) {
     for (int i = 0; i < config_.channels; i++) {
       for (int j = 0; j < config_.ranks; j++) {
         int case_id = i * config_.ranks + j;
-        double bg_energy = background_energy_[i][j] / (dimX * dimY * numP);
-        for (int k = 0; k < dimX * dimY * numP; i++) {
-          accu_Pmap[case_id][i] += bg_energy / 1000 / num_devices;
+        double bg_energy = background_energy_[i][j] / (dimX * dimY * numP) /
+                           1000 / num_devices;
+        double *energy_map = accu_Pmap.Case(case_id);
+        for (int k = 0; k < accu_Pmap.CaseSize(); k++) {
+          energy_map[k] += bg_energy;
         }
       }
     }
@@ -602,65 +751,59 @@ void ThermalCalculator::PrintFinalPT(uint64_t clk) {
   }
 }
 
-void ThermalCalculator::CalcTransT(int case_id) {
-  double time = config_.epoch_period * config_.tCK * 1e-9;
-  double ***powerM = InitPowerM(case_id, 0);
-  double totP = GetTotalPower(powerM);
+void ThermalCalculator::CalcTransT(int case_id, int epochs) {
+  double time = config_.epoch_period * config_.tCK * 1e-9 * epochs;
+  InitPowerM(epoch_Pmap_, case_id,
+             static_cast<double>(config_.epoch_period) * epochs);
+  double totP = GetTotalPower();
   std::cout << "total trans power is " << totP * 1000 << " [mW]" << std::endl;
-  T_trans[case_id] = transient_thermal_solver(
-      powerM, config_.chip_dim_x, config_.chip_dim_y, numP, dimX + num_dummy,
-      dimY + num_dummy, Midx, MidxSize, Cap, CapSize, time, time_iter,
-      T_trans[case_id], Tamb);
+  if (trans_factor_) {
+    implicit_thermal_solver(powerM_.data(), config_.chip_dim_x,
+                            config_.chip_dim_y, numP, dimX + num_dummy,
+                            dimY + num_dummy, trans_factor_, Cap, time,
+                            config_.implicit_steps * epochs,
+                            T_trans.Case(case_id), Tamb);
+  } else {
+    transient_thermal_solver(powerM_.data(), config_.chip_dim_x,
+                             config_.chip_dim_y, numP, dimX + num_dummy,
+                             dimY + num_dummy, Midx, MidxSize, Cap, CapSize,
+                             time, time_iter * epochs, T_trans.Case(case_id),
+                             Tamb);
+  }
 }
 
 void ThermalCalculator::CalcFinalT(int case_id, uint64_t clk) {
-  double ***powerM = InitPowerM(case_id, clk);
-  double totP = GetTotalPower(powerM);
+  InitPowerM(accu_Pmap, case_id, static_cast<double>(clk));
+  double totP = GetTotalPower();
   std::cout << "total final power is " << totP * 1000 << " [mW]" << std::endl;
-  double *T = steady_thermal_solver(powerM, config_.chip_dim_x,
+  double *T = steady_thermal_solver(powerM_.data(), config_.chip_dim_x,
                                     config_.chip_dim_y, numP, dimX + num_dummy,
-                                    dimY + num_dummy, Midx, MidxSize, Tamb);
-  T_final[case_id] = T;
-}
-
-double ***ThermalCalculator::InitPowerM(int case_id, uint64_t clk) {
-  double ***powerM;
-  // assert in powerM
-  powerM = new double **[dimX + num_dummy];
-  for (int i = 0; i < dimX + num_dummy; i++) {
-    powerM[i] = new double *[dimY + num_dummy];
-    for (int j = 0; j < dimY + num_dummy; j++) {
-      powerM[i][j] = new double[numP];
-    }
-  }
-  // initialize powerM
-  for (int i = 0; i < dimX + num_dummy; i++)
-    for (int j = 0; j < dimY + num_dummy; j++)
-      std::fill_n(powerM[i][j], numP, 0.0);
-
-  // when clk is 0 then it's trans otherwise it's final
-  double div = clk == 0 ? (double)config_.epoch_period : (double)clk;
-  auto &power_map = clk == 0 ? cur_Pmap : accu_Pmap;
-  // fill in powerM
-  for (int i = 0; i < dimX; i++) {
+                                    dimY + num_dummy, steady_factor_, Tamb);
+  std::copy(T, T + T_size, T_final.Case(case_id));
+  free(T);
+}
+
+void ThermalCalculator::InitPowerM(const ThermalGrid &power_map, int case_id,
+                                   double div) {
+  // fill in powerM_, the dummy cells around the die stay 0
+  int pad_x = dimX + num_dummy;
+  int pad_y = dimY + num_dummy;
+  for (int l = 0; l < numP; l++) {
     for (int j = 0; j < dimY; j++) {
-      for (int l = 0; l < numP; l++) {
-        powerM[i + num_dummy / 2][j + num_dummy / 2][l] =
-            power_map[case_id][l * (dimX * dimY) + j * dimX + i] / div;
+      double *row = powerM_.data() + (l * pad_y + j + num_dummy / 2) * pad_x +
+                    num_dummy / 2;
+      const double *energy = power_map.Case(case_id) + power_map.Index(l, 0, j);
+      for (int i = 0; i < dimX; i++) {
+        row[i] = energy[i] / div;
       }
     }
   }
-  return powerM;
 }
 
-double ThermalCalculator::GetTotalPower(double ***powerM) {
+double ThermalCalculator::GetTotalPower() const {
   double total_power = 0.0;
-  for (int i = 0; i < dimX; i++) {
-    for (int j = 0; j < dimY; j++) {
-      for (int l = 0; l < numP; l++) {
-        total_power += powerM[i + num_dummy / 2][j + num_dummy / 2][l];
-      }
-    }
+  for (double power : powerM_) {
+    total_power += power;
   }
   return total_power;
 }
@@ -676,12 +819,23 @@ void ThermalCalculator::InitialParameters() {
                             dimX + num_dummy, dimY + num_dummy, &CapSize);
   calculate_time_step();
 
+  // the matrices only depend on the geometry, so they are factorized once and
+  // every solve afterwards is a pair of triangular solves
+  int layer_dim = (dimX + num_dummy) * (dimY + num_dummy);
+  steady_factor_ =
+      factor_thermal_matrix(Midx, MidxSize, T_size, nullptr, layer_dim, 0.0);
+  if (config_.transient_solver == "IMPLICIT") {
+    double step_time =
+        config_.epoch_period * config_.tCK * 1e-9 / config_.implicit_steps;
+    trans_factor_ = factor_thermal_matrix(Midx, MidxSize, T_size, Cap,
+                                          layer_dim, step_time);
+  }
+
   for (int ir = 0; ir < num_case; ir++) {
     double *T =
         initialize_Temperature(config_.chip_dim_x, config_.chip_dim_y, numP,
                                dimX + num_dummy, dimY + num_dummy, Tamb);
-    for (int i = 0; i < T_size; i++)
-      T_trans[ir][i] = T[i];
+    std::copy(T, T + T_size, T_trans.Case(ir));
     free(T);
   }
 }
@@ -720,12 +874,12 @@ void ThermalCalculator::calculate_time_step() {
   int layer_dim = (dimX + num_dummy) * (dimY + num_dummy);
 
   for (int j = 0; j < MidxSize; j++) {
-    int idx0 = (int)(Midx[j][0] + 0.01);
-    int idx1 = (int)(Midx[j][1] + 0.01);
+    int idx0 = (int)(Midx[3 * j] + 0.01);
+    int idx1 = (int)(Midx[3 * j + 1] + 0.01);
     int idxC = idx0 / layer_dim;
 
     if (idx0 == idx1) {
-      double g = Midx[j][2];
+      double g = Midx[3 * j + 2];
       double c = Cap[idxC];
       if (c / g < dt)
         dt = c / g;
@@ -744,25 +898,18 @@ void ThermalCalculator::calculate_time_step() {
   std::cout << "time_iter = " << time_iter << std::endl;
 }
 
-double ThermalCalculator::GetMaxTofCase(double **temp_map, int case_id) {
-  double maxT = 0;
-  for (int i = 0; i < T_size; i++) {
-    if (temp_map[case_id][i] > maxT) {
-      maxT = temp_map[case_id][i];
-    }
-  }
-  return maxT;
+double ThermalCalculator::GetMaxTofCase(const ThermalGrid &temp_map,
+                                        int case_id) const {
+  const double *temp = temp_map.Case(case_id);
+  return *std::max_element(temp, temp + T_size);
 }
 
-double ThermalCalculator::GetMaxTofCaseLayer(double **temp_map, int case_id,
-                                             int layer) {
+double ThermalCalculator::GetMaxTofCaseLayer(const ThermalGrid &temp_map,
+                                             int case_id, int layer) const {
   double maxT = 0;
-  int layer_pos_offset =
-      (layerP[layer] + 1) * ((dimX + num_dummy) * (dimY + num_dummy));
   for (int j = num_dummy / 2; j < dimY + num_dummy / 2; j++) {
     for (int i = num_dummy / 2; i < dimX + num_dummy / 2; i++) {
-      double t =
-          temp_map[case_id][layer_pos_offset + j * (dimX + num_dummy) + i] - T0;
+      double t = temp_map(case_id, layerP[layer] + 1, i, j) - T0;
       maxT = maxT > t ? maxT : t;
     }
   }
@@ -770,18 +917,15 @@ double ThermalCalculator::GetMaxTofCaseLayer(double **temp_map, int case_id,
 }
 
 void ThermalCalculator::PrintCSV_trans(std::ofstream &csvfile,
-                                       std::vector<std::vector<double>> P_,
-                                       double **T_, int id, uint64_t scale) {
+                                       const ThermalGrid &P_,
+                                       const ThermalGrid &T_, int id,
+                                       uint64_t scale) {
   for (int l = 0; l < numP; l++) {
     for (int j = num_dummy / 2; j < dimY + num_dummy / 2; j++) {
       for (int i = num_dummy / 2; i < dimX + num_dummy / 2; i++) {
-        double pw = P_[id][l * ((dimX) * (dimY)) +
-                           (j - num_dummy / 2) * (dimX) + (i - num_dummy / 2)] /
+        double pw = P_(id, l, i - num_dummy / 2, j - num_dummy / 2) /
                     (double)scale;
-        double tm =
-            T_[id][(layerP[l] + 1) * ((dimX + num_dummy) * (dimY + num_dummy)) +
-                   j * (dimX + num_dummy) + i] -
-            T0;
+        double tm = T_(id, layerP[l] + 1, i, j) - T0;
         csvfile << id << "," << i - num_dummy / 2 << "," << j - num_dummy / 2
                 << "," << l << "," << pw << "," << tm << "," << sample_id
                 << std::endl;
@@ -791,17 +935,15 @@ void ThermalCalculator::PrintCSV_trans(std::ofstream &csvfile,
 }
 
 void ThermalCalculator::PrintCSV_final(std::ofstream &csvfile,
-                                       std::vector<std::vector<double>> P_,
-                                       double **T_, int id, uint64_t scale) {
+                                       const ThermalGrid &P_,
+                                       const ThermalGrid &T_, int id,
+                                       uint64_t scale) {
   for (int l = 0; l < numP; l++) {
     for (int j = num_dummy / 2; j < dimY + num_dummy / 2; j++) {
       for (int i = num_dummy / 2; i < dimX + num_dummy / 2; i++) {
-        double pw = P_[id][l * (dimX * dimY) + (j - num_dummy / 2) * dimX +
-                           (i - num_dummy / 2)] /
+        double pw = P_(id, l, i - num_dummy / 2, j - num_dummy / 2) /
                     (double)scale;
-        double tm =
-            T_[id][(layerP[l] + 1) * ((dimX + num_dummy) * (dimY + num_dummy)) +
-                   j * (dimX + num_dummy) + i];
+        double tm = T_(id, layerP[l] + 1, i, j);
         csvfile << id << "," << i - num_dummy / 2 << "," << j - num_dummy / 2
                 << "," << l << "," << pw << "," << tm << std::endl;
       }
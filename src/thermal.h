@@ -2,19 +2,90 @@
 #define __THERMAL_H
 
 #include "bankstate.h"
+#include "checkpoint.h"
 #include "common.h"
 #include "configuration.h"
 #include "thermal_config.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
 #include <fstream>
-#include <functional>
 #include <iostream>
+#include <thread>
 #include <time.h>
 #include <vector>
 
+// a thermal system matrix factorized by SuperLU_MT, see thermal_solver.c
+struct ThermalFactor;
+
 namespace dramsim3 {
 
-extern std::function<Address(const Address &addr)> GetPhyAddress;
+/// @brief num_case grids of layers x dim_x x dim_y values in one contiguous
+/// array, x varying fastest, so a layer or a whole case is one flat range.
+class ThermalGrid {
+public:
+  ThermalGrid() : layers_(0), dim_x_(0), dim_y_(0) {}
+  ThermalGrid(int num_case, int layers, int dim_x, int dim_y)
+      : layers_(layers), dim_x_(dim_x), dim_y_(dim_y),
+        values_(static_cast<size_t>(num_case) * layers * dim_x * dim_y, 0.0) {}
+  int CaseSize() const { return layers_ * dim_x_ * dim_y_; }
+  int Index(int layer, int x, int y) const {
+    return (layer * dim_y_ + y) * dim_x_ + x;
+  }
+  double *Case(int case_id) { return values_.data() + case_id * CaseSize(); }
+  const double *Case(int case_id) const {
+    return values_.data() + case_id * CaseSize();
+  }
+  double &operator()(int case_id, int layer, int x, int y) {
+    return Case(case_id)[Index(layer, x, y)];
+  }
+  double operator()(int case_id, int layer, int x, int y) const {
+    return Case(case_id)[Index(layer, x, y)];
+  }
+  void Fill(double value) { std::fill(values_.begin(), values_.end(), value); }
+  std::vector<double> &values() { return values_; }
+  const std::vector<double> &values() const { return values_; }
+
+private:
+  int layers_, dim_x_, dim_y_;
+  std::vector<double> values_;
+};
+
+/// @brief The loc_mapping bit permutation of (channel, rank, bankgroup, bank,
+/// row, column). Every byte of a field scatters its bits through a lookup
+/// table, instead of moving the bits one at a time.
+class PhyAddressMap {
+public:
+  enum Field { CHANNEL, RANK, BANKGROUP, BANK, ROW, COLUMN, NUM_FIELDS };
+  PhyAddressMap() : identity_(true) {}
+  /// @brief Parse a loc_mapping, an empty one maps every address to itself.
+  void Init(const std::string &mapping, int column_offset);
+  bool identity() const { return identity_; }
+  Address Map(const Address &addr) const;
+  /// @brief The mapped bits of addr, e.g. with one field 0 so that it can be
+  /// swept with Scatter.
+  uint64_t Scatter(const Address &addr) const;
+  uint64_t Scatter(int field, int value) const {
+    uint64_t bits = 0;
+    const auto &tables = scatter_[field];
+    for (size_t i = 0; i < tables.size(); i++) {
+      bits |= tables[i][(value >> (8 * i)) & 0xff];
+    }
+    return bits;
+  }
+  int Extract(uint64_t bits, int field) const {
+    return ModuloWidth(bits, width_[field], pos_[field]);
+  }
+
+private:
+  bool identity_;
+  // width and position of each field in the mapped bits
+  int width_[NUM_FIELDS];
+  int pos_[NUM_FIELDS];
+  // [field][byte of the field][byte value], bits the byte maps to
+  std::vector<std::array<uint64_t, 256>> scatter_[NUM_FIELDS];
+};
 
 class ThermalCalculator {
 public:
@@ -24,51 +95,83 @@ public:
                       const uint64_t clk);
   void UpdateBackgroundEnergy(const int channel, const int rank,
                               const double energy);
-  // assuming evenly distributed logic layer power
-  void UpdateEpoch(const uint64_t clk);
   void SetLogicPower(double logic_power);
+  /// @brief Epoch boundary, solves the transient temperatures of the epoch,
+  /// on a background thread with thermal.async.
   void PrintTransPT(uint64_t clk);
   void PrintFinalPT(uint64_t clk);
   void UpdateLogicPower(double logic_power);
+  /// @brief From now on the commands of each channel add their energy to a
+  /// grid of their own, so that UpdateCMDPower may run concurrently for
+  /// different channels. Used by the thermal replay, the channel grids are
+  /// folded at the epochs but not checkpointed.
+  void SplitChannelEnergy();
+  /// @brief Count the energy of the commands so far times times, for the
+  /// thermal replay, which walks a repeated trace once.
+  void RepeatEnergy(uint64_t times);
+  /// @brief Max temperature [C] of every bank in the last epoch solved,
+  /// indexed by (channel * ranks + rank) * banks + bank. With thermal.async
+  /// an epoch is only seen here once the next epoch boundary waited for it.
+  const std::vector<double> &BankTemperatures() const { return bank_temps_; }
+  // checkpointing, the power maps and the transient temperatures
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
 
 private:
+  // assuming evenly distributed logic layer power
+  void UpdateEpoch(const uint64_t clk);
+  /// @brief Solve and print the epochs in epoch_Pmap_, the last ending at clk.
+  void SolveEpochs(uint64_t clk, int epochs);
+  /// @brief Wait for the epochs solved in the background, if any.
+  void WaitEpochs() const;
+
   // Initialization
-  double ***InitPowerM(int case_id, uint64_t clk);
+  // the power of a case of energy map over div cycles into powerM_
+  void InitPowerM(const ThermalGrid &energy_map, int case_id, double div);
   void InitialParameters();
 
   // location mapping functions
   void SetPhyAddressMapping();
+  void SetBankOrigins();
   std::pair<int, int> MapToVault(int channel_id);
   std::pair<int, int> MapToBank(int bankgroup_id, int bank_id);
   int MapToZ(int channel_id, int bank_id);
-  std::pair<std::vector<int>, std::vector<int>>
-  MapToXY(const Command &cmd, int vault_id_x, int vault_id_y, int bank_id_x,
-          int bank_id_y);
+  int BankOrigin(int channel, int bankgroup, int bank) const {
+    return (channel * config_.bankgroups + bankgroup) *
+               config_.banks_per_group +
+           bank;
+  }
   void LocationMappingANDaddEnergy_RF(const int channel, const Command &cmd,
                                       int bank0, int row0, int caseID_,
                                       double add_energy);
   void LocationMappingANDaddEnergy(const int channel, const Command &cmd,
-                                   int bank0, int row0, int caseID_,
-                                   double add_energy);
+                                   int caseID_, double add_energy);
   void UpdatePowerMaps(double add_energy, bool trans, uint64_t clk);
+  // moves the command energy of cur_Pmap and the channel grids to accu_Pmap
+  // and pending_Pmap_
+  void FoldCommandEnergy();
+  ThermalGrid &CommandGrid(int channel) {
+    return channel_Pmaps_.empty() ? cur_Pmap : channel_Pmaps_[channel];
+  }
 
   // calculations
-  void CalcTransT(int case_id);
+  void CalcTransT(int case_id, int epochs);
   void CalcFinalT(int case_id, uint64_t clk);
-  double GetTotalPower(double ***powerM);
+  double GetTotalPower() const;
   int square_array(int total_grids_);
   int determineXY(double xd, double yd, int total_grids_);
-  double GetMaxTofCase(double **temp_map, int case_id);
-  double GetMaxTofCaseLayer(double **temp_map, int case_id, int layer);
+  // the bank temperatures of T_trans into solved_bank_temps_
+  void FindBankTemperatures();
+  double GetMaxTofCase(const ThermalGrid &temp_map, int case_id) const;
+  double GetMaxTofCaseLayer(const ThermalGrid &temp_map, int case_id,
+                            int layer) const;
   void calculate_time_step();
 
   // print to csv-files
-  void PrintCSV_trans(std::ofstream &csvfile,
-                      std::vector<std::vector<double>> P_, double **T_, int id,
-                      uint64_t scale);
-  void PrintCSV_final(std::ofstream &csvfile,
-                      std::vector<std::vector<double>> P_, double **T_, int id,
-                      uint64_t scale);
+  void PrintCSV_trans(std::ofstream &csvfile, const ThermalGrid &P_,
+                      const ThermalGrid &T_, int id, uint64_t scale);
+  void PrintCSV_final(std::ofstream &csvfile, const ThermalGrid &P_,
+                      const ThermalGrid &T_, int id, uint64_t scale);
   void PrintCSVHeader_final(std::ofstream &csvfile);
   void PrintCSV_bank(std::ofstream &csvfile);
 
@@ -79,16 +182,48 @@ private:
   const int num_dummy = 2;  // dummy cells around the calculatd die
 
   int dimX, dimY, numP;   // Dimension of the memory
-  double **Midx;          // Midx storing thermal conductance
+  double *Midx;           // Midx storing thermal conductance, 3 per entry
   double *Cap;            // Cap storing the thermal capacitance
   int MidxSize, CapSize;  // first dimension size of Midx and Cap
   int T_size;
-  double **T_trans, **T_final;
+  // LU factors of the steady and, with the implicit transient solver, the
+  // backward Euler system matrices, built once in InitialParameters
+  ThermalFactor *steady_factor_;
+  ThermalFactor *trans_factor_;
+  // temperatures of the layers (3 per die and the heat sink) of each case,
+  // with the dummy cells around the die
+  ThermalGrid T_trans, T_final;
+  // power of the case being solved, one layer per die, with the dummy cells
+  std::vector<double> powerM_;
 
   int sample_id;  // index of the sampling power
 
-  std::vector<std::vector<double>> accu_Pmap;  // accumulative power map
-  std::vector<std::vector<double>> cur_Pmap;   // current power map
+  // energy per die and grid cell of each case, accumulated over the run,
+  // and of the commands since the last epoch. Commands only add to cur_Pmap,
+  // which is folded into accu_Pmap and pending_Pmap_ at the epochs.
+  ThermalGrid accu_Pmap;
+  ThermalGrid cur_Pmap;
+  // cur_Pmap of each channel, see SplitChannelEnergy
+  std::vector<ThermalGrid> channel_Pmaps_;
+  // energy, background included, of the epochs not handed to the solver yet
+  // and of the ones being solved
+  ThermalGrid pending_Pmap_;
+  int pending_epochs_;
+  ThermalGrid epoch_Pmap_;
+  // solves epoch_Pmap_ into T_trans with thermal.async, T_trans and the epoch
+  // output belong to it until it is joined
+  mutable std::thread epoch_thread_;
+  std::atomic<bool> epoch_done_;
+  // bank temperatures of the epochs solved, and of the ones published by
+  // the simulation thread, see BankTemperatures
+  std::vector<double> solved_bank_temps_;
+  std::vector<double> bank_temps_;
+
+  PhyAddressMap phy_map_;
+  // grid x, y and die of the first cell of each bank, see BankOrigin
+  std::vector<int> bank_origin_x_;
+  std::vector<int> bank_origin_y_;
+  std::vector<int> bank_origin_z_;
 
   std::vector<std::vector<int>> refresh_count;
 
@@ -1,87 +1,192 @@
 #include "thermal_replay.h"
+
+#include <algorithm>
+#include <map>
+#include <thread>
+
 #include "./../ext/headers/args.hxx"
 
 // this will not be used in a library file so it's ok to do this
 using namespace dramsim3;
 
-ThermalReplay::ThermalReplay(std::string trace_name, std::string config_file,
-                             std::string output_dir, uint64_t repeat)
-    : config_(config_file, output_dir), thermal_calc_(config_), repeat_(repeat),
-      last_clk_(0) {
+namespace {
+
+// commands of the text trace read before the channels replay them
+const size_t kChunkCommands = 1 << 16;
+
+// the counter a command is counted in, nullptr if it cannot be replayed
+const char *CommandStat(CommandType cmd_type) {
+  switch (cmd_type) {
+    case CommandType::READ:
+    case CommandType::READ_PRECHARGE: return "num_read_cmds";
+    case CommandType::WRITE:
+    case CommandType::WRITE_PRECHARGE: return "num_write_cmds";
+    case CommandType::ACTIVATE: return "num_act_cmds";
+    case CommandType::PRECHARGE: return "num_pre_cmds";
+    case CommandType::REFRESH: return "num_ref_cmds";
+    case CommandType::REFRESH_BANK: return "num_refb_cmds";
+    case CommandType::SREF_ENTER: return "num_srefe_cmds";
+    case CommandType::SREF_EXIT: return "num_srefx_cmds";
+    case CommandType::PD_ENTER: return "num_pde_cmds";
+    case CommandType::PD_EXIT: return "num_pdx_cmds";
+    default: return nullptr;
+  }
+}
+
+}  // namespace
+
+ThermalReplay::ThermalReplay(const std::vector<std::string> &trace_names,
+                             std::string config_file, std::string output_dir,
+                             uint64_t repeat)
+    : config_(config_file, output_dir), thermal_calc_(config_),
+      repeat_(repeat), channels_(config_.channels) {
+  if (repeat_ == 0 || trace_names.empty()) {
+    std::cerr << "Need a trace and at least one repeat" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
   for (int i = 0; i < config_.channels; i++) {
     channel_stats_.emplace_back(config_, i);
+    // for power calculation we only need to know if a bank is active
+    channels_[i].bank_active.assign(config_.ranks * config_.banks, false);
+    channels_[i].active_cycles.assign(config_.ranks, 0);
+    channels_[i].idle_cycles.assign(config_.ranks, 0);
   }
 
-  // Initialize bank states, for power calculation we only need to know
-  // if it's active
-  for (int i = 0; i < config_.channels; i++) {
-    std::vector<std::vector<std::vector<bool>>> chan_vec;
-    for (int j = 0; j < config_.ranks; j++) {
-      std::vector<std::vector<bool>> rank_vec;
-      for (int k = 0; k < config_.bankgroups; k++) {
-        std::vector<bool> bank_vec(config_.banks_per_group, false);
-        rank_vec.push_back(bank_vec);
+  // binary command traces, one per channel, are decoded as they are replayed
+  for (const auto &trace_name : trace_names) {
+    if (!CommandTraceReader::IsCommandTrace(trace_name)) {
+      if (trace_names.size() > 1) {
+        std::cerr << "Only binary command traces can be replayed per channel"
+                  << std::endl;
+        AbruptExit(__FILE__, __LINE__);
+      }
+      text_trace_.open(trace_name);
+      if (!text_trace_) {
+        std::cout << "cannot open trace file " << trace_name << std::endl;
+        std::exit(1);
       }
-      chan_vec.push_back(rank_vec);
+      break;
+    }
+    std::unique_ptr<CommandTraceReader> reader(
+        new CommandTraceReader(trace_name));
+    int channel = reader->Channel();
+    if (channel < 0 || channel >= config_.channels ||
+        channels_[channel].reader) {
+      std::cerr << trace_name << " has a bad or repeated channel " << channel
+                << std::endl;
+      AbruptExit(__FILE__, __LINE__);
     }
-    bank_active_.push_back(chan_vec);
+    channels_[channel].reader = std::move(reader);
   }
 
-  // read commands into memory
-  std::ifstream trace_file(trace_name);
-  if (!trace_file) {
-    std::cout << "cannot open trace file " << trace_name << std::endl;
-    std::exit(1);
+  int num_threads = std::min(config_.num_threads, config_.channels);
+  int hw_threads = static_cast<int>(std::thread::hardware_concurrency());
+  if (hw_threads > 0 && num_threads > hw_threads) {
+    num_threads = hw_threads;
   }
+  thread_pool_.reset(new ThreadPool(num_threads));
+  if (thread_pool_->NumThreads() > 1) {
+    thermal_calc_.SplitChannelEnergy();
+  }
+}
 
+void ThermalReplay::Run() {
+  // one pass over the trace
+  auto replay = [this](int channel) { ReplayChannel(channel); };
+  if (text_trace_.is_open()) {
+    while (ReadChunk()) {
+      thread_pool_->ParallelFor(config_.channels, replay);
+    }
+  } else {
+    thread_pool_->ParallelFor(config_.channels, replay);
+  }
+  // the pass ends with the last command of any channel
+  uint64_t pass_clk = 0;
+  for (const auto &channel : channels_) {
+    pass_clk = std::max(pass_clk, channel.last_clk);
+  }
+  for (auto &channel : channels_) {
+    CountBackground(channel, pass_clk);
+  }
+
+  // each repeat starts over from closed banks, so it adds the energy and the
+  // stats of the first pass again
+  thermal_calc_.RepeatEnergy(repeat_);
+  uint64_t clk = pass_clk * repeat_;
+  std::ofstream json_out(config_.json_stats_name, std::ofstream::out);
+  json_out << "{";
+  json_out.close();
+  for (int c = 0; c < config_.channels; c++) {
+    const ChannelReplay &channel = channels_[c];
+    SimpleStats &stats = channel_stats_[c];
+    for (int i = 0; i < static_cast<int>(CommandType::SIZE); i++) {
+      const char *stat = CommandStat(static_cast<CommandType>(i));
+      if (stat != nullptr) {
+        stats.IncrementBy(stat, channel.cmd_counts[i] * repeat_);
+      }
+    }
+    for (int r = 0; r < config_.ranks; r++) {
+      stats.IncrementVecBy("rank_active_cycles", r,
+                           channel.active_cycles[r] * repeat_);
+      stats.IncrementVecBy("all_bank_idle_cycles", r,
+                           channel.idle_cycles[r] * repeat_);
+    }
+    stats.PrintFinalStats();
+    if (c != config_.channels - 1) {
+      std::ofstream chan_out(config_.json_stats_name, std::ofstream::app);
+      chan_out << "," << std::endl;
+    }
+    for (int r = 0; r < config_.ranks; r++) {
+      thermal_calc_.UpdateBackgroundEnergy(c, r,
+                                           stats.RankBackgroundEnergy(r));
+    }
+  }
+  json_out.open(config_.json_stats_name, std::ofstream::app);
+  json_out << "}";
+  json_out.close();
+  thermal_calc_.PrintFinalPT(clk);
+}
+
+bool ThermalReplay::ReadChunk() {
   std::string line;
-  uint64_t clk = 0;
-  while (std::getline(trace_file, line)) {
+  size_t num_cmds = 0;
+  while (num_cmds < kChunkCommands && std::getline(text_trace_, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    uint64_t clk;
     Command cmd;
     ParseLine(line, clk, cmd);
-    timed_commands_.push_back(std::pair<uint64_t, Command>(clk, cmd));
+    if (cmd.Channel() < 0 || cmd.Channel() >= config_.channels) {
+      std::cerr << "Bad channel in trace line " << line << std::endl;
+      AbruptExit(__FILE__, __LINE__);
+    }
+    channels_[cmd.Channel()].chunk.emplace_back(clk, cmd);
+    num_cmds++;
   }
-  trace_file.close();
+  return num_cmds > 0;
 }
 
-ThermalReplay::~ThermalReplay() {}
-
-void ThermalReplay::Run() {
-  uint64_t clk = 0;
-  for (uint64_t i = 0; i < repeat_; i++) {
-    uint64_t clk_offset = 0;
-    for (size_t j = 0; j < timed_commands_.size(); j++) {
-      // for (int j = 0; j < cmds_.size(); j++) {
-      // Command &cmd = cmds_[j];
-      // clk_offset = clks_[j];
-      clk_offset = timed_commands_[j].first;
-      Command &cmd = timed_commands_[j].second;
-      ProcessCMD(cmd, clk + clk_offset);
-      thermal_calc_.UpdateCMDPower(0, cmd, clk + clk_offset);
-    }
-    clk += clk_offset;
-
-    // reset bank states
-    for (int c = 0; c < config_.channels; c++) {
-      for (int r = 0; r < config_.ranks; r++) {
-        for (int g = 0; g < config_.bankgroups; g++) {
-          for (int b = 0; b < config_.banks_per_group; b++) {
-            bank_active_[c][r][g][b] = false;
-          }
-        }
-      }
+void ThermalReplay::ReplayChannel(int channel) {
+  ChannelReplay &replay = channels_[channel];
+  if (replay.reader) {
+    uint64_t clk;
+    Command cmd;
+    while (replay.reader->Next(clk, cmd)) {
+      ProcessCMD(replay, cmd, clk);
     }
+    return;
   }
-  for (int c = 0; c < config_.channels; c++) {
-    // channel_stats_[c].PrintFinalStats(clk, std::cout, std::cout, std::cout);
-    channel_stats_[c].PrintFinalStats();
+  for (const auto &timed_cmd : replay.chunk) {
+    ProcessCMD(replay, timed_cmd.second, timed_cmd.first);
   }
-  thermal_calc_.PrintFinalPT(clk);
+  replay.chunk.clear();
 }
 
 // parsing line from trace file into a command
-void ThermalReplay::ParseLine(std::string line, uint64_t &clk, Command &cmd) {
-  std::map<std::string, CommandType> cmd_map = {
+void ThermalReplay::ParseLine(const std::string &line, uint64_t &clk,
+                              Command &cmd) const {
+  static const std::map<std::string, CommandType> cmd_map = {
       {"read",               CommandType::READ           },
       {"read_p",             CommandType::READ_PRECHARGE },
       {"write",              CommandType::WRITE          },
@@ -94,11 +199,14 @@ void ThermalReplay::ParseLine(std::string line, uint64_t &clk, Command &cmd) {
       {"refresh",            CommandType::REFRESH        },
       {"self_refresh_enter", CommandType::SREF_ENTER     },
       {"self_refresh_exit",  CommandType::SREF_EXIT      },
+      {"power_down_enter",   CommandType::PD_ENTER       },
+      {"power_down_exit",    CommandType::PD_EXIT        },
   };
   std::vector<std::string> tokens = StringSplit(line, ' ');
 
   // basic sanity check
-  if (tokens.size() != 8) {
+  auto it = tokens.size() == 8 ? cmd_map.find(tokens[1]) : cmd_map.end();
+  if (it == cmd_map.end()) {
     std::cerr << "Check trace format!" << std::endl;
     AbruptExit(__FILE__, __LINE__);
   }
@@ -106,104 +214,60 @@ void ThermalReplay::ParseLine(std::string line, uint64_t &clk, Command &cmd) {
   // converting clock
   clk = stoull(tokens[0]);
 
-  // converting address
+  // converting address, dramsim3tracedump prints rows and columns in hex
   Address addr(std::stoi(tokens[2]), std::stoi(tokens[3]), std::stoi(tokens[4]),
-               std::stoi(tokens[5]), std::stoi(tokens[6]),
-               std::stoi(tokens[7]));
+               std::stoi(tokens[5]), std::stoi(tokens[6], nullptr, 0),
+               std::stoi(tokens[7], nullptr, 0));
 
   // reassign cmd
   cmd.addr = addr;
-  cmd.cmd_type = cmd_map[tokens[1]];
+  cmd.cmd_type = it->second;
   return;
 }
 
-void ThermalReplay::ProcessCMD(Command &cmd, uint64_t clk) {
+void ThermalReplay::ProcessCMD(ChannelReplay &replay, const Command &cmd,
+                               uint64_t clk) {
   // calculate background power
   // TODO add self-ref later
-  uint64_t past_clks = clk - last_clk_;
-  for (int i = 0; i < config_.channels; i++) {
-    for (int j = 0; j < config_.ranks; j++) {
-      if (IsRankActive(i, j)) {
-        channel_stats_[i].IncrementVecBy("rank_active_cycles", j, past_clks);
-      } else {
-        channel_stats_[i].IncrementVecBy("all_bank_idle_cycles", j, past_clks);
-      }
-    }
-  }
+  CountBackground(replay, clk);
 
-  int channel = cmd.Channel();
   // update cmd count
-  switch (cmd.cmd_type) {
-    case CommandType::READ:
-    case CommandType::READ_PRECHARGE:
-      channel_stats_[channel].Increment("num_read_cmds");
-      break;
-    case CommandType::WRITE:
-    case CommandType::WRITE_PRECHARGE:
-      channel_stats_[channel].Increment("num_write_cmds");
-      break;
-    case CommandType::ACTIVATE:
-      channel_stats_[channel].Increment("num_act_cmds");
-      break;
-    case CommandType::PRECHARGE:
-      channel_stats_[channel].Increment("num_pre_cmds");
-      break;
-    case CommandType::REFRESH:
-      channel_stats_[channel].Increment("num_ref_cmds");
-      break;
-    case CommandType::REFRESH_BANK:
-      channel_stats_[channel].Increment("num_refb_cmds");
-      break;
-    case CommandType::SREF_ENTER:
-      channel_stats_[channel].Increment("num_srefe_cmds");
-      break;
-    case CommandType::SREF_EXIT:
-      channel_stats_[channel].Increment("num_srefx_cmds");
-      break;
-    default: AbruptExit(__FILE__, __LINE__);
+  if (CommandStat(cmd.cmd_type) == nullptr) {
+    AbruptExit(__FILE__, __LINE__);
   }
+  replay.cmd_counts[static_cast<int>(cmd.cmd_type)]++;
 
   // update bank states
+  int bank = cmd.Rank() * config_.banks +
+             cmd.Bankgroup() * config_.banks_per_group + cmd.Bank();
   switch (cmd.cmd_type) {
-    case CommandType::ACTIVATE:
-      bank_active_[cmd.Channel()][cmd.Rank()][cmd.Bankgroup()][cmd.Bank()] =
-          true;
-      break;
+    case CommandType::ACTIVATE: replay.bank_active[bank] = true; break;
     case CommandType::READ_PRECHARGE:
     case CommandType::WRITE_PRECHARGE:
-    case CommandType::PRECHARGE:
-      bank_active_[cmd.Channel()][cmd.Rank()][cmd.Bankgroup()][cmd.Bank()] =
-          false;
-      break;
+    case CommandType::PRECHARGE: replay.bank_active[bank] = false; break;
     default: break;
   }
-
-  if (clk % config_.epoch_period) {
-    for (int c = 0; c < config_.channels; c++) {
-      // where to print isn't important here what we really need is the
-      // updated stats
-      channel_stats_[c].PrintEpochStats();
-      for (int r = 0; r < config_.ranks; r++) {
-        double bg_energy = channel_stats_[c].RankBackgroundEnergy(r);
-        thermal_calc_.UpdateBackgroundEnergy(c, r, bg_energy);
-      }
-    }
-  }
-  last_clk_ = clk;
+  thermal_calc_.UpdateCMDPower(cmd.Channel(), cmd, clk);
   return;
 }
 
-bool ThermalReplay::IsRankActive(int channel, int rank) {
-  std::vector<std::vector<bool>> &rank_active = bank_active_[channel][rank];
-  for (size_t i = 0; i < rank_active.size(); i++) {
-    std::vector<bool> &bg_active = rank_active[i];
-    for (size_t j = 0; j < bg_active.size(); j++) {
-      if (bg_active[j]) {
-        return true;
-      }
+void ThermalReplay::CountBackground(ChannelReplay &replay,
+                                    uint64_t clk) const {
+  uint64_t past_clks = clk - replay.last_clk;
+  for (int r = 0; r < config_.ranks; r++) {
+    if (IsRankActive(replay, r)) {
+      replay.active_cycles[r] += past_clks;
+    } else {
+      replay.idle_cycles[r] += past_clks;
     }
   }
-  return false;
+  replay.last_clk = clk;
+}
+
+bool ThermalReplay::IsRankActive(const ChannelReplay &replay,
+                                 int rank) const {
+  auto begin = replay.bank_active.begin() + rank * config_.banks;
+  return std::find(begin, begin + config_.banks, true) != begin + config_.banks;
 }
 
 int main(int argc, const char **argv) {
@@ -219,8 +283,11 @@ int main(int argc, const char **argv) {
   args::ValueFlag<std::string> memory_type_arg(
       parser, "memory_type", "Type of memory system - default, hmc, ideal",
       {"memory-type"}, "default");
-  args::ValueFlag<std::string> trace_file_arg(parser, "trace", "The trace file",
-                                              {'t', "trace-file"});
+  args::ValueFlagList<std::string> trace_file_arg(
+      parser, "trace",
+      "The trace file, repeat it to replay one binary command trace per "
+      "channel",
+      {'t', "trace-file"});
 
   try {
     parser.ParseCLI(argc, argv);
@@ -234,13 +301,13 @@ int main(int argc, const char **argv) {
   }
 
   uint64_t repeats = args::get(repeat_arg);
-  std::string config_file, output_dir, trace_file, memory_system_type;
+  std::string config_file, output_dir, memory_system_type;
   config_file = args::get(config_arg);
   output_dir = args::get(output_dir_arg);
-  trace_file = args::get(trace_file_arg);
+  std::vector<std::string> trace_files = args::get(trace_file_arg);
   memory_system_type = args::get(memory_type_arg);
 
-  ThermalReplay thermal_replay(trace_file, config_file, output_dir, repeats);
+  ThermalReplay thermal_replay(trace_files, config_file, output_dir, repeats);
 
   thermal_replay.Run();
 
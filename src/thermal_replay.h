@@ -2,34 +2,66 @@
 #define __THERMAL_REPLAY_H
 
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "binary_trace.h"
 #include "common.h"
 #include "configuration.h"
 #include "simple_stats.h"
 #include "thermal.h"
+#include "thread_pool.h"
 
 namespace dramsim3 {
 
+/// @brief Replays command traces through the thermal model. The traces are
+/// streamed, either one binary command trace per channel (other.cmd_trace)
+/// or a text trace of all the channels read in chunks, and the channels are
+/// replayed on system.num_threads threads, each into its own energy grid.
+/// The trace is walked once, its repeats reuse the energy and the stats of
+/// that pass.
 class ThermalReplay {
 public:
-  ThermalReplay(std::string trace_name, std::string config_file,
-                std::string output_dir, uint64_t repeat);
-  ~ThermalReplay();
+  ThermalReplay(const std::vector<std::string> &trace_names,
+                std::string config_file, std::string output_dir,
+                uint64_t repeat);
   void Run();
 
 private:
-  std::vector<std::pair<uint64_t, Command>> timed_commands_;
+  /// @brief Replay state of a channel, only touched by the thread replaying
+  /// the channel.
+  struct ChannelReplay {
+    ChannelReplay() : last_clk(0), cmd_counts() {}
+    // the binary command trace of the channel, if any
+    std::unique_ptr<CommandTraceReader> reader;
+    // or the commands of the channel in the current text trace chunk
+    std::vector<std::pair<uint64_t, Command>> chunk;
+    // whether each bank, rank * banks + bank, has a row open
+    std::vector<bool> bank_active;
+    uint64_t last_clk;
+    uint64_t cmd_counts[static_cast<int>(CommandType::SIZE)];
+    std::vector<uint64_t> active_cycles;
+    std::vector<uint64_t> idle_cycles;
+  };
+
   Config config_;
   ThermalCalculator thermal_calc_;
   uint64_t repeat_;
-  uint64_t last_clk_;
   std::vector<SimpleStats> channel_stats_;
-  std::vector<std::vector<std::vector<std::vector<bool>>>> bank_active_;
-  void ParseLine(std::string line, uint64_t &clk, Command &cmd);
-  void ProcessCMD(Command &cmd, uint64_t clk);
-  bool IsRankActive(int channel, int rank);
+  std::vector<ChannelReplay> channels_;
+  std::ifstream text_trace_;
+  std::unique_ptr<ThreadPool> thread_pool_;
+
+  /// @brief Split the next chunk of the text trace into the channels,
+  /// returns false at the end of the trace.
+  bool ReadChunk();
+  void ReplayChannel(int channel);
+  void ParseLine(const std::string &line, uint64_t &clk, Command &cmd) const;
+  void ProcessCMD(ChannelReplay &replay, const Command &cmd, uint64_t clk);
+  /// @brief Count the background cycles of the channel up to clk.
+  void CountBackground(ChannelReplay &replay, uint64_t clk) const;
+  bool IsRankActive(const ChannelReplay &replay, int rank) const;
 };
 
 }  // namespace dramsim3
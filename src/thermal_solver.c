@@ -86,8 +86,9 @@ double *calculate_Cap_array(double W, double Lc, int numP, int dimX, int dimZ,
     return C;
 }
 
-double **calculate_Midx_array(double W, double Lc, int numP, int dimX, int dimZ,
-                              int *MidxSize, double Tamb) {
+/* the conductance matrix, count rows of (row, column, value) in one array */
+double *calculate_Midx_array(double W, double Lc, int numP, int dimX, int dimZ,
+                             int *MidxSize, double Tamb) {
     double Wsink, Lsink, Hsink, Ksink, rTSV, Ktsv;
     int numLayer;
     double *K, *H;
@@ -280,17 +281,13 @@ double **calculate_Midx_array(double W, double Lc, int numP, int dimX, int dimZ,
     // * here we update number of non-zero values by adding the number
     // * of the diagnal values
 
-    double **Midx;
+    double *Midx;
     // allocate space for Midx
-    if (!(Midx = (double **)malloc((count) * sizeof(double *))))
+    if (!(Midx = (double *)malloc(3 * count * sizeof(double))))
         printf("Malloc fails for Midx[].\n");
-    for (i = 0; i < count; i++)
-        if (!(Midx[i] = (double *)malloc((3) * sizeof(double))))
-            printf("Malloc fails for Midx[%d][].\n", i);
 
     // try to initialize Midx
-    for (i = 0; i < count; i++)
-        for (j = 0; j < 3; j++) Midx[i][j] = 0;
+    for (i = 0; i < 3 * count; i++) Midx[i] = 0;
 
     // fill in the off-diagnal values
     int idx = 0,
@@ -301,88 +298,88 @@ double **calculate_Midx_array(double W, double Lc, int numP, int dimX, int dimZ,
             for (i = 0; i < dimX; i++) {
                 idx_re = idx;
                 if (l > 0) {
-                    Midx[idx][0] = l * dimX * dimZ + j * dimX + i;
-                    Midx[idx][1] = (l - 1) * dimX * dimZ + j * dimX + i;
-                    Midx[idx][2] =
+                    Midx[3 * idx] = l * dimX * dimZ + j * dimX + i;
+                    Midx[3 * idx + 1] = (l - 1) * dimX * dimZ + j * dimX + i;
+                    Midx[3 * idx + 2] =
                         -1 / (Rvert[i][j][l] / 2 + Rvert[i][j][l - 1] / 2);
-                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[idx][0],
-                    // Midx[idx][1], Midx[idx][2]);
+                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[3 * idx],
+                    // Midx[3 * idx + 1], Midx[3 * idx + 2]);
                     idx++;
                 }
                 if (j - 1 >= 0) {
-                    Midx[idx][0] = l * dimX * dimZ + j * dimX + i;
-                    Midx[idx][1] = l * dimX * dimZ + (j - 1) * dimX + i;
-                    Midx[idx][2] = -1 / Rhori[l][1];
-                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[idx][0],
-                    // Midx[idx][1], Midx[idx][2]);
+                    Midx[3 * idx] = l * dimX * dimZ + j * dimX + i;
+                    Midx[3 * idx + 1] = l * dimX * dimZ + (j - 1) * dimX + i;
+                    Midx[3 * idx + 2] = -1 / Rhori[l][1];
+                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[3 * idx],
+                    // Midx[3 * idx + 1], Midx[3 * idx + 2]);
                     idx++;
                 }
                 if (i - 1 >= 0) {
-                    Midx[idx][0] = l * dimX * dimZ + j * dimX + i;
-                    Midx[idx][1] = l * dimX * dimZ + j * dimX + i - 1;
-                    Midx[idx][2] = -1 / Rhori[l][0];
-                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[idx][0],
-                    // Midx[idx][1], Midx[idx][2]);
+                    Midx[3 * idx] = l * dimX * dimZ + j * dimX + i;
+                    Midx[3 * idx + 1] = l * dimX * dimZ + j * dimX + i - 1;
+                    Midx[3 * idx + 2] = -1 / Rhori[l][0];
+                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[3 * idx],
+                    // Midx[3 * idx + 1], Midx[3 * idx + 2]);
                     idx++;
                 }
                 if (i + 1 < dimX) {
-                    Midx[idx][0] = l * dimX * dimZ + j * dimX + i;
-                    Midx[idx][1] = l * dimX * dimZ + j * dimX + i + 1;
-                    Midx[idx][2] = -1 / Rhori[l][0];
-                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[idx][0],
-                    // Midx[idx][1], Midx[idx][2]);
+                    Midx[3 * idx] = l * dimX * dimZ + j * dimX + i;
+                    Midx[3 * idx + 1] = l * dimX * dimZ + j * dimX + i + 1;
+                    Midx[3 * idx + 2] = -1 / Rhori[l][0];
+                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[3 * idx],
+                    // Midx[3 * idx + 1], Midx[3 * idx + 2]);
                     idx++;
                 }
 
                 if (j + 1 < dimZ) {
-                    Midx[idx][0] = l * dimX * dimZ + j * dimX + i;
-                    Midx[idx][1] = l * dimX * dimZ + (j + 1) * dimX + i;
-                    Midx[idx][2] = -1 / Rhori[l][1];
-                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[idx][0],
-                    // Midx[idx][1], Midx[idx][2]);
+                    Midx[3 * idx] = l * dimX * dimZ + j * dimX + i;
+                    Midx[3 * idx + 1] = l * dimX * dimZ + (j + 1) * dimX + i;
+                    Midx[3 * idx + 2] = -1 / Rhori[l][1];
+                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[3 * idx],
+                    // Midx[3 * idx + 1], Midx[3 * idx + 2]);
                     idx++;
                 }
                 if (l < numLayer) {
-                    Midx[idx][0] = l * dimX * dimZ + j * dimX + i;
-                    Midx[idx][1] = (l + 1) * dimX * dimZ + j * dimX + i;
-                    Midx[idx][2] =
+                    Midx[3 * idx] = l * dimX * dimZ + j * dimX + i;
+                    Midx[3 * idx + 1] = (l + 1) * dimX * dimZ + j * dimX + i;
+                    Midx[3 * idx + 2] =
                         -1 / (Rvert[i][j][l] / 2 + Rvert[i][j][l + 1] / 2);
-                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[idx][0],
-                    // Midx[idx][1], Midx[idx][2]);
+                    // printf("%d:%f\t%f\t%.5f\n", idx, Midx[3 * idx],
+                    // Midx[3 * idx + 1], Midx[3 * idx + 2]);
                     idx++;
                 }
 
                 // calculate the diagnal values
                 // printf("idx_re = %d; idx = %d\n", idx_re, idx);
-                Midx[idx][0] = l * dimX * dimZ + j * dimX + i;
-                Midx[idx][1] = l * dimX * dimZ + j * dimX + i;
+                Midx[3 * idx] = l * dimX * dimZ + j * dimX + i;
+                Midx[3 * idx + 1] = l * dimX * dimZ + j * dimX + i;
 
                 // printf("ATENTION: idx_re = %d, idx = %d\n", idx_re, idx);
                 for (k = idx_re; k < idx; k++) {
-                    // if (Midx[idx][0] == 5)
-                    // printf("Midx[idx][2] = %.6f\n", Midx[idx][2]);
-                    Midx[idx][2] -= Midx[k][2];
+                    // if (Midx[3 * idx] == 5)
+                    // printf("Midx = %.6f\n", Midx[3 * idx + 2]);
+                    Midx[3 * idx + 2] -= Midx[3 * k + 2];
                 }
-                if (Midx[idx][0] < dimX * dimZ) {  // heat sink nodes
-                    // if (Midx[idx][0] == 5)
-                    // printf("Midx[idx][2] = %.6f\n", Midx[idx][2]);
-                    Midx[idx][2] += 1 / Ramb;
+                if (Midx[3 * idx] < dimX * dimZ) {  // heat sink nodes
+                    // if (Midx[3 * idx] == 5)
+                    // printf("Midx = %.6f\n", Midx[3 * idx + 2]);
+                    Midx[3 * idx + 2] += 1 / Ramb;
                 }
-                // printf("%d:%f\t%f\t%.5f\t, %d\t%d\n", idx, Midx[idx][0],
-                // Midx[idx][1], Midx[idx][2], idx_re, idx);
+                // printf("%d:%f\t%f\t%.5f\t, %d\t%d\n", idx, Midx[3 * idx],
+                // Midx[3 * idx + 1], Midx[3 * idx + 2], idx_re, idx);
                 idx++;
                 // sort this row
                 for (k = idx - 2; k >= idx_re; k--) {
-                    if (Midx[k][1] > Midx[k + 1][1]) {
-                        row_t = Midx[k][0];
-                        col_t = Midx[k][1];
-                        val_t = Midx[k][2];
-                        Midx[k][0] = Midx[k + 1][0];
-                        Midx[k][1] = Midx[k + 1][1];
-                        Midx[k][2] = Midx[k + 1][2];
-                        Midx[k + 1][0] = row_t;
-                        Midx[k + 1][1] = col_t;
-                        Midx[k + 1][2] = val_t;
+                    if (Midx[3 * k + 1] > Midx[3 * (k + 1) + 1]) {
+                        row_t = Midx[3 * k];
+                        col_t = Midx[3 * k + 1];
+                        val_t = Midx[3 * k + 2];
+                        Midx[3 * k] = Midx[3 * (k + 1)];
+                        Midx[3 * k + 1] = Midx[3 * (k + 1) + 1];
+                        Midx[3 * k + 2] = Midx[3 * (k + 1) + 2];
+                        Midx[3 * (k + 1)] = row_t;
+                        Midx[3 * (k + 1) + 1] = col_t;
+                        Midx[3 * (k + 1) + 2] = val_t;
                     } else
                         break;
                 }
@@ -394,7 +391,8 @@ double **calculate_Midx_array(double W, double Lc, int numP, int dimX, int dimZ,
 
     /*  int iidx;
       for (iidx = 0; iidx < count; iidx ++)
-        printf("%f\t%f\t%.5f\n", Midx[iidx][0], Midx[iidx][1], Midx[iidx][2]);
+        printf("%f\t%f\t%.5f\n", Midx[3 * iidx], Midx[3 * iidx + 1],
+               Midx[3 * iidx + 2]);
     */
 
     // printf("size of Midx is %d\n", sizeof Midx /sizeof Midx[0]);
@@ -420,8 +418,105 @@ double **calculate_Midx_array(double W, double Lc, int numP, int dimX, int dimZ,
     return Midx;
 }
 
-double *steady_thermal_solver(double ***powerM, double W, double Lc, int numP,
-                              int dimX, int dimZ, double **Midx, int count,
+/* A system matrix factorized once by SuperLU_MT, each solve is a pair of
+ * triangular solves */
+struct ThermalFactor {
+    SuperMatrix L, U;
+    int_t *perm_r; /* row permutations from partial pivoting */
+    int_t *perm_c; /* column permutation vector */
+    int_t n;
+    Gstat_t Gstat;
+};
+
+struct ThermalFactor *factor_thermal_matrix(double *Midx, int count, int n,
+                                            double *Cap, int layer_dim,
+                                            double dt) {
+    struct ThermalFactor *f;
+    SuperMatrix A, AC;
+    superlumt_options_t superlumt_options;
+    superlu_memusage_t superlu_memusage;
+    double *a;
+    int_t *asub, *xa;
+    int_t nprocs, panel_size, relax, info;
+
+    if (!(f = (struct ThermalFactor *)malloc(sizeof(*f))))
+        SUPERLU_ABORT("Malloc fails for ThermalFactor.");
+    f->n = n;
+    nprocs = omp_get_max_threads();
+    panel_size = sp_ienv(1);
+    relax = sp_ienv(2);
+
+    /* Initialize matrix A, the arrays are owned by A */
+    if (!(a = doubleMalloc(count))) SUPERLU_ABORT("Malloc fails for a[].");
+    if (!(asub = intMalloc(count))) SUPERLU_ABORT("Malloc fails for asub[].");
+    if (!(xa = intMalloc(n + 1))) SUPERLU_ABORT("Malloc fails for xa[].");
+    int row = -1;
+    for (int i = 0; i < count; i++) {
+        if (Midx[3 * i] > row) {
+            row = Midx[3 * i];  // enter a new column
+            xa[row] = i;       // index of the first item of each row
+        }
+        a[i] = Midx[3 * i + 2];
+        asub[i] = (int)Midx[3 * i + 1];  // column index of each item
+        // C/dt on the diagonal for a backward Euler step
+        if (Cap && asub[i] == row) a[i] += Cap[row / layer_dim] / dt;
+    }
+    xa[row + 1] = count;
+
+    printf("Factorizing the %lld x %lld %s matrix (%d non-zeros) on %lld "
+           "cores\n",
+           (long long)n, (long long)n, Cap ? "transient" : "steady", count,
+           (long long)nprocs);
+    dCreate_CompCol_Matrix(&A, n, n, count, a, asub, xa, SLU_NC, SLU_D, SLU_GE);
+
+    if (!(f->perm_r = intMalloc(n)))
+        SUPERLU_ABORT("Malloc fails for perm_r[].");
+    if (!(f->perm_c = intMalloc(n)))
+        SUPERLU_ABORT("Malloc fails for perm_c[].");
+    /* minimum degree ordering on structure of A'*A */
+    get_perm_c(1, &A, f->perm_c);
+
+    /* the factorization steps of pdgssv, without the solve */
+    StatAlloc(n, nprocs, panel_size, relax, &f->Gstat);
+    StatInit(n, nprocs, &f->Gstat);
+    pdgstrf_init(nprocs, EQUILIBRATE, NOTRANS, NO, panel_size, relax, 1.0, NO,
+                 0.0, f->perm_c, f->perm_r, NULL, 0, &A, &AC,
+                 &superlumt_options, &f->Gstat);
+    pdgstrf(&superlumt_options, &AC, f->perm_r, &f->L, &f->U, &f->Gstat,
+            &info);
+    pxgstrf_finalize(&superlumt_options, &AC);
+    Destroy_CompCol_Matrix(&A);
+    if (info != 0) SUPERLU_ABORT("Factorizing the thermal matrix fails.");
+
+    superlu_dQuerySpace(nprocs, &f->L, &f->U, panel_size, &superlu_memusage);
+    printf("#NZ in L+U = " IFMT "\tL\\U MB %.3f\n",
+           ((SCPformat *)f->L.Store)->nnz + ((NCPformat *)f->U.Store)->nnz -
+               f->L.ncol,
+           superlu_memusage.for_lu / 1024 / 1024);
+    return f;
+}
+
+void solve_thermal_matrix(struct ThermalFactor *f, double *rhs) {
+    SuperMatrix B;
+    int_t info;
+    dCreate_Dense_Matrix(&B, f->n, 1, rhs, f->n, SLU_DN, SLU_D, SLU_GE);
+    dgstrs(NOTRANS, &f->L, &f->U, f->perm_r, f->perm_c, &B, &f->Gstat, &info);
+    Destroy_SuperMatrix_Store(&B);
+    if (info != 0) SUPERLU_ABORT("Solving the thermal matrix fails.");
+}
+
+void free_thermal_factor(struct ThermalFactor *f) {
+    if (!f) return;
+    Destroy_SuperNode_SCP(&f->L);
+    Destroy_CompCol_NCP(&f->U);
+    SUPERLU_FREE(f->perm_r);
+    SUPERLU_FREE(f->perm_c);
+    StatFree(&f->Gstat);
+    free(f);
+}
+
+double *steady_thermal_solver(double *powerM, double W, double Lc, int numP,
+                              int dimX, int dimZ, struct ThermalFactor *factor,
                               double Tamb) {
     int numLayer = numP * 3;
     int_t *layerP;
@@ -438,180 +533,33 @@ double *steady_thermal_solver(double ***powerM, double W, double Lc, int numP,
     double Rsinky = Hsink / Ksink / gridXsink / gridZsink;  // y direction
     double Ramb = Rsinky / 2;
 
-    // convert the values to the SuperMatrix format
-    SuperMatrix A, L, U, B;
-    double *a;
-    int_t *asub, *xa;
-    int_t *perm_r; /* row permutations from partial pivoting */
-    int_t *perm_c; /* column permutation vector */
-    SCPformat *Lstore;
-    NCPformat *Ustore;
-    int_t nrhs, info, m, n, nnz, b;
-    int_t nprocs; /* maximum number of processors to use. */
-    int_t panel_size, relax, maxsup;
-    int_t permc_spec;
-    trans_t trans;
-    double *rhs;
-    superlu_memusage_t superlu_memusage;
-
-    nrhs = 1;
-    trans = NOTRANS;
-    nprocs = omp_get_max_threads();
-    b = 1;
-    panel_size = sp_ienv(1);
-    relax = sp_ienv(2);
-    maxsup = sp_ienv(3);
-
-    /* Initialize matrix A. */
-    m = n = dimX * dimZ * (numLayer + 1);
-    nnz = count;
-    if (!(a = doubleMalloc(nnz)))
-        SUPERLU_ABORT("Malloc fails for a[].");  // I cannot free the space
-    if (!(asub = intMalloc(nnz)))
-        SUPERLU_ABORT("Malloc fails for asub[].");  // I cannot free the space
-    if (!(xa = intMalloc(n + 1)))
-        SUPERLU_ABORT("Malloc fails for xa[].");  // I cannot free the space
-
-    /* assign values to the arrays: a, asub and xa */
-    int row = -1;
-    for (int i = 0; i < count; i++) {
-        if (Midx[i][0] > row) {
-            row = Midx[i][0];  // enter a new column
-            xa[row] = i;       // index of the first item of each row
-        }
-        a[i] = Midx[i][2];
-        asub[i] = (int)Midx[i][1];  // column index of each item
-    }
-    xa[row + 1] = count;
-
-    printf("Using %lld Cores to calculate\n", nprocs);
-    printf("Building the sparse matrix ...\n");
-    printf("Dimension of the G matrix is %lld x %lld\n", m, n);
-    printf("Number of non-zero entries is %lld\n", nnz);
-
-    /* Create matrix A in the format expected by SuperLU. */
-    dCreate_CompCol_Matrix(&A, m, n, nnz, a, asub, xa, SLU_NC, SLU_D, SLU_GE);
-    // dPrint_CompCol_Matrix("A", &A);
-    /* Create right-hand side matrix B. */
-    if (!(rhs = doubleMalloc(m * nrhs)))
-        SUPERLU_ABORT("Malloc fails for rhs[].");
+    int m = dimX * dimZ * (numLayer + 1);
+    double *Tt;
+    if (!(Tt = (double *)malloc(m * sizeof(double))))
+        printf("Malloc fails for Tt\n");
 
-    // assign values to B
+    // assign values to the right-hand side, solved in place
     for (int i = 0; i < m; i++)  // initialize rhs to 0
-        rhs[i] = 0;
-    for (int i = 0; i < dimX * dimZ; i++) rhs[i] = Tamb / Ramb;
+        Tt[i] = 0;
+    for (int i = 0; i < dimX * dimZ; i++) Tt[i] = Tamb / Ramb;
     for (int l = 0; l < numP; l++)
         for (int i = 0; i < dimX; i++)
             for (int j = 0; j < dimZ; j++) {
-                rhs[dimX * dimZ * (layerP[l] + 1) + j * dimX + i] =
-                    powerM[i][j][l];
-                // rhs[dimX*dimZ*(layerP[l]+1) + i*dimZ + j] = powerM[i][j][l];
-                // printf("%.6f\n", powerM[i][j][l]);
+                Tt[dimX * dimZ * (layerP[l] + 1) + j * dimX + i] =
+                    powerM[dimX * dimZ * l + j * dimX + i];
             }
 
-    // free the space
-    for (int i = 0; i < dimX; i++) {
-        for (int j = 0; j < dimZ; j++) {
-            free(powerM[i][j]);
-        }
-        free(powerM[i]);
-    }
-    free(powerM);
-
-    dCreate_Dense_Matrix(&B, m, nrhs, rhs, m, SLU_DN, SLU_D, SLU_GE);
+    solve_thermal_matrix(factor, Tt);
+    for (int i = 0; i < m; ++i) Tt[i] -= T0;
 
-    // dPrint_Dense_Matrix("B", &B);
-
-    if (!(perm_r = intMalloc(m))) SUPERLU_ABORT("Malloc fails for perm_r[].");
-    if (!(perm_c = intMalloc(n))) SUPERLU_ABORT("Malloc fails for perm_c[].");
-
-    /*
-     * Get column permutation vector perm_c[], according to permc_spec:
-     *   permc_spec = 0: natural ordering
-     *   permc_spec = 1: minimum degree ordering on structure of A'*A
-     *   permc_spec = 2: minimum degree ordering on structure of A'+A
-     *   permc_spec = 3: approximate minimum degree for unsymmetric matrices
-     */
-    permc_spec = 1;
-    get_perm_c(permc_spec, &A, perm_c);
-
-    printf("Finish building the sparse matrix\n");
-    printf("------------------------------------------------------------\n\n");
-
-    /* Solve the linear system. */
-    pdgssv(nprocs, &A, perm_c, perm_r, &L, &U, &B, &info);
-
-    printf("Finish solving the linear equation\n");
-
-    // dPrint_Dense_Matrix("B", &B);
-
-    // extract the Temperature from B
-    DNformat *Astore = (DNformat *)B.Store;
-    // double *Tt; // vector stores the temperature for all grids
-
-    double *Ttp, *Tt;
-    if (!(Tt = (double *)malloc(dimX * dimZ * (numP * 3 + 1) * sizeof(double))))
-        printf("Malloc fails for Tt\n");
-    Ttp = (double *)Astore->nzval;
-    printf("B.nrow is %lld\n", B.nrow);
-    for (int i = 0; i < B.nrow; ++i) {
-        Tt[i] = Ttp[i] - T0;
-        // printf("Tt[%d] = %.2f\n", i, Tt[i]);
-    }
-
-    /*Tt = (double *) Astore->nzval;
-    printf("B.nrow is %d\n", B.nrow);
-    for (i = 0; i < B.nrow; ++i)
-    {
-        Tt[i] = Tt[i] - T0;
-        //printf("%.2f\n", T[i]);
-    }*/
-
-    printf("Finish converting the temperature matrix\n");
-    printf("Free the space...\n");
-
-    if (info == 0) {
-        // dinf_norm_error(nrhs, &B, xact); /* Inf. norm of the error */
-
-        Lstore = (SCPformat *)L.Store;
-        Ustore = (NCPformat *)U.Store;
-        printf("#NZ in factor L = " IFMT "\n", Lstore->nnz);
-        printf("#NZ in factor U = " IFMT "\n", Ustore->nnz);
-        printf("#NZ in L+U = " IFMT "\n", Lstore->nnz + Ustore->nnz - L.ncol);
-
-        superlu_dQuerySpace(nprocs, &L, &U, panel_size, &superlu_memusage);
-        printf("L\\U MB %.3f\ttotal MB needed %.3f\texpansions " IFMT "\n",
-               superlu_memusage.for_lu / 1024 / 1024,
-               superlu_memusage.total_needed / 1024 / 1024,
-               superlu_memusage.expansions);
-    }
-
-    /* De-allocate storage */
-    // free the arrays defined by myself
     SUPERLU_FREE(layerP);
-    SUPERLU_FREE(rhs);
-    SUPERLU_FREE(perm_r);
-    SUPERLU_FREE(perm_c);
-    printf("finish SUPERLU_FREE\n");
-    Destroy_CompCol_Matrix(&A);
-    Destroy_SuperMatrix_Store(&B);
-    Destroy_SuperNode_SCP(&L);
-    Destroy_CompCol_NCP(&U);
-    /* De-allocate other storage */
-    // free(K); free(H); free(layerP); free(Tt);
-
-    printf(
-        "================= FINISH STEADY TEMPERATURE SOLVER "
-        "===============\n\n");
-
     return Tt;
 }
 
-double *transient_thermal_solver(double ***powerM, double W, double Lc,
-                                 int numP, int dimX, int dimZ, double **Midx,
-                                 int MidxSize, double *Cap, int CapSize,
-                                 double time, int iter, double *T_trans,
-                                 double Tamb) {
+void transient_thermal_solver(double *powerM, double W, double Lc, int numP,
+                              int dimX, int dimZ, double *Midx, int MidxSize,
+                              double *Cap, int CapSize, double time, int iter,
+                              double *T_trans, double Tamb) {
     int numLayer = numP * 3;
 
     // define the active layer array
@@ -628,13 +576,14 @@ double *transient_thermal_solver(double ***powerM, double W, double Lc,
     double Rsinky = Hsink / Ksink / gridXsink / gridZsink;  // y direction
     double Ramb = Rsinky / 2;
 
-    double *Tp = T_trans;
-    double *T, *P;
     int T_size = dimX * dimZ * (numLayer + 1);
+    double *Tp, *T, *P;
+    if (!(Tp = doubleMalloc(T_size))) SUPERLU_ABORT("Malloc fails for rhs[].");
     if (!(T = doubleMalloc(T_size))) SUPERLU_ABORT("Malloc fails for rhs[].");
     if (!(P = doubleMalloc(T_size))) SUPERLU_ABORT("Malloc fails for rhs[].");
 
     // initialize T and P
+    memcpy(Tp, T_trans, T_size * sizeof(*T));
     memset(T, 0, T_size * sizeof(*T));
     memset(P, 0, T_size * sizeof(*T));
 
@@ -643,8 +592,7 @@ double *transient_thermal_solver(double ***powerM, double W, double Lc,
         for (int j = 0; j < dimZ; j++)
             for (int i = 0; i < dimX; i++) {
                 P[dimX * dimZ * (layerP[l] + 1) + i * dimZ + j] =
-                    powerM[i][j][l];
-                // printf("%.6f\n", powerM[i][j][l]);
+                    powerM[dimX * dimZ * l + j * dimX + i];
             }
 
     double dt = time / (double)iter;
@@ -661,13 +609,13 @@ double *transient_thermal_solver(double ***powerM, double W, double Lc,
         for (int j = 0; j < MidxSize; j += block_size) {
             int bound = j + block_size < MidxSize ? (j + block_size) : MidxSize;
             for (int b = j; b < bound; b++) {
-                int idx0 = (int)(Midx[b][0] + 0.01);
-                int idx1 = (int)(Midx[b][1] + 0.01);
-                double tmp_c = Midx[b][2];
+                int idx0 = (int)(Midx[3 * b] + 0.01);
+                int idx1 = (int)(Midx[3 * b + 1] + 0.01);
+                double tmp_c = Midx[3 * b + 2];
                 int idxC = idx0 / (dimX * dimZ);
 
                 if (idx0 == idx1) {
-                    // if (1-Midx[j][2]*dt/Cap[idxC] < 0)
+                    // if (1-Midx[3 * j + 2]*dt/Cap[idxC] < 0)
                     //    printf("NEGATIVE: idx0 = %d\n", idx0);
                     double tmp_a = 1 - tmp_c * dt / Cap[idxC];
                     double tmp_b = tmp_a * Tp[idx1] + P[idx0] * dt / Cap[idxC];
@@ -687,20 +635,53 @@ double *transient_thermal_solver(double ***powerM, double W, double Lc,
         memset(T, 0, dimX * dimZ * (numLayer + 1) * sizeof(*T));
     }
 
-    // free the space
-    for (int i = 0; i < dimX; i++) {
-        for (int j = 0; j < dimZ; j++) {
-            free(powerM[i][j]);
-        }
-        free(powerM[i]);
-    }
-    free(powerM);
-
+    memcpy(T_trans, Tp, T_size * sizeof(*T));
     SUPERLU_FREE(layerP);
     SUPERLU_FREE(P);
     SUPERLU_FREE(T);
+    SUPERLU_FREE(Tp);
+}
 
-    return Tp;
+void implicit_thermal_solver(double *powerM, double W, double Lc, int numP,
+                             int dimX, int dimZ, struct ThermalFactor *factor,
+                             double *Cap, double time, int iter,
+                             double *T_trans, double Tamb) {
+    int numLayer = numP * 3;
+    double Wsink = W;
+    double Lsink = Lc;
+    double Hsink = Hhs;
+    double Ksink = Khs;
+    double gridXsink = Wsink / dimX;
+    double gridZsink = Lsink / dimZ;
+    double Rsinky = Hsink / Ksink / gridXsink / gridZsink;  // y direction
+    double Ramb = Rsinky / 2;
+
+    int layer_dim = dimX * dimZ;
+    int T_size = layer_dim * (numLayer + 1);
+    double *P, *rhs;
+    if (!(P = doubleMalloc(T_size))) SUPERLU_ABORT("Malloc fails for P[].");
+    if (!(rhs = doubleMalloc(T_size))) SUPERLU_ABORT("Malloc fails for rhs[].");
+
+    // same power vector as the explicit solver
+    memset(P, 0, T_size * sizeof(*P));
+    for (int i = 0; i < layer_dim; i++) P[i] = Tamb / Ramb;
+    for (int l = 0; l < numP; l++)
+        for (int j = 0; j < dimZ; j++)
+            for (int i = 0; i < dimX; i++)
+                P[layer_dim * (l * 3 + 1) + i * dimZ + j] =
+                    powerM[layer_dim * l + j * dimX + i];
+
+    // (C/dt + G) T' = C/dt T + P for every step, factor holds C/dt + G
+    double dt = time / (double)iter;
+    for (int iit = 0; iit < iter; iit++) {
+        for (int k = 0; k < T_size; k++)
+            rhs[k] = Cap[k / layer_dim] / dt * T_trans[k] + P[k];
+        solve_thermal_matrix(factor, rhs);
+        memcpy(T_trans, rhs, T_size * sizeof(*rhs));
+    }
+
+    SUPERLU_FREE(P);
+    SUPERLU_FREE(rhs);
 }
 
 double get_maxT(double *T, int Tsize) {
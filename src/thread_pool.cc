@@ -0,0 +1,112 @@
+#include "thread_pool.h"
+
+namespace dramsim3 {
+
+namespace {
+
+// spin this many times before giving up the time slice
+const int kSpinsBeforeYield = 1024;
+// and give it up this many times before parking
+const int kYieldsBeforePark = 256;
+
+}  // namespace
+
+ThreadPool::ThreadPool(int num_threads)
+    : num_threads_(num_threads < 1 ? 1 : num_threads), task_(nullptr),
+      num_tasks_(0), generation_(0), done_(num_threads_), stop_(false),
+      parked_(0) {
+  for (int i = 0; i < num_threads_; i++) {
+    done_[i].store(0);
+  }
+  workers_.reserve(num_threads_ - 1);
+  for (int i = 1; i < num_threads_; i++) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  stop_.store(true);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wake_.notify_all();
+  }
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::ParallelFor(int num_tasks,
+                             const std::function<void(int)> &task) {
+  if (num_threads_ == 1) {
+    for (int i = 0; i < num_tasks; i++) {
+      task(i);
+    }
+    return;
+  }
+  task_ = &task;
+  num_tasks_ = num_tasks;
+  uint64_t gen = generation_.load(std::memory_order_relaxed) + 1;
+  // sequentially consistent with the parking in WorkerLoop, either a worker
+  // sees the new generation or it is seen parked here
+  generation_.store(gen);
+  if (parked_.load() > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wake_.notify_all();
+  }
+
+  RunTasks(0);
+
+  // barrier: wait until every worker has finished its share
+  for (int i = 1; i < num_threads_; i++) {
+    int spins = 0;
+    while (done_[i].load(std::memory_order_acquire) != gen) {
+      if (++spins == kSpinsBeforeYield) {
+        std::this_thread::yield();
+        spins = 0;
+      }
+    }
+  }
+  return;
+}
+
+void ThreadPool::WorkerLoop(int thread_id) {
+  uint64_t seen = 0;
+  int spins = 0;
+  int yields = 0;
+  while (!stop_.load(std::memory_order_acquire)) {
+    uint64_t gen = generation_.load(std::memory_order_acquire);
+    if (gen == seen) {
+      if (++spins < kSpinsBeforeYield) {
+        continue;
+      }
+      spins = 0;
+      if (++yields < kYieldsBeforePark) {
+        std::this_thread::yield();
+        continue;
+      }
+      yields = 0;
+      std::unique_lock<std::mutex> lock(mutex_);
+      parked_.fetch_add(1);
+      wake_.wait(lock, [this, seen] {
+        return stop_.load() || generation_.load() != seen;
+      });
+      parked_.fetch_sub(1);
+      continue;
+    }
+    spins = 0;
+    yields = 0;
+    RunTasks(thread_id);
+    seen = gen;
+    done_[thread_id].store(gen, std::memory_order_release);
+  }
+  return;
+}
+
+void ThreadPool::RunTasks(int thread_id) const {
+  for (int i = thread_id; i < num_tasks_; i += num_threads_) {
+    (*task_)(i);
+  }
+  return;
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,55 @@
+#ifndef __THREAD_POOL_H
+#define __THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dramsim3 {
+
+/// @brief A persistent pool of worker threads that run a batch of indexed
+/// tasks and then meet at a barrier. It is meant to be dispatched every cycle,
+/// so the workers spin (and eventually yield) for a while after a batch. Once
+/// that budget is used up, e.g. while the host runs between ticks, they park
+/// on a condition variable and the next batch wakes them. Task i is always
+/// run by thread i % NumThreads(), the calling thread being thread 0, so the
+/// work split is deterministic.
+class ThreadPool {
+public:
+  /// @brief num_threads is the total number of threads including the caller.
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+  int NumThreads() const { return num_threads_; }
+  /// @brief Run task(0) ... task(num_tasks - 1) and return after all of them
+  /// have finished.
+  void ParallelFor(int num_tasks, const std::function<void(int)> &task);
+
+private:
+  void WorkerLoop(int thread_id);
+  void RunTasks(int thread_id) const;
+
+  int num_threads_;
+  std::vector<std::thread> workers_;
+
+  // the current batch, only written while all the workers are parked
+  const std::function<void(int)> *task_;
+  int num_tasks_;
+
+  // a new batch is published by bumping generation_, every worker
+  // acknowledges it by copying the generation into its done_ slot
+  std::atomic<uint64_t> generation_;
+  std::vector<std::atomic<uint64_t>> done_;
+  std::atomic<bool> stop_;
+
+  // workers that ran out of spins wait on wake_, counted in parked_ so that
+  // ParallelFor only takes the lock when one does
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::atomic<int> parked_;
+};
+
+}  // namespace dramsim3
+#endif  // __THREAD_POOL_H
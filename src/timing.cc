@@ -4,12 +4,16 @@
 
 namespace dramsim3 {
 
-Timing::Timing(const Config &config)
-    : same_bank(static_cast<int>(CommandType::SIZE)),
-      other_banks_same_bankgroup(static_cast<int>(CommandType::SIZE)),
-      other_bankgroups_same_rank(static_cast<int>(CommandType::SIZE)),
-      other_ranks(static_cast<int>(CommandType::SIZE)),
-      same_rank(static_cast<int>(CommandType::SIZE)) {
+TimingList::TimingList(const std::vector<Constraint> &list)
+    : size_(static_cast<int>(list.size())) {
+  if (size_ > kMaxSize) {
+    std::cerr << "Too many timing constraints for one command" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  std::copy(list.begin(), list.end(), constraints_.begin());
+}
+
+Timing::Timing(const Config &config) {
   int read_to_read_l = std::max(config.burst_cycle, config.tCCD_L);
   int read_to_read_s = std::max(config.burst_cycle, config.tCCD_S);
   int read_to_read_o = config.burst_cycle + config.tRTRS;
@@ -52,11 +56,17 @@ Timing::Timing(const Config &config)
   int refresh_to_refresh = config.tREFI;  // refresh intervals (per rank level)
   int refresh_to_activate = config.tRFC;  // tRFC is defined as ref to act
   int refresh_to_activate_bank = config.tRFCb;
+  int same_bank_refresh_to_other_bank = config.tREFSBRD;
 
   int self_refresh_entry_to_exit = config.tCKESR;
   int self_refresh_exit = config.tXS;
-  // int powerdown_to_exit = config.tCKE;
-  // int powerdown_exit = config.tXP;
+  int powerdown_to_exit = config.tCKE;
+  int powerdown_exit = config.tXP;
+  // power-down entry waits for the data bursts (tRDPDEN, tWRPDEN) and for
+  // write recovery, ACT and PRE only take a cycle (tACTPDEN, tPRPDEN)
+  int read_to_powerdown = config.RL + config.burst_cycle + 1;
+  int write_to_powerdown = config.WL + config.burst_cycle + config.tWR + 1;
+  int command_to_powerdown = 1;
 
   if (config.bankgroups == 1) {
     // for a bankgroup can be disabled, in that case
@@ -77,7 +87,8 @@ Timing::Timing(const Config &config)
           {CommandType::WRITE,           read_to_write    },
           {CommandType::READ_PRECHARGE,  read_to_read_l   },
           {CommandType::WRITE_PRECHARGE, read_to_write    },
-          {CommandType::PRECHARGE,       read_to_precharge}
+          {CommandType::PRECHARGE,       read_to_precharge},
+          {CommandType::PD_ENTER,        read_to_powerdown}
   };
   other_banks_same_bankgroup[static_cast<int>(CommandType::READ)] =
       std::vector<std::pair<CommandType, int>>{
@@ -108,7 +119,8 @@ Timing::Timing(const Config &config)
           {CommandType::WRITE,           write_to_write_l  },
           {CommandType::READ_PRECHARGE,  write_to_read_l   },
           {CommandType::WRITE_PRECHARGE, write_to_write_l  },
-          {CommandType::PRECHARGE,       write_to_precharge}
+          {CommandType::PRECHARGE,       write_to_precharge},
+          {CommandType::PD_ENTER,        write_to_powerdown}
   };
   other_banks_same_bankgroup[static_cast<int>(CommandType::WRITE)] =
       std::vector<std::pair<CommandType, int>>{
@@ -135,10 +147,11 @@ Timing::Timing(const Config &config)
   // command READ_PRECHARGE
   same_bank[static_cast<int>(CommandType::READ_PRECHARGE)] =
       std::vector<std::pair<CommandType, int>>{
-          {CommandType::ACTIVATE,     readp_to_act    },
-          {CommandType::REFRESH,      read_to_activate},
-          {CommandType::REFRESH_BANK, read_to_activate},
-          {CommandType::SREF_ENTER,   read_to_activate}
+          {CommandType::ACTIVATE,     readp_to_act     },
+          {CommandType::REFRESH,      read_to_activate },
+          {CommandType::REFRESH_BANK, read_to_activate },
+          {CommandType::SREF_ENTER,   read_to_activate },
+          {CommandType::PD_ENTER,     read_to_powerdown}
   };
   other_banks_same_bankgroup[static_cast<int>(CommandType::READ_PRECHARGE)] =
       std::vector<std::pair<CommandType, int>>{
@@ -165,10 +178,11 @@ Timing::Timing(const Config &config)
   // command WRITE_PRECHARGE
   same_bank[static_cast<int>(CommandType::WRITE_PRECHARGE)] =
       std::vector<std::pair<CommandType, int>>{
-          {CommandType::ACTIVATE,     write_to_activate},
-          {CommandType::REFRESH,      write_to_activate},
-          {CommandType::REFRESH_BANK, write_to_activate},
-          {CommandType::SREF_ENTER,   write_to_activate}
+          {CommandType::ACTIVATE,     write_to_activate },
+          {CommandType::REFRESH,      write_to_activate },
+          {CommandType::REFRESH_BANK, write_to_activate },
+          {CommandType::SREF_ENTER,   write_to_activate },
+          {CommandType::PD_ENTER,     write_to_powerdown}
   };
   other_banks_same_bankgroup[static_cast<int>(CommandType::WRITE_PRECHARGE)] =
       std::vector<std::pair<CommandType, int>>{
@@ -201,6 +215,7 @@ Timing::Timing(const Config &config)
           {CommandType::READ_PRECHARGE,  activate_to_read     },
           {CommandType::WRITE_PRECHARGE, activate_to_write    },
           {CommandType::PRECHARGE,       activate_to_precharge},
+          {CommandType::PD_ENTER,        command_to_powerdown },
   };
 
   other_banks_same_bankgroup[static_cast<int>(CommandType::ACTIVATE)] =
@@ -221,7 +236,8 @@ Timing::Timing(const Config &config)
           {CommandType::ACTIVATE,     precharge_to_activate},
           {CommandType::REFRESH,      precharge_to_activate},
           {CommandType::REFRESH_BANK, precharge_to_activate},
-          {CommandType::SREF_ENTER,   precharge_to_activate}
+          {CommandType::SREF_ENTER,   precharge_to_activate},
+          {CommandType::PD_ENTER,     command_to_powerdown }
   };
 
   // for those who need tPPD
@@ -243,7 +259,8 @@ Timing::Timing(const Config &config)
           {CommandType::ACTIVATE,     refresh_to_activate_bank},
           {CommandType::REFRESH,      refresh_to_activate_bank},
           {CommandType::REFRESH_BANK, refresh_to_activate_bank},
-          {CommandType::SREF_ENTER,   refresh_to_activate_bank}
+          {CommandType::SREF_ENTER,   refresh_to_activate_bank},
+          {CommandType::PD_ENTER,     refresh_to_activate_bank}
   };
 
   other_banks_same_bankgroup[static_cast<int>(CommandType::REFRESH_BANK)] =
@@ -258,17 +275,25 @@ Timing::Timing(const Config &config)
           {CommandType::REFRESH_BANK, refresh_to_refresh },
   };
 
+  // same-bank refresh, the other banks of the rank keep working but their
+  // ACTs and refreshes are spaced from it (the REFRESH_BANK lists above hold
+  // tRFC and tREFI for per-bank refresh)
+  same_bank_refresh_other_banks = std::vector<std::pair<CommandType, int>>{
+      {CommandType::ACTIVATE,     same_bank_refresh_to_other_bank},
+      {CommandType::REFRESH_BANK, same_bank_refresh_to_other_bank}
+  };
+
   // REFRESH, SREF_ENTER and SREF_EXIT are isued to the entire
   // rank  command REFRESH
   same_rank[static_cast<int>(CommandType::REFRESH)] =
       std::vector<std::pair<CommandType, int>>{
           {CommandType::ACTIVATE,   refresh_to_activate},
           {CommandType::REFRESH,    refresh_to_activate},
-          {CommandType::SREF_ENTER, refresh_to_activate}
+          {CommandType::SREF_ENTER, refresh_to_activate},
+          {CommandType::PD_ENTER,   refresh_to_activate}
   };
 
   // command SREF_ENTER
-  // TODO: add power down commands
   same_rank[static_cast<int>(CommandType::SREF_ENTER)] =
       std::vector<std::pair<CommandType, int>>{
           {CommandType::SREF_EXIT, self_refresh_entry_to_exit}
@@ -280,7 +305,29 @@ Timing::Timing(const Config &config)
           {CommandType::ACTIVATE,     self_refresh_exit},
           {CommandType::REFRESH,      self_refresh_exit},
           {CommandType::REFRESH_BANK, self_refresh_exit},
-          {CommandType::SREF_ENTER,   self_refresh_exit}
+          {CommandType::SREF_ENTER,   self_refresh_exit},
+          {CommandType::PD_ENTER,     self_refresh_exit}
+  };
+
+  // command PD_ENTER, a rank stays powered down for at least tCKE
+  same_rank[static_cast<int>(CommandType::PD_ENTER)] =
+      std::vector<std::pair<CommandType, int>>{
+          {CommandType::PD_EXIT, powerdown_to_exit}
+  };
+
+  // command PD_EXIT, tXP until the rank takes any other command
+  same_rank[static_cast<int>(CommandType::PD_EXIT)] =
+      std::vector<std::pair<CommandType, int>>{
+          {CommandType::READ,            powerdown_exit},
+          {CommandType::READ_PRECHARGE,  powerdown_exit},
+          {CommandType::WRITE,           powerdown_exit},
+          {CommandType::WRITE_PRECHARGE, powerdown_exit},
+          {CommandType::ACTIVATE,        powerdown_exit},
+          {CommandType::PRECHARGE,       powerdown_exit},
+          {CommandType::REFRESH,         powerdown_exit},
+          {CommandType::REFRESH_BANK,    powerdown_exit},
+          {CommandType::SREF_ENTER,      powerdown_exit},
+          {CommandType::PD_ENTER,        powerdown_exit}
   };
 }
 
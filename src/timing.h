@@ -3,20 +3,49 @@
 
 #include "common.h"
 #include "configuration.h"
+#include <array>
+#include <utility>
 #include <vector>
 
 namespace dramsim3 {
 
+/// @brief A fixed capacity list of (command, delay) constraints stored inline,
+/// so that walking it on every issued command touches no heap memory.
+class TimingList {
+public:
+  using Constraint = std::pair<CommandType, int>;
+  // no command constrains more than this many command types
+  static const int kMaxSize = 10;
+
+  TimingList() : size_(0) {}
+  // build time only conversion from the lists written out in timing.cc
+  TimingList(const std::vector<Constraint> &list);
+
+  const Constraint *begin() const { return constraints_.data(); }
+  const Constraint *end() const { return constraints_.data() + size_; }
+  int size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+private:
+  std::array<Constraint, kMaxSize> constraints_;
+  int size_;
+};
+
+/// @brief Indexed by the issued command type.
+using TimingTable =
+    std::array<TimingList, static_cast<int>(CommandType::SIZE)>;
+
 class Timing {
 public:
   Timing(const Config &config);
-  std::vector<std::vector<std::pair<CommandType, int>>> same_bank;
-  std::vector<std::vector<std::pair<CommandType, int>>>
-      other_banks_same_bankgroup;
-  std::vector<std::vector<std::pair<CommandType, int>>>
-      other_bankgroups_same_rank;
-  std::vector<std::vector<std::pair<CommandType, int>>> other_ranks;
-  std::vector<std::vector<std::pair<CommandType, int>>> same_rank;
+  TimingTable same_bank;
+  TimingTable other_banks_same_bankgroup;
+  TimingTable other_bankgroups_same_rank;
+  TimingTable other_ranks;
+  TimingTable same_rank;
+  /// @brief A same-bank refresh (REFRESH_BANK to all bankgroups) on the
+  /// banks of the rank outside its bank set.
+  TimingList same_bank_refresh_other_banks;
 };
 
 }  // namespace dramsim3
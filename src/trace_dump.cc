@@ -0,0 +1,57 @@
+#include <iomanip>
+#include <iostream>
+
+#include "./../ext/headers/args.hxx"
+#include "binary_trace.h"
+
+using namespace dramsim3;
+
+int main(int argc, const char **argv) {
+  args::ArgumentParser parser(
+      "Decode the binary traces of other.cmd_trace and other.addr_trace into "
+      "the text formats of CMD_TRACE and ADDR_TRACE.",
+      "Examples: \n."
+      "./build/dramsim3tracedump dramsim3ch_0cmd.btrace\n"
+      "./build/dramsim3tracedump dramsim3addr.btrace > addr.trace");
+  args::HelpFlag help(parser, "help", "Display the help menu", {'h', "help"});
+  args::Positional<std::string> trace_arg(
+      parser, "trace", "The binary trace file name (mandatory)");
+
+  try {
+    parser.ParseCLI(argc, argv);
+  } catch (const args::Help &) {
+    std::cout << parser;
+    return 0;
+  } catch (const args::ParseError &e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return 1;
+  }
+
+  std::string trace_file = args::get(trace_arg);
+  if (trace_file.empty()) {
+    std::cerr << parser;
+    return 1;
+  }
+
+  if (CommandTraceReader::IsCommandTrace(trace_file)) {
+    CommandTraceReader reader(trace_file);
+    uint64_t clk;
+    Command cmd;
+    while (reader.Next(clk, cmd)) {
+      std::cout << std::left << std::setw(18) << clk << " " << cmd << "\n";
+    }
+  } else if (BinaryTraceReader::IsBinaryTrace(trace_file)) {
+    BinaryTraceReader reader(trace_file);
+    Transaction trans;
+    while (reader.Next(trans)) {
+      std::cout << std::hex << trans.addr << std::dec << " "
+                << (trans.is_write ? "WRITE " : "READ ") << trans.added_cycle
+                << "\n";
+    }
+  } else {
+    std::cerr << trace_file << " is not a binary trace" << std::endl;
+    return 1;
+  }
+  return 0;
+}
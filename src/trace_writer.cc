@@ -0,0 +1,107 @@
+#include "trace_writer.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace dramsim3 {
+
+namespace {
+
+// records moved out of a ring at a time
+const size_t kBatchSize = 4096;
+// how long the writer sleeps when every ring is empty
+const int kIdleSleepMicroseconds = 200;
+
+}  // namespace
+
+TraceRing::TraceRing(size_t capacity) : head_(0), tail_(0) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  records_.resize(size);
+  mask_ = size - 1;
+}
+
+size_t TraceRing::Pop(TraceEntry *out, size_t max) {
+  size_t head = head_.load(std::memory_order_relaxed);
+  size_t tail = tail_.load(std::memory_order_acquire);
+  size_t num = std::min(max, tail - head);
+  for (size_t i = 0; i < num; i++) {
+    out[i] = records_[(head + i) & mask_];
+  }
+  head_.store(head + num, std::memory_order_release);
+  return num;
+}
+
+TraceWriter::TraceWriter() : batch_(kBatchSize), stop_(false) {}
+
+TraceWriter::~TraceWriter() {
+  if (thread_.joinable()) {
+    stop_.store(true);
+    thread_.join();
+  }
+  // whatever the producers pushed after the last pass
+  while (Drain() > 0) {
+  }
+  for (auto &sink : sinks_) {
+    if (sink.cmd_out) {
+      sink.cmd_out->Close();
+    } else {
+      sink.addr_out->Close();
+    }
+  }
+}
+
+TraceRing *TraceWriter::AddCommandTrace(const std::string &trace_file,
+                                        int channel) {
+  Sink sink;
+  sink.ring.reset(new TraceRing(1 << 16));
+  sink.cmd_out.reset(new CommandTraceWriter(trace_file, channel));
+  sinks_.push_back(std::move(sink));
+  return sinks_.back().ring.get();
+}
+
+TraceRing *TraceWriter::AddAddressTrace(const std::string &trace_file) {
+  Sink sink;
+  sink.ring.reset(new TraceRing(1 << 16));
+  sink.addr_out.reset(new BinaryTraceWriter(trace_file));
+  sinks_.push_back(std::move(sink));
+  return sinks_.back().ring.get();
+}
+
+void TraceWriter::Start() { thread_ = std::thread(&TraceWriter::Run, this); }
+
+size_t TraceWriter::Drain() {
+  size_t total = 0;
+  for (auto &sink : sinks_) {
+    size_t num;
+    while ((num = sink.ring->Pop(batch_.data(), batch_.size())) > 0) {
+      for (size_t i = 0; i < num; i++) {
+        const TraceEntry &record = batch_[i];
+        if (sink.cmd_out) {
+          sink.cmd_out->Write(
+              record.cycle,
+              Command(static_cast<CommandType>(record.type), record.addr,
+                      record.hex_addr));
+        } else {
+          sink.addr_out->Write(record.hex_addr, record.type != 0,
+                               record.cycle);
+        }
+      }
+      total += num;
+    }
+  }
+  return total;
+}
+
+void TraceWriter::Run() {
+  while (!stop_.load()) {
+    if (Drain() == 0) {
+      std::this_thread::sleep_for(
+          std::chrono::microseconds(kIdleSleepMicroseconds));
+    }
+  }
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,86 @@
+#ifndef __TRACE_WRITER_H
+#define __TRACE_WRITER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "binary_trace.h"
+#include "common.h"
+
+namespace dramsim3 {
+
+/// @brief One traced command or transaction. type is the CommandType of a
+/// command, or whether a transaction is a write.
+struct TraceEntry {
+  uint64_t cycle;
+  uint64_t hex_addr;
+  Address addr;
+  int type;
+};
+
+/// @brief Lock-free single producer, single consumer ring of trace records.
+/// The producer spins when the ring is full, records are never dropped.
+class TraceRing {
+public:
+  explicit TraceRing(size_t capacity);
+  void Push(const TraceEntry &record) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    while (tail - head_.load(std::memory_order_acquire) == records_.size()) {
+      std::this_thread::yield();
+    }
+    records_[tail & mask_] = record;
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+  /// @brief Move up to max records into out, consumer side.
+  size_t Pop(TraceEntry *out, size_t max);
+
+private:
+  std::vector<TraceEntry> records_;
+  size_t mask_;
+  // next record to pop and to push, on their own cache lines
+  char pad0_[64];
+  std::atomic<size_t> head_;
+  char pad1_[64];
+  std::atomic<size_t> tail_;
+  char pad2_[64];
+};
+
+/// @brief Binary CMD_TRACE/ADDR_TRACE sink (other.cmd_trace and
+/// other.addr_trace). Every producer, i.e. each controller and the host
+/// side of the system, gets its own ring, and a background thread encodes
+/// the rings into their trace files, so the simulation only pays for a copy
+/// into the ring. Command traces are written as CommandTraceWriter files and
+/// address traces as BinaryTraceWriter files, which the trace-based CPU can
+/// replay. Use dramsim3tracedump to turn them into text.
+class TraceWriter {
+public:
+  TraceWriter();
+  /// @brief Drains what is left and closes the files.
+  ~TraceWriter();
+  /// @brief Add a trace file fed by the returned ring, only before Start().
+  TraceRing *AddCommandTrace(const std::string &trace_file, int channel);
+  TraceRing *AddAddressTrace(const std::string &trace_file);
+  void Start();
+
+private:
+  struct Sink {
+    std::unique_ptr<TraceRing> ring;
+    std::unique_ptr<CommandTraceWriter> cmd_out;
+    std::unique_ptr<BinaryTraceWriter> addr_out;
+  };
+  /// @brief Encode what is in the rings, returns the number of records.
+  size_t Drain();
+  void Run();
+
+  std::vector<Sink> sinks_;
+  std::vector<TraceEntry> batch_;
+  std::thread thread_;
+  std::atomic<bool> stop_;
+};
+
+}  // namespace dramsim3
+#endif  // __TRACE_WRITER_H
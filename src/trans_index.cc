@@ -0,0 +1,166 @@
+#include "trans_index.h"
+
+namespace dramsim3 {
+
+TransactionIndex::TransactionIndex(int capacity)
+    : free_head_(-1), slot_mask_(0), slot_bits_(0), size_(0) {
+  if (capacity < 1) {
+    capacity = 1;
+  }
+  entries_.resize(capacity);
+  for (int i = capacity - 1; i >= 0; i--) {
+    entries_[i].next = free_head_;
+    free_head_ = i;
+  }
+  // keep the key table at most half full
+  slot_bits_ = 1;
+  while ((1 << slot_bits_) < 2 * capacity) {
+    slot_bits_++;
+  }
+  slots_.resize(static_cast<size_t>(1) << slot_bits_, Slot{0, -1, -1, 0});
+  slot_mask_ = slots_.size() - 1;
+}
+
+size_t TransactionIndex::HomeSlot(uint64_t addr) const {
+  // Fibonacci hashing, the low address bits are mostly zero
+  return static_cast<size_t>((addr * 0x9E3779B97F4A7C15ull) >>
+                             (64 - slot_bits_));
+}
+
+size_t TransactionIndex::FindSlot(uint64_t addr) const {
+  size_t pos = HomeSlot(addr);
+  while (slots_[pos].head != -1 && slots_[pos].addr != addr) {
+    pos = (pos + 1) & slot_mask_;
+  }
+  return pos;
+}
+
+int TransactionIndex::Count(uint64_t addr) const {
+  const Slot &slot = slots_[FindSlot(addr)];
+  return slot.head == -1 ? 0 : slot.count;
+}
+
+const Transaction *TransactionIndex::Find(uint64_t addr) const {
+  const Slot &slot = slots_[FindSlot(addr)];
+  return slot.head == -1 ? nullptr : &entries_[slot.head].trans;
+}
+
+Transaction *TransactionIndex::Find(uint64_t addr) {
+  const Slot &slot = slots_[FindSlot(addr)];
+  return slot.head == -1 ? nullptr : &entries_[slot.head].trans;
+}
+
+void TransactionIndex::Insert(const Transaction &trans) {
+  if (free_head_ == -1) {
+    Grow();
+  }
+  int idx = AllocEntry(trans);
+  Slot &slot = slots_[FindSlot(trans.addr)];
+  if (slot.head == -1) {
+    slot.addr = trans.addr;
+    slot.head = idx;
+    slot.count = 1;
+  } else {
+    entries_[slot.tail].next = idx;
+    slot.count++;
+  }
+  slot.tail = idx;
+  size_++;
+  return;
+}
+
+bool TransactionIndex::PopFront(uint64_t addr, Transaction &trans) {
+  size_t pos = FindSlot(addr);
+  Slot &slot = slots_[pos];
+  if (slot.head == -1) {
+    return false;
+  }
+  int idx = slot.head;
+  trans = entries_[idx].trans;
+  slot.head = entries_[idx].next;
+  slot.count--;
+  entries_[idx].next = free_head_;
+  free_head_ = idx;
+  size_--;
+  if (slot.count == 0) {
+    EraseSlot(pos);
+  }
+  return true;
+}
+
+void TransactionIndex::Save(CheckpointWriter &writer) const {
+  writer.Put(static_cast<uint64_t>(size_));
+  for (const auto &slot : slots_) {
+    for (int idx = slot.head; idx != -1; idx = entries_[idx].next) {
+      writer.Put(entries_[idx].trans);
+    }
+  }
+}
+
+void TransactionIndex::Load(CheckpointReader &reader) {
+  free_head_ = -1;
+  for (int i = static_cast<int>(entries_.size()) - 1; i >= 0; i--) {
+    entries_[i].next = free_head_;
+    free_head_ = i;
+  }
+  for (auto &slot : slots_) {
+    slot.head = -1;
+  }
+  size_ = 0;
+  uint64_t size;
+  reader.Get(size);
+  for (uint64_t i = 0; i < size; i++) {
+    Transaction trans;
+    reader.Get(trans);
+    Insert(trans);
+  }
+}
+
+int TransactionIndex::AllocEntry(const Transaction &trans) {
+  int idx = free_head_;
+  free_head_ = entries_[idx].next;
+  entries_[idx].trans = trans;
+  entries_[idx].next = -1;
+  return idx;
+}
+
+void TransactionIndex::EraseSlot(size_t pos) {
+  // backward-shift deletion so that lookups never need tombstones
+  slots_[pos].head = -1;
+  size_t hole = pos;
+  size_t next = (pos + 1) & slot_mask_;
+  while (slots_[next].head != -1) {
+    size_t home = HomeSlot(slots_[next].addr);
+    // move the slot into the hole unless its home lies in (hole, next]
+    if (((next - home) & slot_mask_) >= ((next - hole) & slot_mask_)) {
+      slots_[hole] = slots_[next];
+      slots_[next].head = -1;
+      hole = next;
+    }
+    next = (next + 1) & slot_mask_;
+  }
+  return;
+}
+
+void TransactionIndex::Grow() {
+  int old_capacity = static_cast<int>(entries_.size());
+  entries_.resize(2 * old_capacity);
+  for (int i = 2 * old_capacity - 1; i >= old_capacity; i--) {
+    entries_[i].next = free_head_;
+    free_head_ = i;
+  }
+  // entry indices are stable, only the key table has to be rebuilt
+  std::vector<Slot> old_slots;
+  old_slots.swap(slots_);
+  slot_bits_++;
+  slots_.resize(static_cast<size_t>(1) << slot_bits_, Slot{0, -1, -1, 0});
+  slot_mask_ = slots_.size() - 1;
+  for (const auto &slot : old_slots) {
+    if (slot.head != -1) {
+      slots_[FindSlot(slot.addr)] = slot;
+    }
+  }
+  return;
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,66 @@
+#ifndef __TRANS_INDEX_H
+#define __TRANS_INDEX_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "checkpoint.h"
+#include "common.h"
+
+namespace dramsim3 {
+
+/// @brief A flat index of pending transactions keyed by address, used in
+/// place of std::multimap<uint64_t, Transaction>. Transactions live in a slab
+/// with a free list and the keys in an open-addressing table (linear probing
+/// with backward-shift deletion), so nothing is allocated per transaction.
+/// Transactions of the same address are chained in insertion order.
+class TransactionIndex {
+public:
+  /// @brief capacity is the number of transactions the slab is sized for. It
+  /// doubles in the rare case that more are pending, e.g. many merged reads.
+  explicit TransactionIndex(int capacity);
+  int Count(uint64_t addr) const;
+  bool Empty() const { return size_ == 0; }
+  int Size() const { return size_; }
+  /// @brief Append trans after the pending transactions of the same address.
+  void Insert(const Transaction &trans);
+  /// @brief The oldest pending transaction of addr, nullptr if there is none.
+  const Transaction *Find(uint64_t addr) const;
+  Transaction *Find(uint64_t addr);
+  /// @brief Remove the oldest pending transaction of addr into trans, return
+  /// false if there is none.
+  bool PopFront(uint64_t addr, Transaction &trans);
+  /// @brief Checkpointing, only the pending transactions and their order per
+  /// address are kept, not where they are in the tables.
+  void Save(CheckpointWriter &writer) const;
+  void Load(CheckpointReader &reader);
+
+private:
+  struct Entry {
+    Transaction trans;
+    int next;
+  };
+  // head == -1 marks an empty slot
+  struct Slot {
+    uint64_t addr;
+    int head;
+    int tail;
+    int count;
+  };
+
+  size_t FindSlot(uint64_t addr) const;
+  size_t HomeSlot(uint64_t addr) const;
+  int AllocEntry(const Transaction &trans);
+  void Grow();
+  void EraseSlot(size_t pos);
+
+  std::vector<Entry> entries_;
+  int free_head_;
+  std::vector<Slot> slots_;
+  size_t slot_mask_;
+  int slot_bits_;
+  int size_;
+};
+
+}  // namespace dramsim3
+#endif  // __TRANS_INDEX_H
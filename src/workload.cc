@@ -0,0 +1,326 @@
+#include "workload.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+#include "INIReader.h"
+#include "common.h"
+
+namespace dramsim3 {
+
+namespace {
+
+std::string ToLower(std::string str) {
+  std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+  return str;
+}
+
+// a byte count with an optional K, M or G suffix
+uint64_t ParseSize(const std::string &section, const std::string &name,
+                   const std::string &value) {
+  char *end;
+  uint64_t size = strtoull(value.c_str(), &end, 0);
+  std::string suffix = ToLower(end);
+  if (end == value.c_str() ||
+      (suffix != "" && suffix != "k" && suffix != "m" && suffix != "g")) {
+    std::cerr << "Bad size " << value << " of " << section << "." << name
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  int shift = suffix == "k" ? 10 : suffix == "m" ? 20 : suffix == "g" ? 30 : 0;
+  return size << shift;
+}
+
+StreamSpec ReadStream(const INIReader &reader, const std::string &section) {
+  StreamSpec stream;
+  stream.name = ToLower(section.substr(section.find('.') + 1));
+  std::string pattern = reader.Get(section, "pattern", "RANDOM");
+  if (pattern == "STRIDE") {
+    stream.pattern = StreamPattern::STRIDE;
+  } else if (pattern == "RANDOM") {
+    stream.pattern = StreamPattern::RANDOM;
+  } else if (pattern == "POINTER_CHASE") {
+    stream.pattern = StreamPattern::POINTER_CHASE;
+  } else if (pattern == "ZIPF") {
+    stream.pattern = StreamPattern::ZIPF;
+  } else if (pattern == "GUPS") {
+    stream.pattern = StreamPattern::GUPS;
+  } else {
+    std::cerr << "Unknown pattern " << pattern << " of " << section
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  stream.base = ParseSize(section, "base", reader.Get(section, "base", "0"));
+  stream.footprint =
+      ParseSize(section, "footprint", reader.Get(section, "footprint", "64M"));
+  stream.line_size =
+      ParseSize(section, "line_size", reader.Get(section, "line_size", "64"));
+  stream.stride = ParseSize(section, "stride",
+                            reader.Get(section, "stride",
+                                       std::to_string(stream.line_size)));
+  stream.read_ratio = reader.GetReal(section, "read_ratio", 1.0);
+  stream.zipf_alpha = reader.GetReal(section, "zipf_alpha", 0.99);
+  if (stream.line_size == 0 || stream.footprint < stream.line_size ||
+      stream.footprint % stream.line_size != 0) {
+    std::cerr << "The footprint of " << section
+              << " has to be a multiple of its line_size" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  if (stream.read_ratio < 0.0 || stream.read_ratio > 1.0 ||
+      stream.zipf_alpha <= 0.0) {
+    std::cerr << "read_ratio of " << section
+              << " has to be within 0 and 1 and zipf_alpha positive"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  return stream;
+}
+
+PhaseSpec ReadPhase(const INIReader &reader, const std::string &section,
+                    const PhaseSpec &defaults,
+                    const std::vector<StreamSpec> &streams) {
+  PhaseSpec phase;
+  phase.cycles =
+      ParseSize(section, "cycles", reader.Get(section, "cycles", "0"));
+  phase.rate = reader.GetReal(section, "rate", defaults.rate);
+  phase.outstanding =
+      reader.GetInteger(section, "outstanding", defaults.outstanding);
+  if (phase.rate <= 0.0 || phase.outstanding < 0) {
+    std::cerr << "rate of " << section
+              << " has to be positive and outstanding not negative"
+              << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  std::string mix = reader.Get(section, "mix", "");
+  std::replace(mix.begin(), mix.end(), ',', ' ');
+  std::istringstream entries(mix);
+  std::string entry;
+  while (entries >> entry) {
+    size_t colon = entry.find(':');
+    std::string name = ToLower(entry.substr(0, colon));
+    double weight =
+        colon == std::string::npos ? 1.0 : std::stod(entry.substr(colon + 1));
+    auto it = std::find_if(
+        streams.begin(), streams.end(),
+        [&name](const StreamSpec &stream) { return stream.name == name; });
+    if (it == streams.end() || weight <= 0.0) {
+      std::cerr << "Bad mix entry " << entry << " of " << section << std::endl;
+      AbruptExit(__FILE__, __LINE__);
+    }
+    phase.mix.push_back(std::make_pair(it - streams.begin(), weight));
+  }
+  if (phase.mix.empty()) {
+    std::cerr << section << " has no mix" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  return phase;
+}
+
+// helpers of the zipf sampler, log1p(x) / x and expm1(x) / x accurate near 0
+double Helper1(double x) {
+  return std::abs(x) > 1e-8 ? std::log1p(x) / x
+                            : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+}
+
+double Helper2(double x) {
+  return std::abs(x) > 1e-8
+             ? std::expm1(x) / x
+             : 1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x));
+}
+
+// an integral of x^-alpha, and its inverse
+double ZipfH(double x, double alpha) {
+  double log_x = std::log(x);
+  return Helper2((1.0 - alpha) * log_x) * log_x;
+}
+
+double ZipfHInverse(double x, double alpha) {
+  double t = std::max(-1.0, x * (1.0 - alpha));
+  return std::exp(Helper1(t) * x);
+}
+
+double ZipfWeight(double x, double alpha) {
+  return std::exp(-alpha * std::log(x));
+}
+
+}  // namespace
+
+WorkloadSpec ReadWorkloadSpec(const std::string &spec_file) {
+  INIReader reader(spec_file);
+  if (reader.ParseError() < 0) {
+    std::cerr << "Can't load workload spec - " << spec_file << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+  WorkloadSpec spec;
+  spec.seed = reader.GetInteger("workload", "seed", 1);
+  for (const auto &section : reader.Sections()) {
+    if (ToLower(section).compare(0, 7, "stream.") == 0) {
+      spec.streams.push_back(ReadStream(reader, section));
+    }
+  }
+  if (spec.streams.empty()) {
+    std::cerr << spec_file << " has no [stream.<name>] section" << std::endl;
+    AbruptExit(__FILE__, __LINE__);
+  }
+
+  PhaseSpec defaults;
+  defaults.rate = reader.GetReal("workload", "rate", 1.0);
+  defaults.outstanding = reader.GetInteger("workload", "outstanding", 0);
+  for (int i = 0;; i++) {
+    std::string section = "phase" + std::to_string(i);
+    if (reader.Sections().count(section) == 0) {
+      break;
+    }
+    spec.phases.push_back(ReadPhase(reader, section, defaults, spec.streams));
+  }
+  if (spec.phases.empty()) {
+    defaults.cycles = 0;
+    for (size_t i = 0; i < spec.streams.size(); i++) {
+      defaults.mix.push_back(std::make_pair(static_cast<int>(i), 1.0));
+    }
+    spec.phases.push_back(defaults);
+  }
+  return spec;
+}
+
+WorkloadGenerator::WorkloadGenerator(const WorkloadSpec &spec)
+    : spec_(spec), gen_(spec.seed), uniform_(0.0, 1.0), phase_(0),
+      phase_start_(0) {
+  for (const auto &stream_spec : spec_.streams) {
+    Stream stream;
+    stream.num_lines = stream_spec.footprint / stream_spec.line_size;
+    stream.mask = 1;
+    while (stream.mask < stream.num_lines) {
+      stream.mask <<= 1;
+    }
+    stream.mask -= 1;
+    stream.pos = 0;
+    stream.waiting = false;
+    stream.write_next = false;
+    stream.write_line = 0;
+    double n = static_cast<double>(stream.num_lines);
+    double alpha = stream_spec.zipf_alpha;
+    stream.zipf_h_x1 = ZipfH(1.5, alpha) - 1.0;
+    stream.zipf_h_n = ZipfH(n + 0.5, alpha);
+    stream.zipf_s = 2.0 - ZipfHInverse(ZipfH(2.5, alpha) -
+                                           ZipfWeight(2.0, alpha),
+                                       alpha);
+    streams_.push_back(stream);
+  }
+}
+
+const PhaseSpec &WorkloadGenerator::Phase(uint64_t clk) {
+  while (spec_.phases[phase_].cycles > 0 &&
+         clk >= phase_start_ + spec_.phases[phase_].cycles) {
+    phase_start_ += spec_.phases[phase_].cycles;
+    phase_ = (phase_ + 1) % spec_.phases.size();
+  }
+  return spec_.phases[phase_];
+}
+
+bool WorkloadGenerator::Next(WorkloadRequest &req) {
+  const PhaseSpec &phase = spec_.phases[phase_];
+  double total = 0.0;
+  for (const auto &entry : phase.mix) {
+    total += streams_[entry.first].waiting ? 0.0 : entry.second;
+  }
+  if (total == 0.0) {
+    return false;
+  }
+  double pick = uniform_(gen_) * total;
+  int index = -1;
+  for (const auto &entry : phase.mix) {
+    if (streams_[entry.first].waiting) {
+      continue;
+    }
+    index = entry.first;
+    pick -= entry.second;
+    if (pick < 0.0) {
+      break;
+    }
+  }
+
+  const StreamSpec &spec = spec_.streams[index];
+  Stream &stream = streams_[index];
+  req.stream = index;
+  switch (spec.pattern) {
+    case StreamPattern::STRIDE:
+      req.addr = spec.base + (stream.pos * spec.stride) % spec.footprint;
+      stream.pos++;
+      req.is_write = uniform_(gen_) >= spec.read_ratio;
+      return true;
+    case StreamPattern::POINTER_CHASE:
+      stream.waiting = true;
+      req.is_write = false;
+      break;
+    case StreamPattern::GUPS:
+      // the update of a line follows its read
+      if (stream.write_next) {
+        stream.write_next = false;
+        req.addr = spec.base + stream.write_line * spec.line_size;
+        req.is_write = true;
+        return true;
+      }
+      stream.write_next = true;
+      req.is_write = false;
+      break;
+    default: req.is_write = uniform_(gen_) >= spec.read_ratio; break;
+  }
+  uint64_t line = NextLine(spec, stream);
+  stream.write_line = line;
+  req.addr = spec.base + line * spec.line_size;
+  return true;
+}
+
+void WorkloadGenerator::ReadDone(int stream) {
+  streams_[stream].waiting = false;
+}
+
+uint64_t WorkloadGenerator::NextLine(const StreamSpec &spec, Stream &stream) {
+  switch (spec.pattern) {
+    case StreamPattern::POINTER_CHASE:
+      // a full period LCG modulo the power of 2 above the footprint visits
+      // every line once per lap, in an order that defeats row locality
+      do {
+        stream.pos = (stream.pos * 6364136223846793005ull +
+                      1442695040888963407ull) &
+                     stream.mask;
+      } while (stream.pos >= stream.num_lines);
+      return stream.pos;
+    case StreamPattern::ZIPF:
+      return Scatter(stream, SampleZipf(spec, stream) - 1);
+    default: return gen_() % stream.num_lines;
+  }
+}
+
+uint64_t WorkloadGenerator::Scatter(const Stream &stream, uint64_t line) const {
+  // an odd multiplier is a bijection modulo a power of 2, walking the cycle
+  // until the line is back in range keeps it one on [0, num_lines)
+  do {
+    line = (line * 0x9E3779B97F4A7C15ull + 0x632BE59BD9B4E019ull) & stream.mask;
+  } while (line >= stream.num_lines);
+  return line;
+}
+
+uint64_t WorkloadGenerator::SampleZipf(const StreamSpec &spec,
+                                       const Stream &stream) {
+  // rejection-inversion sampling (Hormann and Derflinger), O(1) per sample
+  // with no table over the lines
+  double alpha = spec.zipf_alpha;
+  while (true) {
+    double u = stream.zipf_h_n +
+               uniform_(gen_) * (stream.zipf_h_x1 - stream.zipf_h_n);
+    double x = ZipfHInverse(u, alpha);
+    uint64_t k = static_cast<uint64_t>(x + 0.5);
+    k = std::min(std::max(k, static_cast<uint64_t>(1)), stream.num_lines);
+    double weight = ZipfWeight(static_cast<double>(k), alpha);
+    if (k - x <= stream.zipf_s || u >= ZipfH(k + 0.5, alpha) - weight) {
+      return k;
+    }
+  }
+}
+
+}  // namespace dramsim3
@@ -0,0 +1,128 @@
+#ifndef __WORKLOAD_H
+#define __WORKLOAD_H
+
+#include <stdint.h>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dramsim3 {
+
+/// @brief Address patterns of a synthetic stream.
+enum class StreamPattern {
+  STRIDE,         // base + i * stride, wrapping around the footprint
+  RANDOM,         // uniform over the lines of the footprint
+  POINTER_CHASE,  // dependent reads, the next one waits for the last one
+  ZIPF,           // zipfian over the lines, a few hot ones and a cold tail
+  GUPS,           // random read-modify-writes, a read then a write per line
+  SIZE
+};
+
+/// @brief One address stream of a synthetic workload, a [stream.<name>]
+/// section of the spec file.
+struct StreamSpec {
+  std::string name;
+  StreamPattern pattern;
+  uint64_t base;
+  // bytes the stream touches from base, a multiple of line_size
+  uint64_t footprint;
+  // STRIDE, bytes between consecutive requests
+  uint64_t stride;
+  uint64_t line_size;
+  // share of reads, STRIDE, RANDOM and ZIPF only
+  double read_ratio;
+  // ZIPF, the line of rank k is picked with a weight of k^-zipf_alpha
+  double zipf_alpha;
+};
+
+/// @brief A phase of a synthetic workload, a [phase<N>] section of the spec
+/// file. The phases run in order, and over again after the last one.
+struct PhaseSpec {
+  // length of the phase, 0 for one that never ends
+  uint64_t cycles;
+  // requests offered per cycle (open loop), used unless outstanding is set
+  double rate;
+  // requests kept in flight (closed loop)
+  int outstanding;
+  // stream index and weight of the streams requests are drawn from
+  std::vector<std::pair<int, double>> mix;
+};
+
+struct WorkloadSpec {
+  uint64_t seed;
+  std::vector<StreamSpec> streams;
+  std::vector<PhaseSpec> phases;
+};
+
+/// @brief Read a workload spec, an INI file such as
+///   [workload]
+///   seed = 1
+///   rate = 0.5          ; default of the phases
+///   outstanding = 0     ; default of the phases
+///   [stream.scan]
+///   pattern = STRIDE    ; STRIDE, RANDOM, POINTER_CHASE, ZIPF or GUPS
+///   base = 0
+///   footprint = 256M    ; K, M and G suffixes are powers of 2
+///   stride = 64
+///   line_size = 64
+///   read_ratio = 0.75
+///   zipf_alpha = 0.99
+///   [phase0]
+///   cycles = 100000
+///   mix = scan:3 hot:1  ; stream:weight, weights default to 1
+/// A section without any key is ignored. Without phase sections there is one
+/// endless phase mixing every stream evenly.
+WorkloadSpec ReadWorkloadSpec(const std::string &spec_file);
+
+/// @brief A request of a synthetic workload.
+struct WorkloadRequest {
+  uint64_t addr;
+  bool is_write;
+  int stream;
+};
+
+/// @brief Generates the requests of a workload spec on the fly, no trace is
+/// read or kept. The generator only decides what the next request is, when
+/// it is issued is up to the caller, see SyntheticCPU.
+class WorkloadGenerator {
+public:
+  explicit WorkloadGenerator(const WorkloadSpec &spec);
+  /// @brief The phase on at clk, which must not go backwards.
+  const PhaseSpec &Phase(uint64_t clk);
+  /// @brief Draw the next request from the streams of the current phase,
+  /// false if all of them wait for a pointer chase read.
+  bool Next(WorkloadRequest &req);
+  /// @brief A read of the stream returned, a pointer chase may go on.
+  void ReadDone(int stream);
+  const WorkloadSpec &Spec() const { return spec_; }
+
+private:
+  struct Stream {
+    uint64_t num_lines;
+    // mask of the power of 2 at or above num_lines
+    uint64_t mask;
+    uint64_t pos;
+    // POINTER_CHASE, a read is in flight
+    bool waiting;
+    // GUPS, the line whose write is next
+    bool write_next;
+    uint64_t write_line;
+    // ZIPF, constants of the rejection-inversion sampler
+    double zipf_h_x1, zipf_h_n, zipf_s;
+  };
+  uint64_t NextLine(const StreamSpec &spec, Stream &stream);
+  // a permutation of [0, num_lines), so that hot ranks are spread out
+  uint64_t Scatter(const Stream &stream, uint64_t line) const;
+  uint64_t SampleZipf(const StreamSpec &spec, const Stream &stream);
+
+  WorkloadSpec spec_;
+  std::vector<Stream> streams_;
+  std::mt19937_64 gen_;
+  std::uniform_real_distribution<double> uniform_;
+  size_t phase_;
+  uint64_t phase_start_;
+};
+
+}  // namespace dramsim3
+#endif  // __WORKLOAD_H
@@ -0,0 +1,96 @@
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include "binary_trace.h"
+#include "catch.hpp"
+#include "trace_writer.h"
+
+TEST_CASE("Binary trace", "[binary_trace]") {
+    const std::string trace_name = "test_binary_trace.bin";
+
+    SECTION("TEST records round trip through writer and reader") {
+        std::vector<dramsim3::Transaction> written;
+        std::mt19937_64 gen(7);
+        uint64_t cycle = 0;
+        for (int i = 0; i < 5000; i++) {
+            // mix of strides, random jumps and repeated cycles
+            uint64_t addr = i % 3 == 0 ? gen() : static_cast<uint64_t>(i) * 64;
+            cycle += gen() % 4;
+            dramsim3::Transaction trans(addr, gen() % 2 == 0);
+            trans.added_cycle = cycle;
+            written.push_back(trans);
+        }
+        {
+            dramsim3::BinaryTraceWriter writer(trace_name);
+            for (const auto &trans : written) {
+                writer.Write(trans.addr, trans.is_write, trans.added_cycle);
+            }
+        }
+
+        REQUIRE(dramsim3::BinaryTraceReader::IsBinaryTrace(trace_name));
+        dramsim3::BinaryTraceReader reader(trace_name);
+        REQUIRE(reader.NumRecords() == written.size());
+        dramsim3::Transaction trans;
+        for (const auto &expected : written) {
+            REQUIRE(reader.Next(trans));
+            REQUIRE(trans.addr == expected.addr);
+            REQUIRE(trans.is_write == expected.is_write);
+            REQUIRE(trans.added_cycle == expected.added_cycle);
+        }
+        REQUIRE_FALSE(reader.Next(trans));
+        std::remove(trace_name.c_str());
+    }
+
+    SECTION("TEST text traces are not taken for binary ones") {
+        std::ofstream(trace_name) << "0x40 READ 0\n";
+        REQUIRE_FALSE(dramsim3::BinaryTraceReader::IsBinaryTrace(trace_name));
+        std::remove(trace_name.c_str());
+    }
+}
+
+TEST_CASE("Binary command trace", "[binary_trace]") {
+    const std::string trace_name = "test_command_trace.bin";
+
+    SECTION("TEST commands round trip through the background writer") {
+        // more than a ring holds, so the producer has to wait for the writer
+        const int num_cmds = 100000;
+        {
+            dramsim3::TraceWriter writer;
+            dramsim3::TraceRing *ring = writer.AddCommandTrace(trace_name, 3);
+            writer.Start();
+            for (int i = 0; i < num_cmds; i++) {
+                dramsim3::Address addr(3, i % 2, i % 4, i % 3, i, i % 128);
+                ring->Push(dramsim3::TraceEntry{
+                    static_cast<uint64_t>(i) * 5, 0, addr,
+                    static_cast<int>(i % 2 == 0
+                                         ? dramsim3::CommandType::ACTIVATE
+                                         : dramsim3::CommandType::READ)});
+            }
+        }
+
+        REQUIRE(dramsim3::CommandTraceReader::IsCommandTrace(trace_name));
+        REQUIRE_FALSE(dramsim3::BinaryTraceReader::IsBinaryTrace(trace_name));
+        dramsim3::CommandTraceReader reader(trace_name);
+        REQUIRE(reader.Channel() == 3);
+        REQUIRE(reader.NumRecords() == num_cmds);
+        uint64_t clk;
+        dramsim3::Command cmd;
+        for (int i = 0; i < num_cmds; i++) {
+            REQUIRE(reader.Next(clk, cmd));
+            REQUIRE(clk == static_cast<uint64_t>(i) * 5);
+            REQUIRE(cmd.cmd_type == (i % 2 == 0
+                                         ? dramsim3::CommandType::ACTIVATE
+                                         : dramsim3::CommandType::READ));
+            REQUIRE(cmd.Channel() == 3);
+            REQUIRE(cmd.Rank() == i % 2);
+            REQUIRE(cmd.Bankgroup() == i % 4);
+            REQUIRE(cmd.Bank() == i % 3);
+            REQUIRE(cmd.Row() == i);
+            REQUIRE(cmd.Column() == i % 128);
+        }
+        REQUIRE_FALSE(reader.Next(clk, cmd));
+        std::remove(trace_name.c_str());
+    }
+}
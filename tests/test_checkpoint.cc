@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "catch.hpp"
+#include "checkpoint.h"
+#include "configuration.h"
+#include "hmc.h"
+#include "sampled_system.h"
+
+namespace {
+
+struct Return {
+    uint64_t cycle;
+    uint64_t addr;
+    bool operator==(const Return &other) const {
+        return cycle == other.cycle && addr == other.addr;
+    }
+};
+
+// random traffic over a few rows so that there are hits, misses and conflicts
+void Drive(dramsim3::BaseDRAMSystem &dramsys, std::mt19937_64 &gen,
+           uint64_t &clk, int cycles, int addr_bits) {
+    for (int i = 0; i < cycles; i++, clk++) {
+        uint64_t addr = (gen() % (static_cast<uint64_t>(1) << addr_bits)) &
+                        ~static_cast<uint64_t>(63);
+        bool is_write = gen() % 3 == 0;
+        if (gen() % 2 == 0 && dramsys.WillAcceptTransaction(addr, is_write)) {
+            dramsys.AddTransaction(addr, is_write);
+        }
+        dramsys.ClockTick();
+    }
+}
+
+std::string FileContents(const std::string &name) {
+    std::ifstream file(name, std::ifstream::binary);
+    return std::string(std::istreambuf_iterator<char>(file),
+                       std::istreambuf_iterator<char>());
+}
+
+// a restored system has to behave exactly like the one it was taken from
+template <typename System>
+void CheckRestore(const std::string &config_file,
+                  void (*tweak)(dramsim3::Config &), int addr_bits = 22) {
+    const std::string first = "test_checkpoint_first.ckpt";
+    const std::string second = "test_checkpoint_second.ckpt";
+    dramsim3::Config config_a(config_file, ".");
+    dramsim3::Config config_b(config_file, ".");
+    tweak(config_a);
+    tweak(config_b);
+    std::vector<Return> returns_a, returns_b;
+    uint64_t clk_a = 0, clk_b = 0;
+    auto callback_a = [&](uint64_t addr) {
+        returns_a.push_back(Return{clk_a, addr});
+    };
+    auto callback_b = [&](uint64_t addr) {
+        returns_b.push_back(Return{clk_b, addr});
+    };
+    System dramsys_a(config_a, ".", callback_a, callback_a);
+    System dramsys_b(config_b, ".", callback_b, callback_b);
+
+    std::mt19937_64 gen_a(11);
+    Drive(dramsys_a, gen_a, clk_a, 20000, addr_bits);
+    {
+        dramsim3::CheckpointWriter writer(first);
+        dramsys_a.Save(writer);
+    }
+    {
+        dramsim3::CheckpointReader reader(first);
+        dramsys_b.Load(reader);
+        REQUIRE(reader.AtEnd());
+    }
+    std::mt19937_64 gen_b = gen_a;
+    clk_b = clk_a;
+    returns_a.clear();
+    Drive(dramsys_a, gen_a, clk_a, 20000, addr_bits);
+    Drive(dramsys_b, gen_b, clk_b, 20000, addr_bits);
+    REQUIRE_FALSE(returns_a.empty());
+    REQUIRE(returns_a == returns_b);
+
+    // and end up in the same state
+    {
+        dramsim3::CheckpointWriter writer_a(first);
+        dramsys_a.Save(writer_a);
+        dramsim3::CheckpointWriter writer_b(second);
+        dramsys_b.Save(writer_b);
+    }
+    REQUIRE(FileContents(first) == FileContents(second));
+    std::remove(first.c_str());
+    std::remove(second.c_str());
+}
+
+void NoTweak(dramsim3::Config &config) {}
+
+void Sampling(dramsim3::Config &config) {
+    config.sampling = true;
+    config.sample_fast_forward_cycles = 3000;
+    config.sample_warmup_cycles = 1000;
+    config.sample_measure_cycles = 1000;
+}
+
+void FourCubes(dramsim3::Config &config) { config.num_cubes = 4; }
+
+}  // namespace
+
+TEST_CASE("Checkpoint restore", "[checkpoint]") {
+    SECTION("TEST DDR4 system resumes identically") {
+        CheckRestore<dramsim3::JedecDRAMSystem>(
+            "configs/DDR4_8Gb_x8_3200.ini", NoTweak);
+    }
+
+    SECTION("TEST sampled system resumes identically") {
+        CheckRestore<dramsim3::SampledDRAMSystem>("configs/HBM1_4Gb_x128.ini",
+                                                  Sampling);
+    }
+
+    SECTION("TEST HMC system resumes identically") {
+        CheckRestore<dramsim3::HMCMemorySystem>(
+            "configs/HMC2_8GB_4Lx16.ini", NoTweak);
+    }
+
+    SECTION("TEST HMC chain resumes identically") {
+        // over all four 8GB cubes
+        CheckRestore<dramsim3::HMCChainSystem>("configs/HMC2_8GB_4Lx16.ini",
+                                               FourCubes, 35);
+    }
+}
@@ -1,4 +1,10 @@
 #define CATCH_CONFIG_MAIN
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include "address_profile.h"
 #include "catch.hpp"
 #include "configuration.h"
 
@@ -93,3 +99,146 @@ TEST_CASE("Address Mapping", "[config]") {
     }
 }
 
+
+TEST_CASE("XOR hashed address mapping", "[config]") {
+    // same config as above, hashing bank and bankgroup with row bits
+    std::ifstream base_file("configs/HBM1_4Gb_x128.ini");
+    std::stringstream content;
+    content << base_file.rdbuf();
+    std::string ini = content.str();
+    ini.replace(ini.find("[system]"), 8, "[system]\naddress_xor = babg");
+    std::ofstream("test_xor_mapping.ini") << ini;
+    dramsim3::Config config("test_xor_mapping.ini", ".");
+    std::remove("test_xor_mapping.ini");
+
+    SECTION("TEST xor fields take successive row bits") {
+        REQUIRE(config.ba_xor_pos == config.ro_pos);
+        REQUIRE(config.bg_xor_pos == config.ro_pos + 2);
+        REQUIRE(config.ch_xor_mask == 0);
+        REQUIRE(config.ra_xor_mask == 0);
+    }
+
+    SECTION("TEST row bits are folded into bank and bankgroup") {
+        uint64_t row_lsb = 1ull << (config.ro_pos + config.shift_bits);
+        auto addr = config.AddressMapping(row_lsb);
+        REQUIRE(addr.row == 1);
+        REQUIRE(addr.bank == 1);
+        REQUIRE(addr.bankgroup == 0);
+
+        addr = config.AddressMapping(0b1100 * row_lsb);
+        REQUIRE(addr.row == 0b1100);
+        REQUIRE(addr.bank == 0);
+        REQUIRE(addr.bankgroup == 3);
+
+        uint64_t bank_lsb = 1ull << (config.ba_pos + config.shift_bits);
+        addr = config.AddressMapping(row_lsb | bank_lsb);
+        REQUIRE(addr.bank == 0);
+        REQUIRE(addr.channel == config.AddressChannel(row_lsb | bank_lsb));
+    }
+}
+
+TEST_CASE("Config overrides", "[config]") {
+    dramsim3::ConfigOverrides overrides = {
+        {"system.trans_queue_size", "7"},
+        {"system.address_mapping", "rorabgbachco"},
+        {"other.epoch_period", "1234"}};
+    dramsim3::Config base("configs/HBM1_4Gb_x128.ini", ".");
+    dramsim3::Config config("configs/HBM1_4Gb_x128.ini", ".", overrides);
+
+    SECTION("TEST overridden values replace the ones in the file") {
+        REQUIRE(base.trans_queue_size != 7);
+        REQUIRE(config.trans_queue_size == 7);
+        REQUIRE(config.address_mapping == "rorabgbachco");
+        REQUIRE(config.epoch_period == 1234);
+    }
+
+    SECTION("TEST other values are kept") {
+        REQUIRE(config.channels == base.channels);
+        REQUIRE(config.tCK == base.tCK);
+        REQUIRE(config.cmd_queue_size == base.cmd_queue_size);
+    }
+}
+
+TEST_CASE("Config cache", "[config]") {
+    dramsim3::ConfigCache::Clear();
+    dramsim3::ConfigOverrides overrides = {{"system.trans_queue_size", "7"}};
+    auto base = dramsim3::ConfigCache::Get("configs/HBM1_4Gb_x128.ini", ".");
+    auto again = dramsim3::ConfigCache::Get("configs/HBM1_4Gb_x128.ini", ".");
+    auto config = dramsim3::ConfigCache::Get("configs/HBM1_4Gb_x128.ini", ".",
+                                             overrides);
+    dramsim3::Config uncached("configs/HBM1_4Gb_x128.ini", ".", overrides);
+
+    SECTION("TEST a config is derived once and shared") {
+        REQUIRE(base == again);
+        REQUIRE(base != config);
+        REQUIRE(dramsim3::ConfigCache::NumConfigsDerived() == 2);
+    }
+
+    SECTION("TEST overrides are applied on top of the parsed file") {
+        REQUIRE(dramsim3::ConfigCache::NumFilesParsed() == 1);
+        REQUIRE(config->trans_queue_size == 7);
+        REQUIRE(base->trans_queue_size != 7);
+    }
+
+    SECTION("TEST cached configs match the uncached ones") {
+        REQUIRE(config->channels == uncached.channels);
+        REQUIRE(config->tCK == uncached.tCK);
+        REQUIRE(config->address_mapping == uncached.address_mapping);
+        REQUIRE(config->json_stats_name == uncached.json_stats_name);
+        REQUIRE(config->ch_mask == uncached.ch_mask);
+        REQUIRE(config->tRFC == uncached.tRFC);
+    }
+}
+
+TEST_CASE("Address mapping prediction", "[config]") {
+    dramsim3::Config config("configs/HBM1_4Gb_x128.ini", ".");
+    // a stream of consecutive requests
+    std::vector<uint64_t> addrs;
+    dramsim3::AddressProfile profile(config);
+    for (uint64_t i = 0; i < 20000; i++) {
+        uint64_t addr = i << config.shift_bits;
+        addrs.push_back(addr);
+        profile.Add(addr);
+    }
+
+    SECTION("TEST bit statistics") {
+        REQUIRE(profile.Count() == 20000);
+        REQUIRE(profile.FlipRate(0) == Approx(1.0));
+        REQUIRE(profile.FlipRate(1) == Approx(0.5).epsilon(0.01));
+        REQUIRE(profile.Entropy(0) == Approx(1.0));
+        // bit 20 is never set
+        REQUIRE(profile.Entropy(20) == 0.0);
+        REQUIRE(profile.RowLocality(0) == 0.0);
+        // all but one of every 16 consecutive pairs stay in a 16 block
+        REQUIRE(profile.RowLocality(4) == Approx(15.0 / 16).epsilon(0.01));
+    }
+
+    SECTION("TEST row locality of the mapping is predicted") {
+        dramsim3::Config col_low = config;
+        col_low.SetAddressMapping("rochrababgco", "");
+        dramsim3::Config row_low = config;
+        row_low.SetAddressMapping("chrababgcoro", "");
+        auto col_low_prediction = dramsim3::PredictMapping(col_low, addrs);
+        auto row_low_prediction = dramsim3::PredictMapping(row_low, addrs);
+        REQUIRE(col_low_prediction.address_mapping == "rochrababgco");
+        REQUIRE(col_low_prediction.row_hit_rate > 0.9);
+        REQUIRE(row_low_prediction.row_hit_rate < 0.1);
+        REQUIRE(col_low_prediction.requests_per_cycle >
+                row_low_prediction.requests_per_cycle);
+        REQUIRE(col_low_prediction.channel_imbalance >= 1.0);
+    }
+
+    SECTION("TEST candidates are distinct and valid") {
+        auto candidates = dramsim3::CandidateMappings(config, false);
+        std::set<std::pair<std::string, std::string>> unique(
+            candidates.begin(), candidates.end());
+        REQUIRE(unique.size() == candidates.size());
+        auto hashed = dramsim3::CandidateMappings(config, true);
+        REQUIRE(hashed.size() > candidates.size());
+        for (const auto &candidate : hashed) {
+            dramsim3::Config remapped = config;
+            remapped.SetAddressMapping(candidate.first, candidate.second);
+            REQUIRE(remapped.address_xor == candidate.second);
+        }
+    }
+}
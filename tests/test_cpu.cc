@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+#include "cpu.h"
+
+namespace {
+
+std::string WriteTrace(const std::string &file, const std::string &text) {
+    std::ofstream(file) << text;
+    return file;
+}
+
+}  // namespace
+
+TEST_CASE("Multi trace CPU", "[cpu]") {
+    // every request is due at once, so the MSHRs are the only limit
+    std::string trace0;
+    for (int i = 0; i < 12; i++) {
+        trace0 += "0x1000 READ 0\n";
+    }
+    for (int i = 0; i < 12; i++) {
+        trace0 += "0x" + std::to_string(i + 2) + "0000 READ 0\n";
+    }
+    std::string trace1;
+    for (int i = 0; i < 6; i++) {
+        trace1 += "0x1000 READ 0\n0x1000 WRITE 0\n";
+    }
+    std::vector<std::string> traces = {
+        WriteTrace("test_cpu_0.trace", trace0),
+        WriteTrace("test_cpu_1.trace", trace1)};
+    const int mshrs = 3;
+    dramsim3::MultiTraceCPU cpu("configs/DDR4_8Gb_x8_2400.ini", ".", traces,
+                                mshrs, "rr");
+
+    int max_outstanding = 0;
+    for (int clk = 0; clk < 20000; clk++) {
+        cpu.ClockTick();
+        for (int core = 0; core < 2; core++) {
+            max_outstanding = std::max(max_outstanding, cpu.InFlight(core));
+        }
+    }
+    for (const auto &trace : traces) {
+        std::remove(trace.c_str());
+    }
+
+    SECTION("TEST in flight requests stay within the MSHRs") {
+        REQUIRE(max_outstanding == mshrs);
+    }
+
+    SECTION("TEST a repeated address completes each request once") {
+        REQUIRE(cpu.Reads(0) == 24);
+        REQUIRE(cpu.Writes(0) == 0);
+        REQUIRE(cpu.Reads(1) == 6);
+        REQUIRE(cpu.Writes(1) == 6);
+        REQUIRE(cpu.InFlight(0) == 0);
+        REQUIRE(cpu.InFlight(1) == 0);
+    }
+}
@@ -1,6 +1,25 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "analytical_system.h"
 #include "catch.hpp"
+#include "channel_state.h"
 #include "configuration.h"
+#include "controller.h"
 #include "dram_system.h"
+#include "sampled_system.h"
+#include "submission.h"
+#include "thread_pool.h"
+#ifdef LATENCY_BREAKDOWN
+#include "latency_breakdown.h"
+#endif  // LATENCY_BREAKDOWN
 
 bool call_back_called = false;
 void dummy_call_back(uint64_t addr) {
@@ -30,3 +49,1295 @@ TEST_CASE("Jedec DRAMSystem Testing", "[dramsim3]") {
         REQUIRE(clk == tRC);
     }
 }
+
+TEST_CASE("Thread pool", "[dramsim3]") {
+    dramsim3::ThreadPool pool(4);
+    std::vector<int> runs(16, 0);
+    auto task = [&runs](int i) { runs[i]++; };
+    pool.ParallelFor(16, task);
+
+    SECTION("TEST parked workers wake up for the next batch") {
+        // long enough for the workers to run out of spins and park
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        for (int n = 0; n < 100; n++) {
+            pool.ParallelFor(16, task);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        pool.ParallelFor(16, task);
+        for (int i = 0; i < 16; i++) {
+            REQUIRE(runs[i] == 102);
+        }
+    }
+}
+
+TEST_CASE("Jedec DRAMSystem idle cycle skipping", "[dramsim3]") {
+    dramsim3::Config config("configs/HBM1_4Gb_x128.ini", ".");
+    config.skip_idle_cycles = true;
+
+    dramsim3::JedecDRAMSystem dramsys(config, ".", dummy_call_back,
+                                      dummy_call_back);
+
+    SECTION("TEST latency is unchanged after idle cycles") {
+        // let the controllers go idle first
+        for (int i = 0; i < 1000; i++) {
+            dramsys.ClockTick();
+        }
+        dramsys.AddTransaction(1, false);
+        int clk = 0;
+        while (true) {
+            dramsys.ClockTick();
+            clk++;
+            if (call_back_called) {
+                call_back_called = false;
+                break;
+            }
+        }
+
+        int tRC = config.tRCDRD + config.CL + config.BL;
+        REQUIRE(clk == tRC);
+    }
+}
+
+TEST_CASE("Jedec DRAMSystem multi-cycle ticking", "[dramsim3]") {
+    dramsim3::Config config("configs/HBM1_4Gb_x128.ini", ".");
+    config.skip_idle_cycles = true;
+
+    dramsim3::JedecDRAMSystem dramsys(config, ".", dummy_call_back,
+                                      dummy_call_back);
+
+    SECTION("TEST ClockTickN stops at host visible events") {
+        // nothing to do, runs all the way
+        REQUIRE(dramsys.ClockTickN(1000) == 1000);
+        dramsys.AddTransaction(1, false);
+        // the transaction leaves the transaction queue in the first cycle
+        REQUIRE(dramsys.ClockTickN(1000) == 1);
+        REQUIRE_FALSE(call_back_called);
+        uint64_t clk = 1 + dramsys.ClockTickN(1000);
+        REQUIRE(call_back_called);
+        call_back_called = false;
+
+        int tRC = config.tRCDRD + config.CL + config.BL;
+        REQUIRE(clk == tRC);
+        REQUIRE(dramsys.RunUntil(5000) == 5000 - 1000 - clk);
+    }
+}
+
+// cycles taken to finish a fixed random workload over a few rows per bank
+uint64_t RunWorkload(dramsim3::Config &config, int num_trans) {
+    int num_returns = 0;
+    auto callback = [&num_returns](uint64_t addr) { num_returns++; };
+    dramsim3::JedecDRAMSystem dramsys(config, ".", callback, callback);
+    std::mt19937_64 gen(5);
+    uint64_t addr = (gen() % (1 << 22)) & ~static_cast<uint64_t>(63);
+    int num_added = 0;
+    uint64_t clk = 0;
+    while (num_returns < num_trans && clk < 1000000) {
+        bool is_write = num_added % 3 == 0;
+        if (num_added < num_trans &&
+            dramsys.WillAcceptTransaction(addr, is_write)) {
+            dramsys.AddTransaction(addr, is_write);
+            num_added++;
+            addr = (gen() % (1 << 22)) & ~static_cast<uint64_t>(63);
+        }
+        dramsys.ClockTick();
+        clk++;
+    }
+    REQUIRE(num_returns == num_trans);
+    return clk;
+}
+
+TEST_CASE("Jedec DRAMSystem schedulers", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    uint64_t first_ready_clk = RunWorkload(config, 4000);
+
+    SECTION("TEST FR-FCFS finishes every transaction no later") {
+        config.scheduler = "FRFCFS";
+        REQUIRE(RunWorkload(config, 4000) <= first_ready_clk);
+        config.trans_per_cycle = 4;
+        config.row_hit_cap = 16;
+        REQUIRE(RunWorkload(config, 4000) <= first_ready_clk);
+    }
+
+    SECTION("TEST PER_RANK queues") {
+        config.queue_structure = "PER_RANK";
+        config.scheduler = "FRFCFS";
+        RunWorkload(config, 4000);
+    }
+}
+
+// number of write drains the channel 0 controller started for a write stream
+uint64_t CountWriteDrains(dramsim3::Config &config) {
+    auto callback = [](uint64_t addr) {};
+    dramsim3::JedecDRAMSystem dramsys(config, ".", callback, callback);
+    uint64_t addr = 0;
+    for (int clk = 0; clk < 20000; clk++) {
+        // a read now and then so that the drains are not all idle ones
+        bool is_write = clk % 8 != 0;
+        if (dramsys.WillAcceptTransaction(addr, is_write)) {
+            dramsys.AddTransaction(addr, is_write);
+            addr += 1 << 20;
+        }
+        dramsys.ClockTick();
+    }
+    dramsys.PrintStats();
+    std::ifstream stats_file(config.json_stats_name);
+    nlohmann::json j = nlohmann::json::parse(stats_file);
+    std::remove(config.json_stats_name.c_str());
+    std::remove(config.txt_stats_name.c_str());
+    return j["0"]["num_write_drains"];
+}
+
+TEST_CASE("Jedec DRAMSystem write drain watermarks", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    uint64_t full_drains = CountWriteDrains(config);
+    REQUIRE(full_drains > 0);
+
+    SECTION("TEST partial drains start more often") {
+        config.write_drain_high = 16;
+        config.write_drain_low = 8;
+        REQUIRE(CountWriteDrains(config) > full_drains);
+        config.write_drain_batching = true;
+        REQUIRE(CountWriteDrains(config) > full_drains);
+    }
+
+    SECTION("TEST idle drains stop at a low watermark above the threshold") {
+        config.write_drain_low = 12;
+        REQUIRE(config.write_drain_idle_threshold < config.write_drain_low);
+        for (int skip = 0; skip < 2; skip++) {
+            config.skip_idle_cycles = skip == 1;
+            auto callback = [](uint64_t addr) {};
+            dramsim3::JedecDRAMSystem dramsys(config, ".", callback,
+                                              callback);
+            for (uint64_t i = 0; i < 20; i++) {
+                REQUIRE(dramsys.AddTransaction(i << 20, true));
+            }
+            for (int clk = 0; clk < 5000; clk++) {
+                dramsys.ClockTick();
+            }
+            dramsys.PrintStats();
+            std::ifstream stats_file(config.json_stats_name);
+            nlohmann::json j = nlohmann::json::parse(stats_file);
+            std::remove(config.json_stats_name.c_str());
+            std::remove(config.txt_stats_name.c_str());
+            // one idle drain down to write_drain_low, then none
+            REQUIRE(j["0"]["num_write_drains"] == 1);
+            REQUIRE(j["0"]["num_write_cmds"] == 20 - 12);
+        }
+    }
+}
+
+TEST_CASE("Jedec DRAMSystem write after read dependency", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    int reads_done = 0;
+    auto read_callback = [&reads_done](uint64_t addr) { reads_done++; };
+    auto write_callback = [](uint64_t addr) {};
+    dramsim3::JedecDRAMSystem dramsys(config, ".", read_callback,
+                                      write_callback);
+    // the write at the head of the full write buffer waits for the read to
+    // the same address, which must still be scheduled while the buffer stays
+    // full
+    REQUIRE(dramsys.AddTransaction(0, false));
+    REQUIRE(dramsys.AddTransaction(0, true));
+    uint64_t addr = 1 << 20;
+    while (dramsys.WillAcceptTransaction(addr, true)) {
+        dramsys.AddTransaction(addr, true);
+        addr += 1 << 20;
+    }
+    for (int clk = 0; clk < 1000; clk++) {
+        dramsys.ClockTick();
+    }
+    REQUIRE(reads_done == 1);
+}
+
+// channel 0 stats of bursts of traffic with idle gaps in between
+nlohmann::json RunBursts(dramsim3::Config &config) {
+    int num_added = 0, num_returns = 0;
+    auto callback = [&num_returns](uint64_t addr) { num_returns++; };
+    dramsim3::JedecDRAMSystem dramsys(config, ".", callback, callback);
+    std::mt19937_64 gen(7);
+    for (int clk = 0; clk < 60000; clk++) {
+        uint64_t addr = (gen() % (1 << 22)) & ~static_cast<uint64_t>(63);
+        if (clk % 4000 < 2000 && dramsys.WillAcceptTransaction(addr, false)) {
+            dramsys.AddTransaction(addr, false);
+            num_added++;
+        }
+        dramsys.ClockTick();
+    }
+    for (int clk = 0; clk < 4000; clk++) {
+        dramsys.ClockTick();
+    }
+    REQUIRE(num_returns == num_added);
+    dramsys.PrintStats();
+    std::ifstream stats_file(config.json_stats_name);
+    nlohmann::json j = nlohmann::json::parse(stats_file);
+    std::remove(config.json_stats_name.c_str());
+    std::remove(config.txt_stats_name.c_str());
+    return j["0"];
+}
+
+TEST_CASE("Jedec DRAMSystem refresh postponing", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    config.tREFI = 3000;
+    nlohmann::json stats = RunBursts(config);
+    REQUIRE(stats["num_postponed_refs"] == 0);
+    REQUIRE(stats["num_pulled_in_refs"] == 0);
+    uint64_t num_refs = stats["num_ref_cmds"];
+
+    SECTION("TEST refreshes move into the idle gaps") {
+        config.refresh_postpone_max = 8;
+        stats = RunBursts(config);
+        REQUIRE(stats["num_postponed_refs"] > 0);
+        // refreshes done ahead in the gaps are not postponed in the bursts
+        config.refresh_pull_in_max = 8;
+        stats = RunBursts(config);
+        REQUIRE(stats["num_pulled_in_refs"] > 0);
+        // nothing owed is left behind by more than the limit
+        REQUIRE(stats["num_ref_cmds"].get<uint64_t>() + 8 * config.ranks >=
+                num_refs);
+    }
+
+    SECTION("TEST same-bank refresh") {
+        config.refresh_policy = dramsim3::RefreshPolicy::SAME_BANK_STAGGERED;
+        config.refresh_postpone_max = 4;
+        stats = RunBursts(config);
+        REQUIRE(stats["num_ref_cmds"] == 0);
+        REQUIRE(stats["num_refb_cmds"] > 0);
+    }
+}
+
+TEST_CASE("Channel state same-bank refresh spacing", "[dramsim3]") {
+    using dramsim3::Address;
+    using dramsim3::Command;
+    using dramsim3::CommandType;
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    config.tREFSBRD = 30;
+    dramsim3::Timing timing(config);
+    dramsim3::ChannelState channel_state(config, timing);
+    // REFsb of bank sets 0 and 1 of rank 0, and reads to both sets, which
+    // need an ACT first
+    Command ref0(CommandType::REFRESH_BANK, Address(0, 0, -1, 0, -1, -1), 0);
+    Command ref1(CommandType::REFRESH_BANK, Address(0, 0, -1, 1, -1, -1), 0);
+    Command read0(CommandType::READ, Address(0, 0, 2, 0, 5, 0), 0);
+    Command read1(CommandType::READ, Address(0, 0, 2, 1, 5, 0), 0);
+    uint64_t clk = 1000;
+    REQUIRE(channel_state.GetReadyCommand(ref0, clk).cmd_type ==
+            CommandType::REFRESH_BANK);
+    channel_state.UpdateTimingAndStates(ref0, clk);
+
+    SECTION("TEST another bank set waits tREFSBRD") {
+        REQUIRE_FALSE(channel_state.GetReadyCommand(ref1, clk + 1).IsValid());
+        REQUIRE_FALSE(
+            channel_state.GetReadyCommand(ref1, clk + 29).IsValid());
+        REQUIRE(channel_state.GetReadyCommand(ref1, clk + 30).cmd_type ==
+                CommandType::REFRESH_BANK);
+        REQUIRE_FALSE(
+            channel_state.GetReadyCommand(read1, clk + 29).IsValid());
+        REQUIRE(channel_state.GetReadyCommand(read1, clk + 30).cmd_type ==
+                CommandType::ACTIVATE);
+    }
+
+    SECTION("TEST the refreshed bank set waits tRFCb") {
+        REQUIRE_FALSE(channel_state
+                          .GetReadyCommand(read0, clk + config.tRFCb - 1)
+                          .IsValid());
+        REQUIRE(channel_state.GetReadyCommand(read0, clk + config.tRFCb)
+                    .cmd_type == CommandType::ACTIVATE);
+    }
+}
+
+TEST_CASE("Jedec DRAMSystem power-down", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    config.tREFI = 3000;
+    nlohmann::json stats = RunBursts(config);
+    REQUIRE(stats["num_pde_cmds"] == 0);
+    double energy = stats["total_energy"];
+    config.enable_power_down = true;
+
+    SECTION("TEST the predictor powers down in the idle gaps") {
+        nlohmann::json pd_stats = RunBursts(config);
+        REQUIRE(pd_stats["num_pde_cmds"] > 0);
+        REQUIRE(pd_stats["num_pdx_cmds"].get<int>() + config.ranks >=
+                pd_stats["num_pde_cmds"]);
+        REQUIRE(pd_stats["pre_pd_cycles"]["0"] > 0);
+        REQUIRE(pd_stats["total_energy"] < energy);
+        // the reads that came in the gaps paid for the wake up
+        REQUIRE(pd_stats["read_pd_wakeup_latency"].size() > 0);
+        config.skip_idle_cycles = true;
+        REQUIRE(RunBursts(config) == pd_stats);
+    }
+
+    SECTION("TEST the timeout policy") {
+        config.power_down_policy = dramsim3::PowerDownPolicy::TIMEOUT;
+        config.power_down_threshold = 50;
+        nlohmann::json pd_stats = RunBursts(config);
+        REQUIRE(pd_stats["num_pde_cmds"] > 0);
+        REQUIRE(pd_stats["total_energy"] < energy);
+        config.skip_idle_cycles = true;
+        REQUIRE(RunBursts(config) == pd_stats);
+    }
+}
+
+TEST_CASE("Jedec DRAMSystem self-refresh", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_2400.ini", ".");
+    config.enable_self_refresh = true;
+    config.sref_threshold = 300;
+    // rows close right away, so a rank goes idle at a fixed cycle after
+    // each read and one of the gaps lands a read within tCKESR of the entry
+    config.row_buf_policy = "CLOSE_PAGE";
+    int num_srefe = 0, num_srefx = 0;
+    for (int gap = 250; gap <= 420; gap++) {
+        int num_added = 0, num_returns = 0;
+        auto callback = [&num_returns](uint64_t addr) { num_returns++; };
+        dramsim3::JedecDRAMSystem dramsys(config, ".", callback, callback);
+        for (int clk = 0; clk < 8 * 1000; clk++) {
+            if (clk % 1000 == 0 || clk % 1000 == gap) {
+                dramsys.AddTransaction(0, false);
+                num_added++;
+            }
+            dramsys.ClockTick();
+        }
+        for (int clk = 0; clk < 2000; clk++) {
+            dramsys.ClockTick();
+        }
+        REQUIRE(num_returns == num_added);
+        dramsys.PrintStats();
+        std::ifstream stats_file(config.json_stats_name);
+        nlohmann::json stats = nlohmann::json::parse(stats_file)["0"];
+        std::remove(config.json_stats_name.c_str());
+        std::remove(config.txt_stats_name.c_str());
+        num_srefe += stats["num_srefe_cmds"].get<int>();
+        num_srefx += stats["num_srefx_cmds"].get<int>();
+    }
+    // every gap enters and leaves self-refresh more than once
+    REQUIRE(num_srefe > 2 * 171);
+    REQUIRE(num_srefx + 171 * config.ranks >= num_srefe);
+}
+
+TEST_CASE("Jedec DRAMSystem epoch stats", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    config.epoch_period = 10000;
+    config.epoch_json = true;
+    config.epoch_csv = true;
+    RunBursts(config);
+    std::ifstream json_file(config.json_epoch_name);
+    nlohmann::json epochs = nlohmann::json::parse(json_file);
+    std::ifstream csv_file(config.csv_epoch_name);
+    std::vector<std::string> rows;
+    std::string line;
+    while (std::getline(csv_file, line)) {
+        rows.push_back(line);
+    }
+    std::remove(config.json_epoch_name.c_str());
+    std::remove(config.csv_epoch_name.c_str());
+
+    SECTION("TEST one row per channel and epoch in both formats") {
+        REQUIRE(epochs.size() == 6 * config.channels);
+        REQUIRE(rows.size() == epochs.size() + 1);
+        // the columns are the sorted stat names, the row of the first epoch
+        // starts with its act_energy
+        REQUIRE(rows[0].compare(0, 11, "act_energy,") == 0);
+        std::string first = rows[1].substr(0, rows[1].find(','));
+        REQUIRE(std::stod(first) == epochs[0]["act_energy"].get<double>());
+        uint64_t reads = 0;
+        for (const auto &epoch : epochs) {
+            reads += epoch["num_reads_done"].get<uint64_t>();
+        }
+        REQUIRE(reads > 0);
+    }
+}
+
+// channel 0 stats of bursts of a random and a streaming read stream mixed
+nlohmann::json RunMixed(dramsim3::Config &config) {
+    int num_added = 0, num_returns = 0;
+    auto callback = [&num_returns](uint64_t addr) { num_returns++; };
+    dramsim3::JedecDRAMSystem dramsys(config, ".", callback, callback);
+    std::mt19937_64 gen(11);
+    uint64_t stream_addr = 0;
+    for (int clk = 0; clk < 60000; clk++) {
+        uint64_t addr = (gen() % (1 << 24)) & ~static_cast<uint64_t>(63);
+        if (clk % 2 == 0) {
+            addr = stream_addr;
+        }
+        if (clk % 3000 < 1500 && dramsys.WillAcceptTransaction(addr, false)) {
+            dramsys.AddTransaction(addr, false);
+            num_added++;
+            stream_addr += clk % 2 == 0 ? 64 : 0;
+        }
+        dramsys.ClockTick();
+    }
+    for (int clk = 0; clk < 4000; clk++) {
+        dramsys.ClockTick();
+    }
+    REQUIRE(num_returns == num_added);
+    dramsys.PrintStats();
+    std::ifstream stats_file(config.json_stats_name);
+    nlohmann::json j = nlohmann::json::parse(stats_file);
+    std::remove(config.json_stats_name.c_str());
+    std::remove(config.txt_stats_name.c_str());
+    return j["0"];
+}
+
+uint64_t SumBanks(const nlohmann::json &vec_stat) {
+    uint64_t sum = 0;
+    for (const auto &bank : vec_stat) {
+        sum += bank.get<uint64_t>();
+    }
+    return sum;
+}
+
+TEST_CASE("Jedec DRAMSystem row buffer policies", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    nlohmann::json open_stats = RunMixed(config);
+    uint64_t open_hits = SumBanks(open_stats["row_buf_hits"]);
+    uint64_t open_conflicts = SumBanks(open_stats["row_buf_conflicts"]);
+    REQUIRE(open_hits > 0);
+    REQUIRE(open_conflicts > 0);
+    REQUIRE(open_hits + open_conflicts +
+                SumBanks(open_stats["row_buf_empties"]) ==
+            open_stats["num_read_cmds"]);
+    config.row_buf_policy = "CLOSE_PAGE";
+    nlohmann::json close_stats = RunMixed(config);
+    REQUIRE(SumBanks(close_stats["row_buf_hits"]) == 0);
+    REQUIRE(SumBanks(close_stats["row_buf_conflicts"]) == 0);
+    REQUIRE(close_stats["num_row_reopens"] > 0);
+
+    SECTION("TEST the timeout policy closes idle rows") {
+        config.row_buf_policy = "TIMEOUT";
+        config.row_buf_timeout = 20;
+        nlohmann::json stats = RunMixed(config);
+        REQUIRE(stats["num_timeout_pres"] > 0);
+        REQUIRE(SumBanks(stats["row_buf_hits"]) > 0);
+        REQUIRE(SumBanks(stats["row_buf_conflicts"]) < open_conflicts);
+        config.skip_idle_cycles = true;
+        REQUIRE(RunMixed(config) == stats);
+    }
+
+    SECTION("TEST the predictor keeps the row hits close page throws away") {
+        config.row_buf_policy = "PREDICTOR";
+        nlohmann::json stats = RunMixed(config);
+        REQUIRE(stats["num_predicted_pres"] > 0);
+        REQUIRE(SumBanks(stats["row_buf_hits"]) > 0);
+        REQUIRE(SumBanks(stats["row_buf_conflicts"]) < open_conflicts);
+        REQUIRE(stats["num_row_reopens"] < close_stats["num_row_reopens"]);
+    }
+}
+
+// cycles until num_reads streaming reads to channel 0 are done, and the
+// channel 0 stats of the run
+uint64_t RunReads(dramsim3::Config &config, int num_reads,
+                  nlohmann::json &stats) {
+    int num_returns = 0;
+    auto callback = [&num_returns](uint64_t addr) { num_returns++; };
+    dramsim3::JedecDRAMSystem dramsys(config, ".", callback, callback);
+    int num_added = 0;
+    uint64_t clk = 0;
+    uint64_t addr = 0;
+    while (num_returns < num_reads && clk < 10000000) {
+        while (num_added < num_reads) {
+            if (config.AddressChannel(addr) != 0) {
+                addr += config.request_size_bytes;
+                continue;
+            }
+            if (!dramsys.WillAcceptTransaction(addr, false)) {
+                break;
+            }
+            dramsys.AddTransaction(addr, false);
+            num_added++;
+            addr += config.request_size_bytes;
+        }
+        dramsys.ClockTick();
+        clk++;
+    }
+    REQUIRE(num_returns == num_reads);
+    dramsys.PrintStats();
+    std::ifstream stats_file(config.json_stats_name);
+    stats = nlohmann::json::parse(stats_file)["0"];
+    std::remove(config.json_stats_name.c_str());
+    std::remove(config.txt_stats_name.c_str());
+    return clk;
+}
+
+TEST_CASE("Controller sub-channels", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    REQUIRE(config.ranks == 2);
+    // streams go round the bankgroups of both ranks, bus bound
+    config.SetAddressMapping("robacorabgch", "");
+    nlohmann::json stats;
+    uint64_t one_bus = RunReads(config, 4000, stats);
+    REQUIRE(stats["sub_channel_cmds"] == 0);
+
+    SECTION("TEST HBM2 pseudo channels") {
+        dramsim3::Config pc("configs/HBM2_4Gb_x64_PC.ini", ".");
+        REQUIRE(pc.sub_channels == 2);
+        REQUIRE(pc.ranks == 2);
+        REQUIRE(pc.shared_cmd_bus);
+        REQUIRE(pc.request_size_bytes == 32);
+    }
+
+    SECTION("TEST each sub-channel has a queue of its own") {
+        config.sub_channels = 2;
+        REQUIRE(config.SubChannel(0) == 0);
+        REQUIRE(config.SubChannel(1) == 1);
+        dramsim3::Timing timing(config);
+        dramsim3::Controller ctrl(0, config, timing);
+        std::mt19937_64 gen(3);
+        int accepted[2] = {0, 0};
+        for (int i = 0; i < 1000; i++) {
+            uint64_t addr = (gen() % (1 << 28)) << config.shift_bits;
+            if (config.AddressChannel(addr) != 0 ||
+                !ctrl.WillAcceptTransaction(addr, false)) {
+                continue;
+            }
+            dramsim3::Transaction trans(addr, false);
+            ctrl.AddTransaction(trans);
+            accepted[config.AddressMapping(addr).rank]++;
+        }
+        REQUIRE(accepted[0] == config.trans_queue_size);
+        REQUIRE(accepted[1] == config.trans_queue_size);
+    }
+
+    SECTION("TEST separate data buses and command buses add bandwidth") {
+        config.sub_channels = 2;
+        uint64_t shared_cmd_bus = RunReads(config, 4000, stats);
+        REQUIRE(stats["sub_channel_cmds"] == 0);
+        REQUIRE(shared_cmd_bus < one_bus * 6 / 10);
+        config.shared_cmd_bus = false;
+        uint64_t own_cmd_buses = RunReads(config, 4000, stats);
+        REQUIRE(stats["sub_channel_cmds"] > 0);
+        REQUIRE(own_cmd_buses <= shared_cmd_bus);
+    }
+}
+
+// channel 0 stats of random reads of class 0 from source 0 and of class 1
+// from source 1, class 0 added every period0 cycles (0 as fast as it is
+// taken) and class 1 as fast as it is taken
+nlohmann::json RunClasses(dramsim3::Config &config, int period0) {
+    auto callback = [](uint64_t addr) {};
+    dramsim3::JedecDRAMSystem dramsys(config, ".", callback, callback);
+    std::mt19937_64 gen(7);
+    auto next_addr = [&gen, &config]() {
+        uint64_t addr;
+        do {
+            addr = (gen() % (1 << 28)) << config.shift_bits;
+        } while (config.AddressChannel(addr) != 0);
+        return addr;
+    };
+    uint64_t addrs[2] = {next_addr(), next_addr()};
+    for (int clk = 0; clk < 100000; clk++) {
+        for (int i = 0; i < 2; i++) {
+            if (i == 0 && period0 > 0 && clk % period0 != 0) {
+                continue;
+            }
+            while (dramsys.WillAcceptTransaction(addrs[i], false, i)) {
+                dramsys.AddTransaction(addrs[i], false, 0, i, i);
+                addrs[i] = next_addr();
+                if (i == 0 && period0 > 0) {
+                    break;
+                }
+            }
+        }
+        dramsys.ClockTick();
+    }
+    dramsys.PrintStats();
+    std::ifstream stats_file(config.json_stats_name);
+    nlohmann::json stats = nlohmann::json::parse(stats_file)["0"];
+    std::remove(config.json_stats_name.c_str());
+    std::remove(config.txt_stats_name.c_str());
+    return stats;
+}
+
+TEST_CASE("Controller QoS classes", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    config.qos_classes = 2;
+    config.qos_weights = {1, 1};
+    config.qos_arbitration = "STRICT";
+    nlohmann::json strict = RunClasses(config, 0);
+    double peak = static_cast<double>(config.request_size_bytes) /
+                  (config.burst_cycle * config.tCK);
+    REQUIRE(strict["qos_reads_done"]["0"] > 0);
+
+    SECTION("TEST each class has a queue of its own") {
+        dramsim3::Timing timing(config);
+        dramsim3::Controller ctrl(0, config, timing);
+        int accepted[2] = {0, 0};
+        for (uint64_t i = 0; i < 200; i++) {
+            uint64_t addr = i << config.shift_bits;
+            int qos_class = i % 2;
+            if (config.AddressChannel(addr) != 0 ||
+                !ctrl.WillAcceptTransaction(addr, false, qos_class)) {
+                continue;
+            }
+            dramsim3::Transaction trans(addr, false);
+            trans.qos_class = qos_class;
+            ctrl.AddTransaction(trans);
+            accepted[qos_class]++;
+        }
+        REQUIRE(accepted[0] == config.trans_queue_size);
+        REQUIRE(accepted[1] == config.trans_queue_size);
+    }
+
+    SECTION("TEST strict priority serves the latency critical class first") {
+        // the bulk class only gets what the critical one leaves over
+        REQUIRE(strict["qos_reads_done"]["1"] <
+                strict["qos_reads_done"]["0"]);
+        // a light critical class still waits for the bulk commands queued
+        // to its bank, but for nothing else
+        nlohmann::json light = RunClasses(config, 40);
+        REQUIRE(light["qos_read_latency"]["0"] <
+                light["qos_read_latency"]["1"]);
+        REQUIRE(light["read_class0_latency_p99"] <
+                light["read_class1_latency_p99"]);
+    }
+
+    SECTION("TEST weighted arbitration shares the bandwidth by weight") {
+        config.qos_arbitration = "WEIGHTED";
+        nlohmann::json even = RunClasses(config, 0);
+        double ratio = static_cast<double>(even["qos_reads_done"]["0"]) /
+                       static_cast<double>(even["qos_reads_done"]["1"]);
+        REQUIRE(ratio > 0.9);
+        REQUIRE(ratio < 1.1);
+        // short of 3 as the bulk class gets the banks the other one leaves
+        config.qos_weights = {3, 1};
+        nlohmann::json skewed = RunClasses(config, 0);
+        ratio = static_cast<double>(skewed["qos_reads_done"]["0"]) /
+                static_cast<double>(skewed["qos_reads_done"]["1"]);
+        REQUIRE(ratio > 2.0);
+        REQUIRE(ratio < 3.0);
+    }
+
+    SECTION("TEST the starvation guard bounds the wait of the bulk class") {
+        config.qos_starvation_cycles = 500;
+        nlohmann::json guarded = RunClasses(config, 0);
+        REQUIRE(guarded["num_qos_starved"] > 0);
+        REQUIRE(guarded["qos_reads_done"]["1"] >
+                strict["qos_reads_done"]["1"]);
+        REQUIRE(guarded["read_class1_latency_p999"] <
+                strict["read_class1_latency_p999"]);
+    }
+
+    SECTION("TEST a bandwidth cap holds a source to its share") {
+        config.qos_arbitration = "WEIGHTED";
+        config.qos_source_caps = {0.0, 0.1};
+        nlohmann::json capped = RunClasses(config, 0);
+        double share = static_cast<double>(capped["qos_bandwidth"]["1"]) / peak;
+        REQUIRE(share > 0.09);
+        REQUIRE(share < 0.105);
+        // the capped source alone, the controller idles until it has tokens
+        nlohmann::json alone = RunClasses(config, 100000);
+        share = static_cast<double>(alone["qos_bandwidth"]["1"]) / peak;
+        REQUIRE(share > 0.09);
+        REQUIRE(share < 0.105);
+        config.skip_idle_cycles = true;
+        REQUIRE(RunClasses(config, 100000) == alone);
+    }
+}
+
+// channel 0 stats of 8 saturating streams of reads and writes spread over
+// the ranks
+nlohmann::json RunStreams(dramsim3::Config &config) {
+    int num_added = 0, num_returns = 0;
+    auto callback = [&num_returns](uint64_t addr) { num_returns++; };
+    dramsim3::JedecDRAMSystem dramsys(config, ".", callback, callback);
+    std::mt19937_64 gen(5);
+    std::vector<uint64_t> streams(8);
+    for (auto &addr : streams) {
+        addr = (gen() % (1ull << 34)) & ~static_cast<uint64_t>(8191);
+    }
+    for (int clk = 0; clk < 50000; clk++) {
+        int s = gen() % streams.size();
+        uint64_t addr = streams[s];
+        bool is_write = s % 4 == 3;
+        if (config.AddressChannel(addr) == 0 &&
+            dramsys.WillAcceptTransaction(addr, is_write)) {
+            dramsys.AddTransaction(addr, is_write);
+            num_added++;
+        }
+        streams[s] = addr + 64;
+        dramsys.ClockTick();
+    }
+    for (int clk = 0; clk < 20000; clk++) {
+        dramsys.ClockTick();
+    }
+    REQUIRE(num_returns == num_added);
+    dramsys.PrintStats();
+    std::ifstream stats_file(config.json_stats_name);
+    nlohmann::json j = nlohmann::json::parse(stats_file);
+    std::remove(config.json_stats_name.c_str());
+    std::remove(config.txt_stats_name.c_str());
+    return j["0"];
+}
+
+TEST_CASE("Command queue column batching", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    REQUIRE(config.ranks == 2);
+    // reads and writes share the command queues
+    config.unified_queue = true;
+    nlohmann::json base = RunStreams(config);
+    REQUIRE(base["num_column_batches"] == 0);
+    REQUIRE(base["rank_switch_cycles"] > 0);
+    uint64_t base_cmds = base["num_read_cmds"].get<uint64_t>() +
+                         base["num_write_cmds"].get<uint64_t>();
+    uint64_t base_turnarounds = base["rw_turnaround_cycles"];
+
+    SECTION("TEST batches save turnarounds and keep the bandwidth") {
+        config.column_batch_length = 16;
+        nlohmann::json stats = RunStreams(config);
+        REQUIRE(stats["num_column_batches"] > 0);
+        REQUIRE(stats["rw_turnaround_cycles"] < base_turnarounds / 2);
+        REQUIRE(stats["num_read_cmds"].get<uint64_t>() +
+                    stats["num_write_cmds"].get<uint64_t>() >
+                base_cmds);
+        // held back commands soon end the batches
+        config.column_batch_fairness_cycles = 1;
+        nlohmann::json fair = RunStreams(config);
+        REQUIRE(fair["rw_turnaround_cycles"] >
+                2 * stats["rw_turnaround_cycles"].get<uint64_t>());
+        config.column_batch_fairness_cycles = 64;
+        config.skip_idle_cycles = true;
+        REQUIRE(RunStreams(config) == stats);
+    }
+}
+
+TEST_CASE("Controller refresh temperature derating", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    REQUIRE(config.ranks == 2);
+    dramsim3::Timing timing(config);
+    dramsim3::Controller cool(0, config, timing);
+    dramsim3::Controller hot(0, config, timing);
+    std::vector<double> temps(config.ranks * config.banks, 50.0);
+    cool.SetBankTemperatures(temps.data());
+    // one bank of rank 1 above refresh_derate_temp
+    temps[config.banks + 3] = config.refresh_derate_temp + 1;
+    hot.SetBankTemperatures(temps.data());
+    for (int clk = 0; clk < 20 * config.tREFI; clk++) {
+        cool.ClockTick();
+        hot.ClockTick();
+    }
+
+    SECTION("TEST only the hot rank refreshes twice as often") {
+        uint64_t cool_refs = cool.GetSampleCounts().ref_cmds;
+        uint64_t hot_refs = hot.GetSampleCounts().ref_cmds;
+        REQUIRE(cool_refs >= 38);
+        REQUIRE(hot_refs >= cool_refs + cool_refs / 2 - 2);
+        REQUIRE(hot_refs <= cool_refs + cool_refs / 2 + 2);
+    }
+}
+
+TEST_CASE("Controller self-profiling", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    dramsim3::Timing timing(config);
+    dramsim3::Controller plain(0, config, timing);
+    config.profile = true;
+    dramsim3::Controller profiled(0, config, timing);
+    REQUIRE(plain.GetProfiler() == nullptr);
+    REQUIRE(profiled.GetProfiler() != nullptr);
+    std::mt19937_64 gen(3);
+    for (int clk = 0; clk < 20000; clk++) {
+        uint64_t addr = (gen() % (1 << 24)) & ~static_cast<uint64_t>(63);
+        bool is_write = clk % 3 == 0;
+        if (clk % 4 == 0 && plain.WillAcceptTransaction(addr, is_write)) {
+            plain.AddTransaction(dramsim3::Transaction(addr, is_write));
+            profiled.AddTransaction(dramsim3::Transaction(addr, is_write));
+        }
+        plain.ReturnDoneTrans(clk);
+        profiled.ReturnDoneTrans(clk);
+        plain.ClockTick();
+        profiled.ClockTick();
+    }
+
+    SECTION("TEST profiling does not change the simulation") {
+        auto a = plain.GetSampleCounts();
+        auto b = profiled.GetSampleCounts();
+        REQUIRE(a.read_cmds == b.read_cmds);
+        REQUIRE(a.act_cmds == b.act_cmds);
+        REQUIRE(a.ref_cmds == b.ref_cmds);
+        REQUIRE(a.read_latency_sum == b.read_latency_sum);
+    }
+
+    SECTION("TEST the event counters") {
+        auto counts = profiled.GetSampleCounts();
+        nlohmann::json report = profiled.GetProfiler()->Report();
+        REQUIRE(report["events"]["ticks"] == 20000);
+        REQUIRE(report["events"]["commands_issued"] ==
+                counts.read_cmds + counts.write_cmds + counts.act_cmds +
+                    counts.pre_cmds + counts.ref_cmds);
+        REQUIRE(report["get_ready_calls_per_command"] >= 1.0);
+        REQUIRE(report["average_scan_length"] >= 1.0);
+        // a column command updates at least every bank of its channel
+        REQUIRE(report["timing_updates_per_command"] >=
+                config.ranks * config.banks);
+        REQUIRE(report["parts"]["command_select"]["calls"] == 20000);
+        REQUIRE(report["seconds"] > 0.0);
+    }
+}
+
+#ifdef LATENCY_BREAKDOWN
+// sum of the values of a histogram in the final stats
+uint64_t HistoSum(const nlohmann::json &histo) {
+    uint64_t sum = 0;
+    for (auto it = histo.begin(); it != histo.end(); it++) {
+        sum += std::stoull(it.key()) * it.value().get<uint64_t>();
+    }
+    return sum;
+}
+
+TEST_CASE("Jedec DRAMSystem latency breakdown", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    config.tREFI = 3000;
+    nlohmann::json stats = RunBursts(config);
+
+    SECTION("TEST the parts add up to the read latency") {
+        uint64_t sum = 0;
+        for (auto part : dramsim3::kLatencyPartNames) {
+            sum += HistoSum(stats["read_" + std::string(part) + "_latency"]);
+        }
+        REQUIRE(sum == HistoSum(stats["read_latency"]));
+        REQUIRE(HistoSum(stats["read_refresh_latency"]) > 0);
+        REQUIRE(HistoSum(stats["read_row_miss_latency"]) > 0);
+        REQUIRE(stats["read_latency_p99"] >= stats["read_latency_p50"]);
+    }
+}
+#endif  // LATENCY_BREAKDOWN
+
+TEST_CASE("Sampled DRAMSystem", "[dramsim3]") {
+    dramsim3::Config config("configs/HBM1_4Gb_x128.ini", ".");
+    config.sampling = true;
+    config.sample_fast_forward_cycles = 2000;
+    config.sample_warmup_cycles = 500;
+    config.sample_measure_cycles = 500;
+
+    int num_returns = 0;
+    auto callback = [&num_returns](uint64_t addr) { num_returns++; };
+    dramsim3::SampledDRAMSystem dramsys(config, ".", callback, callback);
+
+    SECTION("TEST fast-forwarded accesses only track open rows") {
+        // row miss on a closed bank
+        dramsys.AddTransaction(1, false);
+        uint64_t clk = dramsys.ClockTickN(1000);
+        REQUIRE(num_returns == 1);
+        REQUIRE(clk == config.read_delay + config.tRCD + 1);
+        // row hit
+        dramsys.AddTransaction(1, false);
+        REQUIRE(dramsys.ClockTickN(1000) == config.read_delay + 1);
+        REQUIRE(num_returns == 2);
+    }
+
+    SECTION("TEST every transaction returns across phase changes") {
+        int num_added = 0;
+        uint64_t addr = 0;
+        for (int clk = 0; clk < 3 * 3000; clk++) {
+            if (dramsys.WillAcceptTransaction(addr, clk % 4 == 0)) {
+                dramsys.AddTransaction(addr, clk % 4 == 0);
+                num_added++;
+                addr += 64;
+            }
+            dramsys.ClockTick();
+        }
+        for (int clk = 0; clk < 1000; clk++) {
+            dramsys.ClockTick();
+        }
+        REQUIRE(num_returns == num_added);
+
+        dramsys.PrintStats();
+        std::ifstream sampling_file("dramsim3sampling.json");
+        REQUIRE(sampling_file.good());
+        nlohmann::json j = nlohmann::json::parse(sampling_file);
+        REQUIRE(j["windows"] == 3);
+        REQUIRE(j["metrics"]["average_bandwidth"]["mean"] > 0.0);
+        std::remove(config.json_stats_name.c_str());
+        std::remove(config.txt_stats_name.c_str());
+        std::remove("dramsim3sampling.json");
+    }
+}
+
+// average read latency of random reads and writes offered at one per period
+// cycles, tagged with their issue cycle
+double RandomReadLatency(dramsim3::BaseDRAMSystem &dramsys, int cycles,
+                         int period) {
+    uint64_t reads = 0, latency_sum = 0, clk = 0;
+    dramsys.RegisterCompletionCallback(
+        [&](const dramsim3::Completion &c) {
+            if (!c.is_write) {
+                reads++;
+                latency_sum += clk - c.tag;
+            }
+        });
+    std::mt19937_64 gen(1);
+    uint64_t addr = gen() & 0x3fffffc0;
+    for (clk = 0; clk < static_cast<uint64_t>(cycles); clk++) {
+        bool is_write = clk % (3 * period) == 0;
+        if (clk % period == 0 &&
+            dramsys.WillAcceptTransaction(addr, is_write)) {
+            dramsys.AddTransaction(addr, is_write, clk);
+            addr = gen() & 0x3fffffc0;
+        }
+        dramsys.ClockTick();
+    }
+    return static_cast<double>(latency_sum) / reads;
+}
+
+TEST_CASE("Analytical DRAMSystem", "[dramsim3]") {
+    dramsim3::Config config("configs/DDR4_8Gb_x8_3200.ini", ".");
+    config.memory_model = "ANALYTICAL";
+    std::vector<dramsim3::Completion> done;
+    auto callback = [&done](const dramsim3::Completion &c) {
+        done.push_back(c);
+    };
+
+    SECTION("TEST row empties, hits and conflicts") {
+        dramsim3::AnalyticalDRAMSystem dramsys(config, ".", nullptr, nullptr);
+        dramsys.RegisterCompletionCallback(callback);
+        // cycles until the next completion, ClockTickN also stops when a
+        // queue entry is freed
+        auto next_done = [&]() {
+            uint64_t cycles = 0;
+            size_t num_done = done.size();
+            while (done.size() == num_done) {
+                cycles += dramsys.ClockTickN(1000);
+            }
+            return cycles;
+        };
+        REQUIRE(dramsys.AddTransaction(0, false, 1));
+        uint64_t empty = next_done();
+        REQUIRE(done.size() == 1);
+        REQUIRE(empty > static_cast<uint64_t>(config.read_delay +
+                                              config.tRCD));
+        // plus the expected wait for a refresh
+        REQUIRE(empty < static_cast<uint64_t>(config.read_delay +
+                                              config.tRCD + config.tRFC / 2));
+        REQUIRE(dramsys.AddTransaction(64, false, 2));
+        uint64_t hit = next_done();
+        REQUIRE(hit < empty);
+        REQUIRE(hit > static_cast<uint64_t>(config.read_delay));
+        // another row of the same bank
+        uint64_t other_row = 0;
+        for (uint64_t addr = 64; other_row == 0; addr += 64) {
+            dramsim3::Address a = config.AddressMapping(addr);
+            if (a.channel == 0 && a.rank == 0 && a.bankgroup == 0 &&
+                a.bank == 0 && a.row != 0) {
+                other_row = addr;
+            }
+        }
+        REQUIRE(dramsys.AddTransaction(other_row, false, 3));
+        REQUIRE(next_done() > empty);
+        REQUIRE(done.size() == 3);
+        // writes return right away
+        REQUIRE(dramsys.AddTransaction(0, true, 4));
+        REQUIRE(next_done() == 2);
+        REQUIRE(done.back().tag == 4);
+    }
+
+    SECTION("TEST the data bus caps the bandwidth") {
+        dramsim3::AnalyticalDRAMSystem dramsys(config, ".", nullptr, nullptr);
+        dramsys.RegisterCompletionCallback(callback);
+        int cycles = 20000;
+        uint64_t addr = 0;
+        for (int clk = 0; clk < cycles; clk++) {
+            while (dramsys.WillAcceptTransaction(addr, false)) {
+                dramsys.AddTransaction(addr, false);
+                addr += 64;
+            }
+            dramsys.ClockTick();
+        }
+        size_t peak = cycles / config.burst_cycle * config.channels;
+        REQUIRE(done.size() <= peak);
+        REQUIRE(done.size() > peak / 2);
+    }
+
+    SECTION("TEST the latency is in line with the detailed model") {
+        // up to about 3/4 of the peak bandwidth
+        for (int period : {40, 10}) {
+            dramsim3::JedecDRAMSystem jedec(config, ".", nullptr, nullptr);
+            dramsim3::AnalyticalDRAMSystem analytical(config, ".", nullptr,
+                                                      nullptr);
+            double jedec_latency = RandomReadLatency(jedec, 50000, period);
+            double analytical_latency =
+                RandomReadLatency(analytical, 50000, period);
+            REQUIRE(analytical_latency > 0.7 * jedec_latency);
+            REQUIRE(analytical_latency < 1.3 * jedec_latency);
+        }
+    }
+
+    SECTION("TEST calibration on a detailed run") {
+        config.analytical_calibration_cycles = 20000;
+        dramsim3::JedecDRAMSystem jedec(config, ".", nullptr, nullptr);
+        dramsim3::AnalyticalDRAMSystem analytical(config, ".", nullptr,
+                                                  nullptr);
+        REQUIRE(analytical.Calibrating());
+        double jedec_latency = RandomReadLatency(jedec, 60000, 8);
+        double analytical_latency = RandomReadLatency(analytical, 60000, 8);
+        REQUIRE_FALSE(analytical.Calibrating());
+        REQUIRE(analytical.LatencyOffset() != 0.0);
+        REQUIRE(analytical_latency > 0.8 * jedec_latency);
+        REQUIRE(analytical_latency < 1.2 * jedec_latency);
+    }
+
+    SECTION("TEST the memory model is picked by the config") {
+        dramsim3::MemorySystem memory(
+            "configs/DDR4_8Gb_x8_3200.ini", ".", nullptr, nullptr,
+            {{"system.memory_model", "ANALYTICAL"}});
+        memory.RegisterCompletionCallback(callback);
+        REQUIRE(memory.AddTransaction(0, false, 1));
+        for (int clk = 0; clk < 1000; clk++) {
+            memory.ClockTick();
+        }
+        REQUIRE(done.size() == 1);
+        memory.PrintStats();
+        std::ifstream stats_file("dramsim3.json");
+        nlohmann::json j = nlohmann::json::parse(stats_file);
+        REQUIRE(j["0"]["num_reads_done"] == 1);
+        std::ifstream model_file("dramsim3analytical.json");
+        REQUIRE(model_file.good());
+        std::remove("dramsim3.json");
+        std::remove("dramsim3analytical.json");
+    }
+}
+
+TEST_CASE("Tagged and batched completions", "[dramsim3]") {
+    dramsim3::MemorySystem memory("configs/HBM1_4Gb_x128.ini", ".", nullptr,
+                                  nullptr);
+
+    SECTION("TEST every transaction returns its own tag") {
+        std::vector<dramsim3::Completion> done;
+        memory.RegisterCompletionCallback(
+            [&done](const dramsim3::Completion &c) { done.push_back(c); });
+        // merged reads of one address still return one tag each
+        REQUIRE(memory.AddTransaction(0, false, 7));
+        REQUIRE(memory.AddTransaction(0, false, 8));
+        REQUIRE(memory.AddTransaction(1 << 12, true, 9));
+        for (int clk = 0; clk < 1000; clk++) {
+            memory.ClockTick();
+        }
+        REQUIRE(done.size() == 3);
+        std::vector<uint64_t> tags;
+        for (const auto &c : done) {
+            tags.push_back(c.tag);
+            REQUIRE(c.is_write == (c.tag == 9));
+        }
+        std::sort(tags.begin(), tags.end());
+        REQUIRE(tags == std::vector<uint64_t>{7, 8, 9});
+    }
+
+    SECTION("TEST a batch holds the completions of one ClockTickN") {
+        std::vector<size_t> batches;
+        uint64_t tag_sum = 0;
+        memory.RegisterBatchCallback(
+            [&](const dramsim3::Completion *done, size_t num) {
+                batches.push_back(num);
+                for (size_t i = 0; i < num; i++) {
+                    tag_sum += done[i].tag;
+                }
+            });
+        for (uint64_t i = 0; i < 4; i++) {
+            REQUIRE(memory.AddTransaction(i << 6, false, i + 1));
+        }
+        // ticking one cycle at a time delivers no empty batches
+        for (int clk = 0; clk < 5; clk++) {
+            memory.ClockTick();
+        }
+        REQUIRE(batches.empty());
+        int calls = 0;
+        while (tag_sum < 1 + 2 + 3 + 4 && calls < 100) {
+            memory.ClockTickN(1000);
+            calls++;
+        }
+        REQUIRE(tag_sum == 1 + 2 + 3 + 4);
+        REQUIRE(batches.size() <= static_cast<size_t>(calls));
+        size_t total = 0;
+        for (size_t num : batches) {
+            REQUIRE(num > 0);
+            total += num;
+        }
+        REQUIRE(total == 4);
+    }
+}
+
+// the cache stats of a memory system, whose stats files are removed
+nlohmann::json CacheStats(dramsim3::MemorySystem &memory) {
+    memory.PrintStats();
+    std::ifstream stats_file("dramsim3cache.json");
+    REQUIRE(stats_file.good());
+    nlohmann::json j = nlohmann::json::parse(stats_file);
+    std::remove("dramsim3cache.json");
+    std::remove("dramsim3.json");
+    std::remove("dramsim3.txt");
+    return j;
+}
+
+TEST_CASE("Memory-side cache", "[dramsim3]") {
+    dramsim3::ConfigOverrides overrides = {{"cache.size", "64"},
+                                           {"cache.associativity", "4"},
+                                           {"cache.line_size", "128"},
+                                           {"cache.hit_latency", "5"}};
+    std::vector<dramsim3::Completion> done;
+    auto callback = [&done](const dramsim3::Completion &c) {
+        done.push_back(c);
+    };
+
+    SECTION("TEST hits return at the hit latency") {
+        dramsim3::MemorySystem memory("configs/DDR4_8Gb_x8_3200.ini", ".",
+                                      nullptr, nullptr, overrides);
+        memory.RegisterCompletionCallback(callback);
+        REQUIRE(memory.AddTransaction(0x1000, false, 1));
+        while (done.empty()) {
+            memory.ClockTick();
+        }
+        // the other half of the 128 byte line was filled along
+        REQUIRE(memory.AddTransaction(0x1040, false, 2));
+        for (int clk = 0; clk <= 5; clk++) {
+            REQUIRE(done.size() == 1);
+            memory.ClockTick();
+        }
+        REQUIRE(done.size() == 2);
+        REQUIRE(done[1].tag == 2);
+        nlohmann::json stats = CacheStats(memory);
+        REQUIRE(stats["reads"] == 2);
+        REQUIRE(stats["read_hits"] == 1);
+        REQUIRE(stats["dram_reads"] == 2);
+    }
+
+    SECTION("TEST write misses fetch the rest of the line") {
+        dramsim3::MemorySystem memory("configs/DDR4_8Gb_x8_3200.ini", ".",
+                                      nullptr, nullptr, overrides);
+        memory.RegisterCompletionCallback(callback);
+        // the write is done at the hit latency, the read of the other half
+        // of the line waits for the fill
+        REQUIRE(memory.AddTransaction(0x2000, true, 1));
+        REQUIRE(memory.AddTransaction(0x2040, false, 2));
+        for (int clk = 0; clk <= 5; clk++) {
+            memory.ClockTick();
+        }
+        REQUIRE(done.size() == 1);
+        REQUIRE(done[0].tag == 1);
+        while (done.size() < 2) {
+            memory.ClockTick();
+        }
+        REQUIRE(memory.AddTransaction(0x2040, false, 3));
+        for (int clk = 0; clk <= 5; clk++) {
+            memory.ClockTick();
+        }
+        REQUIRE(done.size() == 3);
+        nlohmann::json stats = CacheStats(memory);
+        REQUIRE(stats["write_hits"] == 0);
+        REQUIRE(stats["read_hits"] == 1);
+        REQUIRE(stats["miss_merges"] == 1);
+        REQUIRE(stats["fills"] == 1);
+        REQUIRE(stats["dram_reads"] == 2);
+    }
+
+    std::mt19937_64 gen(5);
+    const int num_trans = 20000;
+    // lines of the requests, twice the lines of the cache, so that about
+    // half of them hit
+    overrides["cache.line_size"] = "64";
+    auto run = [&](dramsim3::MemorySystem &memory) {
+        memory.RegisterCompletionCallback(callback);
+        int added = 0;
+        for (int clk = 0; clk < 10000000 && done.size() < num_trans; clk++) {
+            uint64_t addr = (gen() % 2048) << 6;
+            bool is_write = gen() % 3 == 0;
+            if (added < num_trans &&
+                memory.WillAcceptTransaction(addr, is_write)) {
+                memory.AddTransaction(addr, is_write, added++);
+            }
+            memory.ClockTick();
+        }
+        REQUIRE(done.size() == num_trans);
+        std::vector<uint64_t> tags;
+        for (const auto &c : done) {
+            tags.push_back(c.tag);
+        }
+        std::sort(tags.begin(), tags.end());
+        for (int i = 0; i < num_trans; i++) {
+            REQUIRE(tags[i] == static_cast<uint64_t>(i));
+        }
+        return CacheStats(memory);
+    };
+
+    SECTION("TEST write-back caches write dirty victims back") {
+        dramsim3::MemorySystem memory("configs/DDR4_8Gb_x8_3200.ini", ".",
+                                      nullptr, nullptr, overrides);
+        nlohmann::json stats = run(memory);
+        REQUIRE(stats["reads"].get<int>() + stats["writes"].get<int>() ==
+                num_trans);
+        REQUIRE(stats["hit_rate"] > 0.3);
+        REQUIRE(stats["writebacks"] > 0);
+        REQUIRE(stats["dram_writes"] == stats["writebacks"]);
+        REQUIRE(stats["dram_reads"] == stats["fills"]);
+        REQUIRE(stats["dram_requests_saved"] > 0);
+    }
+
+    SECTION("TEST write-through caches send every write") {
+        overrides["cache.write_policy"] = "WRITE_THROUGH";
+        dramsim3::MemorySystem memory("configs/DDR4_8Gb_x8_3200.ini", ".",
+                                      nullptr, nullptr, overrides);
+        nlohmann::json stats = run(memory);
+        REQUIRE(stats["writebacks"] == 0);
+        REQUIRE(stats["dram_writes"] == stats["writes"]);
+    }
+}
+
+TEST_CASE("Multi-producer submission front end", "[dramsim3]") {
+    // no epoch stats files, the run is longer than an epoch
+    dramsim3::MemorySystem memory("configs/HBM1_4Gb_x128.ini", ".", nullptr,
+                                  nullptr,
+                                  {{"other.epoch_period", "1000000000"}});
+    const int num_producers = 4;
+    const int credits = 8;
+    const int per_producer = 2000;
+    dramsim3::SubmissionFrontEnd front_end(memory, num_producers, credits);
+
+    SECTION("TEST every producer gets back what it submitted") {
+        // Catch assertions are not thread safe, producers only record
+        std::vector<std::vector<uint64_t>> done_tags(num_producers);
+        std::vector<int> credit_errors(num_producers, 0);
+        std::atomic<int> finished(0);
+        std::vector<std::thread> producers;
+        for (int p = 0; p < num_producers; p++) {
+            producers.emplace_back([&, p]() {
+                std::mt19937_64 gen(p);
+                int submitted = 0;
+                dramsim3::Completion completions[16];
+                while (done_tags[p].size() <
+                       static_cast<size_t>(per_producer)) {
+                    // the producers share addresses
+                    uint64_t addr = (gen() % 10000) << 6;
+                    uint64_t tag = (static_cast<uint64_t>(p) << 32) | submitted;
+                    if (submitted < per_producer &&
+                        front_end.Submit(p, addr, submitted % 3 == 0, tag)) {
+                        submitted++;
+                    }
+                    size_t num = front_end.PollCompletions(p, completions, 16);
+                    for (size_t i = 0; i < num; i++) {
+                        done_tags[p].push_back(completions[i].tag);
+                    }
+                    int left = front_end.Credits(p);
+                    if (left < 0 || left > credits) {
+                        credit_errors[p]++;
+                    }
+                    std::this_thread::yield();
+                }
+                finished++;
+            });
+        }
+        // this thread ticks
+        uint64_t clk = 0;
+        while (finished.load() < num_producers && clk < 100000000) {
+            front_end.ClockTick();
+            clk++;
+        }
+        for (auto &producer : producers) {
+            producer.join();
+        }
+        for (int p = 0; p < num_producers; p++) {
+            REQUIRE(credit_errors[p] == 0);
+            REQUIRE(front_end.Credits(p) == credits);
+            REQUIRE(done_tags[p].size() == static_cast<size_t>(per_producer));
+            std::sort(done_tags[p].begin(), done_tags[p].end());
+            for (int n = 0; n < per_producer; n++) {
+                REQUIRE(done_tags[p][n] ==
+                        ((static_cast<uint64_t>(p) << 32) | n));
+            }
+        }
+    }
+}
@@ -1,5 +1,10 @@
+#include <random>
+#include <utility>
+#include <vector>
+
 #include "catch.hpp"
 #include "configuration.h"
+#include "hmc.h"
 #include "memory_system.h"
 
 bool hmc_called = false;
@@ -39,3 +44,160 @@ TEST_CASE("HMC System Testing", "[dramsim3][hmc]") {
         REQUIRE(clk == idle_lat);
     }
 }
+
+TEST_CASE("HMC System packet matching", "[dramsim3][hmc]") {
+    int num_reads = 0, num_writes = 0;
+    dramsim3::MemorySystem hmc(
+        "configs/HMC_2GB_4Lx16.ini", ".",
+        [&num_reads](uint64_t addr) { num_reads++; },
+        [&num_writes](uint64_t addr) { num_writes++; });
+
+    SECTION("TEST every request of a hot address gets its own response") {
+        int added_reads = 0, added_writes = 0;
+        for (int clk = 0; clk < 20000; clk++) {
+            // a few addresses, so reads and writes to one address are in
+            // flight together
+            uint64_t addr = static_cast<uint64_t>(clk % 5) << 12;
+            bool is_write = clk % 3 == 0;
+            if (clk < 10000 && hmc.WillAcceptTransaction(addr, is_write)) {
+                hmc.AddTransaction(addr, is_write);
+                if (is_write) {
+                    added_writes++;
+                } else {
+                    added_reads++;
+                }
+            }
+            hmc.ClockTick();
+        }
+        REQUIRE(added_reads > 0);
+        REQUIRE(num_reads == added_reads);
+        REQUIRE(num_writes == added_writes);
+    }
+}
+
+// cycle and address of every return of a random workload
+template <typename System>
+std::vector<std::pair<int, uint64_t>> RunVaults(int num_threads,
+                                                int num_cubes = 1) {
+    dramsim3::Config config("configs/HMC_2GB_4Lx16.ini", ".");
+    config.num_threads = num_threads;
+    config.num_cubes = num_cubes;
+    std::vector<std::pair<int, uint64_t>> returns;
+    int clk = 0;
+    auto callback = [&returns, &clk](uint64_t addr) {
+        returns.push_back(std::make_pair(clk, addr));
+    };
+    System hmc(config, ".", callback, callback);
+    std::mt19937_64 gen(3);
+    // 2GB per cube
+    uint64_t addr_range = static_cast<uint64_t>(num_cubes) << 31;
+    for (clk = 0; clk < 20000; clk++) {
+        uint64_t addr = (gen() % addr_range) & ~static_cast<uint64_t>(63);
+        bool is_write = gen() % 3 == 0;
+        if (hmc.WillAcceptTransaction(addr, is_write)) {
+            hmc.AddTransaction(addr, is_write);
+        }
+        hmc.ClockTick();
+    }
+    return returns;
+}
+
+TEST_CASE("HMC System parallel vaults", "[dramsim3][hmc]") {
+    SECTION("TEST the vaults tick the same on worker threads") {
+        std::vector<std::pair<int, uint64_t>> serial =
+            RunVaults<dramsim3::HMCMemorySystem>(1);
+        REQUIRE_FALSE(serial.empty());
+        REQUIRE(RunVaults<dramsim3::HMCMemorySystem>(4) == serial);
+    }
+}
+
+TEST_CASE("HMC System crossbar arbitration", "[dramsim3][hmc]") {
+    dramsim3::Config config("configs/HMC_2GB_4Lx16.ini", ".");
+
+    SECTION("TEST every policy and crossbar shape returns every request") {
+        const char *policies[] = {"AGE", "ROUND_ROBIN", "WEIGHTED"};
+        for (auto policy : policies) {
+            for (int num_quads : {4, 8}) {
+                config.xbar_arbitration = policy;
+                config.num_quads = num_quads;
+                config.xbar_bandwidth = num_quads / 2;
+                int num_returns = 0, num_added = 0;
+                auto callback = [&num_returns](uint64_t addr) {
+                    num_returns++;
+                };
+                dramsim3::HMCMemorySystem hmc(config, ".", callback,
+                                              callback);
+                std::mt19937_64 gen(11);
+                for (int clk = 0; clk < 15000; clk++) {
+                    uint64_t addr =
+                        (gen() % (1ull << 31)) & ~static_cast<uint64_t>(63);
+                    bool is_write = gen() % 3 == 0;
+                    if (clk < 10000 &&
+                        hmc.WillAcceptTransaction(addr, is_write)) {
+                        hmc.AddTransaction(addr, is_write);
+                        num_added++;
+                    }
+                    hmc.ClockTick();
+                }
+                REQUIRE(num_added > 0);
+                REQUIRE(num_returns == num_added);
+            }
+        }
+    }
+}
+
+TEST_CASE("HMC System cube chains", "[dramsim3][hmc]") {
+    dramsim3::Config config("configs/HMC_2GB_4Lx16.ini", ".");
+    config.num_cubes = 4;
+
+    SECTION("TEST the far cubes take longer") {
+        std::vector<int> latency;
+        for (int cube = 0; cube < 4; cube++) {
+            int clk = 0;
+            bool returned = false;
+            auto callback = [&returned](uint64_t addr) { returned = true; };
+            dramsim3::HMCChainSystem chain(config, ".", callback, callback);
+            uint64_t addr = static_cast<uint64_t>(cube) << 31;
+            REQUIRE(chain.GetCube(addr) == cube);
+            REQUIRE(chain.Hops(cube) == cube);
+            chain.AddTransaction(addr, false);
+            while (!returned && clk < 1000) {
+                chain.ClockTick();
+                clk++;
+            }
+            REQUIRE(returned);
+            latency.push_back(clk);
+        }
+        for (int cube = 1; cube < 4; cube++) {
+            // a hop there and back
+            REQUIRE(latency[cube] >=
+                    latency[cube - 1] + 2 * config.cube_hop_latency);
+        }
+    }
+
+    SECTION("TEST every request returns and the cubes tick the same "
+            "in parallel") {
+        std::vector<std::pair<int, uint64_t>> serial =
+            RunVaults<dramsim3::HMCChainSystem>(1, 4);
+        REQUIRE_FALSE(serial.empty());
+        REQUIRE(RunVaults<dramsim3::HMCChainSystem>(4, 4) == serial);
+        config.cube_topology = "STAR";
+        int returns = 0;
+        auto callback = [&returns](uint64_t addr) { returns++; };
+        dramsim3::HMCChainSystem star(config, ".", callback, callback);
+        REQUIRE(star.Hops(3) == 1);
+        int added = 0;
+        for (int clk = 0; clk < 5000; clk++) {
+            uint64_t addr = static_cast<uint64_t>(clk % 4) << 31 | clk << 6;
+            if (star.WillAcceptTransaction(addr, clk % 3 == 0)) {
+                star.AddTransaction(addr, clk % 3 == 0);
+                added++;
+            }
+            star.ClockTick();
+        }
+        for (int clk = 0; clk < 2000; clk++) {
+            star.ClockTick();
+        }
+        REQUIRE(returns == added);
+    }
+}
@@ -0,0 +1,56 @@
+#include <map>
+#include <random>
+
+#include "catch.hpp"
+#include "trans_index.h"
+
+TEST_CASE("Transaction index", "[trans_index]") {
+    dramsim3::TransactionIndex index(4);
+
+    SECTION("TEST same address is kept in insertion order") {
+        for (uint64_t i = 0; i < 3; i++) {
+            dramsim3::Transaction trans(0x40, false);
+            trans.added_cycle = i;
+            index.Insert(trans);
+        }
+        REQUIRE(index.Count(0x40) == 3);
+        REQUIRE(index.Count(0x80) == 0);
+        REQUIRE(index.Find(0x80) == nullptr);
+        REQUIRE(index.Find(0x40)->added_cycle == 0);
+
+        dramsim3::Transaction trans;
+        for (uint64_t i = 0; i < 3; i++) {
+            REQUIRE(index.PopFront(0x40, trans));
+            REQUIRE(trans.added_cycle == i);
+        }
+        REQUIRE_FALSE(index.PopFront(0x40, trans));
+        REQUIRE(index.Empty());
+    }
+
+    SECTION("TEST against std::multimap beyond the initial capacity") {
+        std::multimap<uint64_t, uint64_t> reference;
+        std::mt19937_64 gen(1);
+        for (uint64_t i = 0; i < 20000; i++) {
+            // few distinct addresses so that chains and collisions happen
+            uint64_t addr = (gen() % 64) << 6;
+            if (gen() % 3 != 0) {
+                dramsim3::Transaction trans(addr, false);
+                trans.added_cycle = i;
+                index.Insert(trans);
+                reference.insert(std::make_pair(addr, i));
+            } else {
+                dramsim3::Transaction trans;
+                bool found = index.PopFront(addr, trans);
+                auto it = reference.find(addr);
+                REQUIRE(found == (it != reference.end()));
+                if (found) {
+                    REQUIRE(trans.added_cycle == it->second);
+                    reference.erase(it);
+                }
+            }
+            REQUIRE(index.Count(addr) ==
+                    static_cast<int>(reference.count(addr)));
+        }
+        REQUIRE(index.Size() == static_cast<int>(reference.size()));
+    }
+}
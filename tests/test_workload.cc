@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+#include "workload.h"
+
+namespace {
+
+dramsim3::WorkloadSpec ReadSpec(const std::string &text) {
+    std::string file = "test_workload.ini";
+    std::ofstream(file) << text;
+    dramsim3::WorkloadSpec spec = dramsim3::ReadWorkloadSpec(file);
+    std::remove(file.c_str());
+    return spec;
+}
+
+}  // namespace
+
+TEST_CASE("Workload spec", "[workload]") {
+    dramsim3::WorkloadSpec spec =
+        ReadSpec("[workload]\nrate = 0.5\n"
+                 "[stream.Scan]\npattern = STRIDE\nbase = 1G\n"
+                 "footprint = 4K\nstride = 128\n"
+                 "[stream.hot]\npattern = ZIPF\nfootprint = 64M\n"
+                 "[phase0]\ncycles = 100\nmix = scan:3 hot\n"
+                 "[phase1]\noutstanding = 8\nmix = hot\n");
+    REQUIRE(spec.streams.size() == 2);
+    REQUIRE(spec.streams[0].name == "scan");
+    REQUIRE(spec.streams[0].base == 1ull << 30);
+    REQUIRE(spec.streams[0].footprint == 4096);
+    REQUIRE(spec.streams[1].stride == 64);
+    REQUIRE(spec.phases.size() == 2);
+    REQUIRE(spec.phases[0].rate == 0.5);
+    REQUIRE(spec.phases[0].mix.size() == 2);
+    REQUIRE(spec.phases[0].mix[0].second == 3.0);
+    REQUIRE(spec.phases[1].outstanding == 8);
+
+    SECTION("TEST the phases run in order and over again") {
+        dramsim3::WorkloadGenerator gen(spec);
+        REQUIRE(gen.Phase(0).cycles == 100);
+        REQUIRE(gen.Phase(99).cycles == 100);
+        REQUIRE(gen.Phase(100).outstanding == 8);
+        REQUIRE(gen.Phase(100000).outstanding == 8);
+    }
+
+    SECTION("TEST one endless phase without phase sections") {
+        spec = ReadSpec("[stream.a]\npattern = RANDOM\n"
+                        "[stream.b]\npattern = STRIDE\n");
+        REQUIRE(spec.phases.size() == 1);
+        REQUIRE(spec.phases[0].cycles == 0);
+        REQUIRE(spec.phases[0].mix.size() == 2);
+    }
+}
+
+TEST_CASE("Workload generator patterns", "[workload]") {
+    dramsim3::WorkloadRequest req;
+
+    SECTION("TEST strides wrap around the footprint") {
+        dramsim3::WorkloadGenerator gen(
+            ReadSpec("[stream.s]\npattern = STRIDE\nbase = 4096\n"
+                     "footprint = 1K\nstride = 256\nread_ratio = 0.5\n"));
+        int writes = 0;
+        for (int i = 0; i < 400; i++) {
+            REQUIRE(gen.Next(req));
+            REQUIRE(req.addr == 4096 + (i % 4) * 256);
+            writes += req.is_write ? 1 : 0;
+        }
+        REQUIRE(writes > 150);
+        REQUIRE(writes < 250);
+    }
+
+    SECTION("TEST a pointer chase visits every line and waits for reads") {
+        dramsim3::WorkloadGenerator gen(
+            ReadSpec("[stream.c]\npattern = POINTER_CHASE\n"
+                     "footprint = 1000K\nline_size = 1K\n"));
+        std::set<uint64_t> lines;
+        for (int i = 0; i < 1000; i++) {
+            REQUIRE(gen.Next(req));
+            REQUIRE_FALSE(req.is_write);
+            REQUIRE(req.addr % 1024 == 0);
+            lines.insert(req.addr);
+            REQUIRE_FALSE(gen.Next(req));
+            gen.ReadDone(req.stream);
+        }
+        REQUIRE(lines.size() == 1000);
+        REQUIRE(*lines.rbegin() < 1000 * 1024);
+    }
+
+    SECTION("TEST zipf is skewed towards a few hot lines") {
+        dramsim3::WorkloadGenerator gen(
+            ReadSpec("[stream.z]\npattern = ZIPF\nfootprint = 64M\n"));
+        std::map<uint64_t, int> counts;
+        for (int i = 0; i < 100000; i++) {
+            gen.Next(req);
+            REQUIRE(req.addr < 64 << 20);
+            counts[req.addr]++;
+        }
+        std::vector<int> sorted;
+        for (const auto &count : counts) {
+            sorted.push_back(count.second);
+        }
+        std::sort(sorted.rbegin(), sorted.rend());
+        // the hottest of a million lines gets about 1 / H(1M) ~ 7%
+        REQUIRE(sorted[0] > 5000);
+        REQUIRE(sorted[0] < 9000);
+        int top = 0;
+        for (int i = 0; i < 100; i++) {
+            top += sorted[i];
+        }
+        REQUIRE(top > 30000);
+        // and the hot lines are spread out, not all in the first rows
+        REQUIRE(counts.rbegin()->first > 32 << 20);
+    }
+
+    SECTION("TEST GUPS writes back every line it reads") {
+        dramsim3::WorkloadGenerator gen(
+            ReadSpec("[stream.g]\npattern = GUPS\nfootprint = 1G\n"));
+        for (int i = 0; i < 100; i++) {
+            gen.Next(req);
+            REQUIRE_FALSE(req.is_write);
+            uint64_t addr = req.addr;
+            gen.Next(req);
+            REQUIRE(req.is_write);
+            REQUIRE(req.addr == addr);
+        }
+    }
+
+    SECTION("TEST the mix weights") {
+        dramsim3::WorkloadGenerator gen(ReadSpec(
+            "[stream.a]\npattern = RANDOM\n[stream.b]\npattern = RANDOM\n"
+            "[phase0]\nmix = a:3, b:1\n"));
+        int from_a = 0;
+        for (int i = 0; i < 10000; i++) {
+            gen.Next(req);
+            from_a += req.stream == 0 ? 1 : 0;
+        }
+        REQUIRE(from_a > 7000);
+        REQUIRE(from_a < 8000);
+    }
+}